@@ -0,0 +1,160 @@
+/**
+ *  Copyright 2017-2018, Pavel Kraynyukhov <pavel.kraynyukhov@gmail.com>
+ *
+ *  This file is a part of LAppS (Lua Application Server).
+ *
+ *  LAppS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  LAppS is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with LAppS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  $Id: batch_dispatch.cpp October 25, 2026 10:40 AM $
+ *
+ **/
+
+/**
+ * Cost of delivering small RAW messages to a Lua service, the way
+ * LuaReactiveServiceContext does it.
+ *
+ * "lookup": onMessage() is looked up in the service table for every
+ * message (the dispatch before the callbacks were cached).
+ * "cached": onMessage() is taken from the registry.
+ * "batch": a drained batch goes to onMessages(batch) in one pcall.
+ *
+ * Build:
+ *   g++ -O2 -std=c++17 -I/usr/include/luajit-2.1 batch_dispatch.cpp -o batch_dispatch -lluajit-5.1
+ * Run:
+ *   ./batch_dispatch [messages] [batch size] [message size]
+ **/
+
+extern "C" {
+#include <lua.h>
+#include <lualib.h>
+#include <lauxlib.h>
+}
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+static const char* service=R"(
+service={ bytes=0 }
+
+function service.onMessage(handler, opcode, message)
+  service.bytes=service.bytes+#message
+  return true
+end
+
+function service.onMessages(batch)
+  local bytes=service.bytes
+  for i=3,#batch,3 do
+    bytes=bytes+#batch[i]
+  end
+  service.bytes=bytes
+  return true
+end
+)";
+
+static void check(lua_State* L, const int ret)
+{
+  if(ret != 0)
+    throw std::runtime_error(lua_tostring(L,-1));
+  if(!lua_toboolean(L,-1))
+    throw std::runtime_error("the callback is returned false");
+}
+
+static void push(lua_State* L, const std::vector<uint8_t>& message)
+{
+  lua_pushinteger(L,0x7f0000001000);
+  lua_pushinteger(L,2);
+  lua_pushlstring(L,(const char*)(message.data()),message.size());
+}
+
+template <typename F> static double measure(const size_t messages, F&& dispatch)
+{
+  auto start=std::chrono::steady_clock::now();
+  dispatch();
+  std::chrono::duration<double> elapsed=std::chrono::steady_clock::now()-start;
+  return messages/elapsed.count();
+}
+
+int main(int argc, char** argv)
+{
+  const size_t messages=(argc > 1) ? std::strtoul(argv[1],nullptr,10) : 2000000;
+  const size_t batch=(argc > 2) ? std::strtoul(argv[2],nullptr,10) : 64;
+  const size_t size=(argc > 3) ? std::strtoul(argv[3],nullptr,10) : 32;
+  const std::vector<uint8_t> message(size,'x');
+
+  lua_State* L=luaL_newstate();
+  luaL_openlibs(L);
+  if(luaL_dostring(L,service))
+    throw std::runtime_error(lua_tostring(L,-1));
+
+  lua_getglobal(L,"service");
+  lua_getfield(L,-1,"onMessage");
+  const int onMessage=luaL_ref(L,LUA_REGISTRYINDEX);
+  lua_getfield(L,-1,"onMessages");
+  const int onMessages=luaL_ref(L,LUA_REGISTRYINDEX);
+  lua_settop(L,0);
+
+  const double lookup=measure(messages,[&](){
+    for(size_t i=0;i<messages;++i)
+    {
+      lua_settop(L,0);
+      lua_getfield(L,LUA_GLOBALSINDEX,"service");
+      lua_getfield(L,-1,"onMessage");
+      push(L,message);
+      check(L,lua_pcall(L,3,1,0));
+    }
+  });
+
+  const double cached=measure(messages,[&](){
+    for(size_t i=0;i<messages;++i)
+    {
+      lua_settop(L,0);
+      lua_rawgeti(L,LUA_REGISTRYINDEX,onMessage);
+      push(L,message);
+      check(L,lua_pcall(L,3,1,0));
+    }
+  });
+
+  const double batched=measure(messages,[&](){
+    for(size_t done=0;done<messages;)
+    {
+      const size_t n=std::min(batch,messages-done);
+      lua_settop(L,0);
+      lua_rawgeti(L,LUA_REGISTRYINDEX,onMessages);
+      lua_createtable(L,static_cast<int>(3*n),0);
+      for(size_t i=0;i<n;++i)
+      {
+        push(L,message);
+        lua_rawseti(L,2,3*i+3);
+        lua_rawseti(L,2,3*i+2);
+        lua_rawseti(L,2,3*i+1);
+      }
+      check(L,lua_pcall(L,1,1,0));
+      done+=n;
+    }
+  });
+
+  std::printf("messages: %zu, batch: %zu, size: %zu bytes\n",messages,batch,size);
+  std::printf("lookup  : %10.0f msg/s\n",lookup);
+  std::printf("cached  : %10.0f msg/s (%.2fx)\n",cached,cached/lookup);
+  std::printf("batch   : %10.0f msg/s (%.2fx)\n",batched,batched/lookup);
+
+  lua_close(L);
+  return 0;
+}
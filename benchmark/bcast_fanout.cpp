@@ -0,0 +1,239 @@
+/**
+ *  Copyright 2017-2018, Pavel Kraynyukhov <pavel.kraynyukhov@gmail.com>
+ *
+ *  This file is a part of LAppS (Lua Application Server).
+ *
+ *  LAppS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  LAppS is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with LAppS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  $Id: bcast_fanout.cpp October 20, 2026 4:10 PM $
+ *
+ **/
+
+
+/**
+ * Broadcast fan-out latency: time from bcast() until the frame is queued
+ * to the last subscriber.
+ *
+ * "serial" walks all the subscribers on the calling thread and copies the
+ * frame for each of them, as Broadcast::bcast() did with send(*msg).
+ * "partitioned" uses BroadcastPartition as the IOWorkers do: the calling
+ * thread posts one reference of the frame per worker, the workers queue it
+ * to their own subscribers in parallel.
+ *
+ * In the serial case the publisher is blocked for the whole fan-out, in
+ * the partitioned case only for the posts, which is reported separately.
+ *
+ * Every 100th subscriber never drains its queue, so the slow subscriber
+ * policy (skip, 64KiB limit) is exercised too.
+ *
+ * Build:
+ *   g++ -O2 -std=c++17 -I../include -I../../ITCLib/include bcast_fanout.cpp -o bcast_fanout -lpthread
+ * Run:
+ *   ./bcast_fanout [workers] [messages]
+ **/
+
+#include <Broadcast.h>
+#include <Parker.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+/**
+ * @brief stands for a connection: fast subscribers drain immediately,
+ * slow ones keep everything queued.
+ **/
+class Subscriber : public ::abstract::WebSocket
+{
+ private:
+  const bool                      mSlow;
+  std::deque<MSGBufferTypeSPtr>   mQueue;
+  size_t                          mPending;
+
+ public:
+  explicit Subscriber(const bool slow) : mSlow(slow), mQueue(), mPending{0}
+  {
+  }
+
+  void queueOut(OutFrame&& frame)
+  {
+    if(mSlow)
+    {
+      mPending+=frame.buffer->size();
+      mQueue.push_back(std::move(frame.buffer));
+    }
+  }
+  const size_t pendingBytes() const { return mPending; }
+  const size_t dropShared(const size_t) { return 0; }
+  const bool replaceShared(const uint64_t, const MSGBufferTypeSPtr&) { return false; }
+  void closeNow() {}
+
+  const int send(const std::vector<uint8_t>&) { return 0; }
+  const int send(const MSGBufferTypeSPtr&) { return 0; }
+  const int forward(const WebSocketProtocol::OpCode, const MSGBufferTypeSPtr&) { return 0; }
+  const State getState() const { return MESSAGING; }
+  const bool mustAutoFragment() const { return false; }
+  void returnBuffer(std::remove_reference<const std::shared_ptr<MSGBufferType>&>::type) {}
+  void close() {}
+  const int getfd() const { return -1; }
+  ::abstract::Worker* getOwner() const { return nullptr; }
+};
+
+struct FanOutWorker
+{
+  std::shared_ptr<LAppS::BroadcastPartition>  partition;
+  LAppS::Parker                               parker;
+  std::mutex                                  mutex;
+  std::vector<MSGBufferTypeSPtr>              inbox;
+  std::atomic<size_t>                         done;
+
+  explicit FanOutWorker(const LAppS::BroadcastOptions& options)
+  : partition(std::make_shared<LAppS::BroadcastPartition>(options)), parker(), mutex(), inbox(), done{0}
+  {
+  }
+};
+
+static double percentile(std::vector<double>& samples, const double p)
+{
+  std::sort(samples.begin(),samples.end());
+  return samples[std::min(samples.size()-1,static_cast<size_t>(p*samples.size()))];
+}
+
+static void serial(const size_t subscribers, const size_t messages, const MSGBufferTypeSPtr& frame)
+{
+  std::vector<std::shared_ptr<Subscriber>> subs;
+  for(size_t i=0;i<subscribers;++i)
+    subs.push_back(std::make_shared<Subscriber>((i%100) == 0));
+
+  std::vector<double> latencies;
+  for(size_t m=0;m<messages;++m)
+  {
+    const auto start=Clock::now();
+    for(auto& sub : subs)
+    {
+      if(sub->pendingBytes()+frame->size() > 65536) continue;
+      sub->queueOut(OutFrame{sub.get(),-1,OutFrame::DATA,std::make_shared<MSGBufferType>(*frame),0,nullptr});
+    }
+    std::chrono::duration<double,std::micro> elapsed=Clock::now()-start;
+    latencies.push_back(elapsed.count());
+  }
+  std::printf("  serial      p50: %10.0f us  p99: %10.0f us\n",percentile(latencies,0.5),percentile(latencies,0.99));
+}
+
+static void partitioned(const size_t workers, const size_t subscribers, const size_t messages, const MSGBufferTypeSPtr& frame)
+{
+  LAppS::BroadcastOptions options;
+  options.max_pending=65536;
+
+  std::vector<std::unique_ptr<FanOutWorker>> pool;
+  for(size_t w=0;w<workers;++w)
+    pool.push_back(std::make_unique<FanOutWorker>(options));
+
+  // destroyed before the partitions, the subscribers leave them on destruction
+  std::vector<std::shared_ptr<Subscriber>> subs;
+  for(size_t i=0;i<subscribers;++i)
+  {
+    auto& target=pool[i%workers];
+    subs.push_back(std::make_shared<Subscriber>((i%100) == 0));
+    target->partition->expect(nullptr);
+    target->partition->subscribe(subs.back().get());
+  }
+
+  std::atomic<bool> stop{false};
+  std::vector<std::thread> threads;
+  for(size_t w=0;w<workers;++w)
+  {
+    threads.emplace_back([&,w](){
+      FanOutWorker& self=*pool[w];
+      std::vector<MSGBufferTypeSPtr> local;
+      while(!stop.load())
+      {
+        {
+          std::lock_guard<std::mutex> sync(self.mutex);
+          local.swap(self.inbox);
+        }
+        if(local.empty())
+        {
+          self.parker.prepare();
+          {
+            std::lock_guard<std::mutex> sync(self.mutex);
+            if(!self.inbox.empty())
+            {
+              self.parker.cancel();
+              continue;
+            }
+          }
+          self.parker.park(10);
+          continue;
+        }
+        for(auto& msg : local)
+        {
+          self.partition->deliver(msg,0);
+          self.done.fetch_add(1,std::memory_order_release);
+        }
+        local.clear();
+      }
+    });
+  }
+
+  std::vector<double> latencies;
+  std::vector<double> publisher;
+  for(size_t m=0;m<messages;++m)
+  {
+    const auto start=Clock::now();
+    for(auto& worker : pool)
+    {
+      {
+        std::lock_guard<std::mutex> sync(worker->mutex);
+        worker->inbox.push_back(frame);
+      }
+      worker->parker.unpark();
+    }
+    std::chrono::duration<double,std::micro> posted=Clock::now()-start;
+    publisher.push_back(posted.count());
+    for(auto& worker : pool)
+      while(worker->done.load(std::memory_order_acquire) < m+1);
+    std::chrono::duration<double,std::micro> elapsed=Clock::now()-start;
+    latencies.push_back(elapsed.count());
+  }
+  stop.store(true);
+  for(auto& worker : pool) worker->parker.unpark();
+  for(auto& thread : threads) thread.join();
+
+  std::printf("  partitioned p50: %10.0f us  p99: %10.0f us  (publisher blocked p50: %.1f us)\n",
+    percentile(latencies,0.5),percentile(latencies,0.99),percentile(publisher,0.5));
+}
+
+int main(int argc, char** argv)
+{
+  const size_t workers=argc > 1 ? std::strtoull(argv[1],nullptr,10) : 4;
+  const size_t messages=argc > 2 ? std::strtoull(argv[2],nullptr,10) : 50;
+  auto frame=std::make_shared<MSGBufferType>(256,'x');
+
+  for(const size_t subscribers : {10000ul,100000ul,1000000ul})
+  {
+    std::printf("subscribers: %zu, workers: %zu, frame: %zu bytes, messages: %zu\n",
+      subscribers,workers,frame->size(),messages);
+    serial(subscribers,messages,frame);
+    partitioned(workers,subscribers,messages,frame);
+  }
+  return 0;
+}
@@ -0,0 +1,185 @@
+/**
+ *  Copyright 2017-2018, Pavel Kraynyukhov <pavel.kraynyukhov@gmail.com>
+ *
+ *  This file is a part of LAppS (Lua Application Server).
+ *
+ *  LAppS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  LAppS is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with LAppS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  $Id: dispatch_latency.cpp October 19, 2026 3:30 PM $
+ *
+ **/
+
+/**
+ * Queueing latency of the "ordered" and "steal" dispatch modes under
+ * skewed load.
+ *
+ * An open loop generator emits requests at a fixed rate. One chatty
+ * connection produces a configurable share of all requests, the rest are
+ * spread evenly over the other connections. Connections are bound to the
+ * instances round robin, as Shakespeer does. 5% of the requests are slow.
+ * In the "steal" mode the instances use RunQueue/StealGroup exactly as
+ * LuaReactiveService does.
+ *
+ * Build:
+ *   g++ -O2 -std=c++17 -I../include -I../../ITCLib/include dispatch_latency.cpp -o dispatch_latency -lpthread
+ * Run:
+ *   ./dispatch_latency [instances] [requests/s] [seconds] [chatty share %]
+ **/
+
+#include <StealGroup.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <thread>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+struct Request
+{
+  Clock::time_point enqueued;
+  uint32_t          cost_us;
+};
+
+static void spin(const uint32_t us)
+{
+  const auto until=Clock::now()+std::chrono::microseconds(us);
+  while(Clock::now() < until);
+}
+
+struct Instance
+{
+  std::shared_ptr<LAppS::Parker>                    parker;
+  std::shared_ptr<LAppS::RunQueue<Request>>         queue;
+  std::vector<double>                               latencies;
+  size_t                                            stolen;
+
+  Instance()
+  : parker(std::make_shared<LAppS::Parker>()),
+    queue(std::make_shared<LAppS::RunQueue<Request>>(parker)),
+    latencies(), stolen{0}
+  {
+  }
+};
+
+static void run(const bool steal, const size_t instances, const size_t rate, const size_t seconds, const size_t chatty)
+{
+  std::vector<std::unique_ptr<Instance>> pool;
+  LAppS::StealGroup<Request> group;
+  for(size_t i=0;i<instances;++i)
+  {
+    pool.push_back(std::make_unique<Instance>());
+    if(steal) group.join(pool.back()->queue);
+  }
+
+  std::atomic<bool> done{false};
+  std::vector<std::thread> threads;
+
+  for(size_t i=0;i<instances;++i)
+  {
+    threads.emplace_back([&,i](){
+      Instance& self=*pool[i];
+      std::vector<Request> batch;
+      while(true)
+      {
+        Request request;
+        bool have=self.queue->pop(request);
+        if((!have)&&steal)
+        {
+          batch.clear();
+          const size_t stolen=group.steal(self.queue.get(),batch);
+          if(stolen > 0)
+          {
+            self.stolen+=stolen;
+            self.queue->push(batch);
+            have=self.queue->pop(request);
+          }
+        }
+        if(have)
+        {
+          spin(request.cost_us);
+          std::chrono::duration<double,std::micro> latency=Clock::now()-request.enqueued;
+          self.latencies.push_back(latency.count());
+          continue;
+        }
+        if(done.load()&&(self.queue->size() == 0)&&((!steal)||(!group.backlog(self.queue.get()))))
+          break;
+        self.parker->prepare();
+        if((self.queue->size() > 0)||(steal&&group.backlog(self.queue.get())))
+        {
+          self.parker->cancel();
+          continue;
+        }
+        self.parker->park(10);
+      }
+    });
+  }
+
+  std::mt19937_64 rng(42);
+  std::uniform_int_distribution<size_t> percent(0,99);
+  const size_t connections=instances*16;
+  const auto interval=std::chrono::nanoseconds(1000000000/rate);
+  const size_t total=rate*seconds;
+  auto next=Clock::now();
+  std::vector<Request> one(1);
+
+  for(size_t n=0;n<total;++n)
+  {
+    while(Clock::now() < next);
+    next+=interval;
+
+    const size_t connection=(percent(rng) < chatty) ? 0 : 1+(rng()%(connections-1));
+    Instance& target=*pool[connection%instances];
+
+    one[0]=Request{Clock::now(),(percent(rng) < 5) ? 2000u : 20u};
+    target.queue->push(one);
+    target.parker->unpark();
+    if(steal&&(target.queue->size() > 1))
+      group.wakeIdle(target.queue.get());
+  }
+  done.store(true);
+  for(auto& instance : pool) instance->parker->unpark();
+  for(auto& thread : threads) thread.join();
+
+  std::vector<double> all;
+  size_t stolen=0;
+  for(auto& instance : pool)
+  {
+    all.insert(all.end(),instance->latencies.begin(),instance->latencies.end());
+    stolen+=instance->stolen;
+  }
+  std::sort(all.begin(),all.end());
+  auto pct=[&all](const double p){ return all[std::min(all.size()-1,static_cast<size_t>(p*all.size()))]; };
+
+  std::printf("%-8s requests: %zu, stolen: %zu\n",steal ? "steal" : "ordered",all.size(),stolen);
+  std::printf("         p50: %10.0f us  p99: %10.0f us  p99.9: %10.0f us  max: %10.0f us\n",
+    pct(0.5),pct(0.99),pct(0.999),all.back());
+}
+
+int main(int argc, char** argv)
+{
+  const size_t instances=argc > 1 ? std::strtoull(argv[1],nullptr,10) : 4;
+  const size_t rate=argc > 2 ? std::strtoull(argv[2],nullptr,10) : 16000;
+  const size_t seconds=argc > 3 ? std::strtoull(argv[3],nullptr,10) : 3;
+  const size_t chatty=argc > 4 ? std::strtoull(argv[4],nullptr,10) : 20;
+
+  std::printf("instances: %zu, rate: %zu req/s, duration: %zu s, chatty connection share: %zu%%\n",
+    instances,rate,seconds,chatty);
+  run(false,instances,rate,seconds,chatty);
+  run(true,instances,rate,seconds,chatty);
+  return 0;
+}
@@ -0,0 +1,202 @@
+/**
+ *  Copyright 2017-2018, Pavel Kraynyukhov <pavel.kraynyukhov@gmail.com>
+ *
+ *  This file is a part of LAppS (Lua Application Server).
+ *
+ *  LAppS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  LAppS is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with LAppS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  $Id: fragmented_send.cpp October 28, 2026 5:20 PM $
+ *
+ **/
+
+/**
+ * Sending a large message as WebSocket fragments over a socketpair.
+ *
+ * "per fragment": one buffer per fragment with a copy of its payload
+ * slice, one send() per fragment (the former FragmentedServerMessage).
+ * "vectored": the payload stays in one buffer, the headers of up to 256
+ * fragments are generated into a side array and written together with
+ * the payload slices by one sendmsg() (FragmentedMessage::gather()).
+ *
+ * The reader reassembles the fragments and checks them against the
+ * payload, so both variants are verified to produce the same stream.
+ *
+ * Build:
+ *   g++ -O2 -std=c++17 -I../include fragmented_send.cpp -o fragmented_send -lpthread
+ * Run:
+ *   ./fragmented_send [messages] [message size] [fragment size]
+ **/
+
+#include <limits>
+#include <WSEvent.h>
+#include <WSServerMessage.h>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+static size_t syscalls=0;
+
+static void sendAll(const int fd, const uint8_t* data, size_t len)
+{
+  while(len > 0)
+  {
+    ++syscalls;
+    const ssize_t ret=::send(fd,data,len,MSG_NOSIGNAL);
+    if(ret <= 0) throw std::runtime_error("send() has failed");
+    data+=ret;
+    len-=ret;
+  }
+}
+
+static void perFragment(const int fd, const std::vector<uint8_t>& payload, const size_t fragment)
+{
+  const size_t len=payload.size();
+  for(size_t begin=0;begin < len;begin+=fragment)
+  {
+    const size_t plsize=std::min(fragment,len-begin);
+    auto out=std::make_shared<MSGBufferType>();
+    out->push_back(((begin+plsize == len) ? 128 : 0)|((begin == 0) ? WebSocketProtocol::BINARY : 0));
+    WebSocketProtocol::WS::putLength(plsize,*out);
+    const size_t offset=out->size();
+    out->resize(offset+plsize);
+    memcpy(out->data()+offset,payload.data()+begin,plsize);
+    sendAll(fd,out->data(),out->size());
+  }
+}
+
+static void vectored(const int fd, const std::vector<uint8_t>& payload, const size_t fragment)
+{
+  static constexpr size_t FRAGMENTS_PER_WRITE=256;
+  WebSocketProtocol::FragmentedMessage::HeaderType heads[FRAGMENTS_PER_WRITE];
+  iovec parts[2*FRAGMENTS_PER_WRITE];
+
+  const size_t total=WebSocketProtocol::FragmentedMessage::size(payload.size(),fragment);
+  size_t offset=0;
+  while(offset < total)
+  {
+    msghdr msg{};
+    msg.msg_iov=parts;
+    msg.msg_iovlen=WebSocketProtocol::FragmentedMessage::gather(
+      payload.data(),payload.size(),fragment,WebSocketProtocol::BINARY,offset,parts,heads,FRAGMENTS_PER_WRITE
+    );
+    ++syscalls;
+    const ssize_t ret=::sendmsg(fd,&msg,MSG_NOSIGNAL);
+    if(ret <= 0) throw std::runtime_error("sendmsg() has failed");
+    offset+=ret;
+  }
+}
+
+/**
+ * @brief reads the fragments of `messages` messages and compares them
+ * with the payload.
+ **/
+static void reader(const int fd, const std::vector<uint8_t>& payload, const size_t messages, std::atomic<bool>& valid)
+{
+  std::vector<uint8_t> in(1<<20);
+  std::vector<uint8_t> message;
+  size_t have=0;
+  size_t done=0;
+  size_t pos=0;
+
+  while(done < messages)
+  {
+    const ssize_t ret=::recv(fd,in.data()+have,in.size()-have,0);
+    if(ret <= 0) { valid=false; return; }
+    have+=ret;
+
+    for(;;)
+    {
+      if(have-pos < 2) break;
+      const uint8_t* h=in.data()+pos;
+      size_t hsz=2;
+      uint64_t plsize=h[1]&127;
+      if(plsize == 126)
+      {
+        if(have-pos < 4) break;
+        hsz=4;
+        plsize=(uint64_t(h[2])<<8)|h[3];
+      }
+      else if(plsize == 127)
+      {
+        if(have-pos < 10) break;
+        hsz=10;
+        plsize=0;
+        for(size_t i=0;i<8;++i) plsize=(plsize<<8)|h[2+i];
+      }
+      if(have-pos < hsz+plsize) break;
+
+      if(message.empty() != ((h[0]&15) != 0)) valid=false;
+      message.insert(message.end(),h+hsz,h+hsz+plsize);
+      pos+=hsz+plsize;
+
+      if(h[0]&128)
+      {
+        if(message != payload) valid=false;
+        message.clear();
+        ++done;
+      }
+    }
+    memmove(in.data(),in.data()+pos,have-pos);
+    have-=pos;
+    pos=0;
+  }
+}
+
+template <typename Sender> static double run(Sender send, const std::vector<uint8_t>& payload, const size_t messages, const size_t fragment, bool& valid)
+{
+  int fds[2];
+  if(socketpair(AF_UNIX,SOCK_STREAM,0,fds) != 0)
+    throw std::runtime_error("socketpair() has failed");
+
+  std::atomic<bool> ok{true};
+  std::thread consumer(reader,fds[1],std::cref(payload),messages,std::ref(ok));
+
+  syscalls=0;
+  auto start=std::chrono::steady_clock::now();
+  for(size_t i=0;i<messages;++i)
+    send(fds[0],payload,fragment);
+  consumer.join();
+  std::chrono::duration<double> elapsed=std::chrono::steady_clock::now()-start;
+
+  close(fds[0]);
+  close(fds[1]);
+  valid=ok;
+  return messages/elapsed.count();
+}
+
+int main(int argc, char** argv)
+{
+  const size_t messages=(argc > 1) ? strtoul(argv[1],nullptr,10) : 200;
+  const size_t size=(argc > 2) ? strtoul(argv[2],nullptr,10) : 1048576;
+  const size_t fragment=(argc > 3) ? strtoul(argv[3],nullptr,10) : WebSocketProtocol::FragmentedMessage::DEFAULT_FRAGMENT_SIZE;
+
+  std::vector<uint8_t> payload(size);
+  for(size_t i=0;i<size;++i) payload[i]=static_cast<uint8_t>(i*131+7);
+
+  bool valid;
+  const double legacy=run(perFragment,payload,messages,fragment,valid);
+  printf("per fragment: %10.1f msg/s, %8.1f syscalls/msg %s\n",legacy,double(syscalls)/messages,valid ? "" : "INVALID");
+
+  const double gathered=run(vectored,payload,messages,fragment,valid);
+  printf("vectored:     %10.1f msg/s, %8.1f syscalls/msg %s\n",gathered,double(syscalls)/messages,valid ? "" : "INVALID");
+  return 0;
+}
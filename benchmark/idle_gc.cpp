@@ -0,0 +1,159 @@
+/**
+ *  Copyright 2017-2018, Pavel Kraynyukhov <pavel.kraynyukhov@gmail.com>
+ *
+ *  This file is a part of LAppS (Lua Application Server).
+ *
+ *  LAppS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  LAppS is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with LAppS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  $Id: idle_gc.cpp October 27, 2026 4:30 PM $
+ *
+ **/
+
+/**
+ * Latency of onMessage() calls arriving in bursts, with and without the
+ * incremental GC work LuaServiceContext::idleCollect() does between them.
+ *
+ * Each call allocates some garbage and the service keeps a live table,
+ * so the collector has real work. "none" sleeps through the gaps between
+ * the bursts, "idle" spends them on bounded LUA_GCSTEP slices.
+ *
+ * Build:
+ *   g++ -O2 -std=c++17 -I/usr/include/luajit-2.1 idle_gc.cpp -o idle_gc -lluajit-5.1
+ * Run:
+ *   ./idle_gc [bursts] [calls per burst] [gap ms]
+ **/
+
+extern "C" {
+#include <lua.h>
+#include <lualib.h>
+#include <lauxlib.h>
+}
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+static const char* service=R"(
+service={ live={}, n=0 }
+
+for i=1,200000 do service.live[i]={ i, tostring(i) } end
+
+function service.onMessage(n)
+  local t={}
+  for i=1,32 do t[i]={ n, i, "item"..i } end
+  service.n=service.n+#t
+  return true
+end
+
+return service
+)";
+
+typedef std::chrono::steady_clock Clock;
+
+static const uint64_t ns(const Clock::time_point& from, const Clock::time_point& to)
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(to-from).count();
+}
+
+struct Result
+{
+  std::vector<uint64_t> latencies;
+  uint64_t              gc_ns;
+};
+
+static Result run(const bool idle_gc, const size_t bursts, const size_t calls, const long gap_ms)
+{
+  lua_State* L=luaL_newstate();
+  luaL_openlibs(L);
+  if(luaL_dostring(L,service) != 0)
+    throw std::runtime_error(lua_tostring(L,-1));
+  lua_getfield(L,-1,"onMessage");
+  const int onMessage=luaL_ref(L,LUA_REGISTRYINDEX);
+  lua_settop(L,0);
+
+  const int step_kb=64;
+  const long budget_us=500;
+  int idle_from=0;
+
+  Result result{std::vector<uint64_t>(),0};
+  result.latencies.reserve(bursts*calls);
+
+  for(size_t burst=0;burst<bursts;++burst)
+  {
+    for(size_t i=0;i<calls;++i)
+    {
+      const auto started=Clock::now();
+      lua_rawgeti(L,LUA_REGISTRYINDEX,onMessage);
+      lua_pushinteger(L,i);
+      if(lua_pcall(L,1,1,0) != 0)
+        throw std::runtime_error(lua_tostring(L,-1));
+      lua_settop(L,0);
+      result.latencies.push_back(ns(started,Clock::now()));
+    }
+
+    const auto gap_end=Clock::now()+std::chrono::milliseconds(gap_ms);
+    while(idle_gc&&(Clock::now() < gap_end))
+    {
+      const int kb=lua_gc(L,LUA_GCCOUNT,0);
+      // half way to the threshold of the default pause (200)
+      if(kb < idle_from+std::max(step_kb,idle_from/2))
+        break;
+      const auto started=Clock::now();
+      const auto deadline=started+std::chrono::microseconds(budget_us);
+      do
+      {
+        if(lua_gc(L,LUA_GCSTEP,step_kb))
+        {
+          idle_from=lua_gc(L,LUA_GCCOUNT,0);
+          break;
+        }
+      }while(Clock::now() < deadline);
+      result.gc_ns+=ns(started,Clock::now());
+    }
+    std::this_thread::sleep_until(gap_end);
+  }
+  lua_close(L);
+  return result;
+}
+
+static void report(const char* name, Result& result)
+{
+  auto& l=result.latencies;
+  std::sort(l.begin(),l.end());
+  auto at=[&l](const double q){ return l[std::min(l.size()-1,static_cast<size_t>(q*l.size()))]/1000.0; };
+  const size_t slow=l.end()-std::upper_bound(l.begin(),l.end(),500000);
+  printf("%-5s p50 %6.2f us  p99 %7.2f us  p99.9 %7.2f us  max %8.2f us  >0.5ms %4zu  idle GC %.2f ms\n",
+    name,at(0.5),at(0.99),at(0.999),l.back()/1000.0,slow,result.gc_ns/1000000.0
+  );
+}
+
+int main(int argc, char** argv)
+{
+  const size_t bursts=(argc > 1) ? std::strtoul(argv[1],nullptr,10) : 200;
+  const size_t calls=(argc > 2) ? std::strtoul(argv[2],nullptr,10) : 500;
+  const long gap_ms=(argc > 3) ? std::strtol(argv[3],nullptr,10) : 5;
+
+  printf("%zu bursts of %zu calls, %ld ms gaps\n",bursts,calls,gap_ms);
+  auto none=run(false,bursts,calls,gap_ms);
+  report("none",none);
+  auto idle=run(true,bursts,calls,gap_ms);
+  report("idle",idle);
+  return 0;
+}
@@ -0,0 +1,199 @@
+/**
+ *  Copyright 2017-2018, Pavel Kraynyukhov <pavel.kraynyukhov@gmail.com>
+ *
+ *  This file is a part of LAppS (Lua Application Server).
+ *
+ *  LAppS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  LAppS is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with LAppS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  $Id: lapps_codec.cpp October 23, 2026 3:40 PM $
+ *
+ **/
+
+/**
+ * Requests per second of one LAppS service instance with each of the
+ * "lapps_codec" modes: "nljson", "lua" and "view".
+ *
+ * Each request goes through the same steps as in LuaReactiveServiceContext
+ * and ws:send(): CBOR request -> Lua value -> onMessage echo handler ->
+ * CBOR response in a WebSocket frame. In the "view" mode the request is
+ * validated with a streaming scan and passed as a lazy cbor view, the
+ * echoed params are copied into the response without re-encoding.
+ * Networking is left out.
+ *
+ * Build:
+ *   g++ -O2 -std=c++17 -I../include -I../../ITCLib/include -I/usr/include/luajit-2.1 lapps_codec.cpp -o lapps_codec -lluajit-5.1
+ * Run:
+ *   ./lapps_codec [requests]
+ **/
+
+extern "C" {
+#include <lua.h>
+#include <lualib.h>
+#include <lauxlib.h>
+}
+
+#include <modules/nljson.h>
+#include <modules/cbor.h>
+#include <WSServerMessage.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+
+static const char* handlers=R"(
+  function echo_nljson(msg_type, message)
+    local response=nljson.decode([[{"cid":0,"status":1,"result":[]}]])
+    response.result=message.params
+    return response
+  end
+
+  function echo_lua(msg_type, message)
+    return { cid=0, status=1, result=message.params }
+  end
+)";
+
+static void call(lua_State* L, const char* handler, const int args)
+{
+  if(lua_pcall(L,args,1,0) != 0)
+    throw std::runtime_error(std::string(handler)+": "+lua_tostring(L,-1));
+}
+
+static double viaNLJSON(lua_State* L, const std::vector<uint8_t>& request, const size_t requests, size_t& bytes)
+{
+  auto start=std::chrono::steady_clock::now();
+  for(size_t i=0;i<requests;++i)
+  {
+    lua_settop(L,0);
+    lua_getglobal(L,"echo_nljson");
+    lua_pushinteger(L,4);
+
+    auto udjsptr=static_cast<UDJSPTR**>(lua_newuserdata(L,sizeof(UDJSPTR*)));
+    (*udjsptr)=new UDJSPTR(SHARED_PTR,new JSPTR(std::make_shared<json>(json::from_cbor(request))));
+    luaL_getmetatable(L, "nljson");
+    lua_pushcfunction(L, destroy);
+    lua_setfield(L, -2, "__gc");
+    lua_setmetatable(L, -2);
+
+    call(L,"echo_nljson",2);
+
+    MSGBufferType frame;
+    WebSocketProtocol::ServerMessage(frame,WebSocketProtocol::BINARY,json::to_cbor(get_userdata_value(L,-1)));
+    bytes=frame.size();
+  }
+  std::chrono::duration<double> elapsed=std::chrono::steady_clock::now()-start;
+  return requests/elapsed.count();
+}
+
+static double viaLua(lua_State* L, const std::vector<uint8_t>& request, const size_t requests, size_t& bytes)
+{
+  std::vector<uint8_t> cbor;
+  auto start=std::chrono::steady_clock::now();
+  for(size_t i=0;i<requests;++i)
+  {
+    lua_settop(L,0);
+    lua_getglobal(L,"echo_lua");
+    lua_pushinteger(L,4);
+    cbor_decode(L,request.data(),request.size());
+
+    call(L,"echo_lua",2);
+
+    cbor.clear();
+    cbor_encode(L,-1,cbor);
+    MSGBufferType frame;
+    WebSocketProtocol::ServerMessage(frame,WebSocketProtocol::BINARY,cbor);
+    bytes=frame.size();
+  }
+  std::chrono::duration<double> elapsed=std::chrono::steady_clock::now()-start;
+  return requests/elapsed.count();
+}
+
+static double viaView(lua_State* L, const std::vector<uint8_t>& request, const size_t requests, size_t& bytes)
+{
+  std::vector<uint8_t> cbor;
+  auto start=std::chrono::steady_clock::now();
+  for(size_t i=0;i<requests;++i)
+  {
+    lua_settop(L,0);
+    lua_getglobal(L,"echo_lua");
+    lua_pushinteger(L,4);
+    auto source=std::make_shared<CBORViewSource>(CBORViewSource{std::make_shared<MSGBufferType>(request)});
+    CBORReader r{source->buffer->data(),source->buffer->data()+source->buffer->size()};
+    cbor_skip_item(r,0);
+    push_cborview(L,source,0,source->buffer->size());
+
+    call(L,"echo_lua",2);
+
+    // ws:send() runs inside of onMessage(), before the view is detached
+    cbor.clear();
+    cbor_encode(L,-1,cbor);
+    source->buffer.reset();
+    MSGBufferType frame;
+    WebSocketProtocol::ServerMessage(frame,WebSocketProtocol::BINARY,cbor);
+    bytes=frame.size();
+  }
+  std::chrono::duration<double> elapsed=std::chrono::steady_clock::now()-start;
+  return requests/elapsed.count();
+}
+
+int main(int argc, char** argv)
+{
+  const size_t requests=argc > 1 ? std::strtoull(argv[1],nullptr,10) : 200000;
+
+  lua_State* L=luaL_newstate();
+  luaL_openlibs(L);
+  luaopen_nljson(L);
+  lua_setglobal(L,"nljson");
+  luaopen_cbor(L);
+  lua_setglobal(L,"cbor");
+  lua_settop(L,0);
+  if(luaL_dostring(L,handlers) != 0)
+  {
+    std::fprintf(stderr,"%s\n",lua_tostring(L,-1));
+    return 1;
+  }
+
+  const json request={
+    {"lapps",1},
+    {"method","echo"},
+    {"params",{
+      {
+        {"authkey",1234567},
+        {"seq",42},
+        {"payload",std::string(96,'x')},
+        {"tags",{"alpha","beta","gamma"}},
+        {"price",101.25},
+        {"book",{{{"px",100.5},{"qty",3}},{{"px",100.25},{"qty",7}}}}
+      }
+    }}
+  };
+  const std::vector<uint8_t> cbor=json::to_cbor(request);
+
+  size_t nljson_bytes=0, lua_bytes=0, view_bytes=0;
+  // warm up all paths, then measure
+  viaNLJSON(L,cbor,requests/10,nljson_bytes);
+  viaLua(L,cbor,requests/10,lua_bytes);
+  viaView(L,cbor,requests/10,view_bytes);
+  const double before=viaNLJSON(L,cbor,requests,nljson_bytes);
+  const double after=viaLua(L,cbor,requests,lua_bytes);
+  const double lazy=viaView(L,cbor,requests,view_bytes);
+
+  std::printf("requests: %zu, request: %zu bytes, response frame: %zu (nljson) / %zu (lua) / %zu (view) bytes\n",
+    requests,cbor.size(),nljson_bytes,lua_bytes,view_bytes);
+  std::printf("lapps_codec nljson : %10.0f req/s\n",before);
+  std::printf("lapps_codec lua    : %10.0f req/s (%.2fx)\n",after,after/before);
+  std::printf("lapps_codec view   : %10.0f req/s (%.2fx)\n",lazy,lazy/before);
+  lua_close(L);
+  return 0;
+}
@@ -0,0 +1,151 @@
+/**
+ *  Copyright 2017-2018, Pavel Kraynyukhov <pavel.kraynyukhov@gmail.com>
+ *
+ *  This file is a part of LAppS (Lua Application Server).
+ *
+ *  LAppS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  LAppS is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with LAppS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  $Id: mqr_throughput.cpp October 22, 2026 11:20 AM $
+ *
+ **/
+
+/**
+ * Messages per second between producer and consumer service instances
+ * through an MQR queue.
+ *
+ * Compares the mutex/condition variable protected queue (the former
+ * tsbqueue based MQR) against MQ::Queue on the lock-free MPMC ring, with
+ * the consumers receiving one message at a time (recv) and in batches
+ * (recv_many). Messages are shared pointers, as in MQR.
+ *
+ * Build:
+ *   g++ -O2 -std=c++17 -I../include mqr_throughput.cpp -o mqr_throughput -lpthread
+ * Run:
+ *   ./mqr_throughput [producers] [consumers] [messages] [batch]
+ **/
+
+#include <MQueue.h>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+typedef std::shared_ptr<std::string> Message;
+
+static Message theMessage=std::make_shared<std::string>(128,'x');
+
+class LockedQueue
+{
+ private:
+  std::mutex              mMutex;
+  std::condition_variable mCondition;
+  std::deque<Message>     mQueue;
+
+ public:
+  void send(Message&& message)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      mQueue.push_back(std::move(message));
+    }
+    mCondition.notify_one();
+  }
+
+  Message recv()
+  {
+    std::unique_lock<std::mutex> lock(mMutex);
+    mCondition.wait(lock,[this](){ return !mQueue.empty(); });
+    Message message=std::move(mQueue.front());
+    mQueue.pop_front();
+    return message;
+  }
+};
+
+template <typename Produce, typename Consume>
+static double run(const size_t producers, const size_t consumers, const size_t messages, Produce produce, Consume consume)
+{
+  const size_t per_producer=messages/producers;
+  const size_t total=per_producer*producers;
+  std::atomic<size_t> received{0};
+  std::vector<std::thread> threads;
+
+  auto start=std::chrono::steady_clock::now();
+
+  for(size_t i=0;i<consumers;++i)
+    threads.emplace_back([&](){ consume(received,total); });
+  for(size_t i=0;i<producers;++i)
+    threads.emplace_back([&](){ for(size_t n=0;n<per_producer;++n) produce(); });
+  for(auto& thread : threads) thread.join();
+
+  std::chrono::duration<double> elapsed=std::chrono::steady_clock::now()-start;
+  return total/elapsed.count();
+}
+
+int main(int argc, char** argv)
+{
+  const size_t producers=argc > 1 ? std::strtoull(argv[1],nullptr,10) : 2;
+  const size_t consumers=argc > 2 ? std::strtoull(argv[2],nullptr,10) : 2;
+  const size_t messages=argc > 3 ? std::strtoull(argv[3],nullptr,10) : 4000000;
+  const size_t batch=argc > 4 ? std::strtoull(argv[4],nullptr,10) : 64;
+
+  // each consumer claims a message before the blocking recv(), so none
+  // of them is left waiting when all the messages are received
+  const double locked=[&](){
+    LockedQueue queue;
+    return run(producers,consumers,messages,
+      [&](){ queue.send(Message(theMessage)); },
+      [&](std::atomic<size_t>& received, const size_t all){
+        while(received.fetch_add(1) < all) queue.recv();
+      });
+  }();
+
+  const double single=[&](){
+    LAppS::MQ::Queue<Message> queue(16384);
+    return run(producers,consumers,messages,
+      [&](){ Message message(theMessage); while(!queue.try_send(std::move(message))) std::this_thread::yield(); },
+      [&](std::atomic<size_t>& received, const size_t all){
+        Message message;
+        while(received.load() < all)
+          if(queue.recv(message,10)) received.fetch_add(1);
+      });
+  }();
+
+  const double batched=[&](){
+    LAppS::MQ::Queue<Message> queue(16384);
+    return run(producers,consumers,messages,
+      [&](){ Message message(theMessage); while(!queue.try_send(std::move(message))) std::this_thread::yield(); },
+      [&](std::atomic<size_t>& received, const size_t all){
+        std::vector<Message> out;
+        while(received.load() < all)
+        {
+          out.clear();
+          received.fetch_add(queue.recv_many(out,batch,10));
+        }
+      });
+  }();
+
+  std::printf("producers: %zu, consumers: %zu, messages: %zu, batch: %zu\n",producers,consumers,messages,batch);
+  std::printf("mutex queue           : %12.0f msg/s\n",locked);
+  std::printf("mpmc ring, recv       : %12.0f msg/s (%.2fx)\n",single,single/locked);
+  std::printf("mpmc ring, recv_many  : %12.0f msg/s (%.2fx)\n",batched,batched/locked);
+  return 0;
+}
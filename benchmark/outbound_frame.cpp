@@ -0,0 +1,124 @@
+/**
+ *  Copyright 2017-2018, Pavel Kraynyukhov <pavel.kraynyukhov@gmail.com>
+ *
+ *  This file is a part of LAppS (Lua Application Server).
+ *
+ *  LAppS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  LAppS is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with LAppS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  $Id: outbound_frame.cpp October 23, 2026 6:15 PM $
+ *
+ **/
+
+/**
+ * Cost of building an outbound LAppS frame from an nljson message.
+ *
+ * "two pass": the envelope is validated with find() calls, json::to_cbor()
+ * allocates the payload, ServerMessage copies it behind the header into
+ * the frame buffer (the former ws:send() and bcast:send() path).
+ * "in place": the message is encoded member by member straight into the
+ * frame buffer after the header gap, the envelope is checked on the way
+ * and the header is backfilled (InPlaceServerMessage).
+ *
+ * Build:
+ *   g++ -O2 -std=c++17 -I../include -I/usr/include/luajit-2.1 outbound_frame.cpp -o outbound_frame -lluajit-5.1
+ * Run:
+ *   ./outbound_frame [messages]
+ **/
+
+extern "C" {
+#include <lua.h>
+#include <lualib.h>
+#include <lauxlib.h>
+}
+
+#include <limits>
+#include <modules/cbor.h>
+#include <WSServerMessage.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+static bool validate(const json& msg)
+{
+  auto cid=msg.find("cid");
+  auto status=msg.find("status");
+  auto result=msg.find("result");
+  return (cid != msg.end())&&cid.value().is_number()&&(status != msg.end())&&(status.value() == 1)&&
+    (result != msg.end())&&result.value().is_array();
+}
+
+static double twoPass(const json& msg, const size_t messages, size_t& bytes)
+{
+  auto start=std::chrono::steady_clock::now();
+  for(size_t i=0;i<messages;++i)
+  {
+    if(!validate(msg)) std::abort();
+    auto frame=std::make_shared<MSGBufferType>();
+    WebSocketProtocol::ServerMessage(frame,WebSocketProtocol::BINARY,json::to_cbor(msg));
+    bytes=frame->size();
+  }
+  std::chrono::duration<double> elapsed=std::chrono::steady_clock::now()-start;
+  return messages/elapsed.count();
+}
+
+static double inPlace(const json& msg, const size_t messages, size_t& bytes)
+{
+  auto start=std::chrono::steady_clock::now();
+  for(size_t i=0;i<messages;++i)
+  {
+    bool has_cid=false, has_status=false, has_result=false;
+    WebSocketProtocol::InPlaceServerMessage frame;
+    cbor_encode_json_object(
+      msg,frame.payload(),
+      [&](const std::string& key, const json& value)
+      {
+        if(key == "cid") has_cid=value.is_number();
+        else if(key == "status") has_status=(value == 1);
+        else if(key == "result") has_result=value.is_array();
+      }
+    );
+    if(!(has_cid&&has_status&&has_result)) std::abort();
+    bytes=frame.finish(WebSocketProtocol::BINARY)->size();
+  }
+  std::chrono::duration<double> elapsed=std::chrono::steady_clock::now()-start;
+  return messages/elapsed.count();
+}
+
+int main(int argc, char** argv)
+{
+  const size_t messages=argc > 1 ? std::strtoull(argv[1],nullptr,10) : 200000;
+  const size_t payloads[]={64,4096,131072};
+
+  std::printf("messages: %zu\n",messages);
+  for(const size_t payload : payloads)
+  {
+    json row={{"id",12345},{"price",101.25},{"name",std::string(32,'n')}};
+    json result=json::array();
+    for(size_t sz=0;sz < payload;sz+=64)
+      result.push_back(row);
+    const json msg={{"cid",0},{"status",1},{"result",result}};
+
+    const size_t count=std::max<size_t>(messages*64/payload,1000);
+    size_t before_bytes=0, after_bytes=0;
+    twoPass(msg,count/10,before_bytes);
+    inPlace(msg,count/10,after_bytes);
+    const double before=twoPass(msg,count,before_bytes);
+    const double after=inPlace(msg,count,after_bytes);
+    if(before_bytes != after_bytes) std::abort();
+    std::printf("frame %7zu bytes: two pass %10.0f msg/s, in place %10.0f msg/s (%.2fx)\n",
+      after_bytes,before,after,after/before);
+  }
+  return 0;
+}
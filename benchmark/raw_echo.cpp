@@ -0,0 +1,160 @@
+/**
+ *  Copyright 2017-2018, Pavel Kraynyukhov <pavel.kraynyukhov@gmail.com>
+ *
+ *  This file is a part of LAppS (Lua Application Server).
+ *
+ *  LAppS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  LAppS is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with LAppS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  $Id: raw_echo.cpp October 24, 2026 2:05 PM $
+ *
+ **/
+
+/**
+ * Echo throughput of a RAW service instance, with and without "raw_ffi".
+ *
+ * "string": the message is pushed as a Lua string and echoed with
+ * ws:send(), which copies it into a new frame (the default RAW path).
+ * "raw_ffi": the message is passed as lapps_message_t cdata and ws:send()
+ * forwards the inbound buffer with a new header, no payload copy.
+ *
+ * The socket is a stub which drops the frames, networking is left out.
+ *
+ * Build:
+ *   g++ -O2 -std=c++17 -rdynamic -I../include -I../../ITCLib/include -I/usr/include/luajit-2.1 raw_echo.cpp -o raw_echo -lluajit-5.1 -lpthread
+ * Run:
+ *   ./raw_echo [messages] [message size]
+ **/
+
+extern "C" {
+#include <lua.h>
+#include <lualib.h>
+#include <lauxlib.h>
+}
+
+#include <modules/wsSend.h>
+#include <modules/rawffi.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+
+class EchoSocket : public ::abstract::WebSocket
+{
+ public:
+  size_t  bytes=0;
+  size_t  forwarded=0;
+
+  void queueOut(OutFrame&&) {}
+  const size_t pendingBytes() const { return 0; }
+  const size_t dropShared(const size_t) { return 0; }
+  const bool replaceShared(const uint64_t, const MSGBufferTypeSPtr&) { return false; }
+  void closeNow() {}
+
+  const int send(const std::vector<uint8_t>& buff) { bytes+=buff.size(); return buff.size(); }
+  const int send(const MSGBufferTypeSPtr& buff) { bytes+=buff->size(); return buff->size(); }
+  const int forward(const WebSocketProtocol::OpCode oc, const MSGBufferTypeSPtr& payload)
+  {
+    ++forwarded;
+    bytes+=WebSocketProtocol::InPlaceServerMessage::headerSize(payload->size())+payload->size();
+    return payload->size();
+  }
+  const State getState() const { return MESSAGING; }
+  const bool mustAutoFragment() const { return false; }
+  void returnBuffer(std::remove_reference<const std::shared_ptr<MSGBufferType>&>::type) {}
+  void close() {}
+  const int getfd() const { return -1; }
+  ::abstract::Worker* getOwner() const { return nullptr; }
+};
+
+static void call(lua_State* L, const int args)
+{
+  if(lua_pcall(L,args,1,0) != 0)
+    throw std::runtime_error(lua_tostring(L,-1));
+  if(!lua_toboolean(L,-1))
+    throw std::runtime_error("echo has failed");
+}
+
+static double viaString(lua_State* L, EchoSocket& ws, const MSGBufferTypeSPtr& message, const size_t messages)
+{
+  auto start=std::chrono::steady_clock::now();
+  for(size_t i=0;i<messages;++i)
+  {
+    lua_settop(L,0);
+    lua_getglobal(L,"echo");
+    lua_pushinteger(L,(lua_Integer)(ws.handle()));
+    lua_pushinteger(L,WebSocketProtocol::BINARY);
+    lua_pushlstring(L,(const char*)(message->data()),message->size());
+    call(L,3);
+  }
+  std::chrono::duration<double> elapsed=std::chrono::steady_clock::now()-start;
+  return messages/elapsed.count();
+}
+
+static lapps_message_t raw{nullptr,0,nullptr};
+
+static double viaFFI(lua_State* L, EchoSocket& ws, const MSGBufferTypeSPtr& message, const size_t messages)
+{
+  auto start=std::chrono::steady_clock::now();
+  for(size_t i=0;i<messages;++i)
+  {
+    lua_settop(L,0);
+    lua_getglobal(L,"echo");
+    lua_pushinteger(L,(lua_Integer)(ws.handle()));
+    lua_pushinteger(L,WebSocketProtocol::BINARY);
+    raw=lapps_message_t{message->data(),message->size(),&message};
+    lua_getglobal(L,"raw");
+    call(L,3);
+    raw=lapps_message_t{nullptr,0,nullptr};
+  }
+  std::chrono::duration<double> elapsed=std::chrono::steady_clock::now()-start;
+  return messages/elapsed.count();
+}
+
+int main(int argc, char** argv)
+{
+  const size_t messages=argc > 1 ? std::strtoull(argv[1],nullptr,10) : 1000000;
+  const size_t size=argc > 2 ? std::strtoull(argv[2],nullptr,10) : 4096;
+
+  lua_State* L=luaL_newstate();
+  luaL_openlibs(L);
+  luaopen_wssend(L);
+  lua_setglobal(L,"ws");
+  luaopen_rawffi(L);
+  lua_getfield(L,-1,"wrap");
+  lua_pushlightuserdata(L,&raw);
+  lua_call(L,1,1);
+  lua_setglobal(L,"raw");
+  lua_settop(L,0);
+  if(luaL_dostring(L,"function echo(handler, opcode, message) return ws:send(handler,opcode,message) end") != 0)
+  {
+    std::fprintf(stderr,"%s\n",lua_tostring(L,-1));
+    return 1;
+  }
+
+  auto ws=std::make_shared<EchoSocket>();
+  ws->setHandle(LAppS::wsHandles().create(0,ws.get()));
+  auto message=std::make_shared<MSGBufferType>(size,'x');
+
+  viaString(L,*ws,message,messages/10);
+  viaFFI(L,*ws,message,messages/10);
+  const double before=viaString(L,*ws,message,messages);
+  const double after=viaFFI(L,*ws,message,messages);
+
+  std::printf("messages: %zu, size: %zu bytes, forwarded without copy: %zu\n",messages,size,ws->forwarded);
+  std::printf("string  : %10.0f msg/s\n",before);
+  std::printf("raw_ffi : %10.0f msg/s (%.2fx)\n",after,after/before);
+  lua_close(L);
+  return 0;
+}
@@ -0,0 +1,169 @@
+/**
+ *  Copyright 2017-2018, Pavel Kraynyukhov <pavel.kraynyukhov@gmail.com>
+ *
+ *  This file is a part of LAppS (Lua Application Server).
+ *
+ *  LAppS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  LAppS is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with LAppS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  $Id: spsc_ring.cpp October 19, 2026 1:20 PM $
+ *
+ **/
+
+/**
+ * Throughput of the IOWorker -> service instance edge.
+ *
+ * Compares the mutex protected queue drained with swap (the former
+ * tsbqueue<AppInEvent> path) against the SPSC ring with futex parking
+ * used by ServiceInbox. Events are 16 byte compact records with the
+ * message buffer kept in the side table, as in ServiceInbox.
+ *
+ * Build:
+ *   g++ -O2 -std=c++17 -I../include spsc_ring.cpp -o spsc_ring -lpthread
+ * Run:
+ *   ./spsc_ring [events] [ring size]
+ **/
+
+#include <SPSCRing.h>
+#include <Parker.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+typedef std::shared_ptr<std::vector<uint8_t>> Buffer;
+
+struct FullEvent
+{
+  uint32_t  opcode;
+  void*     websocket;
+  Buffer    message;
+};
+
+struct CompactEvent
+{
+  void*     websocket;
+  uint32_t  opcode;
+  uint32_t  buffer;
+};
+
+static Buffer theBuffer=std::make_shared<std::vector<uint8_t>>(128);
+
+static double mutexQueue(const size_t events)
+{
+  std::mutex mtx;
+  std::condition_variable cv;
+  std::queue<FullEvent> queue;
+
+  auto start=std::chrono::steady_clock::now();
+
+  std::thread consumer([&](){
+    size_t received=0;
+    while(received < events)
+    {
+      std::queue<FullEvent> local;
+      {
+        std::unique_lock<std::mutex> lock(mtx);
+        cv.wait(lock,[&](){ return !queue.empty(); });
+        std::swap(local,queue);
+      }
+      while(!local.empty())
+      {
+        local.pop();
+        ++received;
+      }
+    }
+  });
+
+  for(size_t i=0;i<events;++i)
+  {
+    {
+      std::lock_guard<std::mutex> lock(mtx);
+      queue.push(FullEvent{1,&mtx,theBuffer});
+    }
+    cv.notify_one();
+  }
+  consumer.join();
+
+  std::chrono::duration<double> elapsed=std::chrono::steady_clock::now()-start;
+  return events/elapsed.count();
+}
+
+static double spscRing(const size_t events, const size_t ring_size, size_t& parks)
+{
+  LAppS::SPSCRing<CompactEvent> ring(ring_size);
+  std::vector<Buffer> buffers(ring.capacity());
+  const size_t mask=ring.capacity()-1;
+  LAppS::Parker parker;
+
+  auto start=std::chrono::steady_clock::now();
+
+  std::thread consumer([&](){
+    size_t received=0;
+    while(received < events)
+    {
+      CompactEvent* ev=ring.front();
+      if(ev == nullptr)
+      {
+        parker.prepare();
+        if(!ring.empty())
+        {
+          parker.cancel();
+          continue;
+        }
+        ++parks;
+        parker.park(10);
+        continue;
+      }
+      Buffer message=std::move(buffers[ev->buffer]);
+      ring.pop();
+      ++received;
+    }
+  });
+
+  for(size_t i=0;i<events;++i)
+  {
+    while(ring.full())
+      std::this_thread::yield();
+    const uint32_t idx=static_cast<uint32_t>(ring.tail() & mask);
+    buffers[idx]=theBuffer;
+    ring.try_push(CompactEvent{&ring,1,idx});
+    parker.unpark();
+  }
+  consumer.join();
+
+  std::chrono::duration<double> elapsed=std::chrono::steady_clock::now()-start;
+  return events/elapsed.count();
+}
+
+int main(int argc, char** argv)
+{
+  const size_t events=argc > 1 ? std::strtoull(argv[1],nullptr,10) : 10000000;
+  const size_t ring_size=argc > 2 ? std::strtoull(argv[2],nullptr,10) : 1024;
+  size_t parks=0;
+
+  const double mq=mutexQueue(events);
+  const double sr=spscRing(events,ring_size,parks);
+
+  std::printf("events: %zu, ring size: %zu\n",events,ring_size);
+  std::printf("mutex queue + swap : %12.0f events/s\n",mq);
+  std::printf("spsc ring + futex  : %12.0f events/s (%zu parks)\n",sr,parks);
+  std::printf("speedup            : %12.2fx\n",sr/mq);
+  return 0;
+}
@@ -0,0 +1,127 @@
+/**
+ *  Copyright 2017-2018, Pavel Kraynyukhov <pavel.kraynyukhov@gmail.com>
+ *
+ *  This file is a part of LAppS (Lua Application Server).
+ *
+ *  LAppS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  LAppS is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with LAppS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  $Id: time_to_ready.cpp October 28, 2026 11:40 AM $
+ *
+ **/
+
+/**
+ * Time to ready of the Lua states of a service with a large module.
+ *
+ * "source": each state parses the module, the instances are created one
+ * after another (the startup before the bytecode cache).
+ * "cached": require() loads the module through BytecodeCache.
+ * "parallel": cached, the states are created in parallel, the way
+ * Deployer::start_instances() does it.
+ *
+ * Build:
+ *   g++ -O2 -std=c++17 -I../include -I../../ITCLib/include -I/usr/include/luajit-2.1 time_to_ready.cpp -o time_to_ready -lluajit-5.1 -lpthread -lstdc++fs
+ * Run:
+ *   ./time_to_ready [instances] [functions in the module]
+ **/
+
+extern "C" {
+#include <lua.h>
+#include <lualib.h>
+#include <lauxlib.h>
+}
+
+#include <BytecodeCache.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+typedef std::chrono::steady_clock Clock;
+
+static void writeModule(const std::string& path, const size_t functions)
+{
+  std::ofstream out(path);
+  out << "local service={}\n";
+  for(size_t i=0;i<functions;++i)
+  {
+    out << "function service.handler" << i << "(request)\n"
+        << "  local result={ id=" << i << ", name=\"handler" << i << "\" }\n"
+        << "  for k,v in pairs(request) do\n"
+        << "    if type(v) == \"number\" then result[k]=v*" << i << " else result[k]=tostring(v)..\"" << i << "\" end\n"
+        << "  end\n"
+        << "  return result\n"
+        << "end\n";
+  }
+  out << "return service\n";
+}
+
+static lua_State* startInstance(const bool cached)
+{
+  lua_State* L=luaL_newstate();
+  luaL_openlibs(L);
+  if(cached)
+    install_bytecode_searcher(L);
+  lua_getglobal(L,"require");
+  lua_pushstring(L,"bigservice");
+  if(lua_pcall(L,1,1,0) != 0)
+    throw std::runtime_error(lua_tostring(L,-1));
+  lua_settop(L,0);
+  return L;
+}
+
+static const double run(const size_t instances, const bool cached, const bool parallel)
+{
+  std::vector<lua_State*> states(instances,nullptr);
+  const auto started=Clock::now();
+
+  if(parallel)
+  {
+    std::vector<std::thread> threads;
+    for(size_t i=0;i<instances;++i)
+      threads.emplace_back([&states,i,cached](){ states[i]=startInstance(cached); });
+    for(auto& thread : threads)
+      thread.join();
+  }
+  else
+  {
+    for(size_t i=0;i<instances;++i)
+      states[i]=startInstance(cached);
+  }
+
+  const double ms=std::chrono::duration_cast<std::chrono::microseconds>(Clock::now()-started).count()/1000.0;
+  for(auto L : states)
+    lua_close(L);
+  return ms;
+}
+
+int main(int argc, char** argv)
+{
+  const size_t instances=(argc > 1) ? std::strtoul(argv[1],nullptr,10) : 32;
+  const size_t functions=(argc > 2) ? std::strtoul(argv[2],nullptr,10) : 20000;
+
+  writeModule("./bigservice.lua",functions);
+  setenv("LUA_PATH","./?.lua",1);
+
+  printf("%zu instances, module of %zu functions\n",instances,functions);
+  printf("source   %9.2f ms\n",run(instances,false,false));
+  printf("cached   %9.2f ms\n",run(instances,true,false));
+  printf("parallel %9.2f ms\n",run(instances,true,true));
+  printf("cache hits %zu, misses %zu\n",LAppS::SBytecodeCache::getInstance()->hits(),LAppS::SBytecodeCache::getInstance()->misses());
+  return 0;
+}
@@ -24,8 +24,14 @@ mqr_receiver.queue=mqr.create("testpipe");
 mqr_receiver.run=function()
   while not must_stop()
   do
-    local nljo=mqr_receiver.queue:recv();
-    mqr_receiver.meter();
+    local batch=mqr_receiver.queue:recv_many(256,100);
+    if(batch ~= nil)
+    then
+      for i=1,#batch
+      do
+        mqr_receiver.meter();
+      end
+    end
   end
   print("must stop["..instance_id.."]")
 end
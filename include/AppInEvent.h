@@ -36,7 +36,7 @@ namespace LAppS
   struct AppInEvent
   {
     WebSocketProtocol::OpCode opcode;
-    WSSPtrType                websocket;
+    ::abstract::WebSocket*    websocket;
     MSGBufferTypeSPtr         message;
   };
 }
@@ -21,53 +21,403 @@
  **/
 
 
+
 #ifndef __BROADCAST_H__
 #  define __BROADCAST_H__
 
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <string>
+#include <stdexcept>
+#include <limits>
+#include <utility>
+
+#include <sys/mutex.h>
 #include <sys/synclock.h>
-#include <forward_list>
+#include <ext/tsl/robin_map.h>
 
 #include <WSProtocol.h>
+#include <Config.h>
+#include <OutFrame.h>
+#include <abstract/FanOut.h>
 #include <abstract/WebSocket.h>
+#include <abstract/Worker.h>
 
 namespace LAppS
 {
-  template <bool TLSEnable=true,bool StatsEnable=true> class Broadcast
+  /**
+   * @brief what to do with a subscriber which has more than max_pending
+   * bytes queued:
+   *  SKIP - the new frame is not queued for this subscriber;
+   *  DROP - the oldest queued broadcast frames are dropped to make room;
+   *  DISCONNECT - the subscriber is disconnected.
+   **/
+  enum class SlowSubscriberPolicy : uint8_t { SKIP, DROP, DISCONNECT };
+  
+  /**
+   * @brief channel options. With `conflate` the messages sent with a key
+   * replace the not yet sent message with the same key in each
+   * subscriber's queue, so a slow subscriber gets only the latest value
+   * per key, while the fast ones get every message.
+   * 
+   * The channel may keep the last `retain` messages and, with
+   * `retain_keys`, the latest message per key. Those are replayed to each
+   * new subscriber by its IOWorker before any live message.
+   **/
+  struct BroadcastOptions
+  {
+    SlowSubscriberPolicy  policy;
+    size_t                max_pending;
+    bool                  conflate;
+    size_t                retain;
+    bool                  retain_keys;
+    
+    BroadcastOptions()
+    : policy{SlowSubscriberPolicy::SKIP}, max_pending{8*1024*1024}, conflate{false},
+      retain{0}, retain_keys{false}
+    {
+    }
+    
+    const bool retains() const
+    {
+      return (retain > 0) || retain_keys;
+    }
+  };
+  
+  /**
+   * @brief what Broadcast::bcast() does with the message:
+   *  SEND - keeps it for the late subscribers (if the channel retains any)
+   *    and delivers it to the current ones;
+   *  SNAPSHOT - only keeps it for the late subscribers;
+   *  DELTA - only delivers it to the current subscribers.
+   **/
+  enum class BroadcastDelivery : uint8_t { SEND, SNAPSHOT, DELTA };
+  
+  /**
+   * @brief retained messages with their keys, captured for one subscriber.
+   **/
+  typedef std::vector<std::pair<uint64_t,MSGBufferTypeSPtr>> BroadcastSnapshot;
+  
+  /**
+   * @brief subscribers of a channel connected to one IOWorker. Apart from
+   * the counters, touched by that worker's thread only, so the fan-out
+   * runs on all the workers in parallel without locks.
+   * 
+   * A subscription takes 16 bytes here and 16 bytes in the socket's
+   * Membership list. Sockets leave all their channels when they are
+   * closed or dropped by the worker.
+   **/
+  class BroadcastPartition : public ::abstract::FanOut
   {
-   public:
-    typedef std::forward_list<std::shared_ptr<::abstract::WebSocket>>  BCastSubscribers;
    private:
-    itc::sys::mutex           sMutex;
-    itc::sys::mutex           uMutex;
-    size_t                    ChannelID;
-    BCastSubscribers          mSubscribers;
-    BCastSubscribers          mUnsubscribers;
+    struct Subscriber
+    {
+      ::abstract::WebSocket*  ws;
+      uint32_t                membership;
+    };
+    
+    const BroadcastOptions            mOptions;
+    std::vector<Subscriber>           mSubscribers;
+    std::atomic<::abstract::Worker*>  mOwner;
+    std::atomic<size_t>               mExpected;
+    
+   public:
+    explicit BroadcastPartition(const BroadcastOptions& options)
+    : mOptions(options), mSubscribers(), mOwner{nullptr}, mExpected{0}
+    {
+    }
+    
+    BroadcastPartition(const BroadcastPartition&)=delete;
+    BroadcastPartition(BroadcastPartition&)=delete;
     
-    void purge()
+    /**
+     * @brief any thread: accounts a subscription posted to the owner.
+     **/
+    void expect(::abstract::Worker* owner)
     {
-      ITCSyncLock syncu(uMutex);
+      mOwner.store(owner,std::memory_order_relaxed);
+      mExpected.fetch_add(1,std::memory_order_release);
+    }
+    
+    /**
+     * @brief any thread: the subscription posted after expect() is not
+     * going to happen.
+     **/
+    void cancel()
+    {
+      mExpected.fetch_sub(1,std::memory_order_relaxed);
+    }
+    
+    ::abstract::Worker* getOwner() const
+    {
+      return mOwner.load(std::memory_order_relaxed);
+    }
+    
+    /**
+     * @brief any thread: true if there are subscribers or subscriptions
+     * on the way.
+     **/
+    const bool active() const
+    {
+      return mExpected.load(std::memory_order_acquire) > 0;
+    }
+    
+    const size_t size() const
+    {
+      return mSubscribers.size();
+    }
+    
+    /**
+     * @brief owner thread: adds the subscriber unless it is closed or
+     * already subscribed.
+     * @return true if the subscriber was added.
+     **/
+    const bool join(::abstract::WebSocket* ws)
+    {
+      if((ws == nullptr)||(ws->getState() != ::abstract::WebSocket::MESSAGING))
+      {
+        cancel();
+        return false;
+      }
       
-      auto uit=mUnsubscribers.begin();
-      while(uit!=mUnsubscribers.end())
+      auto& memberships=ws->memberships();
+      for(const auto& membership : memberships)
       {
-        for(auto it=mSubscribers.before_begin();it!=mSubscribers.end();++it)
-        { 
-          auto next=std::next(it);
-          if((next!=mSubscribers.end())&&((*next)==(*uit)))
+        if(membership.channel == this)
+        {
+          cancel();
+          return false;
+        }
+      }
+      
+      mSubscribers.push_back(Subscriber{ws,static_cast<uint32_t>(memberships.size())});
+      memberships.push_back(::abstract::Membership{this,static_cast<uint32_t>(mSubscribers.size()-1)});
+      return true;
+    }
+    
+    void subscribe(::abstract::WebSocket* ws)
+    {
+      join(ws);
+    }
+    
+    /**
+     * @brief owner thread: queues the retained frames to a new subscriber.
+     * The slow subscriber policy is not applied, the snapshot is sent
+     * whole. Keyed frames of conflating channels may still be replaced by
+     * the newer values.
+     **/
+    void replay(::abstract::WebSocket* ws, const BroadcastSnapshot& frames)
+    {
+      for(const auto& frame : frames)
+      {
+        const uint64_t slot_key=mOptions.conflate&&(frame.first != 0) ? conflationKey(frame.first) : 0;
+        ws->queueOut(OutFrame{ws,ws->getfd(),OutFrame::SHARED,frame.second,0,nullptr,slot_key});
+        if(ws->getState() != ::abstract::WebSocket::MESSAGING)
+          return;
+      }
+    }
+    
+    void unsubscribe(::abstract::WebSocket* ws)
+    {
+      for(const auto& membership : ws->memberships())
+      {
+        if(membership.channel == this)
+        {
+          removeAt(membership.slot);
+          return;
+        }
+      }
+    }
+    
+    void removeAt(const uint32_t slot)
+    {
+      const Subscriber gone=mSubscribers[slot];
+      
+      if(slot != mSubscribers.size()-1)
+      {
+        mSubscribers[slot]=mSubscribers.back();
+        const Subscriber& moved=mSubscribers[slot];
+        moved.ws->memberships()[moved.membership].slot=slot;
+      }
+      mSubscribers.pop_back();
+      
+      auto& memberships=gone.ws->memberships();
+      if(gone.membership != memberships.size()-1)
+      {
+        memberships[gone.membership]=memberships.back();
+        const auto& moved=memberships[gone.membership];
+        moved.channel->relink(moved.slot,gone.membership);
+      }
+      memberships.pop_back();
+      
+      mExpected.fetch_sub(1,std::memory_order_relaxed);
+    }
+    
+    const uint64_t conflationKey(const uint64_t key) const
+    {
+      uint64_t value=key^(reinterpret_cast<uintptr_t>(this)*0x9E3779B97F4A7C15ULL);
+      value=(value^(value>>30))*0xBF58476D1CE4E5B9ULL;
+      value=(value^(value>>27))*0x94D049BB133111EBULL;
+      value^=value>>31;
+      return value != 0 ? value : 1;
+    }
+    
+    void relink(const uint32_t slot, const uint32_t membership)
+    {
+      mSubscribers[slot].membership=membership;
+    }
+    
+    void deliver(const MSGBufferTypeSPtr& msg, const uint64_t key)
+    {
+      const size_t size=msg->size();
+      // the key is made unique per channel, sockets share one index
+      const uint64_t slot_key=mOptions.conflate&&(key != 0) ? conflationKey(key) : 0;
+      size_t i=0;
+      while(i<mSubscribers.size())
+      {
+        ::abstract::WebSocket* ws=mSubscribers[i].ws;
+        if(ws->getState() != ::abstract::WebSocket::MESSAGING)
+        {
+          removeAt(i);
+          continue;
+        }
+        
+        const size_t pending=ws->pendingBytes();
+        
+        if((slot_key != 0)&&(pending > 0)&&ws->replaceShared(slot_key,msg))
+        {
+          ++i;
+          continue;
+        }
+        
+        if(pending+size > mOptions.max_pending)
+        {
+          switch(mOptions.policy)
           {
-            mSubscribers.erase_after(it);
-            break;
+            case SlowSubscriberPolicy::SKIP:
+              ++i;
+              continue;
+            case SlowSubscriberPolicy::DROP:
+              if(ws->dropShared(pending+size-mOptions.max_pending) < pending+size-mOptions.max_pending)
+              {
+                // the backlog is not made of broadcasts, nothing to drop
+                ++i;
+                continue;
+              }
+              break;
+            case SlowSubscriberPolicy::DISCONNECT:
+              // leaves all the channels, this one's slot i is refilled
+              ws->closeNow();
+              continue;
           }
         }
-        ++uit;
+        ws->queueOut(OutFrame{ws,ws->getfd(),OutFrame::SHARED,msg,0,nullptr,slot_key});
+        ++i;
+      }
+    }
+  };
+  
+  /**
+   * @brief a subscription of the retaining channel. Carries the snapshot
+   * taken when the subscription was posted, so the new subscriber gets
+   * every message either from the snapshot or live, but not both. The
+   * replay runs on the subscriber's IOWorker.
+   **/
+  class SnapshotJoin : public ::abstract::FanOut
+  {
+   private:
+    std::shared_ptr<BroadcastPartition> mPartition;
+    BroadcastSnapshot                   mFrames;
+    
+   public:
+    SnapshotJoin(const std::shared_ptr<BroadcastPartition>& partition, BroadcastSnapshot&& frames)
+    : mPartition(partition), mFrames(std::move(frames))
+    {
+    }
+    
+    SnapshotJoin(const SnapshotJoin&)=delete;
+    SnapshotJoin(SnapshotJoin&)=delete;
+    
+    void subscribe(::abstract::WebSocket* ws)
+    {
+      if(mPartition->join(ws))
+        mPartition->replay(ws,mFrames);
+    }
+    
+    void unsubscribe(::abstract::WebSocket* ws)
+    {
+      mPartition->unsubscribe(ws);
+    }
+    
+    void deliver(const MSGBufferTypeSPtr& msg, const uint64_t key)
+    {
+      mPartition->deliver(msg,key);
+    }
+    
+    void removeAt(const uint32_t slot)
+    {
+      mPartition->removeAt(slot);
+    }
+    
+    void relink(const uint32_t slot, const uint32_t membership)
+    {
+      mPartition->relink(slot,membership);
+    }
+  };
+  
+  /**
+   * @brief broadcast channel. The frame is encoded once by the caller, each
+   * IOWorker with subscribers of this channel receives one reference to it
+   * and queues it to its own subscribers.
+   **/
+  template <bool TLSEnable=true,bool StatsEnable=true> class Broadcast
+  {
+   private:
+    size_t                                            ChannelID;
+    BroadcastOptions                                  mOptions;
+    std::vector<std::shared_ptr<BroadcastPartition>>  mPartitions;
+    
+    // retained messages, orders the snapshots against the deliveries
+    itc::sys::mutex                                   mRetainMutex;
+    std::deque<MSGBufferTypeSPtr>                     mRecent;
+    tsl::robin_map<uint64_t,MSGBufferTypeSPtr>        mKeyed;
+    
+    static const size_t workers()
+    {
+      return LAppSConfig::getInstance()->getWSConfig()["workers"]["workers"];
+    }
+    
+    const std::shared_ptr<BroadcastPartition>& partition(const ::abstract::Worker* owner) const
+    {
+      if(owner->getID() < mPartitions.size())
+        return mPartitions[owner->getID()];
+      throw std::runtime_error("Broadcast "+std::to_string(ChannelID)+": IOWorker "+std::to_string(owner->getID())+" is unknown");
+    }
+    
+    void post(::abstract::WebSocket* handler, const OutFrame::Kind kind, const std::shared_ptr<::abstract::FanOut>& target)
+    {
+      ::abstract::Worker* owner=handler->getOwner();
+      handler->pin();
+      try{
+        owner->post(OutFrame{handler,handler->getfd(),kind,nullptr,0,target});
+      }catch(...)
+      {
+        handler->unpin();
+        throw;
       }
-      mUnsubscribers.clear();
     }
     
    public:
     
-    explicit Broadcast(const size_t chid) : sMutex(), uMutex(), ChannelID(chid)
+    explicit Broadcast(const size_t chid, const BroadcastOptions& options=BroadcastOptions())
+    : ChannelID(chid), mOptions(options), mPartitions(), mRetainMutex(), mRecent(), mKeyed()
     {
+      const size_t count=workers();
+      mPartitions.reserve(count);
+      for(size_t i=0;i<count;++i)
+        mPartitions.push_back(std::make_shared<BroadcastPartition>(mOptions));
     }
     
     Broadcast()=delete;
@@ -103,29 +453,129 @@ namespace LAppS
       return ChannelID;
     }
     
+    const BroadcastOptions& getOptions() const
+    {
+      return mOptions;
+    }
+    
+    /**
+     * @brief true if there are neither subscribers nor subscriptions on the
+     * way. Only meaningful if nobody subscribes concurrently.
+     **/
+    const bool idle() const
+    {
+      for(const auto& target : mPartitions)
+        if(target->active()) return false;
+      return true;
+    }
+    
+    /**
+     * @brief thread-safe, the membership is changed by the worker owning
+     * the handler.
+     **/
     void subscribe(::abstract::WebSocket* handler)
     {
-      ITCSyncLock sync(sMutex);
-      mSubscribers.push_front(handler->get_shared());
+      const auto& target=partition(handler->getOwner());
+      
+      if(!mOptions.retains())
+      {
+        target->expect(handler->getOwner());
+        try{
+          post(handler,OutFrame::SUBSCRIBE,target);
+        }catch(...)
+        {
+          target->cancel();
+          throw;
+        }
+        return;
+      }
+      
+      ITCSyncLock sync(mRetainMutex);
+      auto join=std::make_shared<SnapshotJoin>(target,snapshot());
+      target->expect(handler->getOwner());
+      try{
+        post(handler,OutFrame::SUBSCRIBE,join);
+      }catch(...)
+      {
+        target->cancel();
+        throw;
+      }
     }
+    
     void unsubscribe(::abstract::WebSocket* handler)
     {
-      ITCSyncLock sync(uMutex);
-      mUnsubscribers.push_front(handler->get_shared());
+      post(handler,OutFrame::UNSUBSCRIBE,partition(handler->getOwner()));
     }
     
-    void bcast(const MSGBufferTypeSPtr& msg)
+    /**
+     * @brief thread-safe, never blocks on subscribers.
+     * @param key - conflation and retention key, 0 for none.
+     **/
+    void bcast(const MSGBufferTypeSPtr& msg, const uint64_t key=0, const BroadcastDelivery how=BroadcastDelivery::SEND)
     {
-      ITCSyncLock sync(sMutex);
-      purge();
+      if(!mOptions.retains())
+      {
+        if(how != BroadcastDelivery::SNAPSHOT)
+          fanout(msg,key);
+        return;
+      }
       
-      for(auto handler : mSubscribers)
+      // the subscription snapshot is taken under the same lock, so a new
+      // subscriber gets this message either retained or live.
+      ITCSyncLock sync(mRetainMutex);
+      if(how != BroadcastDelivery::DELTA)
+        retain(msg,key);
+      if(how != BroadcastDelivery::SNAPSHOT)
+        fanout(msg,key);
+    }
+    
+    /**
+     * @brief drops all the retained messages.
+     **/
+    void forget()
+    {
+      ITCSyncLock sync(mRetainMutex);
+      mRecent.clear();
+      mKeyed.clear();
+    }
+    
+   private:
+    void retain(const MSGBufferTypeSPtr& msg, const uint64_t key)
+    {
+      if(mOptions.retain_keys && (key != 0))
+      {
+        mKeyed[key]=msg;
+      }
+      else if(mOptions.retain > 0)
+      {
+        mRecent.push_back(msg);
+        if(mRecent.size() > mOptions.retain)
+          mRecent.pop_front();
+      }
+    }
+    
+    BroadcastSnapshot snapshot() const
+    {
+      BroadcastSnapshot frames;
+      frames.reserve(mKeyed.size()+mRecent.size());
+      for(const auto& entry : mKeyed)
+        frames.emplace_back(entry.first,entry.second);
+      for(const auto& msg : mRecent)
+        frames.emplace_back(0,msg);
+      return frames;
+    }
+    
+    void fanout(const MSGBufferTypeSPtr& msg, const uint64_t key)
+    {
+      for(const auto& target : mPartitions)
       {
-        handler->send(*msg);
+        if(target->active())
+        {
+          target->getOwner()->post(OutFrame{nullptr,-1,OutFrame::FANOUT,msg,0,target,key});
+        }
       }
     }
   };
 }
 
 #endif /* __BROADCAST_H__ */
-
@@ -30,6 +30,7 @@
 #include <sys/synclock.h>
 
 #include <Broadcast.h>
+#include <TopicTree.h>
 #include <Singleton.h>
 
 namespace LAppS
@@ -48,13 +49,13 @@ namespace LAppS
    Broadcasts(const Broadcasts&)=delete;
    Broadcasts(Broadcasts&)=delete;
    
-   const bool create(const size_t bcastid)
+   const bool create(const size_t bcastid, const BroadcastOptions& options=BroadcastOptions())
    {
      ITCSyncLock sync(mMutex);
      auto it=mBroadcasts.find(bcastid);
      if(it==mBroadcasts.end())
      {
-       mBroadcasts.emplace(bcastid,std::move(std::make_shared<BCastValueType>(bcastid)));
+       mBroadcasts.emplace(bcastid,std::move(std::make_shared<BCastValueType>(bcastid,options)));
        return true;
      }
      return false;
@@ -87,6 +88,7 @@ namespace LAppS
   #endif
 #endif
   typedef itc::Singleton<BCastType> BroadcastRegistry;
+  typedef itc::Singleton<TopicTree<BCastType::BCastValueType>> TopicRegistry;
 }
 
 #endif /* __BROADCASTS_H__ */
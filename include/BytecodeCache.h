@@ -0,0 +1,276 @@
+/**
+ *  Copyright 2017-2018, Pavel Kraynyukhov <pavel.kraynyukhov@gmail.com>
+ *
+ *  This file is a part of LAppS (Lua Application Server).
+ *
+ *  LAppS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  LAppS is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with LAppS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  $Id: BytecodeCache.h October 28, 2026 10:20 AM $
+ *
+ **/
+
+
+#ifndef __BYTECODECACHE_H__
+#  define __BYTECODECACHE_H__
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <string>
+#include <experimental/filesystem>
+
+#include <sys/stat.h>
+
+#include <sys/mutex.h>
+#include <sys/synclock.h>
+#include <Singleton.h>
+
+extern "C" {
+#include <lua.h>
+#include <lualib.h>
+#include <lauxlib.h>
+}
+
+namespace LAppS
+{
+  /**
+   * @brief LuaJIT bytecode of the Lua source files, shared by all the Lua
+   * states of the process.
+   *
+   * Modules are compiled once, by the Deployer when a LAR is deployed or
+   * by the first require() of the file, the other instances load the
+   * bytecode without parsing. An entry is valid while the size and the
+   * mtime of its file are the same.
+   **/
+  class BytecodeCache
+  {
+   private:
+    typedef std::shared_ptr<const std::string> CodeSPtr;
+
+    struct Entry
+    {
+      off_t     size;
+      timespec  mtime;
+      CodeSPtr  code;
+    };
+
+    mutable ::itc::sys::mutex     mMutex;
+    std::map<std::string,Entry>   mEntries;
+    std::atomic<size_t>           mHits;
+    std::atomic<size_t>           mMisses;
+
+    static int writer(lua_State* L, const void* p, size_t sz, void* ud)
+    {
+      static_cast<std::string*>(ud)->append(static_cast<const char*>(p),sz);
+      return 0;
+    }
+
+    static const bool same(const Entry& entry, const struct stat& st)
+    {
+      return (entry.size == st.st_size)&&
+             (entry.mtime.tv_sec == st.st_mtim.tv_sec)&&
+             (entry.mtime.tv_nsec == st.st_mtim.tv_nsec);
+    }
+
+    /**
+     * @brief dumps the function on top of the stack into the cache.
+     **/
+    void store(lua_State* L, const std::string& path, const struct stat& st)
+    {
+      auto code=std::make_shared<std::string>();
+      lua_dump(L,writer,code.get());
+
+      ITCSyncLock sync(mMutex);
+      mEntries[path]=Entry{st.st_size,st.st_mtim,std::move(code)};
+    }
+
+    const CodeSPtr find(const std::string& path, const struct stat& st) const
+    {
+      ITCSyncLock sync(mMutex);
+      auto it=mEntries.find(path);
+      if((it != mEntries.end())&&same(it->second,st))
+        return it->second.code;
+      return nullptr;
+    }
+
+   public:
+    explicit BytecodeCache() : mMutex(), mEntries(), mHits{0}, mMisses{0}
+    {
+    }
+
+    BytecodeCache(const BytecodeCache&)=delete;
+    BytecodeCache(BytecodeCache&)=delete;
+
+    /**
+     * @brief pushes the chunk of the file onto L, from the cache if it is
+     * there, otherwise the file is compiled and cached.
+     * @return luaL_loadfile() status, the error message is pushed on error.
+     **/
+    const int load(lua_State* L, const std::string& path)
+    {
+      struct stat st;
+      if(stat(path.c_str(),&st) != 0)
+      {
+        lua_pushfstring(L,"cannot stat %s",path.c_str());
+        return LUA_ERRFILE;
+      }
+
+      if(auto code=find(path,st))
+      {
+        mHits.fetch_add(1,std::memory_order_relaxed);
+        return luaL_loadbuffer(L,code->data(),code->size(),("@"+path).c_str());
+      }
+
+      mMisses.fetch_add(1,std::memory_order_relaxed);
+      const int ret=luaL_loadfile(L,path.c_str());
+      if(ret == 0)
+        store(L,path,st);
+      return ret;
+    }
+
+    /**
+     * @brief compiles all the .lua files under dir into the cache.
+     * @return amount of the files which have failed to compile.
+     **/
+    const size_t precompile(const std::experimental::filesystem::path& dir)
+    {
+      namespace fs=std::experimental::filesystem;
+
+      size_t failed=0;
+      lua_State* L=luaL_newstate();
+      if(!L)
+        return 0;
+
+      for(auto& entry : fs::recursive_directory_iterator(dir))
+      {
+        if((!fs::is_regular_file(entry.path()))||(entry.path().extension() != ".lua"))
+          continue;
+
+        const std::string path(entry.path().u8string().c_str());
+        struct stat st;
+        if(stat(path.c_str(),&st) != 0)
+          continue;
+
+        if(luaL_loadfile(L,path.c_str()) == 0)
+        {
+          store(L,path,st);
+        }
+        else
+        {
+          ITC_ERROR(__FILE__,__LINE__,"Can't compile {}: {}",path.c_str(),lua_tostring(L,-1));
+          ++failed;
+        }
+        lua_settop(L,0);
+      }
+      lua_close(L);
+      return failed;
+    }
+
+    const size_t hits() const
+    {
+      return mHits.load(std::memory_order_relaxed);
+    }
+
+    const size_t misses() const
+    {
+      return mMisses.load(std::memory_order_relaxed);
+    }
+  };
+
+  typedef ::itc::Singleton<BytecodeCache> SBytecodeCache;
+}
+
+/**
+ * @brief the file of the module on package.path, like the Lua searcher.
+ **/
+static const bool bytecode_find_module(const char* name, const char* path, std::string& filename)
+{
+  std::string module(name);
+  for(auto& c : module)
+    if(c == '.') c='/';
+
+  std::string templates(path);
+  size_t start=0;
+  while(start <= templates.size())
+  {
+    size_t end=templates.find(';',start);
+    if(end == std::string::npos) end=templates.size();
+
+    filename.assign(templates,start,end-start);
+    start=end+1;
+    if(filename.empty())
+      continue;
+
+    for(size_t pos=filename.find('?');pos!=std::string::npos;pos=filename.find('?',pos+module.size()))
+      filename.replace(pos,1,module);
+
+    struct stat st;
+    if((stat(filename.c_str(),&st) == 0)&&S_ISREG(st.st_mode))
+      return true;
+  }
+  return false;
+}
+
+extern "C"
+{
+  /**
+   * package.loaders entry in front of the Lua file searcher, it finds the
+   * module the same way and loads it through the bytecode cache.
+   **/
+  LUA_API int bytecode_searcher(lua_State* L)
+  {
+    const char* name=luaL_checkstring(L,1);
+    lua_getfield(L,LUA_GLOBALSINDEX,"package");
+    lua_getfield(L,-1,"path");
+    const char* path=lua_tostring(L,-1);
+    if(!path)
+      return 0;
+
+    int ret=0;
+    {
+      std::string filename;
+      if(!bytecode_find_module(name,path,filename))
+        return 0;
+
+      ret=LAppS::SBytecodeCache::getInstance()->load(L,filename);
+      if(ret != 0)
+        lua_pushfstring(L,"error loading module '%s' from file '%s':\n\t%s",name,filename.c_str(),lua_tostring(L,-1));
+    }
+    if(ret != 0)
+      return lua_error(L);
+    return 1;
+  }
+}
+
+/**
+ * @brief makes require() use the bytecode cache for the Lua modules.
+ **/
+static void install_bytecode_searcher(lua_State* L)
+{
+  lua_getfield(L,LUA_GLOBALSINDEX,"package");
+  lua_getfield(L,-1,"loaders");
+  if(lua_istable(L,-1))
+  {
+    for(int i=static_cast<int>(lua_objlen(L,-1));i>=2;--i)
+    {
+      lua_rawgeti(L,-1,i);
+      lua_rawseti(L,-2,i+1);
+    }
+    lua_pushcfunction(L,bytecode_searcher);
+    lua_rawseti(L,-2,2);
+  }
+  lua_pop(L,2);
+}
+
+#endif /* __BYTECODECACHE_H__ */
@@ -0,0 +1,247 @@
+/**
+ *  Copyright 2017-2018, Pavel Kraynyukhov <pavel.kraynyukhov@gmail.com>
+ *
+ *  This file is a part of LAppS (Lua Application Server).
+ *
+ *  LAppS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  LAppS is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with LAppS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  $Id: CoScheduler.h October 26, 2026 10:40 AM $
+ *
+ **/
+
+
+#ifndef __COSCHEDULER_H__
+#  define __COSCHEDULER_H__
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <vector>
+
+extern "C" {
+#include <lua.h>
+}
+
+#include <Parker.h>
+#include <abstract/Awaitable.h>
+
+namespace LAppS
+{
+  /**
+   * @brief coroutines of one Lua service instance, suspended on awaitables.
+   *
+   * The instance starts a coroutine with resume(). A native function
+   * running in it calls await(), which yields the coroutine with the
+   * awaitable. run() is called from the instance loop and resumes the
+   * coroutines whose awaitables are ready or expired, in the order they
+   * were suspended. A coroutine yielded without an awaitable is resumed
+   * on the next run(). Everything but the Parker and suspended() is
+   * instance thread only.
+   **/
+  class CoScheduler
+  {
+   public:
+    typedef abstract::Awaitable::Clock Clock;
+
+    // period of poll() for the polling awaitables
+    static constexpr long POLL_MS=1;
+
+   private:
+    struct Task
+    {
+      lua_State*                            thread;
+      std::unique_ptr<abstract::Awaitable>  awaitable;
+      int                                   nargs;
+    };
+
+    lua_State*                            mLState;
+    std::shared_ptr<Parker>               mParker;
+    std::vector<Task>                     mTasks;
+    std::vector<Task>                     mReady;
+    lua_State*                            mCurrent;
+    std::unique_ptr<abstract::Awaitable>  mAwaitable;
+    // mTasks.size() for the stats readers
+    std::atomic<size_t>                   mSuspended;
+
+   public:
+    explicit CoScheduler(lua_State* L)
+    : mLState(L), mParker(), mTasks(), mReady(), mCurrent(nullptr), mAwaitable(), mSuspended{0}
+    {
+      lua_pushlightuserdata(mLState,this);
+      lua_setfield(mLState,LUA_REGISTRYINDEX,"lapps_coscheduler");
+    }
+
+    CoScheduler()=delete;
+    CoScheduler(const CoScheduler&)=delete;
+    CoScheduler(CoScheduler&)=delete;
+
+    ~CoScheduler()
+    {
+      lua_pushnil(mLState);
+      lua_setfield(mLState,LUA_REGISTRYINDEX,"lapps_coscheduler");
+    }
+
+    /**
+     * @brief the scheduler of the instance owning L, nullptr if the
+     * instance does not run coroutines.
+     **/
+    static CoScheduler* get(lua_State* L)
+    {
+      lua_getfield(L,LUA_REGISTRYINDEX,"lapps_coscheduler");
+      auto scheduler=static_cast<CoScheduler*>(lua_touserdata(L,-1));
+      lua_pop(L,1);
+      return scheduler;
+    }
+
+    /**
+     * @brief the awaitables which complete in other threads unpark the
+     * instance with it.
+     **/
+    void setParker(const std::shared_ptr<Parker>& parker)
+    {
+      mParker=parker;
+    }
+
+    const std::shared_ptr<Parker>& parker() const
+    {
+      return mParker;
+    }
+
+    /**
+     * @brief true if L is the coroutine being run by this scheduler, only
+     * then await() may be used.
+     **/
+    const bool running(lua_State* L) const
+    {
+      return (mCurrent != nullptr)&&(L == mCurrent);
+    }
+
+    /**
+     * @brief yields the running coroutine until the awaitable is over,
+     * returns to lua_yield() of the calling C function. nullptr resumes
+     * it on the next run().
+     **/
+    const int await(lua_State* L, std::unique_ptr<abstract::Awaitable>&& awaitable)
+    {
+      mAwaitable=std::move(awaitable);
+      return lua_yield(L,0);
+    }
+
+    /**
+     * @brief resumes the thread with nargs values on its stack, the
+     * thread is kept for run() if it yields.
+     * @return lua_resume() status.
+     **/
+    const int resume(lua_State* thread, const int nargs)
+    {
+      mAwaitable.reset();
+      mCurrent=thread;
+      const int ret=lua_resume(thread,nargs);
+      mCurrent=nullptr;
+
+      if(ret == LUA_YIELD)
+      {
+        // values of a plain coroutine.yield() are not used
+        lua_settop(thread,0);
+        mTasks.push_back(Task{thread,std::move(mAwaitable),0});
+        mSuspended.store(mTasks.size(),std::memory_order_relaxed);
+      }
+      return ret;
+    }
+
+    /**
+     * @brief resumes the coroutines which can go on and calls
+     * resumed(thread,status) for each of them.
+     * @return amount of coroutines resumed.
+     **/
+    template <typename F> const size_t run(F&& resumed)
+    {
+      if(mTasks.empty())
+        return 0;
+
+      const auto now=Clock::now();
+      mReady.clear();
+
+      auto it=std::remove_if(
+        mTasks.begin(),mTasks.end(),
+        [this,&now](Task& task)
+        {
+          if(task.awaitable)
+          {
+            task.nargs=task.awaitable->poll(mLState,task.thread);
+            if((task.nargs < 0)&&(task.awaitable->deadline() <= now))
+              task.nargs=task.awaitable->expire(task.thread);
+            if(task.nargs < 0)
+              return false;
+          }
+          mReady.push_back(Task{task.thread,nullptr,task.nargs});
+          return true;
+        }
+      );
+      mTasks.erase(it,mTasks.end());
+      mSuspended.store(mTasks.size(),std::memory_order_relaxed);
+
+      for(auto& task : mReady)
+        resumed(task.thread,resume(task.thread,task.nargs));
+
+      const size_t count=mReady.size();
+      mReady.clear();
+      return count;
+    }
+
+    /**
+     * @brief how long the instance may sleep without delaying any of the
+     * coroutines, max_ms at most. 0 if there is a coroutine to resume.
+     **/
+    const long timeout(const long max_ms) const
+    {
+      long result=max_ms;
+      if(mTasks.empty())
+        return result;
+
+      const auto now=Clock::now();
+      for(const auto& task : mTasks)
+      {
+        if((!task.awaitable)||task.awaitable->ready())
+          return 0;
+        if(task.awaitable->polling())
+          result=std::min(result,POLL_MS);
+        if(task.awaitable->deadline() != Clock::time_point::max())
+        {
+          const long left=std::chrono::duration_cast<std::chrono::milliseconds>(task.awaitable->deadline()-now).count()+1;
+          result=std::min(result,std::max(left,0L));
+        }
+      }
+      return result;
+    }
+
+    /**
+     * @brief amount of suspended coroutines.
+     **/
+    const size_t size() const
+    {
+      return mTasks.size();
+    }
+
+    /**
+     * @brief size() for the other threads.
+     **/
+    const size_t suspended() const
+    {
+      return mSuspended.load(std::memory_order_relaxed);
+    }
+  };
+}
+
+#endif /* __COSCHEDULER_H__ */
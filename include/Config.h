@@ -57,7 +57,9 @@ namespace LAppS
         {"max_poll_events",300},
         {"max_poll_wait_ms",10},
         {"max_inbounds_skip",50},
-        {"input_buffer_size", 2048}
+        {"input_buffer_size", 2048},
+        {"service_ring_size", 1024},
+        {"max_pending_bytes", 33554432}
       }},
       {"acl", {{"policy", "allow"},{"exclude", {} }}},
 #ifdef LAPPS_TLS_ENABLE
@@ -134,6 +136,23 @@ namespace LAppS
      return lapps_config;
    }
    
+   /**
+    * @brief the section of the service in lapps.json, an empty object if
+    * there is none. Const lookups only: the service instances are built in
+    * parallel, and the non-const json::operator[] inserts missing keys.
+    **/
+   const json& getServiceConfig(const std::string& name) const
+   {
+     static const json empty=json::object();
+     auto services=lapps_config.find("services");
+     if((services == lapps_config.end())||(!services.value().is_object()))
+       return empty;
+     auto service=services.value().find(name);
+     if(service == services.value().end())
+       return empty;
+     return service.value();
+   }
+   
    void save()
    {
      std::ofstream lapps_config_file(mEnv["LAPPS_CONF_DIR"]+"/"+mEnv["LAPPS_CONFIG"], std::ios::trunc);
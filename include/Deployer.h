@@ -26,6 +26,9 @@
 #define __DEPLOYER_H__
 #include <memory>
 #include <mutex>
+#include <future>
+#include <chrono>
+#include <exception>
 #include <sys/synclock.h>
 #include <tsbqueue.h>
 #include <sys/inotify.h>
@@ -42,6 +45,8 @@
  **/
 #include <ServiceFactory.h>
 #include <ServiceRegistry.h>
+#include <ServiceAutoscaler.h>
+#include <BytecodeCache.h>
 #include <LAR.h>
 #include <ext/json.hpp>
 
@@ -58,6 +63,7 @@ namespace LAppS
     int                         mInotifyFD;
     environment::LAppSEnv       mEnv;
     fs::path                    mDeployDir;
+    itc::sys::CancelableThread<ServiceAutoscaler> mAutoscaler;
         
     void deploy_all()
     {
@@ -265,6 +271,11 @@ namespace LAppS
           
           fs::rename(dir, service_path);
         }
+        
+        // the instances load the modules from the bytecode cache
+        const size_t failed=SBytecodeCache::getInstance()->precompile(service_path);
+        if(failed > 0)
+          ITC_ERROR(__FILE__,__LINE__,"Service {}: {} Lua file(s) are not compiled",service_name.c_str(),failed);
       }
       catch(const std::exception& e){
         ITC_ERROR(
@@ -282,10 +293,48 @@ namespace LAppS
         LAppSConfig::getInstance()->save();
       }
     }
+    /**
+     * @brief constructs the instances in parallel, each one loads its Lua
+     * state in its own thread, and registers them in order. The instances
+     * which have failed are not registered, the first error is rethrown.
+     **/
+    template <typename F> void start_instances(const std::string& service_name, const size_t instances, F&& spawn)
+    {
+      const auto started=std::chrono::steady_clock::now();
+      
+      std::vector<std::future<ServiceInstanceStoreType>> starting;
+      starting.reserve(instances);
+      for(size_t i=0;i<instances;++i)
+        starting.push_back(std::async(std::launch::async,spawn));
+      
+      std::exception_ptr error;
+      size_t ready=0;
+      for(auto& instance : starting)
+      {
+        try{
+          SServiceRegistry::getInstance()->reg(instance.get());
+          ++ready;
+        }catch(...)
+        {
+          if(!error)
+            error=std::current_exception();
+        }
+      }
+      
+      ITC_INFO(
+        __FILE__,__LINE__,"Service {}: {} of {} instance(s) are ready in {} ms",service_name.c_str(),ready,instances,
+        std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now()-started).count()
+      );
+      
+      if(error)
+        std::rethrow_exception(error);
+    }
+    
   public:
     void stop_service(const std::string& service_name)
     {
       try{
+        mAutoscaler.getRunnable()->unmanage(service_name);
         SServiceRegistry::getInstance()->unreg(service_name);
       }
       catch(const std::exception& e)
@@ -344,10 +393,13 @@ namespace LAppS
           ITC_INFO(__FILE__,__LINE__,"Starting service {} with {} instance(s)",service_name.c_str(),instances);    
           if(standalone)
           {  
-            for(size_t i=0;i<instances;++i)
-            {
-              SServiceRegistry::getInstance()->reg(ServiceFactory::get(ServiceLanguage::LUA,service_name));
-            }
+            start_instances(
+              service_name,instances,
+              [service_name]()
+              {
+                return ServiceFactory::get(ServiceLanguage::LUA,service_name);
+              }
+            );
           }
           else
           {
@@ -392,18 +444,20 @@ namespace LAppS
             }
             
             
-            for(size_t i=0;i<instances;++i)
+            auto spawn=[proto,service_name,target,max_in_msg_size,default_policy,exclude_list]()
             {
-              SServiceRegistry::getInstance()->reg(
-                ServiceFactory::get(
-                  proto,
-                  ServiceLanguage::LUA,
-                  service_name,
-                  target,max_in_msg_size,
-                  default_policy,exclude_list
-                )
+              return ServiceFactory::get(
+                proto,
+                ServiceLanguage::LUA,
+                service_name,
+                target,max_in_msg_size,
+                default_policy,exclude_list
               );
-            }
+            };
+            
+            start_instances(service_name,instances,spawn);
+            
+            mAutoscaler.getRunnable()->manage(service_name,spawn);
           }
         }
         catch(const std::exception& e)
@@ -427,7 +481,8 @@ namespace LAppS
     
     explicit Deployer()
     : mMayRun{true},mMutex(),
-      mInotifyFD(inotify_init()),mEnv()
+      mInotifyFD(inotify_init()),mEnv(),
+      mAutoscaler{std::make_shared<ServiceAutoscaler>()}
     {
       const std::string deploy_dir=LAppSConfig::getInstance()->getLAppSConfig()["directories"]["deploy"];
       mDeployDir=fs::path(static_cast<const std::string>(mEnv["LAPPS_HOME"])) / deploy_dir;
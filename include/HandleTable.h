@@ -0,0 +1,283 @@
+/**
+ *  Copyright 2017-2018, Pavel Kraynyukhov <pavel.kraynyukhov@gmail.com>
+ *
+ *  This file is a part of LAppS (Lua Application Server).
+ *
+ *  LAppS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  LAppS is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with LAppS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  $Id: HandleTable.h October 25, 2026 3:20 PM $
+ *
+ **/
+
+
+#ifndef __HANDLETABLE_H__
+#  define __HANDLETABLE_H__
+
+#include <atomic>
+#include <cstdint>
+#include <system_error>
+
+namespace abstract
+{
+  class WebSocket;
+}
+
+namespace LAppS
+{
+  /**
+   * @brief generation-tagged handles of the objects owned by IOWorkers.
+   *
+   * A handle is generation(21) | shard(8) | slot(24). Handles are below
+   * 2^53, so they stay exact as Lua numbers, and never 0.
+   *
+   * Each shard belongs to one thread (an IOWorker), only the owner creates
+   * and releases its handles. Any thread resolves a handle with a Guard in
+   * O(1): a released handle fails the generation check and its object is
+   * not touched. The owner must not destroy a released object while
+   * guarded() is true for its handle.
+   **/
+  template <typename T> class HandleTable
+  {
+   public:
+    static const unsigned SLOT_BITS=24;
+    static const unsigned SHARD_BITS=8;
+    static const unsigned GENERATION_BITS=21;
+    static const size_t   SHARDS=size_t(1)<<SHARD_BITS;
+    static const uint64_t INVALID=0;
+
+   private:
+    static const unsigned HANDLE_BITS=SLOT_BITS+SHARD_BITS+GENERATION_BITS;
+    static const uint32_t SLOT_MASK=(uint32_t(1)<<SLOT_BITS)-1;
+    static const uint32_t GENERATION_MASK=(uint32_t(1)<<GENERATION_BITS)-1;
+    static const unsigned CHUNK_BITS=12;
+    static const size_t   CHUNK_SIZE=size_t(1)<<CHUNK_BITS;
+    static const size_t   CHUNKS=size_t(1)<<(SLOT_BITS-CHUNK_BITS);
+    static const uint32_t NONE=SLOT_MASK;
+
+    struct Slot
+    {
+      std::atomic<uint32_t> generation{1};
+      std::atomic<uint32_t> guards{0};
+      std::atomic<T*>       object{nullptr};
+      uint32_t              next=NONE;
+    };
+
+    struct Shard
+    {
+      std::atomic<Slot*>  chunks[CHUNKS];
+      // owner thread only
+      uint32_t            size;
+      uint32_t            free;
+
+      Shard() : size{0}, free{NONE}
+      {
+        for(auto& chunk : chunks)
+          chunk.store(nullptr,std::memory_order_relaxed);
+      }
+
+      ~Shard()
+      {
+        for(auto& chunk : chunks)
+          delete[] chunk.load(std::memory_order_relaxed);
+      }
+    };
+
+    std::atomic<Shard*> mShards[SHARDS];
+
+    static const uint32_t generation(const uint64_t handle)
+    {
+      return static_cast<uint32_t>(handle>>(SLOT_BITS+SHARD_BITS)) & GENERATION_MASK;
+    }
+
+    Slot* find(const uint64_t handle) const
+    {
+      if((handle>>HANDLE_BITS) != 0)
+        return nullptr;
+
+      Shard* shard=mShards[(handle>>SLOT_BITS)&(SHARDS-1)].load(std::memory_order_acquire);
+      if(!shard)
+        return nullptr;
+
+      const uint32_t idx=static_cast<uint32_t>(handle) & SLOT_MASK;
+      Slot* chunk=shard->chunks[idx>>CHUNK_BITS].load(std::memory_order_acquire);
+      if(!chunk)
+        return nullptr;
+
+      return &chunk[idx&(CHUNK_SIZE-1)];
+    }
+
+   public:
+    /**
+     * @brief any thread: keeps the object of a live handle from being
+     * destroyed while the guard exists.
+     **/
+    class Guard
+    {
+     private:
+      Slot* mSlot;
+      T*    mObject;
+
+     public:
+      Guard(const HandleTable& table, const uint64_t handle)
+      : mSlot(table.find(handle)), mObject(nullptr)
+      {
+        if(!mSlot) return;
+
+        // pairs with release(): either the owner sees the guard or the
+        // guard sees the new generation. The generation is checked again
+        // after the object is loaded: the slot may have been released and
+        // reused by create() in between, create() stores the new object
+        // after release() has bumped the generation.
+        mSlot->guards.fetch_add(1,std::memory_order_seq_cst);
+        if(mSlot->generation.load(std::memory_order_seq_cst) == generation(handle))
+        {
+          T* object=mSlot->object.load(std::memory_order_acquire);
+          if(mSlot->generation.load(std::memory_order_seq_cst) == generation(handle))
+          {
+            mObject=object;
+            return;
+          }
+        }
+        mSlot->guards.fetch_sub(1,std::memory_order_release);
+        mSlot=nullptr;
+      }
+
+      Guard()=delete;
+      Guard(const Guard&)=delete;
+      Guard(Guard&)=delete;
+
+      ~Guard()
+      {
+        if(mSlot)
+          mSlot->guards.fetch_sub(1,std::memory_order_release);
+      }
+
+      explicit operator bool() const
+      {
+        return mObject != nullptr;
+      }
+
+      T* get() const
+      {
+        return mObject;
+      }
+
+      T* operator->() const
+      {
+        return mObject;
+      }
+    };
+
+    HandleTable()
+    {
+      for(auto& shard : mShards)
+        shard.store(nullptr,std::memory_order_relaxed);
+    }
+
+    HandleTable(const HandleTable&)=delete;
+    HandleTable(HandleTable&)=delete;
+
+    ~HandleTable()
+    {
+      for(auto& shard : mShards)
+        delete shard.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief owner thread of the shard: a new handle of the object.
+     **/
+    const uint64_t create(const size_t shard_id, T* object)
+    {
+      if(shard_id >= SHARDS)
+        throw std::system_error(EINVAL,std::system_category(),"HandleTable::create(): shard id is out of range");
+
+      Shard* shard=mShards[shard_id].load(std::memory_order_relaxed);
+      if(!shard)
+      {
+        shard=new Shard();
+        mShards[shard_id].store(shard,std::memory_order_release);
+      }
+
+      uint32_t idx=shard->free;
+      Slot* slot=nullptr;
+
+      if(idx != NONE)
+      {
+        slot=&(shard->chunks[idx>>CHUNK_BITS].load(std::memory_order_relaxed)[idx&(CHUNK_SIZE-1)]);
+        shard->free=slot->next;
+      }
+      else
+      {
+        idx=shard->size;
+        if(idx == NONE)
+          throw std::system_error(ENOSPC,std::system_category(),"HandleTable::create(): the shard is full");
+
+        auto& chunk=shard->chunks[idx>>CHUNK_BITS];
+        if(!chunk.load(std::memory_order_relaxed))
+          chunk.store(new Slot[CHUNK_SIZE],std::memory_order_release);
+
+        slot=&(chunk.load(std::memory_order_relaxed)[idx&(CHUNK_SIZE-1)]);
+        ++shard->size;
+      }
+
+      slot->object.store(object,std::memory_order_release);
+
+      return (uint64_t(slot->generation.load(std::memory_order_relaxed))<<(SLOT_BITS+SHARD_BITS))|
+             (uint64_t(shard_id)<<SLOT_BITS)|idx;
+    }
+
+    /**
+     * @brief owner thread of the shard: invalidates the handle, new guards
+     * of it fail from now on. The slot is reused by the next create().
+     **/
+    void release(const uint64_t handle)
+    {
+      Slot* slot=find(handle);
+      if((!slot)||(slot->generation.load(std::memory_order_relaxed) != generation(handle)))
+        return;
+
+      uint32_t next=(generation(handle)+1) & GENERATION_MASK;
+      if(next == 0) next=1;
+      slot->generation.store(next,std::memory_order_seq_cst);
+
+      Shard* shard=mShards[(handle>>SLOT_BITS)&(SHARDS-1)].load(std::memory_order_relaxed);
+      slot->next=shard->free;
+      shard->free=static_cast<uint32_t>(handle) & SLOT_MASK;
+    }
+
+    /**
+     * @brief true if a guard may still reference the object of the slot.
+     * Conservative: guards of a reused slot count as well.
+     **/
+    const bool guarded(const uint64_t handle) const
+    {
+      Slot* slot=find(handle);
+      return slot && (slot->guards.load(std::memory_order_seq_cst) > 0);
+    }
+  };
+
+  typedef HandleTable<::abstract::WebSocket> WSHandleTable;
+
+  /**
+   * @brief handles of the server connections given to Lua. Shards are
+   * owned by the IOWorkers, by their IDs.
+   **/
+  inline WSHandleTable& wsHandles()
+  {
+    static WSHandleTable table;
+    return table;
+  }
+}
+
+#endif /* __HANDLETABLE_H__ */
@@ -24,6 +24,8 @@
 #ifndef __IOWORKER_H__
 #  define __IOWORKER_H__
 
+#include <algorithm>
+
 #include <ePoll.h>
 #include <abstract/IView.h>
 #include <WebSocket.h>
@@ -31,8 +33,12 @@
 #include <abstract/Worker.h>
 #include <sys/mutex.h>
 #include <time.h>
+#include <sys/eventfd.h>
 #include <ext/tsl/robin_map.h>
 #include <cfifo.h>
+#include <tsbqueue.h>
+#include <ServiceInbox.h>
+#include <HandleTable.h>
 
 #include <wolfSSLLib.h>
 
@@ -62,10 +68,20 @@ namespace LAppS
       
       qtype                                     mInQueue;
       tsl::robin_map<int,WSSPtr>                mConnections;
+      std::vector<WSSPtr>                       mGraveyard;
+      std::vector<int>                          mPaused;
       itc::cfifo<int32_t>                       mDCQueue;
       
       std::vector<epoll_event>                  mEvents;
       
+      // frames posted by the services, see post()
+      itc::sys::mutex                           mOutMutex;
+      std::vector<OutFrame>                     mOutbox;
+      std::vector<OutFrame>                     mOutLocal;
+      std::atomic<size_t>                       mOutSize;
+      std::atomic<bool>                         mPolling;
+      int                                       mWakeFD;
+      
       std::atomic<bool>                         haveConnections;
       std::atomic<bool>                         haveDisconnects;
       
@@ -91,11 +107,16 @@ namespace LAppS
     : Worker(id,maxConnections,auto_fragment), enableTLS(),  enableStatsUpdate(), 
       mMayRun{true}, mCanStop{false}, mMaxEPollWait{LAppSConfig::getInstance()->getWSConfig()["workers"]["max_poll_wait_ms"]},
       mStats(), mShakespeer(), mEPoll(std::make_shared<ePoll>()),
-      mInQueue(),mConnections(), mDCQueue(20), 
+      mInQueue(),mConnections(), mGraveyard(), mPaused(), mDCQueue(20), 
       mEvents{LAppSConfig::getInstance()->getWSConfig()["workers"]["max_poll_events"]},
+      mOutMutex(), mOutbox(), mOutLocal(), mOutSize{0}, mPolling{false},
+      mWakeFD(eventfd(0,EFD_NONBLOCK|EFD_CLOEXEC)),
       haveConnections{false},haveDisconnects{false},mTLSContext(wolfSSLServer::getInstance()->getContext()),
       mMaxInboundsSkip{LAppSConfig::getInstance()->getWSConfig()["workers"]["max_inbounds_skip"]}, mCounter{0}
     {
+      if(mWakeFD == -1)
+        throw std::system_error(errno,std::system_category(),"IOWorker::IOWorker(): can't create eventfd");
+      mEPoll->add_level_in(mWakeFD);
       mConnections.clear();
       LAppS::WStats::getInstance()->add_slot(getID());
     }
@@ -114,6 +135,27 @@ namespace LAppS
       mDCQueue.send(fd);
       haveDisconnects.store(true);
     }
+    
+    /**
+     * @brief thread-safe: queues a frame for the connection owned by this
+     * worker. The worker is woken up through the eventfd only if it is
+     * blocked in epoll_wait.
+     **/
+    void post(OutFrame&& frame) final
+    {
+      {
+        ITCSyncLock sync(mOutMutex);
+        mOutbox.push_back(std::move(frame));
+        mOutSize.store(mOutbox.size(),std::memory_order_release);
+      }
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if(mPolling.load(std::memory_order_relaxed)&&mPolling.exchange(false,std::memory_order_acq_rel))
+      {
+        const uint64_t one=1;
+        // EAGAIN: the counter is saturated, the worker is signalled anyway
+        if(::write(mWakeFD,&one,sizeof(one)) == -1) {}
+      }
+    }
         
     const bool  isTLSEnabled() const
     {
@@ -128,8 +170,27 @@ namespace LAppS
       sigaddset(&sigpipe_mask, SIGPIPE);
       sigset_t saved_mask;
       pthread_sigmask(SIG_BLOCK, &sigpipe_mask, &saved_mask);
+      
+      ServiceInbox::producer()=getID();
+      ::abstract::Worker::current()=this;
+      
       while(mMayRun)
       {
+        if(mOutSize.load(std::memory_order_acquire) > 0)
+        {
+          processOutbox();
+        }
+        
+        if(!mGraveyard.empty())
+        {
+          reapGraveyard();
+        }
+        
+        if(!mPaused.empty())
+        {
+          resumePaused();
+        }
+        
         if(haveDisconnects)
         {
           while(!mDCQueue.empty())
@@ -145,18 +206,27 @@ namespace LAppS
         if(haveConnections.load())
         {
           try{
-            int ret=mEPoll->poll(mEvents,mMaxEPollWait);
+            mPolling.store(true,std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            const int timeout=(mOutSize.load(std::memory_order_relaxed) > 0) ? 0 : mMaxEPollWait;
+            int ret=mEPoll->poll(mEvents,timeout);
+            mPolling.store(false,std::memory_order_relaxed);
             if(ret > 0)
             {  
               for(auto i=0;i<ret;++i)
               {
-                if(error_bit(mEvents[i].events))
+                if(mEvents[i].data.fd == mWakeFD)
+                {
+                  uint64_t value;
+                  if(::read(mWakeFD,&value,sizeof(value)) == -1) {}
+                }
+                else if(error_bit(mEvents[i].events))
                 {
                   deleteConnection(mEvents[i].data.fd);
                 }
                 else 
                 {
-                  processIO(mEvents[i].data.fd);
+                  processIO(mEvents[i].data.fd,mEvents[i].events);
                   mStats.mInMessageCount++;
                 }
               }
@@ -185,7 +255,18 @@ namespace LAppS
       {
         expected=true;
       }
+      {
+        ITCSyncLock sync(mOutMutex);
+        for(auto& frame : mOutbox)
+          if(frame.websocket) frame.websocket->unpin();
+        mOutbox.clear();
+        mOutSize.store(0);
+      }
+      for(auto& connection : mConnections)
+        wsHandles().release(connection.second->handle());
       mConnections.clear();
+      mGraveyard.clear();
+      mPaused.clear();
     }
     void onCancel()
     {
@@ -194,6 +275,7 @@ namespace LAppS
     ~IOWorker()
     {
       if(!mCanStop) this->shutdown();
+      ::close(mWakeFD);
     }
 
     void addNewConnection(const std::shared_ptr<WSType>& current)
@@ -207,6 +289,7 @@ namespace LAppS
           "New inbound connection from {} with fd {} will be added to connection pool of worker {} ",
           current->getPeerAddress().c_str(),fd,ID
         );
+        current->setHandle(wsHandles().create(ID,current.get()));
         mConnections.emplace(fd,std::move(current));
         mEPoll->mod_in(fd);    
       }
@@ -258,7 +341,62 @@ namespace LAppS
         }
       }
       
-      void processIO(const int fd)
+      /**
+       * @brief hands the posted frames over to their sockets and runs the
+       * broadcast fan-outs. Frames of the sockets which are disconnected
+       * already are dropped.
+       **/
+      void processOutbox()
+      {
+        {
+          ITCSyncLock sync(mOutMutex);
+          mOutLocal.swap(mOutbox);
+          mOutSize.store(0,std::memory_order_release);
+        }
+        for(auto& frame : mOutLocal)
+        {
+          if(frame.kind == OutFrame::FANOUT)
+          {
+            try{
+              frame.fanout->deliver(frame.buffer,frame.key);
+            }catch(const std::exception& e)
+            {
+              ITC_ERROR(__FILE__,__LINE__,"Broadcast fan-out failed, exception: {}",e.what());
+            }
+            continue;
+          }
+          
+          ::abstract::WebSocket* target=frame.websocket;
+          auto it=mConnections.find(frame.fd);
+          const bool found=(it!=mConnections.end())&&(static_cast<::abstract::WebSocket*>(it->second.get()) == target);
+          
+          switch(frame.kind)
+          {
+            case OutFrame::SUBSCRIBE:
+              frame.fanout->subscribe(found ? it->second.get() : nullptr);
+              break;
+            case OutFrame::UNSUBSCRIBE:
+              frame.fanout->unsubscribe(target);
+              break;
+            default:
+              if(found)
+              {
+                try{
+                  it->second->queueOut(std::move(frame));
+                }catch(const std::exception& e)
+                {
+                  ITC_ERROR(__FILE__,__LINE__,"Can't send to {}, exception: {}",it->second->getPeerAddress().c_str(),e.what());
+                  it->second->closeNow();
+                }
+              }
+              break;
+          }
+          target->unpin();
+        }
+        mOutLocal.clear();
+      }
+      
+      void processIO(const int fd, const uint32_t events)
       {
         auto it=mConnections.find(fd);
         if(it!=mConnections.end())
@@ -268,12 +406,27 @@ namespace LAppS
           {
             case WSType::MESSAGING:
               try {
+                if((events & EPOLLOUT)&&(current->flushOut() == -1))
+                {
+                  deleteConnection(fd);
+                  break;
+                }
+                if(!(events & EPOLLIN))
+                {
+                  current->rearm();
+                  break;
+                }
                 int ret=current->handleInput();
                 if(ret == -1)
                 {
                   ITC_INFO(__FILE__,__LINE__,"Disconnected: {}",current->getPeerAddress().c_str());
                   deleteConnection(fd);
                 }
+                else if(current->isInputPaused())
+                {
+                  mPaused.push_back(fd);
+                  mStats.mPausedConnections=mPaused.size();
+                }
               }
               catch(const std::exception& e)
               {
@@ -286,7 +439,7 @@ namespace LAppS
             break;
             case WSType::HANDSHAKE:
                 mShakespeer.handshake(current,*LAppS::SServiceRegistry::getInstance());
-                if(current->getState() !=WSType::MESSAGING)
+                if(current->getState() == WSType::CLOSED)
                 {
                   ITC_ERROR(__FILE__,__LINE__,"Handshake with the peer {} has been failed. Disconnecting.", current->getPeerAddress());
                   deleteConnection(fd);
@@ -312,6 +465,15 @@ namespace LAppS
         auto it=mConnections.find(fd);
         if(it!=mConnections.end())
         {
+          it->second->leaveAll();
+          // stale handles fail from now on, the ones being resolved keep
+          // the socket alive as the in-flight events do
+          wsHandles().release(it->second->handle());
+          if(it->second->isPinned()||wsHandles().guarded(it->second->handle()))
+          {
+            // services still have events of this socket in flight
+            mGraveyard.push_back(std::move(it->second));
+          }
           mConnections.erase(it);
         }
         mStats.mConnections=mConnections.size();
@@ -321,6 +483,44 @@ namespace LAppS
         }
       }
       
+      /**
+       * @brief re-arms EPOLLIN for the paused connections which services
+       * are below their low watermarks now. Deleted connections are
+       * dropped from the list.
+       **/
+      void resumePaused()
+      {
+        auto it=std::remove_if(
+          mPaused.begin(),mPaused.end(),
+          [this](const int fd){
+            auto cit=mConnections.find(fd);
+            if(cit == mConnections.end()) return true;
+            try{
+              return cit->second->tryResumeInput();
+            }catch(const std::exception& e)
+            {
+              ITC_ERROR(__FILE__,__LINE__,"Can't resume input on fd {}, exception: {}",fd,e.what());
+              return true;
+            }
+          }
+        );
+        mPaused.erase(it,mPaused.end());
+        mStats.mPausedConnections=mPaused.size();
+      }
+      
+      /**
+       * @brief releases the disconnected sockets which are not referenced
+       * by the in-flight service events anymore.
+       **/
+      void reapGraveyard()
+      {
+        auto it=std::remove_if(
+          mGraveyard.begin(),mGraveyard.end(),
+          [](const WSSPtr& ws){ return !(ws->isPinned()||wsHandles().guarded(ws->handle())); }
+        );
+        mGraveyard.erase(it,mGraveyard.end());
+      }
+      
       const std::shared_ptr<WSType> mkWebSocket(const CSocketSPtr& inbound)
       {
         return mkWebSocket(inbound, enableTLS);
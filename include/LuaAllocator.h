@@ -0,0 +1,184 @@
+/**
+ *  Copyright 2017-2018, Pavel Kraynyukhov <pavel.kraynyukhov@gmail.com>
+ *
+ *  This file is a part of LAppS (Lua Application Server).
+ *
+ *  LAppS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  LAppS is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with LAppS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  $Id: LuaAllocator.h October 27, 2026 2:10 PM $
+ *
+ **/
+
+
+#ifndef __LUAALLOCATOR_H__
+#  define __LUAALLOCATOR_H__
+
+#include <atomic>
+#include <cstdlib>
+
+#ifdef MIMALLOC
+#include <mimalloc.h>
+#endif
+
+#include <ext/json.hpp>
+
+using json = nlohmann::json;
+
+namespace LAppS
+{
+  /**
+   * @brief lua_Alloc of one Lua state with byte accounting and a hard cap.
+   *
+   * An allocation over the cap fails, the Lua code gets "not enough memory"
+   * (LUA_ERRMEM) and the state stays usable. The allocator itself may not
+   * call into the Lua state, so the owner collects: after every call above
+   * 7/8 of the cap (pressure()), and before it repeats a call failed by
+   * the cap (exhausted()).
+   *
+   * The counters are written by the thread of the state only, the other
+   * threads read them for the stats.
+   **/
+  class LuaAllocator
+  {
+   private:
+    const size_t          mLimit;
+    const size_t          mHighWatermark;
+    std::atomic<size_t>   mUsed;
+    std::atomic<size_t>   mPeak;
+    std::atomic<size_t>   mRefused;
+    size_t                mCollectedAt;
+    bool                  mExhausted;
+
+    static void release(void* ptr)
+    {
+#ifdef MIMALLOC
+      mi_free(ptr);
+#else
+      free(ptr);
+#endif
+    }
+
+    static void* resize(void* ptr, const size_t nsize)
+    {
+#ifdef MIMALLOC
+      return mi_realloc(ptr,nsize);
+#else
+      return realloc(ptr,nsize);
+#endif
+    }
+
+    void account(const size_t used)
+    {
+      mUsed.store(used,std::memory_order_relaxed);
+      if(used > mPeak.load(std::memory_order_relaxed))
+        mPeak.store(used,std::memory_order_relaxed);
+    }
+
+   public:
+    /**
+     * @param limit - bytes, 0 for no cap.
+     **/
+    explicit LuaAllocator(const size_t limit)
+    : mLimit{limit}, mHighWatermark{limit-limit/8}, mUsed{0}, mPeak{0}, mRefused{0},
+      mCollectedAt{0}, mExhausted{false}
+    {
+    }
+
+    LuaAllocator()=delete;
+    LuaAllocator(const LuaAllocator&)=delete;
+    LuaAllocator(LuaAllocator&)=delete;
+
+    static void* alloc(void* ud, void* ptr, size_t osize, size_t nsize)
+    {
+      auto self=static_cast<LuaAllocator*>(ud);
+      const size_t used=self->mUsed.load(std::memory_order_relaxed);
+      // osize of a new block is not its size in every Lua version
+      if(!ptr) osize=0;
+
+      if(nsize == 0)
+      {
+        if(ptr)
+        {
+          release(ptr);
+          self->account(used-osize);
+        }
+        return nullptr;
+      }
+
+      if((self->mLimit != 0)&&(nsize > osize)&&(used+nsize-osize > self->mLimit))
+      {
+        self->mRefused.store(self->mRefused.load(std::memory_order_relaxed)+1,std::memory_order_relaxed);
+        self->mExhausted=true;
+        return nullptr;
+      }
+
+      void* result=resize(ptr,nsize);
+      if(result)
+        self->account(used+nsize-osize);
+      return result;
+    }
+
+    /**
+     * @brief true once after an allocation was refused by the cap.
+     **/
+    const bool exhausted()
+    {
+      const bool result=mExhausted;
+      mExhausted=false;
+      return result;
+    }
+
+    /**
+     * @brief true if the state is close to the cap and has grown since the
+     * last full GC asked by this method.
+     **/
+    const bool pressure()
+    {
+      if(mLimit == 0)
+        return false;
+      const size_t used=mUsed.load(std::memory_order_relaxed);
+      if((used < mHighWatermark)||(used < mCollectedAt+mLimit/16))
+        return false;
+      mCollectedAt=used;
+      return true;
+    }
+
+    void collected()
+    {
+      mCollectedAt=mUsed.load(std::memory_order_relaxed);
+    }
+
+    const size_t used() const
+    {
+      return mUsed.load(std::memory_order_relaxed);
+    }
+
+    const size_t limit() const
+    {
+      return mLimit;
+    }
+
+    const json getStats() const
+    {
+      return json{
+        { "used", mUsed.load(std::memory_order_relaxed) },
+        { "peak", mPeak.load(std::memory_order_relaxed) },
+        { "limit", mLimit },
+        { "refused", mRefused.load(std::memory_order_relaxed) }
+      };
+    }
+  };
+}
+
+#endif /* __LUAALLOCATOR_H__ */
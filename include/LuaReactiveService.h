@@ -24,13 +24,19 @@
 #ifndef __LUAREACTIVESERVICE_H__
 #  define __LUAREACTIVESERVICE_H__
 
+#include <map>
 #include <string>
+#include <chrono>
+#include <limits>
 
 #include <LuaReactiveServiceContext.h>
 #include <abstract/ReactiveService.h>
 #include <ContextTypes.h>
 #include <AppInEvent.h>
+#include <ServiceInbox.h>
+#include <StealGroup.h>
 #include <NetworkACL.h>
+#include <Config.h>
 
 #include <ext/json.hpp>
 
@@ -41,15 +47,131 @@ namespace LAppS
   template <ServiceProtocol TProto> class LuaReactiveService : public abstract::ReactiveService
   {
    private:
-    using qtype=itc::tsbqueue<AppInEvent,itc::sys::mutex>;
+    typedef StealGroup<AppInEvent>      StealGroupType;
+    typedef RunQueue<AppInEvent>        RunQueueType;
     
     size_t                              mMaxInMsgSize;
     std::atomic<bool>                   mMayRun;
     std::atomic<bool>                   mCanStop;
     LuaReactiveServiceContext<TProto>   mContext;
-    qtype                               mEvents;
+    ServiceInbox                        mEvents;
+    long                                mMaxParkMS;
     NetworkACL                          mACL;
     
+    bool                                mSteal;
+    std::shared_ptr<StealGroupType>     mStealGroup;
+    std::shared_ptr<RunQueueType>       mRunQueue;
+    
+    std::atomic<size_t>                 mProcessed;
+    std::atomic<size_t>                 mStolen;
+    
+    size_t                              mHighWatermark;
+    size_t                              mLowWatermark;
+    std::atomic<bool>                   mThrottled;
+    std::atomic<size_t>                 mThrottledTimes;
+    std::atomic<size_t>                 mBacklog;
+    std::atomic<uint64_t>               mBusyNS;
+    size_t                              mFragmentSize;
+    
+    /**
+     * @brief this service section of lapps.json (never modified here).
+     **/
+    static const json& getServiceConfig(const std::string& name)
+    {
+      return LAppSConfig::getInstance()->getServiceConfig(name);
+    }
+    
+    /**
+     * @brief run queues of the instances of the same service are joined
+     * into the steal group, one group per service name.
+     **/
+    static std::shared_ptr<StealGroupType> getStealGroup(const std::string& name)
+    {
+      static itc::sys::mutex mtx;
+      static std::map<std::string,std::weak_ptr<StealGroupType>> groups;
+      
+      ITCSyncLock sync(mtx);
+      auto group=groups[name].lock();
+      if(!group)
+      {
+        group=std::make_shared<StealGroupType>();
+        groups[name]=group;
+      }
+      return group;
+    }
+    
+    /**
+     * @brief "dispatch" : "ordered" (default) - all messages of a
+     * connection are processed by the instance the connection is bound to;
+     * "steal" - idle instances take messages queued on busy siblings, the
+     * per-connection ordering is not preserved. LAppS protocol only.
+     **/
+    const bool isStealing(const std::string& name) const
+    {
+      const json& service=getServiceConfig(name);
+      auto dispatch=service.find("dispatch");
+      if((dispatch == service.end())||(!dispatch.value().is_string()))
+        return false;
+      const std::string mode=dispatch.value();
+      if(mode == "steal")
+      {
+        if(TProto == ServiceProtocol::LAPPS)
+          return true;
+        ITC_ERROR(__FILE__,__LINE__,"Service {}: dispatch mode \"steal\" is supported for LAppS protocol only, using \"ordered\"",name.c_str());
+        return false;
+      }
+      if(mode != "ordered")
+        ITC_ERROR(__FILE__,__LINE__,"Service {}: unknown dispatch mode \"{}\", using \"ordered\"",name.c_str(),mode.c_str());
+      return false;
+    }
+    
+    /**
+     * @brief "fragment_size" : bytes - payload per fragment of the
+     * outbound messages on the auto-fragmenting sockets (workers
+     * "auto_fragment" in ws.json), absent for the default.
+     **/
+    static const size_t fragmentSize(const std::string& name)
+    {
+      const json& service=getServiceConfig(name);
+      auto fragment=service.find("fragment_size");
+      if(fragment == service.end())
+        return 0;
+      if(fragment.value().is_number_unsigned()&&(fragment.value() > 0)&&(fragment.value() <= std::numeric_limits<uint32_t>::max()))
+        return fragment.value();
+      ITC_ERROR(__FILE__,__LINE__,"Service {}: fragment_size must be a positive 32 bit number, using the default",name.c_str());
+      return 0;
+    }
+    
+    /**
+     * @brief "watermarks" : { "high" : N, "low" : M } - read backpressure.
+     * IOWorkers stop reading from the connections bound to this instance
+     * when its queue depth reaches N and resume below M. "high" : 0
+     * disables backpressure.
+     **/
+    void setWatermarks(const std::string& name)
+    {
+      mHighWatermark=65536;
+      mLowWatermark=0;
+      
+      const json& service=getServiceConfig(name);
+      auto watermarks=service.find("watermarks");
+      if((watermarks != service.end())&&watermarks.value().is_object())
+      {
+        auto high=watermarks.value().find("high");
+        if((high != watermarks.value().end())&&high.value().is_number_unsigned())
+          mHighWatermark=high.value();
+        auto low=watermarks.value().find("low");
+        if((low != watermarks.value().end())&&low.value().is_number_unsigned())
+          mLowWatermark=low.value();
+      }
+      if((mLowWatermark == 0)||(mLowWatermark >= mHighWatermark))
+        mLowWatermark=mHighWatermark/2;
+    }
+    
+    const size_t getQueueDepth() const
+    {
+      return mEvents.size()+mBacklog.load(std::memory_order_relaxed)+(mSteal ? mRunQueue->size() : 0);
+    }
     
    public:
     LuaReactiveService(
@@ -61,14 +183,49 @@ namespace LAppS
     )
     : abstract::ReactiveService(target), mMaxInMsgSize{mims}, 
       mMayRun{true}, mCanStop{false}, mContext{name},
-      mEvents(), mACL{_policy}
+      mEvents(workers(),ringSize()), mMaxParkMS{maxPark()}, mACL{_policy},
+      mSteal{isStealing(name)}, mStealGroup(), mRunQueue(),
+      mProcessed{0}, mStolen{0}, mHighWatermark{0}, mLowWatermark{0},
+      mThrottled{false}, mThrottledTimes{0}, mBacklog{0}, mBusyNS{0},
+      mFragmentSize{fragmentSize(name)}
     {
+      setWatermarks(name);
+      mContext.setParker(mEvents.parker());
+      if(mSteal)
+      {
+        mStealGroup=getStealGroup(name);
+        mRunQueue=std::make_shared<RunQueueType>(mEvents.parker());
+        mStealGroup->join(mRunQueue);
+      }
       for(auto it=policy_exclude.begin();it!=policy_exclude.end();++it)
       {
         mACL.add(std::move(LAppS::addrinfo(it.value().get<std::string>())));
       }
     }
       
+    static const size_t workers()
+    {
+      return LAppSConfig::getInstance()->getWSConfig()["workers"]["workers"];
+    }
+    
+    static const size_t ringSize()
+    {
+      const auto& wcfg=LAppSConfig::getInstance()->getWSConfig()["workers"];
+      auto it=wcfg.find("service_ring_size");
+      if((it!=wcfg.end())&&it.value().is_number_unsigned())
+        return it.value();
+      return 1024;
+    }
+    
+    static const long maxPark()
+    {
+      const auto& wcfg=LAppSConfig::getInstance()->getWSConfig()["workers"];
+      auto it=wcfg.find("max_poll_wait_ms");
+      if((it!=wcfg.end())&&it.value().is_number_unsigned())
+        return it.value();
+      return 10;
+    }
+    
     std::atomic<bool>* get_stop_flag_address()
     {
       return nullptr;
@@ -101,6 +258,8 @@ namespace LAppS
         this->shutdown();
         while(!isDown());
       }
+      if(mSteal)
+        mStealGroup->leave(mRunQueue);
     }
       
     const std::string& getName() const
@@ -151,6 +310,11 @@ namespace LAppS
       return mMaxInMsgSize;
     }
     
+    const size_t getFragmentSize() const
+    {
+      return mFragmentSize;
+    }
+    
     void onCancel()
     {
       this->shutdown();
@@ -159,19 +323,78 @@ namespace LAppS
     void shutdown() final
     {
        mMayRun.store(false);
+       mEvents.wakeup();
     }
     
-    void enqueue(const AppInEvent&& event)
+    void enqueue(AppInEvent&& event)
     {
       try {
         mEvents.send(std::move(event));
       }
       catch (const std::exception& e)
       {
+        event.websocket->unpin();
         ITC_ERROR(__FILE__,__LINE__,"Can't enqueue request to application {}, exception: {}",this->getName().c_str(),e.what());
       }
     }
     
+    /**
+     * @brief called by IOWorkers before re-arming EPOLLIN of the connections
+     * bound to this instance.
+     **/
+    const bool throttled()
+    {
+      if(mHighWatermark == 0) return false;
+      
+      const size_t depth=getQueueDepth();
+      if(mThrottled.load(std::memory_order_relaxed))
+      {
+        if(depth > mLowWatermark) return true;
+        mThrottled.store(false,std::memory_order_relaxed);
+        return false;
+      }
+      if(depth < mHighWatermark) return false;
+      
+      if(!mThrottled.exchange(true,std::memory_order_relaxed))
+      {
+        mThrottledTimes.fetch_add(1,std::memory_order_relaxed);
+        ITC_INFO(__FILE__,__LINE__,"Instance [{}] of the service [{}] is over the high watermark ({} events queued), pausing input",getInstanceId(),this->getName().c_str(),depth);
+      }
+      return true;
+    }
+    
+    const json getStats() const
+    {
+      json stats={
+        { "dispatch", mSteal ? "steal" : "ordered" },
+        { "processed", mProcessed.load(std::memory_order_relaxed) },
+        { "inbox", mEvents.size() },
+        { "depth", getQueueDepth() },
+        { "high_watermark", mHighWatermark },
+        { "low_watermark", mLowWatermark },
+        { "throttled", mThrottled.load(std::memory_order_relaxed) },
+        { "throttled_times", mThrottledTimes.load(std::memory_order_relaxed) },
+        { "coroutines", mContext.suspended() },
+        { "lua_memory", mContext.getMemoryStats() },
+        { "gc", mContext.getGCStats() }
+      };
+      if(mSteal)
+      {
+        stats["stolen"]=mStolen.load(std::memory_order_relaxed);
+        stats["runqueue"]=mRunQueue->size();
+      }
+      return stats;
+    }
+    
+    const LoadSample getLoad() const
+    {
+      return LoadSample{
+        getQueueDepth(),
+        mProcessed.load(std::memory_order_relaxed),
+        mBusyNS.load(std::memory_order_relaxed)
+      };
+    }
+    
     void execute()
     {
       sigset_t sigpipe_mask;
@@ -180,62 +403,223 @@ namespace LAppS
       sigset_t saved_mask;
       pthread_sigmask(SIG_BLOCK, &sigpipe_mask, &saved_mask);
       
+      std::vector<AppInEvent> events;
+      events.reserve(1024);
+      
       while(mMayRun.load())
       { 
-        std::queue<AppInEvent> events;
-        try{
-          mEvents.recv<qtype::SWAP>(events);
-        }catch(const std::exception& e)
+        events.clear();
+        // at max_coroutines the messages wait in the inbox
+        const bool have_events=(!mContext.busy())&&(mSteal ? nextStealing(events) : (mEvents.drain(events) > 0));
+        
+        const auto started=std::chrono::steady_clock::now();
+        
+        if(have_events)
+          process(events);
+        
+        const size_t resumed=resume();
+        
+        if(have_events||(resumed > 0))
         {
+          mContext.relieveMemoryPressure();
+          mBusyNS.fetch_add(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-started).count(),
+            std::memory_order_relaxed
+          );
+        }
+        else
+          idle();
+      }
+      
+      // the service is going down, unpin whatever is left in the queues.
+      events.clear();
+      if(mSteal)
+      {
+        mStealGroup->leave(mRunQueue);
+        while(mRunQueue->steal(events) > 0);
+      }
+      mEvents.drain(events);
+      for(auto& event : events)
+        event.websocket->unpin();
+      
+      ITC_INFO(__FILE__,__LINE__,"Instance [{}] of the service [{}]: execution finished",getInstanceId(), this->getName().c_str());
+      mCanStop.store(true);
+    }
+    
+   private:
+    /**
+     * @brief moves the inbox into the own run queue, then takes one event
+     * from it, or steals from the most loaded sibling if it is empty.
+     **/
+    const bool nextStealing(std::vector<AppInEvent>& events)
+    {
+      if(mEvents.drain(events) > 0)
+      {
+        mRunQueue->push(events);
+        events.clear();
+        if(mRunQueue->size() > 1)
+          mStealGroup->wakeIdle(mRunQueue.get());
+      }
+      
+      AppInEvent event;
+      if(mRunQueue->pop(event))
+      {
+        events.push_back(std::move(event));
+        return true;
+      }
+      
+      const size_t stolen=mStealGroup->steal(mRunQueue.get(),events);
+      if(stolen > 0)
+      {
+        mStolen.fetch_add(stolen,std::memory_order_relaxed);
+        // keep the stolen events available for the other idle siblings
+        mRunQueue->push(events);
+        events.clear();
+        if(mRunQueue->pop(event))
+        {
+          events.push_back(std::move(event));
+          return true;
+        }
+      }
+      return false;
+    }
+    
+    void idle()
+    {
+      // bounded GC work first, the inbox is checked again before parking
+      if(mContext.idleCollect())
+        return;
+      
+      auto& parker=*mEvents.parker();
+      parker.prepare();
+      
+      // prepared before the timeout is computed: an awaitable completed
+      // after this point unparks the instance
+      const long timeout=mContext.waitTimeout(mMaxParkMS);
+      if((timeout == 0)||((!mContext.busy())&&((!mEvents.empty())||(mSteal&&mStealGroup->backlog(mRunQueue.get())))))
+      {
+        parker.cancel();
+        return;
+      }
+      parker.park(timeout);
+    }
+    
+    /**
+     * @brief resumes the suspended onMessage() coroutines which can go on.
+     * @return amount of them resumed.
+     **/
+    const size_t resume()
+    {
+      try
+      {
+        bool up=true;
+        const size_t resumed=mContext.resumeTasks(up);
+        if(!up)
+        {
+          ITC_INFO(__FILE__,__LINE__,"The context for instance [{}] of service [{}] is down.",getInstanceId(), this->getName().c_str());
           mMayRun.store(false);
-          ITC_INFO(__FILE__,__LINE__,"Instance [{}] of the service [{}] is going down",this->getInstanceId(),this->getName().c_str());
-          break;
         }
-        try
+        return resumed;
+      }catch(const std::exception& e)
+      {
+        mMayRun.store(false);
+        ITC_ERROR(__FILE__,__LINE__,"Exception in the instance [{}] of service [{}]::execute(): {}",getInstanceId(), this->getName().c_str(),e.what());
+      }
+      return 0;
+    }
+    
+    static const bool isMessage(const AppInEvent& event)
+    {
+      return (event.opcode != WebSocketProtocol::OpCode::CLOSE)&&(event.opcode != WebSocketProtocol::OpCode::PONG);
+    }
+    
+    /**
+     * @brief delivers the run of messages starting at events[processed] to
+     * onMessages() in one call, if the service has it and the run is longer
+     * than one message. Control frames end the run, so the order of
+     * onDisconnect() and the messages is kept.
+     * @return amount of events processed.
+     **/
+    const size_t processBatch(std::vector<AppInEvent>& events, const size_t processed)
+    {
+      if((!mContext.hasBatchCallback())||(!isMessage(events[processed])))
+        return 0;
+      
+      size_t end=processed+1;
+      while((end < events.size())&&isMessage(events[end]))
+        ++end;
+      
+      if(end-processed < 2)
+        return 0;
+      
+      if(!mContext.onMessages(events,processed,end))
+      {
+        ITC_INFO(__FILE__,__LINE__,"The context for instance [{}] of service [{}] is down.",getInstanceId(), this->getName().c_str());
+        mMayRun.store(false);
+      }
+      for(size_t i=processed;i<end;++i)
+        events[i].websocket->unpin();
+      return end-processed;
+    }
+    
+    void process(std::vector<AppInEvent>& events)
+    {
+      size_t processed=0;
+      try
+      {
+        for(;processed<events.size();++processed)
         {
-          while(!events.empty())
+          mBacklog.store(events.size()-processed,std::memory_order_relaxed);
+          
+          if(const size_t batch=processBatch(events,processed))
+          {
+            processed+=batch-1;
+            continue;
+          }
+          
+          auto& event=events[processed];
+          switch(event.opcode)
           {
-            auto event=std::move(events.front());
-            events.pop();
-            switch(event.opcode)
+            case WebSocketProtocol::OpCode::CLOSE:
+              mContext.onDisconnect(event.websocket);
+              if(event.websocket->getState() == ::abstract::WebSocket::State::MESSAGING)
+                try{
+                  event.websocket->send(event.message);
+                  event.websocket->close();
+                }catch(const std::exception& e)
+                {// ignore errors (peer is gone and so one)
+                }
+              break;
+            case WebSocketProtocol::OpCode::PONG:
+              if(event.websocket->getState() == ::abstract::WebSocket::State::MESSAGING)
+                try{
+                  event.websocket->send(event.message);
+                }catch(const std::exception& e)
+                {// ignore errors (peer is gone and so one)
+                }
+              break;
+            default:
             {
-              case WebSocketProtocol::OpCode::CLOSE:
-                mContext.onDisconnect(event.websocket);
-                if(event.websocket->getState() == ::abstract::WebSocket::State::MESSAGING)
-                  try{
-                    event.websocket->send(*event.message);
-                    event.websocket->close();
-                  }catch(const std::exception& e)
-                  {// ignore errors (bad_weak_ptr and so one)
-                  }
-                break;
-              case WebSocketProtocol::OpCode::PONG:
-                if(event.websocket->getState() == ::abstract::WebSocket::State::MESSAGING)
-                  try{
-                    event.websocket->send(*event.message);
-                  }catch(const std::exception& e)
-                  {// ignore errors (bad_weak_ptr and so one)
-                  }
-                break;
-              default:
+              const bool exec_result=mContext.onMessage(event);
+              if(!exec_result)
               {
-                const bool exec_result=mContext.onMessage(event);
-                if(!exec_result)
-                {
-                  ITC_INFO(__FILE__,__LINE__,"The context for instance [{}] of service [{}] is down.",getInstanceId(), this->getName().c_str());
-                  mMayRun.store(false);
-                }
+                ITC_INFO(__FILE__,__LINE__,"The context for instance [{}] of service [{}] is down.",getInstanceId(), this->getName().c_str());
+                mMayRun.store(false);
               }
             }
           }
-        }catch(const std::exception& e)
-        {
-          mMayRun.store(false);
-          ITC_ERROR(__FILE__,__LINE__,"Exception in the instance [{}] of service [{}]::execute(): {}",getInstanceId(), this->getName().c_str(),e.what());
+          event.websocket->unpin();
         }
+      }catch(const std::exception& e)
+      {
+        mMayRun.store(false);
+        ITC_ERROR(__FILE__,__LINE__,"Exception in the instance [{}] of service [{}]::execute(): {}",getInstanceId(), this->getName().c_str(),e.what());
       }
-      ITC_INFO(__FILE__,__LINE__,"Instance [{}] of the service [{}]: execution finished",getInstanceId(), this->getName().c_str());
-      mCanStop.store(true);
+      mBacklog.store(0,std::memory_order_relaxed);
+      mProcessed.fetch_add(processed,std::memory_order_relaxed);
+      // release the sockets of the events which were not processed
+      for(;processed<events.size();++processed)
+        events[processed].websocket->unpin();
     }
   };
 }
@@ -26,11 +26,18 @@
 
 #include <atomic>
 #include <memory>
+#include <utility>
+#include <exception>
+#include <vector>
+#include <cstring>
+#include <string_view>
+#include <unordered_map>
 
 #include <Val2Type.h>
 #include <abstract/LuaServiceContext.h>
 #include <ContextTypes.h>
 #include <AppInEvent.h>
+#include <CoScheduler.h>
 
 #include <ext/json.hpp>
 using json = nlohmann::json;
@@ -47,17 +54,414 @@ namespace LAppS
     
     itc::utils::Int2Type<Tproto> mProtocol;
     std::atomic<bool>            mustStop;
+    enum      LAppSCodec { NLJSON, LUA, VIEW };
+    const LAppSCodec             mCodec;
+    
+    /**
+     * @brief "lapps_codec" : "nljson" (default) - LAppS requests are
+     * passed to onMessage() as nljson userdata; "lua" - requests are
+     * decoded from CBOR straight into Lua tables, without the JSON DOM;
+     * "view" - requests are passed as lazy cbor views of the message
+     * buffer, fields are decoded when indexed. A view is valid until
+     * onMessage() returns, cbor.decode() copies it into a table.
+     * ws:send() accepts all of them, whatever the codec.
+     **/
+    static const LAppSCodec getCodec(const std::string& name)
+    {
+      const json& service=LAppSConfig::getInstance()->getServiceConfig(name);
+      auto codec=service.find("lapps_codec");
+      if((codec == service.end())||(!codec.value().is_string()))
+        return NLJSON;
+      const std::string mode=codec.value();
+      if((mode == "lua")||(mode == "view"))
+      {
+        if(Tproto == ServiceProtocol::LAPPS)
+          return (mode == "lua") ? LUA : VIEW;
+        ITC_ERROR(__FILE__,__LINE__,"Service {}: lapps_codec \"{}\" is supported for LAppS protocol only, using \"nljson\"",name.c_str(),mode.c_str());
+        return NLJSON;
+      }
+      if(mode != "nljson")
+        ITC_ERROR(__FILE__,__LINE__,"Service {}: unknown lapps_codec \"{}\", using \"nljson\"",name.c_str(),mode.c_str());
+      return NLJSON;
+    }
+    
+    const bool                   mRawFFI;
+    lapps_message_t              mRawMessage;
+    int                          mRawMessageRef;
+    
+    /**
+     * @brief "raw_ffi" : true - RAW services get the inbound message as a
+     * lapps_message_t cdata (see modules/rawffi.h) instead of a string.
+     **/
+    static const bool isRawFFI(const std::string& name)
+    {
+      const json& service=LAppSConfig::getInstance()->getServiceConfig(name);
+      auto raw_ffi=service.find("raw_ffi");
+      if((raw_ffi == service.end())||(!raw_ffi.value().is_boolean())||(!raw_ffi.value().get<bool>()))
+        return false;
+      if(Tproto == ServiceProtocol::RAW)
+        return true;
+      ITC_ERROR(__FILE__,__LINE__,"Service {}: raw_ffi is supported for RAW protocol only",name.c_str());
+      return false;
+    }
+    
+    /**
+     * @brief "coroutines" : true - each onMessage() runs in a coroutine,
+     * which is suspended on the await module calls (see modules/await.h)
+     * while the instance goes on with other messages. "max_coroutines"
+     * limits the suspended ones (10000 by default), the instance stops
+     * taking new messages at the limit.
+     **/
+    static const bool useCoroutines(const std::string& name)
+    {
+      const json& service=LAppSConfig::getInstance()->getServiceConfig(name);
+      auto coroutines=service.find("coroutines");
+      if((coroutines == service.end())||(!coroutines.value().is_boolean())||(!coroutines.value().get<bool>()))
+        return false;
+      if(isRawFFI(name))
+      {
+        ITC_ERROR(__FILE__,__LINE__,"Service {}: coroutines are not supported with raw_ffi",name.c_str());
+        return false;
+      }
+      return true;
+    }
+    
+    static const size_t maxCoroutines(const std::string& name)
+    {
+      const json& service=LAppSConfig::getInstance()->getServiceConfig(name);
+      auto limit=service.find("max_coroutines");
+      if((limit != service.end())&&limit.value().is_number_unsigned()&&(limit.value().get<size_t>() > 0))
+        return limit.value();
+      return 10000;
+    }
+    
+    const bool                   mCoroutines;
+    const size_t                 mMaxCoroutines;
+    std::unique_ptr<CoScheduler> mScheduler;
+    
+    // coroutines by thread: registry references, views of the suspended
+    // requests and the finished threads kept for reuse
+    std::unordered_map<lua_State*,int>                              mThreads;
+    std::unordered_map<lua_State*,std::vector<CBORViewSourceSPtr>>  mThreadViews;
+    std::vector<lua_State*>                                         mIdleThreads;
+    static constexpr size_t MAX_IDLE_THREADS=256;
+    
+    int                          mOnMessageRef;
+    int                          mOnMessagesRef;
+    int                          mPushEventRef;
+    int                          mPushBatchRef;
+    std::vector<CBORViewSourceSPtr> mViews;
+    
+    /**
+     * @brief the arguments of the callbacks are built in a protected call:
+     * with "memory_limit" the payload string, the decoded request or the
+     * batch table may fail to allocate, which must drop the message
+     * instead of the Lua panic. The exceptions of the codecs are carried
+     * out of the call and rethrown.
+     **/
+    struct EventArgs
+    {
+      LuaReactiveServiceContext*  self;
+      const AppInEvent*           event;
+      std::vector<AppInEvent>*    events;
+      size_t                      begin;
+      size_t                      end;
+      bool                        valid;
+      std::exception_ptr          error;
+    };
+    
+    static int pushEventArgs(lua_State* L)
+    {
+      auto args=static_cast<EventArgs*>(lua_touserdata(L,1));
+      lua_settop(L,0);
+      try{
+        args->valid=args->self->pushEvent(*(args->event),args->self->mProtocol);
+      }catch(const std::exception&)
+      {
+        args->error=std::current_exception();
+        lua_settop(L,0);
+      }
+      return lua_gettop(L);
+    }
+    
+    /**
+     * @brief the batch of onMessages(): an array of (handler, opcode or
+     * request type, message) triples, up to the first invalid request.
+     **/
+    static int pushBatchArgs(lua_State* L)
+    {
+      auto args=static_cast<EventArgs*>(lua_touserdata(L,1));
+      lua_settop(L,0);
+      lua_createtable(L,static_cast<int>(3*(args->end-args->begin)),0);
+      
+      int slot=0;
+      try{
+        for(size_t i=args->begin;i<args->end;++i)
+        {
+          if(!args->self->pushEvent((*args->events)[i],args->self->mProtocol))
+          {
+            args->valid=false;
+            break;
+          }
+          lua_rawseti(L,1,slot+3);
+          lua_rawseti(L,1,slot+2);
+          lua_rawseti(L,1,slot+1);
+          slot+=3;
+        }
+      }catch(const std::exception&)
+      {
+        args->error=std::current_exception();
+        slot=0;
+      }
+      if(slot == 0)
+        lua_settop(L,0);
+      return lua_gettop(L);
+    }
+    
+    /**
+     * @brief pushes the arguments built by the function under ref.
+     * @return false if nothing is pushed: args.valid is false for an
+     * invalid request, true for a message dropped by the memory limit.
+     **/
+    const bool pushArgs(const int ref, EventArgs& args)
+    {
+      const int top=lua_gettop(mLState);
+      lua_rawgeti(mLState,LUA_REGISTRYINDEX,ref);
+      lua_pushlightuserdata(mLState,&args);
+      const int ret=pcall(1,LUA_MULTRET);
+      if(args.error)
+      {
+        releaseViews();
+        cleanLuaStack();
+        std::rethrow_exception(args.error);
+      }
+      if(ret != 0)
+      {
+        releaseViews();
+        checkForLuaErrorsOnPcall(ret,"onMessage");
+        cleanLuaStack();
+        args.valid=true;
+        return false;
+      }
+      return lua_gettop(mLState) > top;
+    }
+    
+    /**
+     * @brief lua_newthread() and luaL_ref() for a new coroutine.
+     **/
+    static int newThread(lua_State* L)
+    {
+      auto task=static_cast<std::pair<lua_State*,int>*>(lua_touserdata(L,1));
+      task->first=lua_newthread(L);
+      task->second=luaL_ref(L,LUA_REGISTRYINDEX);
+      return 0;
+    }
     
     std::atomic<bool>* get_stop_flag_address()
     {
       return nullptr;
     }    
     
+    /**
+     * @brief keeps onMessage() and the optional onMessages(batch) of the
+     * service in the registry, so the dispatch does not look them up for
+     * every message. Called after onStart().
+     **/
+    void cacheCallbacks()
+    {
+      lua_getfield(mLState, LUA_GLOBALSINDEX, this->getName().c_str());
+      lua_getfield(mLState,-1,"onMessage");
+      mOnMessageRef=luaL_ref(mLState,LUA_REGISTRYINDEX);
+      
+      lua_getfield(mLState,-1,"onMessages");
+      if(!lua_isfunction(mLState,-1))
+        lua_pop(mLState,1);
+      else if(mRawFFI||mCoroutines)
+      {
+        lua_pop(mLState,1);
+        ITC_INFO(__FILE__,__LINE__,"Service [{}]: onMessages() is not used with {}, messages are dispatched to onMessage()",this->getName().c_str(),mRawFFI ? "raw_ffi" : "coroutines");
+      }
+      else
+        mOnMessagesRef=luaL_ref(mLState,LUA_REGISTRYINDEX);
+      
+      lua_pushcfunction(mLState,pushEventArgs);
+      mPushEventRef=luaL_ref(mLState,LUA_REGISTRYINDEX);
+      lua_pushcfunction(mLState,pushBatchArgs);
+      mPushBatchRef=luaL_ref(mLState,LUA_REGISTRYINDEX);
+      
+      cleanLuaStack();
+    }
+    
     void callAppOnMessage()
     {
-      int ret = lua_pcall (mLState, 3, 1, 0);
+      int ret = pcall(3,1);
       checkForLuaErrorsOnPcall(ret,"onMessage");
     }
+    
+    /**
+     * @brief the boolean returned by the callback, which is the only value
+     * left on the stack.
+     **/
+    const bool getCallResult(const char* method)
+    {
+      const int argc=lua_gettop(mLState);
+      
+      if(argc != 1)
+      {
+        throw std::system_error(
+          EINVAL,std::system_category(),
+          this->getName()+"::"+method+"() is returned "+std::to_string(argc)+
+          " values, but only one boolean value is expected"
+        );
+      }
+      
+      if(lua_isboolean(mLState,argc))
+      {
+        return lua_toboolean(mLState,argc);
+      }
+      return false;
+    }
+    
+    /**
+     * @brief coroutines: runs the function with nargs arguments on top of
+     * the stack in a coroutine. A start failed by the memory limit is made
+     * once more after a full GC, as pcall() does.
+     * @return the result of the function, true if it is suspended or
+     * dropped by the memory limit.
+     **/
+    const bool startTask(const int nargs, const bool retry=true)
+    {
+      const bool keep=retry&&(mAllocator.limit() != 0)&&lua_checkstack(mLState,nargs+1);
+      if(keep)
+      {
+        const int func=lua_gettop(mLState)-nargs;
+        for(int i=func;i<=func+nargs;++i)
+          lua_pushvalue(mLState,i);
+      }
+      
+      lua_State* thread=nullptr;
+      int status=0;
+      if(mIdleThreads.empty())
+      {
+        std::pair<lua_State*,int> task{nullptr,LUA_NOREF};
+        status=lua_cpcall(mLState,newThread,&task);
+        if(status == 0)
+        {
+          thread=task.first;
+          mThreads.emplace(thread,task.second);
+        }
+      }
+      else
+      {
+        thread=mIdleThreads.back();
+        mIdleThreads.pop_back();
+      }
+      
+      if(thread)
+      {
+        lua_xmove(mLState,thread,nargs+1);
+        status=mScheduler->resume(thread,nargs);
+      }
+      
+      if(keep&&(status == LUA_ERRMEM)&&mAllocator.exhausted())
+      {
+        if(thread)
+          dropThread(thread);
+        else
+          lua_pop(mLState,nargs+2); // the error and the copies
+        fullGC();
+        return startTask(nargs,false);
+      }
+      
+      if(!thread)
+      {
+        releaseViews();
+        checkForLuaErrorsOnPcall(status,"onMessage");
+        cleanLuaStack();
+        return true;
+      }
+      
+      if(keep)
+        lua_pop(mLState,nargs+1);
+      return finishTask(thread,status);
+    }
+    
+    /**
+     * @brief releases a thread which is not going to be reused.
+     **/
+    void dropThread(lua_State* thread)
+    {
+      auto it=mThreads.find(thread);
+      luaL_unref(mLState,LUA_REGISTRYINDEX,it->second);
+      mThreads.erase(it);
+    }
+    
+    /**
+     * @brief coroutines: handles the status of the resumed thread. The
+     * views of the request are kept until its coroutine ends. Errors are
+     * thrown as for onMessage().
+     **/
+    const bool finishTask(lua_State* thread, const int status)
+    {
+      if(status == LUA_YIELD)
+      {
+        if(!mViews.empty())
+          mThreadViews[thread]=std::move(mViews);
+        mViews.clear();
+        return true;
+      }
+      
+      releaseViews();
+      auto views=mThreadViews.find(thread);
+      if(views != mThreadViews.end())
+      {
+        for(auto& view_source : views->second)
+          view_source->buffer.reset();
+        mThreadViews.erase(views);
+      }
+      
+      if(status != 0)
+      {
+        // a thread with an error is dead, it is not reused
+        cleanLuaStack();
+        lua_xmove(thread,mLState,1);
+        dropThread(thread);
+        checkForLuaErrorsOnPcall(status,"onMessage");
+        // dropped by the memory limit
+        cleanLuaStack();
+        return true;
+      }
+      
+      const int argc=lua_gettop(thread);
+      const bool result=(argc == 1)&&lua_isboolean(thread,1)&&lua_toboolean(thread,1);
+      lua_settop(thread,0);
+      if(mIdleThreads.size() < MAX_IDLE_THREADS)
+      {
+        mIdleThreads.push_back(thread);
+      }
+      else
+        dropThread(thread);
+      
+      if(argc != 1)
+      {
+        throw std::system_error(
+          EINVAL,std::system_category(),
+          this->getName()+"::onMessage() is returned "+std::to_string(argc)+
+          " values, but only one boolean value is expected"
+        );
+      }
+      return result;
+    }
+    
+    /**
+     * @brief the views must not see the message buffers after they are reused
+     **/
+    void releaseViews()
+    {
+      for(auto& view_source : mViews)
+        view_source->buffer.reset();
+      mViews.clear();
+    }
 
     const bool isServiceModuleValid() final
     {
@@ -111,7 +515,7 @@ namespace LAppS
     {
       lua_getglobal(mLState, this->getName().c_str());
       lua_getfield(mLState, -1, "onStart");
-      int ret = lua_pcall (mLState, 0, 0, 0);
+      int ret = pcall(0,0);
       checkForLuaErrorsOnPcall(ret,"onStart");
       cleanLuaStack();
     }
@@ -120,7 +524,7 @@ namespace LAppS
     {
       lua_getglobal(mLState, this->getName().c_str());
       lua_getfield(mLState, -1, "onShutdown");
-      int ret = lua_pcall (mLState, 0, 0, 0);
+      int ret = pcall(0,0);
       checkForLuaErrorsOnPcall(ret,"onShutdown");
     }
     
@@ -181,13 +585,129 @@ namespace LAppS
     }
     
     
+    /**
+     * @brief same as above for the request decoded into the Lua table at idx.
+     **/
+    static const LAppSInMessageType getLAppSInMessageType(lua_State* L, const int idx)
+    {
+      if(!lua_istable(L,idx)) return INVALID;
+      
+      lua_getfield(L,idx,"lapps");
+      const bool proper_version=(lua_type(L,-1) == LUA_TNUMBER)&&(lua_tonumber(L,-1) == 1);
+      lua_pop(L,1);
+      if(!proper_version) return INVALID;
+      
+      lua_getfield(L,idx,"method");
+      if(lua_type(L,-1) != LUA_TSTRING)
+      {
+        lua_pop(L,1);
+        return INVALID;
+      }
+      size_t len;
+      const char* method_name=lua_tolstring(L,-1,&len);
+      const bool proper_method=(len > 0)&&(method_name[0] != '_')&&(memchr(method_name,'.',len) == nullptr);
+      lua_pop(L,1);
+      if(!proper_method) return INVALID;
+      
+      lua_getfield(L,idx,"params");
+      const bool hasParams=lua_istable(L,-1)&&(cbor_sequence_size(L,lua_gettop(L)) > 0);
+      lua_pop(L,1);
+      
+      lua_getfield(L,idx,"cid");
+      const int cid_type=lua_type(L,-1);
+      lua_pop(L,1);
+      
+      if(cid_type == LUA_TNIL) // REQUEST
+        return hasParams ? REQUEST_WITH_PARAMS : REQUEST;
+      if(cid_type == LUA_TNUMBER) // Client's Notification
+        return hasParams ? CN_WITH_PARAMS : CN;
+      return INVALID;
+    }
+    
+    /**
+     * @brief same as above for the CBOR encoded request, classified with a
+     * streaming scan of the envelope. Throws on malformed CBOR.
+     **/
+    static const LAppSInMessageType getLAppSInMessageType(const uint8_t* data, const size_t len)
+    {
+      CBORReader r{data,data+len};
+      uint64_t count;
+      bool indefinite;
+      if(cbor_open_container(r,count,indefinite) != 5)
+      {
+        cbor_skip_item(r,0);
+        return INVALID;
+      }
+      
+      CBORReader lapps{nullptr,nullptr}, method{nullptr,nullptr}, params{nullptr,nullptr}, cid{nullptr,nullptr};
+      for(uint64_t i=0;cbor_container_next(r,i,count,indefinite);++i)
+      {
+        CBORReader* field=nullptr;
+        const char* key;
+        size_t klen;
+        if(cbor_read_text(r,key,klen))
+        {
+          const std::string_view name(key,klen);
+          if(name == "lapps") field=&lapps;
+          else if(name == "method") field=&method;
+          else if(name == "params") field=&params;
+          else if(name == "cid") field=&cid;
+        }
+        else cbor_skip_item(r,1);
+        
+        if(field) *field=r;
+        cbor_skip_item(r,1);
+      }
+      if(r.pos != r.end)
+        throw std::system_error(EINVAL,std::system_category(),"CBOR: trailing data after the item");
+      
+      double version;
+      if((lapps.pos == nullptr)||(!cbor_read_number(lapps,version))||(version != 1))
+        return INVALID;
+      
+      const char* method_name;
+      size_t method_len;
+      if((method.pos == nullptr)||(!cbor_read_text(method,method_name,method_len)))
+        return INVALID;
+      if((method_len == 0)||(method_name[0] == '_')||(memchr(method_name,'.',method_len) != nullptr))
+        return INVALID;
+      
+      bool hasParams=false;
+      if(params.pos != nullptr)
+      {
+        if(cbor_open_container(params,count,indefinite) == 4)
+          hasParams=cbor_container_next(params,0,count,indefinite);
+      }
+      
+      if(cid.pos == nullptr) // REQUEST
+        return hasParams ? REQUEST_WITH_PARAMS : REQUEST;
+      double cid_value;
+      if(cbor_read_number(cid,cid_value)) // Client's Notification
+        return hasParams ? CN_WITH_PARAMS : CN;
+      return INVALID;
+    }
+    
     void init_bcast_module(const itc::utils::Int2Type<ServiceProtocol::LAPPS>& protocol_is_lapps)
     {
       ::init_bcast_module(mLState);
+      ::init_topics_module(mLState);
+      if(mCodec != NLJSON)
+        ::init_cbor_module(mLState);
     }
     
     void init_bcast_module(const itc::utils::Int2Type<ServiceProtocol::RAW>& protocol_is_raw)
     {
+      if(mRawFFI)
+      {
+        ::init_rawffi_module(mLState);
+        // one cdata for all messages, mRawMessage is refilled for each
+        lua_getfield(mLState,LUA_GLOBALSINDEX,"rawffi");
+        lua_getfield(mLState,-1,"wrap");
+        lua_pushlightuserdata(mLState,&mRawMessage);
+        lua_call(mLState,1,1);
+        mRawMessageRef=luaL_ref(mLState,LUA_REGISTRYINDEX);
+        cleanLuaStack();
+      }
     }
     
     void init_bcast_module(const itc::utils::Int2Type<ServiceProtocol::INTERNAL>& protocol_is_internal)
@@ -200,34 +720,64 @@ namespace LAppS
     {
       cleanLuaStack();
       
-      lua_getfield(mLState, LUA_GLOBALSINDEX, this->getName().c_str());
-      lua_getfield(mLState,-1,"onMessage");
+      if(mRawFFI)
+        return onRawFFIMessage(event);
       
-      lua_pushinteger(mLState, (lua_Integer)(event.websocket.get()));
-      lua_pushinteger(mLState, event.opcode);
+      lua_rawgeti(mLState,LUA_REGISTRYINDEX,mOnMessageRef);
+      EventArgs args{this,&event,nullptr,0,0,true,nullptr};
+      if(!pushArgs(mPushEventRef,args))
+      {
+        event.websocket->returnBuffer(std::move(event.message));
+        return args.valid;
+      }
       
-      lua_pushlstring(mLState,(const char*)(event.message->data()),event.message->size());
+      if(mScheduler)
+      {
+        event.websocket->returnBuffer(std::move(event.message));
+        return startTask(3);
+      }
       
       callAppOnMessage(); 
       
-      uint32_t argc=lua_gettop(mLState);
+      event.websocket->returnBuffer(std::move(event.message));
+      
+      return getCallResult("onMessage");
+    }
+    
+    /**
+     * @brief pushes handler, opcode and the message string.
+     **/
+    const bool pushEvent(const AppInEvent& event, const itc::utils::Int2Type<ServiceProtocol::RAW>& protocol_is_raw)
+    {
+      lua_pushinteger(mLState, (lua_Integer)(event.websocket->handle()));
+      lua_pushinteger(mLState, event.opcode);
+      lua_pushlstring(mLState,(const char*)(event.message->data()),event.message->size());
+      return true;
+    }
+    
+    /**
+     * @brief RAW onMessage() with the message passed as lapps_message_t
+     * cdata, see "raw_ffi". The buffer goes back to the pool unless it is
+     * still referenced by a forwarded frame.
+     **/
+    const bool onRawFFIMessage(const AppInEvent& event)
+    {
+      lua_rawgeti(mLState,LUA_REGISTRYINDEX,mOnMessageRef);
       
-      if(argc != 2)
-      {
-        throw std::system_error(
-          EINVAL,std::system_category(),
-          this->getName()+"::onMessage() is returned "+std::to_string(argc-1)+
-          " values, but only one boolean value is expected"
-        );
-      }
+      lua_pushinteger(mLState, (lua_Integer)(event.websocket->handle()));
+      lua_pushinteger(mLState, event.opcode);
       
-      event.websocket->returnBuffer(std::move(event.message));
+      mRawMessage=lapps_message_t{event.message->data(),event.message->size(),&event.message};
+      lua_rawgeti(mLState,LUA_REGISTRYINDEX,mRawMessageRef);
       
-      if(lua_isboolean(mLState,argc))
-      {
-        return lua_toboolean(mLState,argc);
-      }
-      return false;
+      int ret = pcall(3,1);
+      mRawMessage=lapps_message_t{nullptr,0,nullptr};
+      checkForLuaErrorsOnPcall(ret,"onMessage");
+      
+      if(event.message.use_count() == 1)
+        event.websocket->returnBuffer(std::move(event.message));
+      
+      return getCallResult("onMessage");
     }
     
     void pushRequest(const std::shared_ptr<json>& request)
@@ -243,7 +793,13 @@ namespace LAppS
       lua_setmetatable(mLState, -2);
     }
     
-    const bool onMessage(const AppInEvent& event, const itc::utils::Int2Type<ServiceProtocol::LAPPS>& protocol_is_lapps)
+    /**
+     * @brief pushes handler, request type and the request in the form
+     * selected by "lapps_codec".
+     * @return false if the message is not a valid LAppS request, nothing
+     * is pushed then.
+     **/
+    const bool pushEvent(const AppInEvent& event, const itc::utils::Int2Type<ServiceProtocol::LAPPS>& protocol_is_lapps)
     {
       // exceptions from json and from lua stack MUST be handled in the LuaService derivative class
       // We must prevent possibility to kill app with inappropriate message, therefore 
@@ -253,45 +809,78 @@ namespace LAppS
       if(event.opcode != WebSocketProtocol::OpCode::BINARY)
         return false;
       
-      cleanLuaStack();
-      
-      auto msg=std::make_shared<json>(json::from_cbor(*event.message));
+      if(mCodec == VIEW)
+      {
+        auto msg_type=getLAppSInMessageType(event.message->data(),event.message->size());
+        if(msg_type == INVALID)
+          return false;
+        
+        lua_pushinteger(mLState,(lua_Integer)(event.websocket->handle())); // socket handler for ws::send
+        lua_pushinteger(mLState,msg_type);
+        // the view references the message buffer until onMessage() returns
+        mViews.push_back(std::make_shared<CBORViewSource>(CBORViewSource{event.message}));
+        push_cborview(mLState,mViews.back(),0,event.message->size());
+      }
+      else if(mCodec == LUA)
+      {
+        const int top=lua_gettop(mLState);
+        
+        lua_pushinteger(mLState,(lua_Integer)(event.websocket->handle())); // socket handler for ws::send
+        // the request is decoded straight into a Lua table
+        cbor_decode(mLState,event.message->data(),event.message->size());
+        
+        auto msg_type=getLAppSInMessageType(mLState,lua_gettop(mLState));
+        if(msg_type == INVALID)
+        {
+          lua_settop(mLState,top);
+          return false;
+        }
+        
+        lua_pushinteger(mLState,msg_type);
+        lua_insert(mLState,-2);
+      }
+      else
+      {
+        auto msg=std::make_shared<json>(json::from_cbor(*event.message));
 
-      auto msg_type=getLAppSInMessageType(*msg);
+        auto msg_type=getLAppSInMessageType(*msg);
 
-      // "Protocol violation, LAppS protocol accepts only binary messages (CBOR encoded)"
-      if(msg_type == INVALID)
-        return false;
+        // "Protocol violation, LAppS protocol accepts only binary messages (CBOR encoded)"
+        if(msg_type == INVALID)
+          return false;
 
-      lua_getfield(mLState, LUA_GLOBALSINDEX, this->getName().c_str());
-      lua_getfield(mLState,-1,"onMessage");
-      
-      lua_pushinteger(mLState,(lua_Integer)(event.websocket.get())); // socket handler for ws::send
-      lua_pushinteger(mLState,msg_type);
-      pushRequest(msg);
+        lua_pushinteger(mLState,(lua_Integer)(event.websocket->handle())); // socket handler for ws::send
+        lua_pushinteger(mLState,msg_type);
+        pushRequest(msg);
+      }
+      return true;
+    }
+    
+    const bool onMessage(const AppInEvent& event, const itc::utils::Int2Type<ServiceProtocol::LAPPS>& protocol_is_lapps)
+    {
+      cleanLuaStack();
       
+      lua_rawgeti(mLState,LUA_REGISTRYINDEX,mOnMessageRef);
+      EventArgs args{this,&event,nullptr,0,0,true,nullptr};
+      if(!pushArgs(mPushEventRef,args))
+        return args.valid;
       
-
-      callAppOnMessage(); // handler, type, userdata
-
-      uint32_t argc=lua_gettop(mLState);
-
-      if(argc != 2)
+      if(mScheduler)
       {
-        throw std::system_error(
-          EINVAL,std::system_category(),
-          this->getName()+"::onMessage() is returned "+std::to_string(argc)+
-          " values, but only one boolean value is expected"
-        );
+        const bool result=startTask(3);
+        // a suspended request may still have views of the buffer
+        if(event.message.use_count() == 1)
+          event.websocket->returnBuffer(std::move(event.message));
+        return result;
       }
+
+      int ret = pcall(3,1); // handler, type, request
+      releaseViews();
+      checkForLuaErrorsOnPcall(ret,"onMessage");
       
       event.websocket->returnBuffer(std::move(event.message));
       
-      if(lua_isboolean(mLState,argc))
-      {
-        return lua_toboolean(mLState,argc);
-      }
-      return false;
+      return getCallResult("onMessage");
     }
     
     const bool onMessage(const AppInEvent& event, const itc::utils::Int2Type<ServiceProtocol::INTERNAL>& protocol_is_internal)
@@ -299,12 +888,23 @@ namespace LAppS
       ITC_ERROR(__FILE__,__LINE__,"Internal protocol is not allowed for Reactive Services",nullptr);
       return false;
     }
+    
+    const bool pushEvent(const AppInEvent& event, const itc::utils::Int2Type<ServiceProtocol::INTERNAL>& protocol_is_internal)
+    {
+      return false;
+    }
     void init() final
     {
        init_ws_module(mLState);
       
       init_bcast_module(mProtocol);
       
+      if(mCoroutines)
+      {
+        mScheduler=std::make_unique<CoScheduler>(mLState);
+        ::init_await_module(mLState);
+      }
+      
       
       if(require(this->getName()))
       {
@@ -318,6 +918,7 @@ namespace LAppS
           );
           try {
             this->startService();
+            this->cacheCallbacks();
           }catch(const std::exception& e)
           {
             ITC_ERROR(
@@ -358,7 +959,12 @@ namespace LAppS
     
     explicit LuaReactiveServiceContext(
       const std::string& name
-    ) : abstract::LuaServiceContext(name), mustStop{false}
+    ) : abstract::LuaServiceContext(name), mustStop{false}, mCodec{getCodec(name)},
+      mRawFFI{isRawFFI(name)}, mRawMessage{nullptr,0,nullptr}, mRawMessageRef{LUA_NOREF},
+      mCoroutines{useCoroutines(name)}, mMaxCoroutines{maxCoroutines(name)}, mScheduler(),
+      mThreads(), mThreadViews(), mIdleThreads(),
+      mOnMessageRef{LUA_NOREF}, mOnMessagesRef{LUA_NOREF}, mPushEventRef{LUA_NOREF},
+      mPushBatchRef{LUA_NOREF}, mViews()
     {
       static_assert(Tproto != ServiceProtocol::INTERNAL, "LuaReactiveServiceContext does not supports INTERNAL protocol");
       init();
@@ -370,15 +976,108 @@ namespace LAppS
       return onMessage(std::move(event),mProtocol);
     }
     
-    void onDisconnect(const std::shared_ptr<::abstract::WebSocket>& ws)
+    /**
+     * @brief the awaitables completing in other threads wake the instance
+     * up with the parker of its inbox.
+     **/
+    void setParker(const std::shared_ptr<Parker>& parker)
+    {
+      if(mScheduler)
+        mScheduler->setParker(parker);
+    }
+    
+    /**
+     * @brief true if the instance has max_coroutines requests suspended
+     * and must not take new messages.
+     **/
+    const bool busy() const
+    {
+      return mScheduler&&(mScheduler->size() >= mMaxCoroutines);
+    }
+    
+    /**
+     * @brief amount of the suspended requests, any thread.
+     **/
+    const size_t suspended() const
+    {
+      return mScheduler ? mScheduler->suspended() : 0;
+    }
+    
+    /**
+     * @brief how long the instance may park without delaying a suspended
+     * request, max_ms at most.
+     **/
+    const long waitTimeout(const long max_ms) const
+    {
+      return mScheduler ? mScheduler->timeout(max_ms) : max_ms;
+    }
+    
+    /**
+     * @brief resumes the suspended requests which can go on.
+     * @param up - set to false if any of them returned false.
+     * @return amount of the requests resumed.
+     **/
+    const size_t resumeTasks(bool& up)
+    {
+      if((!mScheduler)||mustStop) return 0;
+      
+      cleanLuaStack();
+      return mScheduler->run(
+        [this,&up](lua_State* thread, const int status)
+        {
+          if(!finishTask(thread,status))
+            up=false;
+        }
+      );
+    }
+    
+    /**
+     * @brief true if the service provides onMessages(batch).
+     **/
+    const bool hasBatchCallback() const
+    {
+      return mOnMessagesRef != LUA_NOREF;
+    }
+    
+    /**
+     * @brief delivers the messages events[begin,end) to onMessages(batch)
+     * in one call. The batch is an array of (handler, opcode or request
+     * type, message) triples in the order of arrival, the same values
+     * onMessage() gets. An invalid LAppS request ends the batch, the
+     * requests before it are delivered and false is returned as
+     * onMessage() does.
+     **/
+    const bool onMessages(std::vector<AppInEvent>& events, const size_t begin, const size_t end)
+    {
+      if(mustStop) return false;
+      
+      cleanLuaStack();
+      
+      lua_rawgeti(mLState,LUA_REGISTRYINDEX,mOnMessagesRef);
+      EventArgs args{this,nullptr,&events,begin,end,true,nullptr};
+      if(!pushArgs(mPushBatchRef,args))
+        return args.valid;
+      
+      int ret = pcall(1,1);
+      releaseViews();
+      checkForLuaErrorsOnPcall(ret,"onMessages");
+      
+      for(size_t i=begin;i<end;++i)
+        if(events[i].message)
+          events[i].websocket->returnBuffer(std::move(events[i].message));
+      
+      return getCallResult("onMessages")&&args.valid;
+    }
+    
+    void onDisconnect(::abstract::WebSocket* ws)
     {
       this->cleanLuaStack();
       
       lua_getfield(mLState, LUA_GLOBALSINDEX, this->getName().c_str());
       lua_getfield(mLState,-1,"onDisconnect");
-      lua_pushinteger(mLState,(lua_Integer)(ws.get()));
+      lua_pushinteger(mLState,(lua_Integer)(ws->handle()));
       
-      int ret = lua_pcall (mLState, 1, 0, 0);
+      int ret = pcall(1,0);
       checkForLuaErrorsOnPcall(ret,"onDisconnect");
     }
     
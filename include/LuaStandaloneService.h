@@ -107,9 +107,9 @@ namespace LAppS
     {
       return 0;
     }
-    void enqueue(const AppInEvent&& e)
+    void enqueue(AppInEvent&& e)
     {
-      throw std::logic_error("Interface method void LuaStandaloneService::enqueue(const AppInEvent&) may not be implemented");
+      throw std::logic_error("Interface method void LuaStandaloneService::enqueue(AppInEvent&&) may not be implemented");
     }
   };
 }
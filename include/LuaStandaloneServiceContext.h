@@ -105,6 +105,7 @@ namespace LAppS
     : abstract::LuaServiceContext(name),mCanStop{false},mMustStop{false}
     {
       init_bcast_module(mLState);
+      init_topics_module(mLState);
       
       lua_pushstring(mLState,std::to_string(instance_id).c_str());
       lua_setglobal(mLState,"instance_id");
@@ -156,7 +157,7 @@ namespace LAppS
       mCanStop.store(false);
       lua_getglobal(mLState, this->getName().c_str());
       lua_getfield(mLState, -1, "init");
-      int ret = lua_pcall(mLState, 0, 0, 0);
+      int ret = pcall(0,0);
       checkForLuaErrorsOnPcall(ret,"init");
       cleanLuaStack();
       ITC_INFO(__FILE__,__LINE__,"Application instance [{}] is initialized",this->getName().c_str());
@@ -171,7 +172,7 @@ namespace LAppS
     {
       lua_getglobal(mLState, this->getName().c_str());
       lua_getfield(mLState, -1, "run");
-      int ret = lua_pcall(mLState, 0, 0, 0);
+      int ret = pcall(0,0);
       try {
         checkForLuaErrorsOnPcall(ret,"run");
       } catch (const std::exception& e)
@@ -0,0 +1,167 @@
+/**
+ *  Copyright 2017-2018, Pavel Kraynyukhov <pavel.kraynyukhov@gmail.com>
+ *
+ *  This file is a part of LAppS (Lua Application Server).
+ *
+ *  LAppS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  LAppS is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with LAppS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  $Id: MPMCRing.h October 22, 2026 9:15 AM $
+ *
+ **/
+
+
+#ifndef __MPMCRING_H__
+#  define __MPMCRING_H__
+
+#include <atomic>
+#include <memory>
+#include <cstddef>
+#include <cstdint>
+#include <system_error>
+
+#ifndef LAPPS_CACHE_LINE_SIZE
+#  define LAPPS_CACHE_LINE_SIZE 64
+#endif
+
+namespace LAppS
+{
+  /**
+   * @brief bounded lock-free multi producer / multi consumer ring.
+   * Capacity is rounded up to the power of two. Each cell carries a
+   * sequence number telling whether it is free for the producer of the
+   * lap or ready for the consumer, so producers and consumers contend
+   * only on their own index with a single CAS per operation.
+   **/
+  template <typename T> class MPMCRing
+  {
+   private:
+    struct Cell
+    {
+      std::atomic<size_t> mSeq;
+      T                   mValue;
+    };
+
+    alignas(LAPPS_CACHE_LINE_SIZE) std::atomic<size_t> mTail; // producers
+    alignas(LAPPS_CACHE_LINE_SIZE) std::atomic<size_t> mHead; // consumers
+    alignas(LAPPS_CACHE_LINE_SIZE) const size_t        mMask;
+    std::unique_ptr<Cell[]>                            mCells;
+
+    static const size_t roundup(const size_t capacity)
+    {
+      if(capacity < 2)
+        throw std::system_error(EINVAL,std::system_category(),"MPMCRing capacity must be at least 2");
+      size_t result=1;
+      while(result < capacity) result<<=1;
+      return result;
+    }
+
+   public:
+    explicit MPMCRing(const size_t capacity)
+    : mTail{0}, mHead{0}, mMask{roundup(capacity)-1}, mCells(new Cell[mMask+1])
+    {
+      for(size_t i=0;i<=mMask;++i)
+        mCells[i].mSeq.store(i,std::memory_order_relaxed);
+    }
+
+    MPMCRing()=delete;
+    MPMCRing(const MPMCRing&)=delete;
+    MPMCRing(MPMCRing&)=delete;
+
+    const size_t capacity() const
+    {
+      return mMask+1;
+    }
+
+    /**
+     * @brief any thread: false if the ring is full.
+     **/
+    template <typename V> const bool try_push(V&& value)
+    {
+      size_t pos=mTail.load(std::memory_order_relaxed);
+      Cell* cell;
+      while(true)
+      {
+        cell=&mCells[pos & mMask];
+        const size_t seq=cell->mSeq.load(std::memory_order_acquire);
+        const intptr_t diff=static_cast<intptr_t>(seq)-static_cast<intptr_t>(pos);
+        if(diff == 0)
+        {
+          if(mTail.compare_exchange_weak(pos,pos+1,std::memory_order_relaxed))
+            break;
+        }
+        else if(diff < 0)
+        {
+          return false;
+        }
+        else
+        {
+          pos=mTail.load(std::memory_order_relaxed);
+        }
+      }
+      cell->mValue=std::forward<V>(value);
+      cell->mSeq.store(pos+1,std::memory_order_release);
+      return true;
+    }
+
+    /**
+     * @brief any thread: false if the ring is empty. The cell is reset to
+     * T() so it does not keep the value alive.
+     **/
+    const bool try_pop(T& value)
+    {
+      size_t pos=mHead.load(std::memory_order_relaxed);
+      Cell* cell;
+      while(true)
+      {
+        cell=&mCells[pos & mMask];
+        const size_t seq=cell->mSeq.load(std::memory_order_acquire);
+        const intptr_t diff=static_cast<intptr_t>(seq)-static_cast<intptr_t>(pos+1);
+        if(diff == 0)
+        {
+          if(mHead.compare_exchange_weak(pos,pos+1,std::memory_order_relaxed))
+            break;
+        }
+        else if(diff < 0)
+        {
+          return false;
+        }
+        else
+        {
+          pos=mHead.load(std::memory_order_relaxed);
+        }
+      }
+      value=std::move(cell->mValue);
+      cell->mValue=T();
+      cell->mSeq.store(pos+mMask+1,std::memory_order_release);
+      return true;
+    }
+
+    /**
+     * @brief approximate amount of elements, safe to call from any thread.
+     **/
+    const size_t size() const
+    {
+      const size_t head=mHead.load(std::memory_order_acquire);
+      const size_t tail=mTail.load(std::memory_order_acquire);
+      return tail > head ? tail - head : 0;
+    }
+
+    const bool empty() const
+    {
+      return size() == 0;
+    }
+  };
+}
+
+#endif /* __MPMCRING_H__ */
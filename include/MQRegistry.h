@@ -32,9 +32,10 @@
 #include <sys/synclock.h>
 #include <Singleton.h>
 
-#include <tsbqueue.h>
+#include <MQueue.h>
 
 #include <ext/json.hpp>
+#include <WSEvent.h>
 
 #include <ext/tsl/robin_map.h>
 
@@ -42,10 +43,25 @@ namespace LAppS
 {
   namespace MQ
   {
-    typedef std::shared_ptr<json>                             MessageType;
-    typedef itc::tsbqueue<MessageType,itc::sys::mutex>        QueueType;
+    /**
+     * @brief either a JSON document or raw bytes, which pass through the
+     * queue without being decoded. Both are shared, never copied.
+     **/
+    struct Message
+    {
+      std::shared_ptr<json> object;
+      MSGBufferTypeSPtr     bytes;
+    };
+    
+    typedef Message                                           MessageType;
+    typedef Queue<MessageType>                                QueueType;
     typedef std::shared_ptr<QueueType>                        QueueHolderType;
     
+    /**
+     * @brief capacity of the queues created without an explicit one.
+     **/
+    static const size_t DEFAULT_CAPACITY=16384;
+    
     class Registry
     {
      private:
@@ -57,7 +73,12 @@ namespace LAppS
       Registry(const Registry&)=delete;
       Registry(Registry&)=delete;
       
-      const size_t create(const std::string& name)
+      /**
+       * @brief creates the queue unless it exists. The capacity of an
+       * existing queue is not changed.
+       * @return the queue, callers keep it instead of looking it up again.
+       **/
+      QueueHolderType create(const std::string& name, const size_t capacity=DEFAULT_CAPACITY)
       {
         ITCSyncLock sync(mMutex);
         size_t hash=std::hash<std::string>{}(name);
@@ -65,9 +86,11 @@ namespace LAppS
         
         if(it==mQueueMap.end())
         {
-          mQueueMap.emplace(hash,std::make_shared<QueueType>());
+          auto queue=std::make_shared<QueueType>(capacity);
+          mQueueMap.emplace(hash,queue);
+          return queue;
         }
-        return hash;
+        return it->second;
       }
       
       auto find(const std::string& name)
@@ -0,0 +1,216 @@
+/**
+ *  Copyright 2017-2018, Pavel Kraynyukhov <pavel.kraynyukhov@gmail.com>
+ *
+ *  This file is a part of LAppS (Lua Application Server).
+ *
+ *  LAppS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  LAppS is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with LAppS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  $Id: MQueue.h October 22, 2026 9:40 AM $
+ *
+ **/
+
+
+#ifndef __MQUEUE_H__
+#  define __MQUEUE_H__
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <vector>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <MPMCRing.h>
+
+namespace LAppS
+{
+  namespace MQ
+  {
+    /**
+     * @brief bounded message queue shared by any number of producers and
+     * consumers. Messages go through the lock-free MPMCRing, consumers
+     * sleep on a futex only when the ring is empty. Producers make the
+     * wake up syscall only when somebody sleeps and nobody is woken up
+     * yet; a woken consumer which leaves messages behind wakes up the next
+     * one.
+     **/
+    template <typename T> class Queue
+    {
+     private:
+      MPMCRing<T>                                         mRing;
+      alignas(LAPPS_CACHE_LINE_SIZE) std::atomic<uint32_t> mEvents;
+      std::atomic<uint32_t>                               mWaiters;
+      std::atomic<bool>                                   mSignaled;
+
+      void futex_wait(const uint32_t expected, const long timeout_ms)
+      {
+        if(timeout_ms < 0)
+        {
+          syscall(SYS_futex,reinterpret_cast<uint32_t*>(&mEvents),FUTEX_WAIT_PRIVATE,expected,nullptr,nullptr,0);
+        }
+        else
+        {
+          timespec ts{timeout_ms/1000,(timeout_ms%1000)*1000000};
+          syscall(SYS_futex,reinterpret_cast<uint32_t*>(&mEvents),FUTEX_WAIT_PRIVATE,expected,&ts,nullptr,0);
+        }
+      }
+
+      void notify()
+      {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if((mWaiters.load(std::memory_order_relaxed) > 0)&&
+           (!mSignaled.load(std::memory_order_relaxed))&&
+           (!mSignaled.exchange(true,std::memory_order_acq_rel)))
+        {
+          mEvents.fetch_add(1,std::memory_order_release);
+          syscall(SYS_futex,reinterpret_cast<uint32_t*>(&mEvents),FUTEX_WAKE_PRIVATE,1,nullptr,nullptr,0);
+        }
+      }
+
+      /**
+       * @brief the wake up latch is cleared by every waiter when it
+       * registers and again when it is gone. A latch left over by a
+       * notify() which has raced with a leaving waiter can not silence the
+       * producers of the next one: it clears the latch before it checks the
+       * ring, and a notify() which sets it again afterwards also changes
+       * mEvents, so the futex_wait() returns at once.
+       **/
+      void enter()
+      {
+        mWaiters.fetch_add(1,std::memory_order_seq_cst);
+        mSignaled.store(false,std::memory_order_seq_cst);
+      }
+
+      void leave()
+      {
+        mWaiters.fetch_sub(1,std::memory_order_seq_cst);
+        mSignaled.store(false,std::memory_order_seq_cst);
+      }
+
+     public:
+      explicit Queue(const size_t capacity)
+      : mRing(capacity), mEvents{0}, mWaiters{0}, mSignaled{false}
+      {
+      }
+
+      Queue()=delete;
+      Queue(const Queue&)=delete;
+      Queue(Queue&)=delete;
+
+      const size_t capacity() const
+      {
+        return mRing.capacity();
+      }
+
+      /**
+       * @brief never blocks.
+       * @return false if the queue is full, the value is left intact.
+       **/
+      const bool try_send(T&& value)
+      {
+        if(!mRing.try_push(std::move(value)))
+          return false;
+        notify();
+        return true;
+      }
+
+      const bool try_recv(T& value)
+      {
+        return mRing.try_pop(value);
+      }
+
+      /**
+       * @brief waits up to timeout_ms for a message, forever if the
+       * timeout is negative.
+       * @return false on timeout.
+       **/
+      const bool recv(T& value, const long timeout_ms=-1)
+      {
+        if(mRing.try_pop(value)) return true;
+        if(timeout_ms == 0) return false;
+
+        const auto deadline=std::chrono::steady_clock::now()+std::chrono::milliseconds(timeout_ms);
+        while(true)
+        {
+          const uint32_t events=mEvents.load(std::memory_order_acquire);
+          enter();
+          if(mRing.try_pop(value))
+          {
+            leave();
+            return true;
+          }
+
+          long remains=-1;
+          if(timeout_ms > 0)
+          {
+            // rounded up, a truncated remainder would end the wait early
+            remains=std::chrono::ceil<std::chrono::milliseconds>(deadline-std::chrono::steady_clock::now()).count();
+            if(remains <= 0)
+            {
+              leave();
+              return false;
+            }
+          }
+          futex_wait(events,remains);
+          leave();
+
+          if(mRing.try_pop(value))
+          {
+            if(!mRing.empty()) notify();
+            return true;
+          }
+        }
+      }
+
+      /**
+       * @brief waits up to timeout_ms for the first message like recv(),
+       * then takes whatever else is available, up to max messages total.
+       * @return amount of messages appended to out.
+       **/
+      const size_t recv_many(std::vector<T>& out, const size_t max, const long timeout_ms=-1)
+      {
+        if(max == 0) return 0;
+
+        T value;
+        if(!recv(value,timeout_ms)) return 0;
+        out.push_back(std::move(value));
+
+        size_t count=1;
+        while((count < max)&&mRing.try_pop(value))
+        {
+          out.push_back(std::move(value));
+          ++count;
+        }
+        return count;
+      }
+
+      /**
+       * @brief approximate, lock-free and non-allocating.
+       **/
+      const bool empty() const
+      {
+        return mRing.empty();
+      }
+
+      const size_t size() const
+      {
+        return mRing.size();
+      }
+    };
+  }
+}
+
+#endif /* __MQUEUE_H__ */
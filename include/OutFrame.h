@@ -0,0 +1,86 @@
+/**
+ *  Copyright 2017-2018, Pavel Kraynyukhov <pavel.kraynyukhov@gmail.com>
+ * 
+ *  This file is a part of LAppS (Lua Application Server).
+ *  
+ *  LAppS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *  
+ *  LAppS is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *  
+ *  You should have received a copy of the GNU General Public License
+ *  along with LAppS.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  $Id: OutFrame.h October 20, 2026 9:15 AM $
+ * 
+ **/
+
+
+#ifndef __OUTFRAME_H__
+#  define __OUTFRAME_H__
+
+#include <cstdint>
+#include <memory>
+#include <WSEvent.h>
+#include <WSServerMessage.h>
+
+namespace abstract
+{
+  class WebSocket;
+  class FanOut;
+}
+
+/**
+ * @brief a ready to send WebSocket frame or a broadcast request posted to
+ * the IOWorker which owns the connection (or the subscribers).
+ * 
+ * DATA and CLOSE frames are addressed by fd and the socket address: the
+ * worker never writes to the socket unless it finds the same socket under
+ * the fd in its connections map. SHARED frames are broadcast frames in a
+ * socket's pending queue, the slow subscriber policy may drop them.
+ * FANOUT delivers the buffer to the subscribers in `fanout`, SUBSCRIBE and
+ * UNSUBSCRIBE change the membership of `websocket` in `fanout`.
+ * 
+ * A non-zero `key` marks a frame of a conflating channel: while it waits
+ * in the socket's pending queue, newer frames with the same key replace it.
+ * 
+ * A DATA frame may carry its WebSocket header in `head` (head_size bytes)
+ * with the bare payload in `buffer`, so that a payload is sent as is,
+ * e.a. when an inbound message is forwarded. `offset` counts the header
+ * bytes too.
+ * 
+ * A DATA frame with non-zero `fragment` is the bare payload of a message
+ * of `opcode` sent as fragments of up to `fragment` bytes, the headers
+ * are generated when it is written (WebSocketProtocol::FragmentedMessage).
+ * `offset` counts the bytes of the whole wire layout then.
+ **/
+struct OutFrame
+{
+  enum Kind : uint8_t { DATA, CLOSE, SHARED, FANOUT, SUBSCRIBE, UNSUBSCRIBE };
+  
+  ::abstract::WebSocket*              websocket;
+  int32_t                             fd;
+  Kind                                kind;
+  MSGBufferTypeSPtr                   buffer;
+  size_t                              offset;
+  std::shared_ptr<::abstract::FanOut> fanout;
+  uint64_t                            key;
+  uint8_t                             head_size;
+  uint8_t                             head[10];
+  WebSocketProtocol::OpCode           opcode;
+  uint32_t                            fragment;
+  
+  const size_t size() const
+  {
+    if(fragment != 0)
+      return WebSocketProtocol::FragmentedMessage::size(buffer->size(),fragment);
+    return head_size+buffer->size();
+  }
+};
+
+#endif /* __OUTFRAME_H__ */
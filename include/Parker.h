@@ -0,0 +1,107 @@
+/**
+ *  Copyright 2017-2018, Pavel Kraynyukhov <pavel.kraynyukhov@gmail.com>
+ *
+ *  This file is a part of LAppS (Lua Application Server).
+ *
+ *  LAppS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  LAppS is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with LAppS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  $Id: Parker.h October 19, 2026 10:40 AM $
+ *
+ **/
+
+
+#ifndef __PARKER_H__
+#  define __PARKER_H__
+
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace LAppS
+{
+  /**
+   * @brief futex based parking spot for a single consumer thread.
+   *
+   * Consumer:
+   *   prepare(); if(<re-check queues> is not empty) cancel(); else park(ms);
+   * Producer:
+   *   <publish>; unpark();
+   *
+   * The seq_cst fences on both sides guarantee that either the consumer
+   * sees the published element on the re-check, or the producer sees the
+   * PARKED state and issues the wake up. Producers pay one fence and one
+   * load when the consumer is running.
+   **/
+  class Parker
+  {
+   private:
+    enum : uint32_t { RUNNING=0, PARKED=1 };
+    alignas(64) std::atomic<uint32_t> mState;
+
+    static void futex_wait(std::atomic<uint32_t>* addr, const uint32_t expected, const long timeout_ms)
+    {
+      timespec ts{timeout_ms/1000,(timeout_ms%1000)*1000000};
+      syscall(SYS_futex,reinterpret_cast<uint32_t*>(addr),FUTEX_WAIT_PRIVATE,expected,&ts,nullptr,0);
+    }
+
+    static void futex_wake(std::atomic<uint32_t>* addr)
+    {
+      syscall(SYS_futex,reinterpret_cast<uint32_t*>(addr),FUTEX_WAKE_PRIVATE,1,nullptr,nullptr,0);
+    }
+
+   public:
+    Parker() : mState{RUNNING}
+    {
+    }
+    Parker(const Parker&)=delete;
+    Parker(Parker&)=delete;
+
+    void prepare()
+    {
+      mState.store(PARKED,std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+
+    void cancel()
+    {
+      mState.store(RUNNING,std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief sleeps until unpark() or the timeout. Spurious returns are
+     * allowed, caller must re-check its queues anyway.
+     **/
+    void park(const long timeout_ms)
+    {
+      if(mState.load(std::memory_order_acquire) == PARKED)
+        futex_wait(&mState,PARKED,timeout_ms);
+      mState.store(RUNNING,std::memory_order_relaxed);
+    }
+
+    void unpark()
+    {
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if(mState.load(std::memory_order_relaxed) == PARKED)
+      {
+        if(mState.exchange(RUNNING,std::memory_order_acq_rel) == PARKED)
+          futex_wake(&mState);
+      }
+    }
+  };
+}
+
+#endif /* __PARKER_H__ */
@@ -0,0 +1,161 @@
+/**
+ *  Copyright 2017-2018, Pavel Kraynyukhov <pavel.kraynyukhov@gmail.com>
+ *
+ *  This file is a part of LAppS (Lua Application Server).
+ *
+ *  LAppS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  LAppS is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with LAppS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  $Id: SPSCRing.h October 19, 2026 10:12 AM $
+ *
+ **/
+
+
+#ifndef __SPSCRING_H__
+#  define __SPSCRING_H__
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <system_error>
+
+#ifndef LAPPS_CACHE_LINE_SIZE
+#  define LAPPS_CACHE_LINE_SIZE 64
+#endif
+
+namespace LAppS
+{
+  /**
+   * @brief bounded wait-free single producer / single consumer ring.
+   * Capacity is rounded up to the power of two. Producer and consumer
+   * indices live on separate cache lines, each side keeps a cached copy
+   * of the opposite index to avoid touching the shared line on every
+   * operation.
+   *
+   * Producer side: full(), try_push().
+   * Consumer side: empty(), front(), pop(), try_pop().
+   **/
+  template <typename T> class SPSCRing
+  {
+   private:
+    alignas(LAPPS_CACHE_LINE_SIZE) std::atomic<size_t> mHead; // consumer
+    size_t                                             mCachedTail;
+
+    alignas(LAPPS_CACHE_LINE_SIZE) std::atomic<size_t> mTail; // producer
+    size_t                                             mCachedHead;
+
+    alignas(LAPPS_CACHE_LINE_SIZE) const size_t        mMask;
+    std::vector<T>                                     mSlots;
+
+    static const size_t roundup(const size_t capacity)
+    {
+      if(capacity < 2)
+        throw std::system_error(EINVAL,std::system_category(),"SPSCRing capacity must be at least 2");
+      size_t result=1;
+      while(result < capacity) result<<=1;
+      return result;
+    }
+
+   public:
+    explicit SPSCRing(const size_t capacity)
+    : mHead{0}, mCachedTail{0}, mTail{0}, mCachedHead{0},
+      mMask{roundup(capacity)-1}, mSlots(mMask+1)
+    {
+    }
+
+    SPSCRing()=delete;
+    SPSCRing(const SPSCRing&)=delete;
+    SPSCRing(SPSCRing&)=delete;
+
+    const size_t capacity() const
+    {
+      return mMask+1;
+    }
+
+    /**
+     * @brief sequence number of the next slot to be pushed. Producer only.
+     **/
+    const size_t tail() const
+    {
+      return mTail.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief producer side: true if there is no free slot.
+     **/
+    const bool full()
+    {
+      const size_t tail=mTail.load(std::memory_order_relaxed);
+      if(tail - mCachedHead <= mMask) return false;
+      mCachedHead=mHead.load(std::memory_order_acquire);
+      return (tail - mCachedHead) > mMask;
+    }
+
+    template <typename V> const bool try_push(V&& value)
+    {
+      if(full()) return false;
+      const size_t tail=mTail.load(std::memory_order_relaxed);
+      mSlots[tail & mMask]=std::forward<V>(value);
+      mTail.store(tail+1,std::memory_order_release);
+      return true;
+    }
+
+    /**
+     * @brief consumer side: true if there is nothing to consume.
+     **/
+    const bool empty()
+    {
+      const size_t head=mHead.load(std::memory_order_relaxed);
+      if(head != mCachedTail) return false;
+      mCachedTail=mTail.load(std::memory_order_acquire);
+      return head == mCachedTail;
+    }
+
+    /**
+     * @brief consumer side: the oldest element or nullptr. The slot stays
+     * owned by the consumer until pop().
+     **/
+    T* front()
+    {
+      if(empty()) return nullptr;
+      return &mSlots[mHead.load(std::memory_order_relaxed) & mMask];
+    }
+
+    void pop()
+    {
+      mHead.store(mHead.load(std::memory_order_relaxed)+1,std::memory_order_release);
+    }
+
+    const bool try_pop(T& value)
+    {
+      T* ptr=front();
+      if(ptr == nullptr) return false;
+      value=std::move(*ptr);
+      pop();
+      return true;
+    }
+
+    /**
+     * @brief approximate amount of elements, safe to call from any thread.
+     **/
+    const size_t size() const
+    {
+      const size_t head=mHead.load(std::memory_order_acquire);
+      const size_t tail=mTail.load(std::memory_order_acquire);
+      return tail > head ? tail - head : 0;
+    }
+  };
+}
+
+#endif /* __SPSCRING_H__ */
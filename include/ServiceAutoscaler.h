@@ -0,0 +1,399 @@
+/**
+ *  Copyright 2017-2018, Pavel Kraynyukhov <pavel.kraynyukhov@gmail.com>
+ *
+ *  This file is a part of LAppS (Lua Application Server).
+ *
+ *  LAppS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  LAppS is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with LAppS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  $Id: ServiceAutoscaler.h October 27, 2026 9:45 AM $
+ *
+ **/
+
+
+#ifndef __SERVICEAUTOSCALER_H__
+#  define __SERVICEAUTOSCALER_H__
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <abstract/Runnable.h>
+#include <sys/mutex.h>
+#include <sys/synclock.h>
+#include <sys/Nanosleep.h>
+
+#include <Config.h>
+#include <ServiceRegistry.h>
+
+#include <ext/json.hpp>
+
+using json = nlohmann::json;
+
+namespace LAppS
+{
+  /**
+   * @brief elastic amount of instances of the reactive services.
+   *
+   * A service with the "autoscale" section in lapps.json:
+   *   "autoscale" : {
+   *     "min" : 1, "max" : 8,         // instances, "instances" is the initial amount
+   *     "max_latency_ms" : 50,        // estimated queue wait of an instance
+   *     "high_depth" : 256,           // queued events per instance
+   *     "busy_high" : 0.8,            // mean share of time the instances are busy
+   *     "busy_low" : 0.25,
+   *     "idle_seconds" : 30,          // below busy_low with empty queues
+   *     "cooldown_seconds" : 5        // between two scaling actions
+   *   }
+   * gets one more instance when any of the thresholds is exceeded, and one
+   * instance less when it stays idle for idle_seconds. The new instances
+   * have their Lua state loaded and onStart() done before they are
+   * registered. Only an instance without connections is retired: the
+   * connections are not moved between instances, and a long-lived
+   * WebSocket would keep a retired one alive for good. A retired instance
+   * takes no new connections and is shut down when the connections which
+   * have raced with its retirement are gone, until then it counts against
+   * max. New connections go to the least loaded instance
+   * (ServiceRegistry::findByTarget()).
+   *
+   * The queue wait is estimated as depth times the mean processing time of
+   * an event over the last interval.
+   **/
+  class ServiceAutoscaler : public ::itc::abstract::IRunnable
+  {
+   public:
+    typedef std::function<ServiceInstanceStoreType()> Spawner;
+
+   private:
+    typedef std::chrono::steady_clock Clock;
+    typedef abstract::Service::LoadSample LoadSample;
+
+    static constexpr long INTERVAL_MS=1000;
+    static constexpr long NAP_MS=100;
+
+    struct Policy
+    {
+      size_t  min;
+      size_t  max;
+      double  max_latency_ms;
+      size_t  high_depth;
+      double  busy_high;
+      double  busy_low;
+      long    idle_seconds;
+      long    cooldown_seconds;
+    };
+
+    struct Managed
+    {
+      Policy                        policy;
+      Spawner                       spawn;
+      std::map<size_t,LoadSample>   samples;
+      Clock::time_point             last_action;
+      Clock::time_point             idle_since;
+      bool                          idle;
+    };
+
+    struct Retired
+    {
+      std::string                   name;
+      ServiceInstanceStoreType      instance;
+    };
+
+    std::atomic<bool>                   mMayRun;
+    ::itc::sys::mutex                   mMutex;
+    std::map<std::string,Managed>       mServices;
+    std::vector<Retired>                mDraining;
+    Clock::time_point                   mLastTick;
+
+    template <typename T> static const T getValue(const json& section, const char* key, const T& default_value)
+    {
+      auto it=section.find(key);
+      if((it == section.end())||(!it.value().is_number()))
+        return default_value;
+      return it.value().get<T>();
+    }
+
+    static const bool getPolicy(const std::string& name, Policy& policy)
+    {
+      const json& service=LAppSConfig::getInstance()->getServiceConfig(name);
+      auto autoscale=service.find("autoscale");
+      if((autoscale == service.end())||(!autoscale.value().is_object()))
+        return false;
+
+      auto standalone=service.find("standalone");
+      if((standalone != service.end())&&standalone.value().is_boolean()&&standalone.value().get<bool>())
+      {
+        ITC_ERROR(__FILE__,__LINE__,"Service {}: autoscale is supported for reactive services only",name.c_str());
+        return false;
+      }
+
+      const json& section=autoscale.value();
+      const size_t instances=getValue<size_t>(service,"instances",1);
+
+      policy.min=getValue<size_t>(section,"min",1);
+      policy.max=getValue<size_t>(section,"max",instances);
+      policy.max_latency_ms=getValue<double>(section,"max_latency_ms",50);
+      policy.high_depth=getValue<size_t>(section,"high_depth",256);
+      policy.busy_high=getValue<double>(section,"busy_high",0.8);
+      policy.busy_low=getValue<double>(section,"busy_low",0.25);
+      policy.idle_seconds=getValue<long>(section,"idle_seconds",30);
+      policy.cooldown_seconds=getValue<long>(section,"cooldown_seconds",5);
+
+      if((policy.min == 0)||(policy.max < policy.min)||(policy.busy_low >= policy.busy_high))
+      {
+        ITC_ERROR(__FILE__,__LINE__,"Service {}: invalid autoscale section (min: {}, max: {}, busy_low: {}, busy_high: {}), autoscaling is disabled",
+          name.c_str(),policy.min,policy.max,policy.busy_low,policy.busy_high
+        );
+        return false;
+      }
+      return true;
+    }
+
+    /**
+     * @brief shuts down the retired instances without connections and
+     * queued events.
+     **/
+    void drain()
+    {
+      auto it=std::remove_if(
+        mDraining.begin(),mDraining.end(),
+        [](const Retired& retired)
+        {
+          const auto& runnable=retired.instance->getRunnable();
+          if((runnable->connections() > 0)||(runnable->getLoad().depth > 0))
+            return false;
+          ITC_INFO(__FILE__,__LINE__,"Service [{}]: retired instance [{}] is drained, shutting down",retired.name.c_str(),runnable->getInstanceId());
+          runnable->shutdown();
+          return true;
+        }
+      );
+      mDraining.erase(it,mDraining.end());
+    }
+
+    void scaleUp(const std::string& name, Managed& service, const size_t count)
+    {
+      try
+      {
+        // the factory returns the instance with its Lua state ready
+        SServiceRegistry::getInstance()->reg(service.spawn());
+        ITC_INFO(__FILE__,__LINE__,"Service [{}] is scaled up to {} instances",name.c_str(),count+1);
+      }
+      catch(const std::exception& e)
+      {
+        ITC_ERROR(__FILE__,__LINE__,"Service [{}]: can't start a new instance: {}",name.c_str(),e.what());
+      }
+    }
+
+    void scaleDown(const std::string& name, const size_t instance_id, const size_t count)
+    {
+      auto instance=SServiceRegistry::getInstance()->retire(name,instance_id);
+      if(instance)
+      {
+        ITC_INFO(__FILE__,__LINE__,"Service [{}] is scaled down to {} instances, instance [{}] is draining",name.c_str(),count-1,instance_id);
+        mDraining.push_back(Retired{name,std::move(instance)});
+      }
+    }
+
+    const size_t draining(const std::string& name) const
+    {
+      return std::count_if(
+        mDraining.begin(),mDraining.end(),
+        [&name](const Retired& retired)
+        {
+          return retired.name == name;
+        }
+      );
+    }
+
+    void check(const std::string& name, Managed& service, const Clock::time_point& now, const double interval_ns)
+    {
+      size_t count=0;
+      size_t depth=0;
+      double busy=0;
+      double latency_ms=0;
+      bool   has_candidate=false;
+      size_t candidate=0;
+      std::map<size_t,LoadSample> samples;
+
+      for(const auto& instance : SServiceRegistry::getInstance()->getInstances(name))
+      {
+        const LoadSample load=instance->getLoad();
+        const size_t id=instance->getInstanceId();
+
+        auto previous=service.samples.find(id);
+        if((previous != service.samples.end())&&(interval_ns > 0))
+        {
+          const double busy_ns=load.busy_ns-previous->second.busy_ns;
+          const size_t processed=load.processed-previous->second.processed;
+          busy+=busy_ns/interval_ns;
+          if(processed > 0)
+            latency_ms=std::max(latency_ms,load.depth*(busy_ns/processed)/1000000.0);
+        }
+
+        if((!has_candidate)&&(instance->connections() == 0))
+        {
+          has_candidate=true;
+          candidate=id;
+        }
+
+        depth+=load.depth;
+        samples.emplace(id,load);
+        ++count;
+      }
+      service.samples.swap(samples);
+
+      if(count == 0)
+        return;
+
+      busy/=count;
+
+      if(count < service.policy.min)
+      {
+        scaleUp(name,service,count);
+        service.last_action=now;
+        return;
+      }
+
+      if(now-service.last_action < std::chrono::seconds(service.policy.cooldown_seconds))
+        return;
+
+      const bool overloaded=(latency_ms > service.policy.max_latency_ms)||
+                            (depth/count > service.policy.high_depth)||
+                            (busy > service.policy.busy_high);
+      if(overloaded)
+      {
+        service.idle=false;
+        if(count+draining(name) < service.policy.max)
+        {
+          scaleUp(name,service,count);
+          service.last_action=now;
+        }
+        return;
+      }
+
+      if((busy >= service.policy.busy_low)||(depth > 0))
+      {
+        service.idle=false;
+        return;
+      }
+
+      if(!service.idle)
+      {
+        service.idle=true;
+        service.idle_since=now;
+        return;
+      }
+
+      if(has_candidate&&(count > service.policy.min)&&(now-service.idle_since >= std::chrono::seconds(service.policy.idle_seconds)))
+      {
+        scaleDown(name,candidate,count);
+        service.last_action=now;
+        service.idle_since=now;
+      }
+    }
+
+   public:
+    explicit ServiceAutoscaler()
+    : mMayRun{true}, mMutex(), mServices(), mDraining(), mLastTick(Clock::now())
+    {
+    }
+
+    ServiceAutoscaler(const ServiceAutoscaler&)=delete;
+    ServiceAutoscaler(ServiceAutoscaler&)=delete;
+
+    ~ServiceAutoscaler()
+    {
+      shutdown();
+      for(auto& retired : mDraining)
+        retired.instance->getRunnable()->shutdown();
+    }
+
+    /**
+     * @brief starts autoscaling of the service if it has the "autoscale"
+     * section. spawn() creates a new instance of the service.
+     **/
+    void manage(const std::string& name, const Spawner& spawn)
+    {
+      Policy policy;
+      if(!getPolicy(name,policy))
+        return;
+
+      ITCSyncLock sync(mMutex);
+      mServices[name]=Managed{policy,spawn,std::map<size_t,LoadSample>(),Clock::now(),Clock::now(),false};
+      ITC_INFO(__FILE__,__LINE__,"Service [{}] is autoscaled within {}..{} instances",name.c_str(),policy.min,policy.max);
+    }
+
+    /**
+     * @brief stops autoscaling of the service, its retired instances are
+     * shut down.
+     **/
+    void unmanage(const std::string& name)
+    {
+      ITCSyncLock sync(mMutex);
+      mServices.erase(name);
+      auto it=std::remove_if(
+        mDraining.begin(),mDraining.end(),
+        [&name](const Retired& retired)
+        {
+          if(retired.name != name)
+            return false;
+          retired.instance->getRunnable()->shutdown();
+          return true;
+        }
+      );
+      mDraining.erase(it,mDraining.end());
+    }
+
+    void onCancel()
+    {
+      shutdown();
+    }
+
+    void shutdown() final
+    {
+      mMayRun.store(false);
+    }
+
+    void execute()
+    {
+      ::itc::sys::Nap nap;
+
+      while(mMayRun.load())
+      {
+        nap.usleep(NAP_MS*1000);
+
+        const auto now=Clock::now();
+        if(now-mLastTick < std::chrono::milliseconds(INTERVAL_MS))
+          continue;
+
+        const double interval_ns=std::chrono::duration_cast<std::chrono::nanoseconds>(now-mLastTick).count();
+        mLastTick=now;
+
+        ITCSyncLock sync(mMutex);
+        drain();
+        for(auto& service : mServices)
+        {
+          if(!mMayRun.load()) break;
+          check(service.first,service.second,now,interval_ns);
+        }
+      }
+    }
+  };
+}
+
+#endif /* __SERVICEAUTOSCALER_H__ */
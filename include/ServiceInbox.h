@@ -0,0 +1,266 @@
+/**
+ *  Copyright 2017-2018, Pavel Kraynyukhov <pavel.kraynyukhov@gmail.com>
+ *
+ *  This file is a part of LAppS (Lua Application Server).
+ *
+ *  LAppS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  LAppS is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with LAppS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  $Id: ServiceInbox.h October 19, 2026 11:05 AM $
+ *
+ **/
+
+
+#ifndef __SERVICEINBOX_H__
+#  define __SERVICEINBOX_H__
+
+#include <queue>
+#include <vector>
+#include <memory>
+#include <limits>
+
+#include <sys/mutex.h>
+#include <sys/synclock.h>
+
+#include <AppInEvent.h>
+#include <SPSCRing.h>
+#include <Parker.h>
+
+namespace LAppS
+{
+  /**
+   * @brief compact representation of AppInEvent inside of the SPSC ring.
+   * The message buffer is kept in the lane's buffer table at index
+   * `buffer`, so that ring slots stay 16 bytes and refcounts are not
+   * touched on the way through the ring.
+   **/
+  struct InboxEvent
+  {
+    ::abstract::WebSocket*  websocket;
+    uint32_t                opcode;
+    uint32_t                buffer;
+  };
+
+  /**
+   * @brief inbound events queue of a reactive service instance.
+   *
+   * Every IOWorker gets its own bounded SPSC lane, so the producers never
+   * contend with each other. When a lane is full the events are spilled
+   * into the lane's locked overflow queue, which is used until the consumer
+   * drains it (this keeps per-connection ordering). Threads which are not
+   * IOWorkers go through the locked foreign queue.
+   *
+   * The consumer parks on a futex only when all lanes are empty.
+   **/
+  class ServiceInbox
+  {
+   public:
+    static const size_t FOREIGN=std::numeric_limits<size_t>::max();
+
+    /**
+     * @brief lane id of the current thread. IOWorkers set it to their ID
+     * on start, any other thread uses the foreign queue.
+     **/
+    static size_t& producer()
+    {
+      static thread_local size_t id=FOREIGN;
+      return id;
+    }
+
+   private:
+    struct Lane
+    {
+      SPSCRing<InboxEvent>            mRing;
+      std::vector<MSGBufferTypeSPtr>  mBuffers;
+      const size_t                    mMask;
+
+      itc::sys::mutex                 mSpillMutex;
+      std::queue<AppInEvent>          mSpill;
+      std::atomic<size_t>             mSpillSize;
+
+      explicit Lane(const size_t capacity)
+      : mRing(capacity), mBuffers(mRing.capacity()), mMask(mRing.capacity()-1),
+        mSpillMutex(), mSpill(), mSpillSize{0}
+      {
+      }
+
+      void push(AppInEvent&& event)
+      {
+        if((mSpillSize.load(std::memory_order_relaxed) == 0)&&(!mRing.full()))
+        {
+          const uint32_t idx=static_cast<uint32_t>(mRing.tail() & mMask);
+          mBuffers[idx]=std::move(event.message);
+          mRing.try_push(InboxEvent{event.websocket,static_cast<uint32_t>(event.opcode),idx});
+        }
+        else
+        {
+          ITCSyncLock sync(mSpillMutex);
+          mSpill.push(std::move(event));
+          mSpillSize.store(mSpill.size(),std::memory_order_release);
+        }
+      }
+
+      void drainRing(std::vector<AppInEvent>& out)
+      {
+        while(InboxEvent* ev=mRing.front())
+        {
+          out.push_back(
+            AppInEvent{
+              static_cast<WebSocketProtocol::OpCode>(ev->opcode),
+              ev->websocket,
+              std::move(mBuffers[ev->buffer])
+            }
+          );
+          mRing.pop();
+        }
+      }
+
+      void drain(std::vector<AppInEvent>& out)
+      {
+        drainRing(out);
+        if(mSpillSize.load(std::memory_order_acquire) > 0)
+        {
+          ITCSyncLock sync(mSpillMutex);
+          // the producer does not touch the ring while spilled, so
+          // everything left in the ring is older than the spill.
+          drainRing(out);
+          while(!mSpill.empty())
+          {
+            out.push_back(std::move(mSpill.front()));
+            mSpill.pop();
+          }
+          mSpillSize.store(0,std::memory_order_release);
+        }
+      }
+
+      const bool empty()
+      {
+        return mRing.empty()&&(mSpillSize.load(std::memory_order_acquire) == 0);
+      }
+
+      const size_t size() const
+      {
+        return mRing.size()+mSpillSize.load(std::memory_order_relaxed);
+      }
+    };
+
+    std::vector<std::unique_ptr<Lane>>  mLanes;
+
+    itc::sys::mutex                     mForeignMutex;
+    std::queue<AppInEvent>              mForeign;
+    std::atomic<size_t>                 mForeignSize;
+
+    std::shared_ptr<Parker>             mParker;
+
+   public:
+    explicit ServiceInbox(const size_t lanes, const size_t capacity)
+    : mLanes(), mForeignMutex(), mForeign(), mForeignSize{0}, mParker(std::make_shared<Parker>())
+    {
+      mLanes.reserve(lanes);
+      for(size_t i=0;i<lanes;++i)
+        mLanes.push_back(std::make_unique<Lane>(capacity));
+    }
+
+    ServiceInbox()=delete;
+    ServiceInbox(const ServiceInbox&)=delete;
+    ServiceInbox(ServiceInbox&)=delete;
+
+    void send(AppInEvent&& event)
+    {
+      const size_t lane=producer();
+      if(lane < mLanes.size())
+      {
+        mLanes[lane]->push(std::move(event));
+      }
+      else
+      {
+        ITCSyncLock sync(mForeignMutex);
+        mForeign.push(std::move(event));
+        mForeignSize.store(mForeign.size(),std::memory_order_release);
+      }
+      mParker->unpark();
+    }
+
+    /**
+     * @brief consumer side: moves all available events into out.
+     * @return amount of events appended.
+     **/
+    const size_t drain(std::vector<AppInEvent>& out)
+    {
+      const size_t before=out.size();
+      for(auto& lane : mLanes)
+        lane->drain(out);
+
+      if(mForeignSize.load(std::memory_order_acquire) > 0)
+      {
+        ITCSyncLock sync(mForeignMutex);
+        while(!mForeign.empty())
+        {
+          out.push_back(std::move(mForeign.front()));
+          mForeign.pop();
+        }
+        mForeignSize.store(0,std::memory_order_release);
+      }
+      return out.size()-before;
+    }
+
+    /**
+     * @brief consumer side: parks the caller for up to timeout_ms if there
+     * are no events.
+     **/
+    void wait(const long timeout_ms)
+    {
+      mParker->prepare();
+      if(!empty())
+      {
+        mParker->cancel();
+        return;
+      }
+      mParker->park(timeout_ms);
+    }
+
+    /**
+     * @brief wakes up the consumer (e.g. on shutdown).
+     **/
+    void wakeup()
+    {
+      mParker->unpark();
+    }
+
+    const std::shared_ptr<Parker>& parker() const
+    {
+      return mParker;
+    }
+
+    const bool empty()
+    {
+      for(auto& lane : mLanes)
+        if(!lane->empty()) return false;
+      return mForeignSize.load(std::memory_order_acquire) == 0;
+    }
+
+    /**
+     * @brief approximate amount of queued events, lock-free, safe to call
+     * from any thread.
+     **/
+    const size_t size() const
+    {
+      size_t result=mForeignSize.load(std::memory_order_relaxed);
+      for(auto& lane : mLanes)
+        result+=lane->size();
+      return result;
+    }
+  };
+}
+
+#endif /* __SERVICEINBOX_H__ */
@@ -28,6 +28,7 @@
 #include <memory>
 #include <vector>
 #include <map>
+#include <limits>
 
 #include <sys/CancelableThread.h>
 #include <sys/mutex.h>
@@ -82,6 +83,68 @@ namespace LAppS
       throw std::runtime_error("ServicesInstanceHolder::next() - empty");
     }
     
+    /**
+     * @brief the instance with the least connections and queued events,
+     * round robin among the equally loaded ones.
+     **/
+    const ServiceSPtrType leastLoaded() const
+    {
+      if(!hasNext())
+        throw std::runtime_error("ServicesInstanceHolder::leastLoaded() - empty");
+      
+      const size_t count=mInstances.size();
+      const size_t start=(current+1)%count;
+      size_t found=start;
+      size_t min_load=std::numeric_limits<size_t>::max();
+      
+      for(size_t i=0;i<count;++i)
+      {
+        const size_t idx=(start+i)%count;
+        const auto& instance=mInstances[idx]->getRunnable();
+        const size_t load=instance->connections()+instance->getLoad().depth;
+        if(load < min_load)
+        {
+          min_load=load;
+          found=idx;
+        }
+      }
+      current=found;
+      return mInstances[found]->getRunnable();
+    }
+    
+    const size_t size() const
+    {
+      return mInstances.size();
+    }
+    
+    const std::vector<ServiceSPtrType> runnables() const
+    {
+      std::vector<ServiceSPtrType> result;
+      result.reserve(mInstances.size());
+      for(const auto& instance : mInstances)
+        result.push_back(instance->getRunnable());
+      return result;
+    }
+    
+    /**
+     * @brief takes the instance out, the instance keeps running.
+     **/
+    ServiceInstanceStoreType remove(const size_t& _id)
+    {
+      for(auto it=mInstances.begin();it!=mInstances.end();++it)
+      {
+        if((*it)->getRunnable()->getInstanceId() == _id)
+        {
+          ServiceInstanceStoreType instance=std::move(*it);
+          mInstances.erase(it);
+          if(current >= mInstances.size())
+            current=0;
+          return instance;
+        }
+      }
+      return nullptr;
+    }
+    
     const bool pop_back()
     {
       if(hasNext())
@@ -131,6 +194,12 @@ namespace LAppS
           j["Reactive"] = false;
           j["Standalone"] = true;
         }
+        
+        auto stats=instance->getRunnable()->getStats();
+        if(!stats.empty())
+        {
+          j["Stats"] = std::move(stats);
+        }
         retobj->push_back(j);
       }
       return retobj;
@@ -220,7 +289,7 @@ namespace LAppS
       }
     }
     
-    const auto& findByName(const std::string& name) const
+    const ServiceSPtrType findByName(const std::string& name) const
     {
       ITCSyncLock sync(mMutex);
       auto it=mServices.find(name);
@@ -231,7 +300,7 @@ namespace LAppS
       throw std::system_error(EINVAL,std::system_category(),fmt::format("ServiceRegistry::findByName({}), - no such service",name));
     }
     
-    const auto& findByTarget(const std::string& target) const
+    const ServiceSPtrType findByTarget(const std::string& target) const
     {
       ITCSyncLock sync(mMutex);
       auto tit=mTargets2Names.find(target);
@@ -240,14 +309,14 @@ namespace LAppS
         auto it=mServices.find(tit->second);
         if(it!=mServices.end())
         {
-          return it->second.next();
+          return it->second.leastLoaded();
         }
         throw std::system_error(EINVAL,std::system_category(),fmt::format("ServiceRegistry::findByTarget({}), - no such service",tit->second));
       }
       throw std::system_error(EINVAL,std::system_category(),fmt::format("ServiceRegistry::findByTarget({}), - no such target",target));
     }
     
-    const auto& findById(const size_t& _id) const
+    const ServiceSPtrType findById(const size_t& _id) const
     {
       ITCSyncLock sync(mCleanMutex);
       ITCSyncLock sync1(mMutex);
@@ -264,6 +333,32 @@ namespace LAppS
       throw std::system_error(EINVAL,std::system_category(),fmt::format("ServiceRegistry::findById({}), - no such instance",_id));
     }
     
+    /**
+     * @brief instances of the service, empty if it is not running.
+     **/
+    const std::vector<ServiceSPtrType> getInstances(const std::string& name) const
+    {
+      ITCSyncLock sync(mMutex);
+      auto it=mServices.find(name);
+      if(it!=mServices.end())
+        return it->second.runnables();
+      return std::vector<ServiceSPtrType>();
+    }
+    
+    /**
+     * @brief stops routing new connections to the instance. The instance is
+     * returned to its caller running, to be shut down when it is drained.
+     * The last instance of a service is never retired.
+     **/
+    ServiceInstanceStoreType retire(const std::string& name, const size_t& _id)
+    {
+      ITCSyncLock sync(mMutex);
+      auto it=mServices.find(name);
+      if((it==mServices.end())||(it->second.size() < 2))
+        return nullptr;
+      return it->second.remove(_id);
+    }
+    
     const auto list() const noexcept
     {
       ITCSyncLock sync(mMutex);
@@ -64,7 +64,7 @@ namespace LAppS
       
       void sendForbidden(const WSSPtr& wssocket)
       {
-        wssocket->send(forbidden);
+        wssocket->sendDirect(forbidden);
         wssocket->close();
       }
       
@@ -73,6 +73,12 @@ namespace LAppS
         mHTTPRParser.clear();
         
         int received=wssocket->recv(headerBuffer);
+        if(received == 0)
+        {
+          // TLS record is not complete yet
+          wssocket->rearm();
+          return;
+        }
         if(received != -1)
         {
           if(static_cast<size_t>(received) < headerBuffer.size())
@@ -84,7 +90,7 @@ namespace LAppS
             
             prepareOKResponse(response,app->getName(),app->getProtocol());
             
-            int sent=wssocket->send(response);
+            int sent=wssocket->sendDirect(response);
             
             try {
               if(sent > 0)
@@ -105,7 +111,7 @@ namespace LAppS
                         "Connection from {} to {} has been filtered according to ACL",
                         wssocket->getPeerAddress().c_str(),app->getName()
                       );
-                      wssocket->send(forbidden);
+                      wssocket->sendDirect(forbidden);
                       wssocket->close();
                       return;
                     }
@@ -142,7 +148,7 @@ namespace LAppS
               "Shakespeer::handshake() was unsuccessful for peer {}. Received %u bytes. Header Content: {}.",
               wssocket->getPeerAddress().c_str(), received, headerBuffer.data()
             );
-            wssocket->send(forbidden);
+            wssocket->sendDirect(forbidden);
             wssocket->close();
             return;
           }
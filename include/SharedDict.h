@@ -0,0 +1,522 @@
+/**
+ *  Copyright 2017-2018, Pavel Kraynyukhov <pavel.kraynyukhov@gmail.com>
+ *
+ *  This file is a part of LAppS (Lua Application Server).
+ *
+ *  LAppS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  LAppS is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with LAppS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  $Id: SharedDict.h October 28, 2026 3:15 PM $
+ *
+ **/
+
+
+#ifndef __SHAREDDICT_H__
+#  define __SHAREDDICT_H__
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <sys/mutex.h>
+#include <sys/synclock.h>
+#include <Singleton.h>
+
+#include <Config.h>
+
+namespace LAppS
+{
+  /**
+   * @brief key/value dictionary shared by all the Lua states of the process,
+   * see modules/shdict.h.
+   *
+   * The keys are hashed into SHARDS shards, each one with its own lock and
+   * its own part of the fixed-size arena. The entries are allocated from
+   * the arena through size-class free lists, the memory of deleted entries
+   * is reused for the new ones of similar size. The entries of a shard are a
+   * tree rather than a hash table: a rehash would leave the old bucket
+   * array in the arena. Nothing is evicted, set() of a new entry fails
+   * when the arena of its shard is exhausted.
+   *
+   * Expired entries are invisible and removed when touched or by
+   * flushExpired().
+   **/
+  class SharedDict
+  {
+   public:
+    static constexpr size_t SHARDS=16;
+    // keys and string values
+    static constexpr size_t MAX_ITEM_SIZE=65536;
+    // room for a few items of MAX_ITEM_SIZE in each shard
+    static constexpr size_t MIN_SHARD_SIZE=262144;
+
+    enum class Type : uint8_t { BOOLEAN, NUMBER, STRING };
+    enum class Status : uint8_t { OK, NOT_FOUND, EXISTS, NOT_A_NUMBER, NO_MEMORY, TOO_LARGE };
+
+    /**
+     * @brief a value to store, the string is copied into the arena.
+     **/
+    struct Item
+    {
+      Type              type;
+      bool              boolean;
+      double            number;
+      std::string_view  string;
+    };
+
+    /**
+     * @brief a copy of the stored value, see get().
+     **/
+    struct Value
+    {
+      Type          type;
+      bool          boolean;
+      double        number;
+      std::string   string;
+    };
+
+    /**
+     * @brief a stored value.
+     **/
+    struct Entry
+    {
+      typedef std::pmr::polymorphic_allocator<char> allocator_type;
+
+      Type              type;
+      bool              boolean;
+      double            number;
+      std::pmr::string  string;
+      int64_t           expires; // steady clock ns, 0 - never
+
+      explicit Entry(const allocator_type& allocator)
+      : type{Type::BOOLEAN}, boolean{false}, number{0}, string(allocator), expires{0}
+      {
+      }
+
+      Entry(const Entry& other, const allocator_type& allocator)
+      : type{other.type}, boolean{other.boolean}, number{other.number},
+        string(other.string,allocator), expires{other.expires}
+      {
+      }
+
+      Entry(Entry&& other, const allocator_type& allocator)
+      : type{other.type}, boolean{other.boolean}, number{other.number},
+        string(std::move(other.string),allocator), expires{other.expires}
+      {
+      }
+    };
+
+   private:
+    typedef std::pmr::map<std::pmr::string,Entry,std::less<>> Entries;
+
+    /**
+     * @brief the memory of a shard: segregated free lists over the arena.
+     * A block is rounded up to its size class, a freed block goes to the
+     * list of its class and is reused by the next allocation of the class.
+     * The arena never takes anything back, so every block size a shard
+     * asks for has a class: up to a string of MAX_ITEM_SIZE with the
+     * terminator and the doubled capacity of a growing std::string.
+     **/
+    class ShardResource : public std::pmr::memory_resource
+    {
+     private:
+      static constexpr size_t ALIGNMENT=alignof(std::max_align_t);
+      static constexpr size_t MAX_BLOCK=2*MAX_ITEM_SIZE+2;
+
+      /**
+       * @brief multiples of 16 up to 64 bytes, then four classes per
+       * power of two.
+       **/
+      static constexpr size_t sizeClass(const size_t bytes)
+      {
+        if(bytes <= 64)
+          return (bytes == 0) ? 0 : (bytes-1)/16;
+        const size_t last=bytes-1;
+        size_t order=6;
+        while((last>>(order+1)) != 0) ++order;
+        return 4+(order-6)*4+((last>>(order-2))-4);
+      }
+
+      static constexpr size_t classSize(const size_t index)
+      {
+        if(index < 4)
+          return (index+1)*16;
+        const size_t order=6+(index-4)/4;
+        return (((index-4)%4)+5)<<(order-2);
+      }
+
+      struct FreeBlock
+      {
+        FreeBlock* next;
+      };
+
+      std::unique_ptr<std::byte[]>            mArena;
+      std::pmr::monotonic_buffer_resource     mArenaResource;
+      std::vector<FreeBlock*>                 mFree;
+
+      void* do_allocate(const size_t bytes, const size_t alignment) override
+      {
+        if((bytes > MAX_BLOCK)||(alignment > ALIGNMENT))
+          throw std::bad_alloc();
+        const size_t index=sizeClass(bytes);
+        if(FreeBlock* block=mFree[index])
+        {
+          mFree[index]=block->next;
+          return block;
+        }
+        return mArenaResource.allocate(classSize(index),ALIGNMENT);
+      }
+
+      void do_deallocate(void* ptr, const size_t bytes, const size_t alignment) override
+      {
+        const size_t index=sizeClass(bytes);
+        mFree[index]=new(ptr) FreeBlock{mFree[index]};
+      }
+
+      bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+      {
+        return this == &other;
+      }
+
+     public:
+      explicit ShardResource(const size_t bytes)
+      : mArena(new std::byte[bytes]),
+        mArenaResource(mArena.get(),bytes,std::pmr::null_memory_resource()),
+        mFree(sizeClass(MAX_BLOCK)+1,nullptr)
+      {
+      }
+    };
+
+    struct Shard
+    {
+      ::itc::sys::mutex                     mutex;
+      ShardResource                         pool;
+      Entries                               entries;
+
+      explicit Shard(const size_t bytes)
+      : mutex(), pool(bytes), entries(&pool)
+      {
+      }
+    };
+
+    const size_t                        mCapacity;
+    std::unique_ptr<std::unique_ptr<Shard>[]> mShards;
+
+    static const int64_t now()
+    {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()
+      ).count();
+    }
+
+    static const int64_t deadline(const long ttl_ms)
+    {
+      return (ttl_ms > 0) ? now()+int64_t(ttl_ms)*1000000 : 0;
+    }
+
+    static const bool expired(const Entry& entry, const int64_t when)
+    {
+      return (entry.expires != 0)&&(entry.expires <= when);
+    }
+
+    Shard& shard(const std::string_view& key) const
+    {
+      return *mShards[std::hash<std::string_view>{}(key)%SHARDS];
+    }
+
+    /**
+     * @brief the live entry of the key, the expired one is removed.
+     **/
+    static Entries::iterator lookup(Shard& shard, const std::string_view& key)
+    {
+      auto it=shard.entries.find(key);
+      if((it != shard.entries.end())&&expired(it->second,now()))
+      {
+        shard.entries.erase(it);
+        return shard.entries.end();
+      }
+      return it;
+    }
+
+    /**
+     * @brief the string is copied first: the entry is left intact when it
+     * does not fit.
+     **/
+    static void assign(Entry& entry, const Item& item, const long ttl_ms)
+    {
+      if(item.type == Type::STRING)
+        entry.string.assign(item.string.data(),item.string.size());
+      else
+        entry.string.clear();
+      entry.type=item.type;
+      entry.boolean=item.boolean;
+      entry.number=item.number;
+      entry.expires=deadline(ttl_ms);
+    }
+
+    /**
+     * @brief stores the item, replaces the live entry unless only_new.
+     * NO_MEMORY keeps the previous value of the key.
+     **/
+    const Status store(const std::string_view& key, const Item& item, const long ttl_ms, const bool only_new)
+    {
+      if((key.size() > MAX_ITEM_SIZE)||(item.string.size() > MAX_ITEM_SIZE))
+        return Status::TOO_LARGE;
+
+      Shard& s=shard(key);
+      ITCSyncLock sync(s.mutex);
+      auto it=lookup(s,key);
+      if((it != s.entries.end())&&only_new)
+        return Status::EXISTS;
+
+      const bool created=(it == s.entries.end());
+      try{
+        if(created)
+          it=s.entries.try_emplace(std::pmr::string(key,&s.pool)).first;
+        assign(it->second,item,ttl_ms);
+      }catch(const std::bad_alloc&)
+      {
+        if(created&&(it != s.entries.end()))
+          s.entries.erase(it);
+        return Status::NO_MEMORY;
+      }
+      return Status::OK;
+    }
+
+   public:
+    /**
+     * @param capacity - bytes of the arena, split between the shards.
+     **/
+    explicit SharedDict(const size_t capacity)
+    : mCapacity{capacity}, mShards(new std::unique_ptr<Shard>[SHARDS])
+    {
+      for(size_t i=0;i<SHARDS;++i)
+        mShards[i]=std::make_unique<Shard>(capacity/SHARDS);
+    }
+
+    SharedDict()=delete;
+    SharedDict(const SharedDict&)=delete;
+    SharedDict(SharedDict&)=delete;
+
+    const Status set(const std::string_view& key, const Item& item, const long ttl_ms=0)
+    {
+      return store(key,item,ttl_ms,false);
+    }
+
+    /**
+     * @brief set() if the key is absent or expired, EXISTS otherwise.
+     **/
+    const Status add(const std::string_view& key, const Item& item, const long ttl_ms=0)
+    {
+      return store(key,item,ttl_ms,true);
+    }
+
+    /**
+     * @brief copies the live entry of the key into value. The Lua values
+     * are pushed by the caller after the shard is unlocked, a Lua error
+     * may not unwind through the lock.
+     * @return false if there is no live entry for the key.
+     **/
+    const bool get(const std::string_view& key, Value& value)
+    {
+      Shard& s=shard(key);
+      ITCSyncLock sync(s.mutex);
+      auto it=lookup(s,key);
+      if(it == s.entries.end())
+        return false;
+      value.type=it->second.type;
+      value.boolean=it->second.boolean;
+      value.number=it->second.number;
+      value.string.assign(it->second.string.data(),it->second.string.size());
+      return true;
+    }
+
+    /**
+     * @brief atomically adds delta to the number. An absent key is created
+     * with init+delta and the ttl if init is given, otherwise NOT_FOUND.
+     * The ttl of an existing entry is kept.
+     **/
+    const Status incr(const std::string_view& key, const double delta, double& result, const double* init=nullptr, const long ttl_ms=0)
+    {
+      if(key.size() > MAX_ITEM_SIZE)
+        return Status::TOO_LARGE;
+
+      Shard& s=shard(key);
+      ITCSyncLock sync(s.mutex);
+      auto it=lookup(s,key);
+      if(it == s.entries.end())
+      {
+        if(!init)
+          return Status::NOT_FOUND;
+        try{
+          it=s.entries.try_emplace(std::pmr::string(key,&s.pool)).first;
+        }catch(const std::bad_alloc&)
+        {
+          return Status::NO_MEMORY;
+        }
+        assign(it->second,Item{Type::NUMBER,false,*init,std::string_view()},ttl_ms);
+      }
+      else if(it->second.type != Type::NUMBER)
+      {
+        return Status::NOT_A_NUMBER;
+      }
+      it->second.number+=delta;
+      result=it->second.number;
+      return Status::OK;
+    }
+
+    const bool remove(const std::string_view& key)
+    {
+      Shard& s=shard(key);
+      ITCSyncLock sync(s.mutex);
+      auto it=lookup(s,key);
+      if(it == s.entries.end())
+        return false;
+      s.entries.erase(it);
+      return true;
+    }
+
+    /**
+     * @brief sets a new ttl of a live entry, 0 - never expires.
+     **/
+    const bool expire(const std::string_view& key, const long ttl_ms)
+    {
+      Shard& s=shard(key);
+      ITCSyncLock sync(s.mutex);
+      auto it=lookup(s,key);
+      if(it == s.entries.end())
+        return false;
+      it->second.expires=deadline(ttl_ms);
+      return true;
+    }
+
+    /**
+     * @param ttl_ms - the time left, -1 if the entry never expires.
+     * @return false if there is no live entry for the key.
+     **/
+    const bool ttl(const std::string_view& key, long& ttl_ms)
+    {
+      Shard& s=shard(key);
+      ITCSyncLock sync(s.mutex);
+      auto it=lookup(s,key);
+      if(it == s.entries.end())
+        return false;
+      ttl_ms=(it->second.expires == 0) ? -1 : (it->second.expires-now())/1000000;
+      return true;
+    }
+
+    /**
+     * @return amount of the expired entries removed.
+     **/
+    const size_t flushExpired()
+    {
+      size_t removed=0;
+      const int64_t when=now();
+      for(size_t i=0;i<SHARDS;++i)
+      {
+        Shard& s=*mShards[i];
+        ITCSyncLock sync(s.mutex);
+        for(auto it=s.entries.begin();it!=s.entries.end();)
+        {
+          if(expired(it->second,when))
+          {
+            it=s.entries.erase(it);
+            ++removed;
+          }
+          else ++it;
+        }
+      }
+      return removed;
+    }
+
+    /**
+     * @brief amount of entries, the expired ones not yet removed included.
+     **/
+    const size_t count() const
+    {
+      size_t result=0;
+      for(size_t i=0;i<SHARDS;++i)
+      {
+        ITCSyncLock sync(mShards[i]->mutex);
+        result+=mShards[i]->entries.size();
+      }
+      return result;
+    }
+
+    const size_t capacity() const
+    {
+      return mCapacity;
+    }
+  };
+
+  /**
+   * @brief the dictionaries configured in lapps.json:
+   *   "shared_dicts" : { "sessions" : 67108864, "limits" : 1048576 }
+   * name : arena size in bytes. A dictionary is created on first use and
+   * lives as long as the process.
+   **/
+  class SharedDicts
+  {
+   private:
+    ::itc::sys::mutex                                   mMutex;
+    std::map<std::string,std::unique_ptr<SharedDict>>   mDicts;
+
+   public:
+    explicit SharedDicts() : mMutex(), mDicts()
+    {
+    }
+
+    SharedDicts(const SharedDicts&)=delete;
+    SharedDicts(SharedDicts&)=delete;
+
+    /**
+     * @return nullptr if the dictionary is not configured.
+     **/
+    SharedDict* find(const std::string& name)
+    {
+      ITCSyncLock sync(mMutex);
+      auto it=mDicts.find(name);
+      if(it != mDicts.end())
+        return it->second.get();
+
+      const json& config=LAppSConfig::getInstance()->getLAppSConfig();
+      auto dicts=config.find("shared_dicts");
+      if((dicts == config.end())||(!dicts.value().is_object()))
+        return nullptr;
+      auto size=dicts.value().find(name);
+      if((size == dicts.value().end())||(!size.value().is_number_integer()))
+        return nullptr;
+
+      const long long bytes=size.value();
+      const size_t capacity=(bytes > 0) ? static_cast<size_t>(bytes) : 0;
+      if(capacity < SharedDict::SHARDS*SharedDict::MIN_SHARD_SIZE)
+      {
+        ITC_ERROR(__FILE__,__LINE__,"Shared dictionary {}: the size {} is too small, at least {} bytes are required",name.c_str(),capacity,SharedDict::SHARDS*SharedDict::MIN_SHARD_SIZE);
+        return nullptr;
+      }
+      return mDicts.emplace(name,std::make_unique<SharedDict>(capacity)).first->second.get();
+    }
+  };
+
+  typedef ::itc::Singleton<SharedDicts> SSharedDicts;
+}
+
+#endif /* __SHAREDDICT_H__ */
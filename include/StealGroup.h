@@ -0,0 +1,210 @@
+/**
+ *  Copyright 2017-2018, Pavel Kraynyukhov <pavel.kraynyukhov@gmail.com>
+ *
+ *  This file is a part of LAppS (Lua Application Server).
+ *
+ *  LAppS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  LAppS is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with LAppS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  $Id: StealGroup.h October 19, 2026 2:10 PM $
+ *
+ **/
+
+
+#ifndef __STEALGROUP_H__
+#  define __STEALGROUP_H__
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <vector>
+#include <algorithm>
+
+#include <sys/mutex.h>
+#include <sys/synclock.h>
+
+#include <Parker.h>
+
+namespace LAppS
+{
+  /**
+   * @brief run queue of a single service instance. The owner pops from
+   * the front one event at a time, idle siblings steal the oldest half.
+   * The lock is held only for the deque manipulation, never while
+   * processing events.
+   **/
+  template <typename T> class RunQueue
+  {
+   private:
+    itc::sys::mutex         mMutex;
+    std::deque<T>           mQueue;
+    std::atomic<size_t>     mSize;
+    std::shared_ptr<Parker> mParker;
+
+   public:
+    explicit RunQueue(const std::shared_ptr<Parker>& parker)
+    : mMutex(), mQueue(), mSize{0}, mParker(parker)
+    {
+    }
+    RunQueue()=delete;
+    RunQueue(const RunQueue&)=delete;
+    RunQueue(RunQueue&)=delete;
+
+    void push(std::vector<T>& events)
+    {
+      ITCSyncLock sync(mMutex);
+      for(auto& event : events)
+        mQueue.push_back(std::move(event));
+      mSize.store(mQueue.size(),std::memory_order_release);
+    }
+
+    const bool pop(T& out)
+    {
+      if(mSize.load(std::memory_order_acquire) == 0) return false;
+      ITCSyncLock sync(mMutex);
+      if(mQueue.empty()) return false;
+      out=std::move(mQueue.front());
+      mQueue.pop_front();
+      mSize.store(mQueue.size(),std::memory_order_release);
+      return true;
+    }
+
+    /**
+     * @brief moves up to a half (at least one) of the queued events into out.
+     **/
+    const size_t steal(std::vector<T>& out)
+    {
+      if(mSize.load(std::memory_order_acquire) == 0) return 0;
+      ITCSyncLock sync(mMutex);
+      const size_t amount=(mQueue.size()+1)/2;
+      for(size_t i=0;i<amount;++i)
+      {
+        out.push_back(std::move(mQueue.front()));
+        mQueue.pop_front();
+      }
+      mSize.store(mQueue.size(),std::memory_order_release);
+      return amount;
+    }
+
+    const size_t size() const
+    {
+      return mSize.load(std::memory_order_acquire);
+    }
+
+    void wakeup()
+    {
+      mParker->unpark();
+    }
+  };
+
+  /**
+   * @brief run queues of all instances of the same service. Membership
+   * is an immutable snapshot replaced on join/leave, so stealing does not
+   * take the group lock.
+   **/
+  template <typename T> class StealGroup
+  {
+   public:
+    typedef std::shared_ptr<RunQueue<T>>          Member;
+
+   private:
+    typedef std::vector<Member>                   Members;
+
+    itc::sys::mutex                               mMutex;
+    std::shared_ptr<const Members>                mMembers;
+    std::atomic<size_t>                           mVictim;
+
+    std::shared_ptr<const Members> members() const
+    {
+      return std::atomic_load(&mMembers);
+    }
+
+   public:
+    StealGroup()
+    : mMutex(), mMembers(std::make_shared<const Members>()), mVictim{0}
+    {
+    }
+    StealGroup(const StealGroup&)=delete;
+    StealGroup(StealGroup&)=delete;
+
+    void join(const Member& member)
+    {
+      ITCSyncLock sync(mMutex);
+      auto updated=std::make_shared<Members>(*members());
+      updated->push_back(member);
+      std::atomic_store(&mMembers,std::shared_ptr<const Members>(std::move(updated)));
+    }
+
+    void leave(const Member& member)
+    {
+      ITCSyncLock sync(mMutex);
+      auto updated=std::make_shared<Members>(*members());
+      updated->erase(std::remove(updated->begin(),updated->end(),member),updated->end());
+      std::atomic_store(&mMembers,std::shared_ptr<const Members>(std::move(updated)));
+    }
+
+    /**
+     * @brief steals from the most loaded sibling, starting the scan from a
+     * rotating position to spread thieves over the victims.
+     * @return amount of events stolen.
+     **/
+    const size_t steal(const RunQueue<T>* self, std::vector<T>& out)
+    {
+      auto snapshot=members();
+      const size_t count=snapshot->size();
+      if(count < 2) return 0;
+
+      const size_t start=mVictim.fetch_add(1,std::memory_order_relaxed)%count;
+      RunQueue<T>* victim=nullptr;
+      size_t max_size=0;
+      for(size_t i=0;i<count;++i)
+      {
+        RunQueue<T>* candidate=(*snapshot)[(start+i)%count].get();
+        if(candidate == self) continue;
+        const size_t sz=candidate->size();
+        if(sz > max_size)
+        {
+          max_size=sz;
+          victim=candidate;
+        }
+      }
+      if(victim == nullptr) return 0;
+      return victim->steal(out);
+    }
+
+    /**
+     * @brief true if any sibling has queued events.
+     **/
+    const bool backlog(const RunQueue<T>* self) const
+    {
+      auto snapshot=members();
+      for(const auto& member : *snapshot)
+        if((member.get() != self)&&(member->size() > 0))
+          return true;
+      return false;
+    }
+
+    /**
+     * @brief wakes up the parked siblings of a backed up instance.
+     **/
+    void wakeIdle(const RunQueue<T>* self)
+    {
+      auto snapshot=members();
+      for(const auto& member : *snapshot)
+        if(member.get() != self)
+          member->wakeup();
+    }
+  };
+}
+
+#endif /* __STEALGROUP_H__ */
@@ -0,0 +1,367 @@
+/**
+ *  Copyright 2017-2018, Pavel Kraynyukhov <pavel.kraynyukhov@gmail.com>
+ * 
+ *  This file is a part of LAppS (Lua Application Server).
+ *  
+ *  LAppS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *  
+ *  LAppS is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *  
+ *  You should have received a copy of the GNU General Public License
+ *  along with LAppS.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  $Id: TopicTree.h October 21, 2026 10:20 AM $
+ * 
+ **/
+
+
+
+#ifndef __TOPICTREE_H__
+#  define __TOPICTREE_H__
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <functional>
+
+#include <sys/mutex.h>
+#include <sys/synclock.h>
+#include <ext/tsl/robin_map.h>
+
+#include <WSEvent.h>
+
+namespace LAppS
+{
+  /**
+   * @brief hierarchical topic filters indexed as a trie of levels.
+   * 
+   * Levels are separated by '/' or '.'. In filters '*' matches exactly one
+   * level and '#' (last level only) matches any number of the remaining
+   * levels, including none. Every filter is backed by a Channel (a
+   * Broadcast), so a publish costs a walk over the matching branches
+   * plus the fan-out of the matching channels, independently of the total
+   * amount of topics.
+   * 
+   * A connection subscribed with several overlapping filters receives the
+   * message once per matching filter.
+   * 
+   * Channel requirements: Channel(size_t id), subscribe(WebSocket*),
+   * unsubscribe(WebSocket*), bcast(const MSGBufferTypeSPtr&) and idle(),
+   * which is true when the channel has no subscribers and no subscriptions
+   * on the way. Channels are created and pruned under the tree lock only.
+   * 
+   * Pruning never walks the whole trie: an unsubscription prunes its own
+   * branch, and every operation revisits PRUNE_STEP of the filters for the
+   * channels left idle by the disconnected subscribers.
+   **/
+  template <typename Channel> class TopicTree
+  {
+   public:
+    typedef std::shared_ptr<Channel> ChannelSPtr;
+    
+   private:
+    struct LevelHash
+    {
+      using is_transparent=void;
+      size_t operator()(const std::string_view& level) const
+      {
+        return std::hash<std::string_view>{}(level);
+      }
+    };
+    
+    struct LevelEqual
+    {
+      using is_transparent=void;
+      bool operator()(const std::string_view& lhs, const std::string_view& rhs) const
+      {
+        return lhs == rhs;
+      }
+    };
+    
+    struct Node
+    {
+      tsl::robin_map<std::string,std::unique_ptr<Node>,LevelHash,LevelEqual> children;
+      std::unique_ptr<Node>   star;
+      ChannelSPtr             here;
+      ChannelSPtr             hash;
+      // positions of the filters of here and hash in mFilters
+      size_t                  here_at=0;
+      size_t                  hash_at=0;
+      
+      const bool empty() const
+      {
+        return children.empty()&&(!star)&&(!here)&&(!hash);
+      }
+    };
+    
+    // the filter of a channel, by the node which holds it
+    struct Filter
+    {
+      std::string filter;
+      Node*       node;
+      bool        multi;
+    };
+    
+    static const size_t PRUNE_STEP=2;
+    
+    itc::sys::mutex     mMutex;
+    Node                mRoot;
+    std::vector<Filter> mFilters;
+    size_t              mCursor;
+    size_t              mNextID;
+    
+    static void split(const std::string_view& topic, std::vector<std::string_view>& levels)
+    {
+      levels.clear();
+      size_t start=0;
+      for(size_t i=0;i<=topic.size();++i)
+      {
+        if((i == topic.size())||(topic[i] == '/')||(topic[i] == '.'))
+        {
+          levels.push_back(topic.substr(start,i-start));
+          start=i+1;
+        }
+      }
+    }
+    
+    void match(const Node& node, const std::vector<std::string_view>& levels, const size_t idx, std::vector<ChannelSPtr>& out) const
+    {
+      // wildcards do not match the topics starting with '$' on the first level
+      const bool system=(idx == 0)&&(!levels.empty())&&(!levels[0].empty())&&(levels[0][0] == '$');
+      
+      if(node.hash&&(!system))
+        out.push_back(node.hash);
+      
+      if(idx == levels.size())
+      {
+        if(node.here) out.push_back(node.here);
+        return;
+      }
+      
+      auto it=node.children.find(levels[idx]);
+      if(it != node.children.end())
+        match(*(it->second),levels,idx+1,out);
+      
+      if(node.star&&(!system))
+        match(*node.star,levels,idx+1,out);
+    }
+    
+    /**
+     * @brief the node the filter levels lead to, nullptr if it does not
+     * exist and create is false. levels must not include the trailing '#'.
+     **/
+    Node* walk(const std::vector<std::string_view>& levels, const size_t count, const bool create)
+    {
+      Node* node=&mRoot;
+      for(size_t i=0;i<count;++i)
+      {
+        if(levels[i] == "*")
+        {
+          if(!node->star)
+          {
+            if(!create) return nullptr;
+            node->star=std::make_unique<Node>();
+          }
+          node=node->star.get();
+        }
+        else
+        {
+          auto it=node->children.find(levels[i]);
+          if(it == node->children.end())
+          {
+            if(!create) return nullptr;
+            it=node->children.emplace(std::string(levels[i]),std::make_unique<Node>()).first;
+          }
+          node=it.value().get();
+        }
+      }
+      return node;
+    }
+    
+    /**
+     * @brief forgets the channel of the filter ending at node.
+     **/
+    void drop(Node* node, const bool multi)
+    {
+      const size_t at=multi ? node->hash_at : node->here_at;
+      (multi ? node->hash : node->here).reset();
+      if(at != mFilters.size()-1)
+      {
+        mFilters[at]=std::move(mFilters.back());
+        Filter& moved=mFilters[at];
+        (moved.multi ? moved.node->hash_at : moved.node->here_at)=at;
+      }
+      mFilters.pop_back();
+    }
+    
+    /**
+     * @brief drops the channel of the filter if it is idle, then the nodes
+     * left empty, from the leaf up to the first node still in use.
+     **/
+    void prune(const std::vector<std::string_view>& levels)
+    {
+      static thread_local std::vector<Node*> path;
+      
+      const bool multi=(levels.back() == "#");
+      const size_t count=multi ? levels.size()-1 : levels.size();
+      
+      path.clear();
+      Node* node=&mRoot;
+      path.push_back(node);
+      for(size_t i=0;i<count;++i)
+      {
+        if(levels[i] == "*")
+        {
+          node=node->star.get();
+        }
+        else
+        {
+          auto it=node->children.find(levels[i]);
+          node=(it == node->children.end()) ? nullptr : it.value().get();
+        }
+        if(!node) return;
+        path.push_back(node);
+      }
+      
+      const ChannelSPtr& channel=multi ? node->hash : node->here;
+      if(channel)
+      {
+        if(!channel->idle()) return;
+        drop(node,multi);
+      }
+      
+      for(size_t i=count;(i > 0)&&path[i]->empty();--i)
+      {
+        if(levels[i-1] == "*") path[i-1]->star.reset();
+        else path[i-1]->children.erase(levels[i-1]);
+      }
+    }
+    
+    void tick()
+    {
+      // prune() may move another filter over the one being checked
+      static thread_local std::string filter;
+      static thread_local std::vector<std::string_view> levels;
+      
+      for(size_t i=0;(i < PRUNE_STEP)&&(!mFilters.empty());++i)
+      {
+        if(mCursor >= mFilters.size()) mCursor=0;
+        const size_t before=mFilters.size();
+        filter=mFilters[mCursor].filter;
+        split(filter,levels);
+        prune(levels);
+        if(mFilters.size() == before) ++mCursor;
+      }
+    }
+    
+   public:
+    TopicTree() : mMutex(), mRoot(), mFilters(), mCursor{0}, mNextID{0}
+    {
+    }
+    TopicTree(const TopicTree&)=delete;
+    TopicTree(TopicTree&)=delete;
+    
+    /**
+     * @return false if the filter is malformed.
+     **/
+    static const bool isValidFilter(const std::string_view& filter)
+    {
+      if(filter.empty()) return false;
+      std::vector<std::string_view> levels;
+      split(filter,levels);
+      for(size_t i=0;i<levels.size();++i)
+      {
+        const auto& level=levels[i];
+        if((level.find('#') != std::string_view::npos)&&((level != "#")||(i != levels.size()-1)))
+          return false;
+        if((level.find('*') != std::string_view::npos)&&(level != "*"))
+          return false;
+      }
+      return true;
+    }
+    
+    static const bool isValidTopic(const std::string_view& topic)
+    {
+      return (!topic.empty())&&(topic.find_first_of("*#") == std::string_view::npos);
+    }
+    
+    /**
+     * @brief subscribes the handler to the filter, the filter must be
+     * valid.
+     **/
+    template <typename Handler> void subscribe(const std::string_view& filter, Handler* handler)
+    {
+      static thread_local std::vector<std::string_view> levels;
+      split(filter,levels);
+      
+      const bool multi=(levels.back() == "#");
+      
+      ITCSyncLock sync(mMutex);
+      Node* node=walk(levels,multi ? levels.size()-1 : levels.size(),true);
+      ChannelSPtr& channel=multi ? node->hash : node->here;
+      if(!channel)
+      {
+        channel=std::make_shared<Channel>(mNextID++);
+        (multi ? node->hash_at : node->here_at)=mFilters.size();
+        mFilters.push_back(Filter{std::string(filter),node,multi});
+      }
+      channel->subscribe(handler);
+      tick();
+    }
+    
+    template <typename Handler> void unsubscribe(const std::string_view& filter, Handler* handler)
+    {
+      static thread_local std::vector<std::string_view> levels;
+      split(filter,levels);
+      
+      const bool multi=(levels.back() == "#");
+      
+      ITCSyncLock sync(mMutex);
+      Node* node=walk(levels,multi ? levels.size()-1 : levels.size(),false);
+      if(node == nullptr) return;
+      ChannelSPtr& channel=multi ? node->hash : node->here;
+      if(channel) channel->unsubscribe(handler);
+      prune(levels);
+      tick();
+    }
+    
+    /**
+     * @brief sends the message to all the channels matching the topic. The
+     * lock is held for the trie walk only, not for the fan-out.
+     * @return amount of the matching filters.
+     **/
+    const size_t publish(const std::string_view& topic, const MSGBufferTypeSPtr& msg)
+    {
+      static thread_local std::vector<std::string_view> levels;
+      static thread_local std::vector<ChannelSPtr> matched;
+      
+      split(topic,levels);
+      matched.clear();
+      {
+        ITCSyncLock sync(mMutex);
+        match(mRoot,levels,0,matched);
+      }
+      for(const auto& channel : matched)
+        channel->bcast(msg);
+      
+      const size_t count=matched.size();
+      matched.clear();
+      return count;
+    }
+    
+    const size_t size()
+    {
+      ITCSyncLock sync(mMutex);
+      return mFilters.size();
+    }
+  };
+}
+
+#endif /* __TOPICTREE_H__ */
@@ -28,11 +28,18 @@
 #include <string>
 #include <WSProtocol.h>
 #include <queue>
+#include <limits>
+#include <memory>
+#include <algorithm>
+#include <cstring>
+#include <sys/uio.h>
 
 /**
- * Fast and bad implementation of server side messages.
- * To be optimized later. TODO: create header in a separate buffer, then
- * send the buffer and afterwards the payload. 
+ * Server side messages. ServerMessage copies the payload behind its
+ * header, InPlaceServerMessage serializes the payload straight into the
+ * frame buffer and backfills the header, and FragmentedMessage generates
+ * the headers of the fragments next to the payload at write time, so large
+ * messages are sent from the payload buffer as is.
  **/
 namespace WebSocketProtocol
 {
@@ -49,191 +56,6 @@ namespace WebSocketProtocol
     MakeMessageHeader()=delete;
   };
   
-  struct FragmentedServerMessage
-  {
-    // Ethernet frame Upper Layer protocol payload typically 1500 bytes
-    // TCP frame 20 bytes without options up to 60 bytes with options
-    // IP header 24 bytes max
-    // 24+60 == 84 bytes
-    // 1500 - 84 = 1416 max WebSockets Frame size (inclusive headers)
-    // max WebSocket header size 24 bytes
-    // 1416 - 24 = 1392 max fame payload size
-    // 
-    
-    typedef std::vector<uint8_t> msgtype;
-    typedef std::queue<MSGBufferTypeSPtr> msgQType;
-    
-    FragmentedServerMessage(msgQType& out,const WebSocketProtocol::OpCode oc,const char* src, const size_t len)
-    {
-      const size_t fragment_pl_size=1392;
-      int fragments = len/fragment_pl_size;
-      size_t bytes_left=len;
-      size_t offset=0;
-      
-      auto outmsg=std::make_shared<MSGBufferType>();
-      
-      if(fragments>1)
-      {
-        // first fragment
-        outmsg->clear();
-        outmsg->push_back(oc);
-        WS::putLength(fragment_pl_size,*outmsg);
-        offset=outmsg->size();
-        outmsg->resize(offset+fragment_pl_size);
-        memcpy(outmsg->data()+offset,src,fragment_pl_size);
-        bytes_left=bytes_left-fragment_pl_size;
-        out.push(outmsg);
-        --fragments;
-        
-        // continuation fragments
-        while((fragments-1)>0)
-        {
-          outmsg=std::make_shared<MSGBufferType>();
-          outmsg->clear();
-          outmsg->push_back(0);
-          WS::putLength(fragment_pl_size,*outmsg);
-          offset=outmsg->size();
-          outmsg->resize(offset+fragment_pl_size);
-          memcpy(outmsg->data()+offset,src+(len-bytes_left),fragment_pl_size);
-          bytes_left=bytes_left-fragment_pl_size;
-          out.push(outmsg);
-          --fragments;
-        }
-        // fin fragment;
-        outmsg=std::make_shared<MSGBufferType>();
-        outmsg->clear();
-        outmsg->push_back(128);
-        WS::putLength(bytes_left,*outmsg);
-        offset=outmsg->size();
-        outmsg->resize(offset+bytes_left);
-        memcpy(outmsg->data()+offset,src+(len-bytes_left),bytes_left);
-        out.push(outmsg);
-      }else{
-        outmsg->clear();
-        outmsg->push_back(128|oc);
-        WS::putLength(len,*outmsg);
-        size_t offset=outmsg->size();
-        outmsg->resize(offset+len);
-        memcpy(outmsg->data()+offset,src,len);
-        out.push(outmsg);
-      }
-    }
-    
-    FragmentedServerMessage(msgQType& out,const WebSocketProtocol::OpCode oc,const std::vector<uint8_t>& src)
-    {
-      const size_t len=src.size();
-      const size_t fragment_pl_size=1392;
-      int fragments = len/fragment_pl_size;
-      size_t bytes_left=len;
-      size_t offset=0;
-      
-      auto outmsg=std::make_shared<MSGBufferType>();
-      
-      if(fragments>1)
-      {
-        // first fragment
-        outmsg->clear();
-        outmsg->push_back(oc);
-        WS::putLength(fragment_pl_size,*outmsg);
-        offset=outmsg->size();
-        outmsg->resize(offset+fragment_pl_size);
-        memcpy(outmsg->data()+offset,src.data(),fragment_pl_size);
-        bytes_left=bytes_left-fragment_pl_size;
-        out.push(outmsg);
-        --fragments;
-        
-        // continuation fragments
-        while((fragments-1)>0)
-        {
-          outmsg=std::make_shared<MSGBufferType>();
-          outmsg->clear();
-          outmsg->push_back(0);
-          WS::putLength(fragment_pl_size,*outmsg);
-          offset=outmsg->size();
-          outmsg->resize(offset+fragment_pl_size);
-          memcpy(outmsg->data()+offset,src.data()+(len-bytes_left),fragment_pl_size);
-          bytes_left=bytes_left-fragment_pl_size;
-          out.push(outmsg);
-          --fragments;
-        }
-        // fin fragment;
-        outmsg=std::make_shared<MSGBufferType>();
-        outmsg->clear();
-        outmsg->push_back(128);
-        WS::putLength(bytes_left,*outmsg);
-        offset=outmsg->size();
-        outmsg->resize(offset+bytes_left);
-        memcpy(outmsg->data()+offset,src.data()+(len-bytes_left),bytes_left);
-        out.push(outmsg);
-      }else{
-        outmsg->clear();
-        outmsg->push_back(128|oc);
-        WS::putLength(len,*outmsg);
-        size_t offset=outmsg->size();
-        outmsg->resize(offset+len);
-        memcpy(outmsg->data()+offset,src.data(),len);
-        out.push(outmsg);
-      }
-    }
-    
-    FragmentedServerMessage(msgQType& out,const WebSocketProtocol::OpCode oc,const std::shared_ptr<std::vector<uint8_t>>& src)
-    {
-      const size_t len=src->size();
-      const size_t fragment_pl_size=1392;
-      int fragments = len/fragment_pl_size;
-      size_t bytes_left=len;
-      size_t offset=0;
-      
-      auto outmsg=std::make_shared<MSGBufferType>();
-      
-      if(fragments>1)
-      {
-        // first fragment
-        outmsg->clear();
-        outmsg->push_back(oc);
-        WS::putLength(fragment_pl_size,*outmsg);
-        offset=outmsg->size();
-        outmsg->resize(offset+fragment_pl_size);
-        memcpy(outmsg->data()+offset,src->data(),fragment_pl_size);
-        bytes_left=bytes_left-fragment_pl_size;
-        out.push(outmsg);
-        --fragments;
-        
-        // continuation fragments
-        while((fragments-1)>0)
-        {
-          outmsg=std::make_shared<MSGBufferType>();
-          outmsg->clear();
-          outmsg->push_back(0);
-          WS::putLength(fragment_pl_size,*outmsg);
-          offset=outmsg->size();
-          outmsg->resize(offset+fragment_pl_size);
-          memcpy(outmsg->data()+offset,src->data()+(len-bytes_left),fragment_pl_size);
-          bytes_left=bytes_left-fragment_pl_size;
-          out.push(outmsg);
-          --fragments;
-        }
-        // fin fragment;
-        outmsg=std::make_shared<MSGBufferType>();
-        outmsg->clear();
-        outmsg->push_back(128);
-        WS::putLength(bytes_left,*outmsg);
-        offset=outmsg->size();
-        outmsg->resize(offset+bytes_left);
-        memcpy(outmsg->data()+offset,src->data()+(len-bytes_left),bytes_left);
-        out.push(outmsg);
-      }else{
-        outmsg->clear();
-        outmsg->push_back(128|oc);
-        WS::putLength(len,*outmsg);
-        size_t offset=outmsg->size();
-        outmsg->resize(offset+len);
-        memcpy(outmsg->data()+offset,src->data(),len);
-        out.push(outmsg);
-      }
-    }
-  };
-  
   struct ServerMessage
   {
     ServerMessage(
@@ -287,6 +109,185 @@ namespace WebSocketProtocol
     }
   };
   
+  /**
+   * @brief server message serialised straight into its frame buffer.
+   *
+   * The payload is appended to payload() right after a gap reserved for
+   * the header, finish() backfills the header once the payload size is
+   * known. The gap and the capacity are sized after the previous frame
+   * built by the same thread, so the payload is moved only when its size
+   * class (up to 125 bytes, up to 64KiB, larger) changes.
+   **/
+  class InPlaceServerMessage
+  {
+   private:
+    struct Hint
+    {
+      size_t gap;
+      size_t capacity;
+    };
+    
+    static Hint& hint()
+    {
+      static thread_local Hint value{2,256};
+      return value;
+    }
+    
+    MSGBufferTypeSPtr mBuffer;
+    const size_t      mGap;
+    
+   public:
+    static const size_t MAX_HEADER_SIZE=10;
+    
+    static const size_t headerSize(const size_t pllength)
+    {
+      if(pllength > std::numeric_limits<uint16_t>::max()) return 10;
+      if(pllength > 125) return 4;
+      return 2;
+    }
+    
+    /**
+     * @brief writes the header of a single (FIN) frame with the payload of
+     * pllength bytes into out, which must fit MAX_HEADER_SIZE bytes.
+     * @return size of the header.
+     **/
+    static const size_t putHeader(uint8_t* out, const WebSocketProtocol::OpCode oc, const size_t pllength)
+    {
+      return putHeader(out,true,oc,pllength);
+    }
+    
+    /**
+     * @brief as above, for a fragment: fin is false for all but the last
+     * one, oc is CONTINUE for all but the first one.
+     **/
+    static const size_t putHeader(uint8_t* out, const bool fin, const WebSocketProtocol::OpCode oc, const size_t pllength)
+    {
+      const size_t hsz=headerSize(pllength);
+      out[0]=(fin ? 128 : 0)|oc;
+      switch(hsz)
+      {
+        case 2:
+          out[1]=static_cast<uint8_t>(pllength);
+          break;
+        case 4:
+          out[1]=126;
+          out[2]=static_cast<uint8_t>(pllength>>8);
+          out[3]=static_cast<uint8_t>(pllength);
+          break;
+        default:
+          out[1]=127;
+          for(size_t i=0;i<8;++i)
+            out[2+i]=static_cast<uint8_t>(static_cast<uint64_t>(pllength)>>(56-8*i));
+      }
+      return hsz;
+    }
+    
+    InPlaceServerMessage()
+    : mBuffer(std::make_shared<MSGBufferType>()), mGap(hint().gap)
+    {
+      // large frames are rare, they are left to grow on their own
+      mBuffer->reserve(std::min<size_t>(hint().capacity,65536));
+      mBuffer->resize(mGap);
+    }
+    InPlaceServerMessage(const InPlaceServerMessage&)=delete;
+    InPlaceServerMessage(InPlaceServerMessage&)=delete;
+    
+    /**
+     * @brief the frame buffer, payload must be appended to it.
+     **/
+    MSGBufferType& payload()
+    {
+      return *mBuffer;
+    }
+    
+    /**
+     * @brief writes the header of a single (FIN) frame.
+     * @return the frame, the object must not be used afterwards.
+     **/
+    MSGBufferTypeSPtr finish(const WebSocketProtocol::OpCode oc)
+    {
+      const size_t len=mBuffer->size()-mGap;
+      const size_t hsz=headerSize(len);
+      if(hsz > mGap)
+        mBuffer->insert(mBuffer->begin(),hsz-mGap,0);
+      else if(hsz < mGap)
+        mBuffer->erase(mBuffer->begin(),mBuffer->begin()+(mGap-hsz));
+      
+      putHeader(mBuffer->data(),oc,len);
+      hint()=Hint{hsz,mBuffer->size()};
+      return std::move(mBuffer);
+    }
+  };
+  
+  /**
+   * @brief wire layout of a message sent as fragments with up to
+   * `fragment` bytes of payload each. The payload stays in one buffer, the
+   * headers of the fragments being written are generated into a side
+   * array by gather(), so the message is written with one vectored write
+   * per batch of fragments instead of one buffer and one write each.
+   **/
+  struct FragmentedMessage
+  {
+    // Ethernet frame Upper Layer protocol payload typically 1500 bytes
+    // TCP frame 20 bytes without options up to 60 bytes with options
+    // IP header 24 bytes max
+    // 24+60 == 84 bytes
+    // 1500 - 84 = 1416 max WebSockets Frame size (inclusive headers)
+    // max WebSocket header size 24 bytes
+    // 1416 - 24 = 1392 max fame payload size
+    static const size_t DEFAULT_FRAGMENT_SIZE=1392;
+    
+    typedef uint8_t HeaderType[InPlaceServerMessage::MAX_HEADER_SIZE];
+    
+    /**
+     * @return the size of all the fragments with their headers.
+     **/
+    static const size_t size(const size_t len, const size_t fragment)
+    {
+      if(len <= fragment)
+        return InPlaceServerMessage::headerSize(len)+len;
+      const size_t full=(len-1)/fragment;
+      const size_t last=len-full*fragment;
+      return full*(InPlaceServerMessage::headerSize(fragment)+fragment)+InPlaceServerMessage::headerSize(last)+last;
+    }
+    
+    /**
+     * @brief fills iov with the headers and the payload slices of up to
+     * max_fragments fragments, starting at offset bytes into the wire
+     * layout. The headers are written into heads[max_fragments].
+     * @return amount of the iovec entries used, up to 2*max_fragments.
+     **/
+    static const size_t gather(
+      const uint8_t* payload, const size_t len, const size_t fragment,
+      const WebSocketProtocol::OpCode oc, const size_t offset,
+      iovec* iov, HeaderType* heads, const size_t max_fragments
+    )
+    {
+      const size_t stride=InPlaceServerMessage::headerSize(fragment)+fragment;
+      size_t index=offset/stride;
+      size_t pos=offset-index*stride;
+      size_t count=0;
+      
+      for(size_t n=0;(n < max_fragments)&&(index*fragment < len);++n,++index)
+      {
+        const size_t begin=index*fragment;
+        const size_t plsize=std::min(fragment,len-begin);
+        const size_t hsz=InPlaceServerMessage::putHeader(
+          heads[n],begin+plsize == len,(index == 0) ? oc : WebSocketProtocol::CONTINUE,plsize
+        );
+        if(pos < hsz)
+        {
+          iov[count++]={heads[n]+pos,hsz-pos};
+          pos=0;
+        }
+        else pos-=hsz;
+        iov[count++]={const_cast<uint8_t*>(payload)+begin+pos,plsize-pos};
+        pos=0;
+      }
+      return count;
+    }
+  };
+  
   /**
    * 5.5.1.  Close
 
@@ -27,8 +27,11 @@
 
 
 #include <map>
+#include <deque>
 #include <vector>
 #include <string>
+#include <sys/socket.h>
+#include <sys/uio.h>
 
 #include <net/NSocket.h>
 #include <TCPListener.h>
@@ -44,8 +47,11 @@
 #include <abstract/WebSocket.h>
 #include <abstract/Worker.h>
 
+#include <ext/tsl/robin_map.h>
+
 #include <ServiceRegistry.h>
 #include <AppInEvent.h>
+#include <OutFrame.h>
 
 
 // wolfSSL
@@ -61,20 +67,23 @@ typedef std::shared_ptr<itc::net::Socket> CSocketSPtr;
 template <bool TLSEnable=false, bool StatsEnable=false> class WebSocket
 : public abstract::WebSocket
 {
- public:
-  
-  
-  
-  std::shared_ptr<abstract::WebSocket> get_shared() final
-  {
-    return this->shared_from_this();
-  }
-  
  private:
-  itc::sys::mutex                     mMutex;
   int                                 fd;
-  State                               mState;
+  // written by the owning worker, read by the services too
+  std::atomic<State>                  mState;
   std::atomic<bool>                   mNoInput;
+  bool                                mInputPaused;
+  
+  // owning worker only: frames not yet accepted by the kernel
+  std::deque<OutFrame>                mPending;
+  size_t                              mPendingBytes;
+  // the part of mPendingBytes which is not SHARED, see maxPendingBytes()
+  size_t                              mUnicastBytes;
+  
+  // pending frames of the conflating channels by key, created on demand.
+  // deque references survive push_back/pop_front, dropped frames are
+  // tombstoned instead of erased, so the pointers stay valid.
+  std::unique_ptr<tsl::robin_map<uint64_t,OutFrame*>> mConflated;
   
   itc::utils::Bool2Type<TLSEnable>    enableTLS;
   itc::utils::Bool2Type<StatsEnable>  enableStatsUpdate;
@@ -91,6 +100,7 @@ template <bool TLSEnable=false, bool StatsEnable=false> class WebSocket
   ::LAppS::ServiceSPtrType            mApplication;
   
   bool                                mAutoFragment;
+  size_t                              mFragmentSize;
   
   ::abstract::Worker*                 mParent;  
   CSocketSPtr                         mSocketSPtr;
@@ -140,12 +150,8 @@ template <bool TLSEnable=false, bool StatsEnable=false> class WebSocket
     else
     {
       setState(State::HANDSHAKE);
-      
-      // back to blocking IO mode
-      
-      auto opts = fcntl(fd,F_GETFL);
-      opts = opts & (~O_NONBLOCK);
-      fcntl(fd, F_SETFL, opts);
+      // the socket stays non-blocking: all the writes are done by the
+      // owning worker, which waits for EPOLLOUT on WANT_WRITE.
       mEPoll->mod_in(fd);
     }
   }
@@ -175,11 +181,12 @@ template <bool TLSEnable=false, bool StatsEnable=false> class WebSocket
     const bool               auto_fragment,
     WOLFSSL_CTX*             tls_context=nullptr
   )
-  : mMutex(), fd(socksptr->getfd()), mState{TLSEnable ? ACCEPT:  HANDSHAKE}, 
-    mNoInput{false}, enableTLS(), enableStatsUpdate(),
+  : fd(socksptr->getfd()), mState{TLSEnable ? ACCEPT:  HANDSHAKE}, 
+    mNoInput{false}, mInputPaused{false}, mPending(), mPendingBytes{0}, mUnicastBytes{0}, mConflated(), enableTLS(), enableStatsUpdate(),
     TLSContext{tls_context}, TLSSocket{nullptr},mEPoll(ep),
     mStats{0,0,0,0,0,0}, streamProcessor(512),
-    mApplication{nullptr}, mAutoFragment(auto_fragment),mParent{_parent},
+    mApplication{nullptr}, mAutoFragment(auto_fragment),
+    mFragmentSize{WebSocketProtocol::FragmentedMessage::DEFAULT_FRAGMENT_SIZE},mParent{_parent},
     mSocketSPtr(std::move(socksptr))
   {
     init(fd, enableTLS);
@@ -200,7 +207,7 @@ template <bool TLSEnable=false, bool StatsEnable=false> class WebSocket
 
   const bool is_accepted() const
   {
-    return mState > State::ACCEPT;
+    return getState() > State::ACCEPT;
   }
   
   void accept()
@@ -212,24 +219,24 @@ template <bool TLSEnable=false, bool StatsEnable=false> class WebSocket
   
   ~WebSocket()
   {
-    switch(mState)
+    switch(getState())
     {
       case State::MESSAGING:
-        closeSocket(WebSocketProtocol::SHUTDOWN);
+        // services reference sockets by raw pointer, no events may be
+        // enqueued from here.
       case State::ACCEPT:
       case State::HANDSHAKE:
         terminate();
       case State::CLOSED:
-      {
-        ITCSyncLock sync(mMutex);
         mSocketSPtr->close();
-      }
     }
     if(TLSEnable&&TLSSocket)
     {
       wolfSSL_free(TLSSocket);
       TLSSocket=nullptr;
     }
+    if(mApplication)
+      mApplication->unbind();
   }
   
   void returnBuffer(std::remove_reference<const std::shared_ptr<MSGBufferType>&>::type buffer)
@@ -239,8 +246,7 @@ template <bool TLSEnable=false, bool StatsEnable=false> class WebSocket
   
   void terminate()
   {
-    ITCSyncLock sync(mMutex);
-    if(mState != State::CLOSED)
+    if(getState() != State::CLOSED)
     {
       sigset_t sigsetmask;
       sigemptyset(&sigsetmask);
@@ -257,10 +263,34 @@ template <bool TLSEnable=false, bool StatsEnable=false> class WebSocket
     }
   }
   
+  /**
+   * @brief thread-safe. On the owning worker closes the socket at once,
+   * otherwise the close is posted to the worker and happens after the
+   * frames sent before are flushed.
+   **/
   void close()
   {
-    if(mState != State::CLOSED)
+    if(getState() == State::CLOSED) return;
+    
+    if(::abstract::Worker::current() == mParent)
+    {
+      closeNow();
+    }
+    else
+    {
+      post(OutFrame{this,fd,OutFrame::CLOSE,nullptr,0});
+    }
+  }
+  
+  void closeNow()
+  {
+    if(getState() != State::CLOSED)
     {
+      mPending.clear();
+      mPendingBytes=0;
+      mUnicastBytes=0;
+      mConflated.reset();
+      leaveAll();
       if(TLSEnable)
       {
         wolfSSL_shutdown(TLSSocket);
@@ -295,11 +325,17 @@ template <bool TLSEnable=false, bool StatsEnable=false> class WebSocket
 
   void setApplication(const LAppS::ServiceSPtrType& ptr)
   {
+    if(mApplication)
+      mApplication->unbind();
     mApplication=ptr;
     if(mApplication)
     {
+      mApplication->bind();
       streamProcessor.setMaxMSGSize(mApplication->getMaxMSGSize());
-      mEPoll->mod_in(fd);
+      if(mApplication->getFragmentSize() != 0)
+        mFragmentSize=mApplication->getFragmentSize();
+      // the rest of the upgrade response may be waiting for EPOLLOUT
+      rearm();
     }
   }
   
@@ -314,8 +350,9 @@ template <bool TLSEnable=false, bool StatsEnable=false> class WebSocket
   }
   void setState(const State state)
   {
-    if((state > mState)||(state == mState))
-      mState=state;
+    const State current=mState.load(std::memory_order_relaxed);
+    if((state > current)||(state == current))
+      mState.store(state,std::memory_order_release);
     else throw std::logic_error(
         "Connection::setState(), - new state is out of order"
     );
@@ -323,46 +360,251 @@ template <bool TLSEnable=false, bool StatsEnable=false> class WebSocket
   
   const State getState() const
   {
-    return mState;
+    return mState.load(std::memory_order_acquire);
   }
   const int getfd() const
   {
     return fd;
   }
   
+  ::abstract::Worker* getOwner() const
+  {
+    return mParent;
+  }
+  
+  const size_t pendingBytes() const
+  {
+    return mPendingBytes;
+  }
+  
+  /**
+   * @brief owning worker only: drops the oldest SHARED frames which are not
+   * started yet, until at least `bytes` are freed. Dropped frames stay in
+   * the queue as tombstones without buffers.
+   * @return amount of bytes freed.
+   **/
+  const size_t dropShared(const size_t bytes)
+  {
+    size_t freed=0;
+    auto it=mPending.begin();
+    if((it != mPending.end())&&(it->offset > 0)) ++it;
+    for(;(it != mPending.end())&&(freed < bytes);++it)
+    {
+      if((it->kind == OutFrame::SHARED)&&it->buffer)
+      {
+        freed+=it->buffer->size();
+        forget(*it);
+        it->buffer.reset();
+      }
+    }
+    mPendingBytes-=freed;
+    return freed;
+  }
+  
+  /**
+   * @brief owning worker only: replaces the not yet started frame with the
+   * same conflation key.
+   * @return false if there is no such frame.
+   **/
+  const bool replaceShared(const uint64_t key, const MSGBufferTypeSPtr& buffer)
+  {
+    if(!mConflated) return false;
+    auto it=mConflated->find(key);
+    if(it == mConflated->end()) return false;
+    
+    OutFrame* frame=it->second;
+    if(frame->offset > 0) return false;
+    
+    mPendingBytes+=buffer->size();
+    mPendingBytes-=frame->buffer->size();
+    frame->buffer=buffer;
+    return true;
+  }
+  
+  /**
+   * @brief owning worker only.
+   * @return amount of bytes received, 0 if there is nothing to read yet,
+   * -1 on error or EOF.
+   **/
   int recv(std::vector<uint8_t>& buff)
   {
-    ITCSyncLock sync(mMutex);
-    if(mState != State::CLOSED)
+    if(getState() != State::CLOSED)
     {
       return this->recv(buff,enableTLS);
     }
     return -1;
   }
+  
+  /**
+   * @brief thread-safe. The frame is handed over to the owning worker
+   * which writes it without blocking, services never touch the socket.
+   * @return size of the frame or -1 if the socket is closed.
+   **/
+  const int send(const MSGBufferTypeSPtr& buff)
+  {
+    if(getState() == State::CLOSED) return -1;
+    const int size=static_cast<int>(buff->size());
+    post(OutFrame{this,fd,OutFrame::DATA,buff,0});
+    return size;
+  }
+  
   const int send(const std::vector<uint8_t>& buff)
   {
-    ITCSyncLock sync(mMutex);
-    if(mState != State::CLOSED)
+    return send(std::make_shared<MSGBufferType>(buff));
+  }
+  
+  /**
+   * @brief thread-safe. Sends the payload as a single frame without
+   * copying it: the header travels in the OutFrame and the payload buffer
+   * is shared until it is written. Auto-fragmenting sockets send a payload
+   * larger than the fragment size of the service as fragments of the
+   * same buffer.
+   * @return size of the frame(s) or -1 if the socket is closed.
+   **/
+  const int forward(const WebSocketProtocol::OpCode oc, const MSGBufferTypeSPtr& payload)
+  {
+    if(getState() == State::CLOSED) return -1;
+    OutFrame frame{this,fd,OutFrame::DATA,payload,0};
+    if(mAutoFragment&&(payload->size() > mFragmentSize))
     {
-      int ret=this->send(buff,enableTLS);
-      if(ret > 0) updateOutStats(ret);
-      return ret;
+      frame.opcode=oc;
+      frame.fragment=static_cast<uint32_t>(mFragmentSize);
     }
-    return -1;
+    else
+      frame.head_size=static_cast<uint8_t>(WebSocketProtocol::InPlaceServerMessage::putHeader(frame.head,oc,payload->size()));
+    const int size=static_cast<int>(frame.size());
+    post(std::move(frame));
+    return size;
   }
   
-  const int handleInput()
+  /**
+   * @brief owning worker only: sends the HTTP responses before the
+   * protocol upgrade. Whatever the socket does not accept at once waits
+   * in the outbound queue for EPOLLOUT, like the frames of the services.
+   * @return size of the buffer or -1 if the socket is closed.
+   **/
+  const int sendDirect(const std::vector<uint8_t>& buff)
+  {
+    if(getState() == State::CLOSED) return -1;
+    queueOut(OutFrame{this,fd,OutFrame::DATA,std::make_shared<MSGBufferType>(buff),0});
+    if(getState() == State::CLOSED) return -1;
+    return static_cast<int>(buff.size());
+  }
+  
+  /**
+   * @brief "max_pending_bytes" of "workers" : bytes - the cap of the
+   * unicast output waiting for a connection (32 MB by default, 0 - no
+   * cap). A peer which does not read its output is disconnected when a
+   * new frame would take the queue over the cap, a single frame larger
+   * than the cap is accepted on an empty queue. Broadcast frames are not
+   * counted, the channels have their own slow subscriber policies (see
+   * Broadcast.h).
+   **/
+  static const size_t maxPendingBytes()
+  {
+    static const size_t limit=[]()->size_t{
+      const json& workers=LAppSConfig::getInstance()->getWSConfig()["workers"];
+      auto it=workers.find("max_pending_bytes");
+      if((it != workers.end())&&it.value().is_number_unsigned())
+        return it.value();
+      return 32*1024*1024;
+    }();
+    return limit;
+  }
+  
+  /**
+   * @brief owning worker only: appends the frame posted by a service to
+   * the pending output and writes as much as the socket accepts.
+   **/
+  void queueOut(OutFrame&& frame)
   {
-    if(mState != State::CLOSED)
+    if(getState() == State::CLOSED) return;
+    
+    if(frame.buffer)
     {
-      if(mMutex.busy())
+      const size_t bytes=frame.size()-frame.offset;
+      if(frame.kind != OutFrame::SHARED)
       {
-        mEPoll->mod_in(fd);
-        return 0;
+        const size_t limit=maxPendingBytes();
+        if((limit != 0)&&(mUnicastBytes > 0)&&(mUnicastBytes+bytes > limit))
+        {
+          ITC_ERROR(__FILE__,__LINE__,"Peer {} does not read its output, {} bytes are pending, max_pending_bytes is {}. Closing the connection",mPeerAddress.c_str(),mUnicastBytes+bytes,limit);
+          closeNow();
+          return;
+        }
+        mUnicastBytes+=bytes;
+      }
+      mPendingBytes+=bytes;
+    }
+    mPending.push_back(std::move(frame));
+    
+    if(mPending.back().key != 0)
+    {
+      if(!mConflated)
+        mConflated=std::make_unique<tsl::robin_map<uint64_t,OutFrame*>>();
+      (*mConflated)[mPending.back().key]=&mPending.back();
+    }
+    
+    // otherwise EPOLLOUT is awaited already
+    if(mPending.size() == 1)
+    {
+      if(flush() == -1)
+      {
+        closeNow();
+        return;
       }
+      if(!mPending.empty())
+        rearm();
+    }
+  }
+  
+  /**
+   * @brief owning worker only: writes the pending frames on EPOLLOUT.
+   * @return -1 on error, 0 otherwise.
+   **/
+  const int flushOut()
+  {
+    if(getState() == State::CLOSED) return -1;
+    if(flush() == -1)
+    {
+      closeNow();
+      return -1;
+    }
+    return 0;
+  }
+  
+  /**
+   * @brief owning worker only: re-arms the one-shot epoll registration for
+   * whatever the socket is waiting for.
+   **/
+  void rearm()
+  {
+    if(getState() == State::CLOSED) return;
+    
+    const bool want_out=!mPending.empty();
+    
+    if(mInputPaused||mNoInput.load())
+    {
+      if(want_out) mEPoll->mod_out(fd);
+    }
+    else if(want_out)
+    {
+      mEPoll->mod_both(fd);
+    }
+    else
+    {
+      mEPoll->mod_in(fd);
+    }
+  }
+  
+  const int handleInput()
+  {
+    if(getState() != State::CLOSED)
+    {
       if(mNoInput.load())
       {
-        mEPoll->mod_both(fd);
+        // waiting for the service to send the close frame
+        rearm();
         return 0;
       }
       int ret=this->recv(anInBuffer);
@@ -379,18 +621,140 @@ template <bool TLSEnable=false, bool StatsEnable=false> class WebSocket
           if(ret > 0)
             goto repeat_processing;
         }
-        mEPoll->mod_in(fd);
+        if(mApplication->throttled())
+        {
+          // backpressure: the worker re-arms EPOLLIN once the service
+          // queue drains below its low watermark.
+          mInputPaused=true;
+        }
+        rearm();
+      }
+      else if(ret == 0)
+      {
+        rearm();
       }
       return ret;
     }
     return -1;
   }
   
+  const bool isInputPaused() const
+  {
+    return mInputPaused;
+  }
+  
+  /**
+   * @brief resumes reading if the service is not throttled anymore.
+   * @return true if resumed or there is nothing to resume.
+   **/
+  const bool tryResumeInput()
+  {
+    if(!mInputPaused) return true;
+    if(getState() == State::CLOSED)
+    {
+      mInputPaused=false;
+      return true;
+    }
+    if(mApplication->throttled()) return false;
+    mInputPaused=false;
+    rearm();
+    return true;
+  }
+  
 private:
+  
+  /**
+   * @brief runs the frame on the owning worker, or posts it there. Posted
+   * frames keep the socket pinned until the worker has taken them.
+   **/
+  void post(OutFrame&& frame)
+  {
+    if(::abstract::Worker::current() == mParent)
+    {
+      if(frame.kind == OutFrame::CLOSE)
+      {
+        if(mPending.empty()) closeNow();
+        else mPending.push_back(std::move(frame));
+      }
+      else
+      {
+        queueOut(std::move(frame));
+      }
+    }
+    else
+    {
+      this->pin();
+      try{
+        mParent->post(std::move(frame));
+      }catch(...)
+      {
+        this->unpin();
+        throw;
+      }
+    }
+  }
+  
+  /**
+   * @brief writes the pending frames until the socket would block.
+   * @return -1 on error, 0 otherwise.
+   **/
+  const int flush()
+  {
+    while(!mPending.empty())
+    {
+      OutFrame& frame=mPending.front();
+      
+      if(frame.kind == OutFrame::CLOSE)
+      {
+        closeNow();
+        return 0;
+      }
+      
+      if(!frame.buffer)
+      {
+        // dropped by the slow subscriber policy
+        mPending.pop_front();
+        continue;
+      }
+      
+      const size_t left=frame.size()-frame.offset;
+      const int ret=writeFrame(frame,enableTLS);
+      
+      if(ret == -1) return -1;
+      
+      mPendingBytes-=ret;
+      if(frame.kind != OutFrame::SHARED)
+        mUnicastBytes-=ret;
+      
+      if(static_cast<size_t>(ret) < left)
+      {
+        frame.offset+=ret;
+        return 0;
+      }
+      
+      updateOutStats(frame.size());
+      forget(frame);
+      mPending.pop_front();
+    }
+    return 0;
+  }
+  
+  /**
+   * @brief unregisters the frame from the conflation index.
+   **/
+  void forget(const OutFrame& frame)
+  {
+    if((frame.key != 0)&&mConflated)
+    {
+      auto it=mConflated->find(frame.key);
+      if((it != mConflated->end())&&(it->second == &frame))
+        mConflated->erase(it);
+    }
+  }
  
   void processInput(const std::vector<uint8_t>& input,const size_t input_size,WSStreamProcessing::Directive& directive)
   {
-    if(mState!=State::MESSAGING)
+    if(getState() != State::MESSAGING)
     {
       ITC_ERROR(__FILE__,__LINE__,"WebSocket::processInput(), not in messaging state",nullptr);
       return;
@@ -447,6 +811,22 @@ private:
     
   }
   
+  /**
+   * @brief passes the message to the service. The socket is pinned until
+   * the service has processed the event (see LuaReactiveService::execute).
+   **/
+  void enqueue(const WebSocketProtocol::OpCode opcode, MSGBufferTypeSPtr message)
+  {
+    this->pin();
+    try{
+      getApplication()->enqueue(LAppS::AppInEvent{opcode,this,std::move(message)});
+    }catch(...)
+    {
+      this->unpin();
+      throw;
+    }
+  }
+  
   bool onMessage(const WSEvent& ref)
   {
     if(!getApplication())
@@ -461,15 +841,7 @@ private:
       case WebSocketProtocol::TEXT:
         if(streamProcessor.isValidUtf8(ref.message->data(),ref.message->size()))
         {
-          getApplication()->enqueue(
-            std::move(
-              LAppS::AppInEvent{
-                WebSocketProtocol::TEXT,
-                this->get_shared(),
-                std::move(ref.message)
-              }
-            )
-          );
+          enqueue(WebSocketProtocol::TEXT,std::move(ref.message));
           return true;          
         }
         else 
@@ -479,15 +851,7 @@ private:
         }
       case WebSocketProtocol::BINARY:
       {
-        getApplication()->enqueue(
-          std::move(
-            LAppS::AppInEvent{
-              WebSocketProtocol::OpCode::BINARY,
-              this->get_shared(),
-              std::move(ref.message)
-            }
-          )
-        );
+        enqueue(WebSocketProtocol::OpCode::BINARY,std::move(ref.message));
         return true;
       }
       break;
@@ -515,13 +879,7 @@ private:
       auto outBuffer{std::make_shared<MSGBufferType>()};
       WebSocketProtocol::ServerCloseMessage(*outBuffer,ccode);
       
-      getApplication()->enqueue(
-        LAppS::AppInEvent{
-          WebSocketProtocol::OpCode::CLOSE,
-          this->get_shared(),
-          outBuffer
-        }
-      );
+      enqueue(WebSocketProtocol::OpCode::CLOSE,std::move(outBuffer));
       mNoInput.store(true);
     }
     catch(const std::exception& e)
@@ -606,14 +964,7 @@ RFC 6455                 The WebSocket Protocol            December 2011
       *outBuffer,
       event.message
     );
-    getApplication()->enqueue(std::move(
-        LAppS::AppInEvent{
-          WebSocketProtocol::OpCode::PONG,
-          this->get_shared(),
-          outBuffer
-        }
-      )
-    );;
+    enqueue(WebSocketProtocol::OpCode::PONG,std::move(outBuffer));
   }
   
   void updateOutStats(const size_t sz)
@@ -633,22 +984,15 @@ RFC 6455                 The WebSocket Protocol            December 2011
   
   int recv(std::vector<uint8_t>& buff, const itc::utils::Bool2Type<false> noTLS)
   {
-    while(true)
+    int ret=::recv(fd,buff.data(),buff.size(),MSG_NOSIGNAL|MSG_DONTWAIT);
+    if(ret == -1)
     {
-      int ret=::recv(fd,buff.data(),buff.size(),MSG_NOSIGNAL);
-      if(ret == -1)
-      {
-        if((errno == EWOULDBLOCK)||(errno == EAGAIN))
-        {
-          continue;
-        }
-        else
-        {
-          return -1;
-        }
-      }
-      return ret;
+      if((errno == EWOULDBLOCK)||(errno == EAGAIN))
+        return 0;
+      return -1;
     }
+    if(ret == 0) return -1; // EOF
+    return ret;
   }
 
   int recv(std::vector<uint8_t>& buff, const itc::utils::Bool2Type<true> withTLS)
@@ -659,6 +1003,9 @@ RFC 6455                 The WebSocket Protocol            December 2011
       
       if(ret <= 0)
       {
+        const int error=wolfSSL_get_error(TLSSocket,ret);
+        if((error == SSL_ERROR_WANT_READ)||(error == SSL_ERROR_WANT_WRITE))
+          return 0;
         logWOLFSSLError(ret, "WebSocket::recv(withTLS) :");
         return -1;
       }
@@ -668,45 +1015,156 @@ RFC 6455                 The WebSocket Protocol            December 2011
     return -1;
   }
   
-  const int send(const std::vector<uint8_t>& buff,const itc::utils::Bool2Type<false> noTLS)
+  /**
+   * @brief writes the rest of the frame, the header and the payload are
+   * gathered into one call.
+   * @return as write().
+   **/
+  const int writeFrame(const OutFrame& frame, const itc::utils::Bool2Type<false> noTLS)
   {
-    size_t outCursor=0;
-    do
+    if(frame.fragment != 0)
+      return writeFragments(frame);
+    
+    if(frame.offset >= frame.head_size)
     {
-      const int result=::send(fd,buff.data()+outCursor,buff.size()-outCursor,MSG_NOSIGNAL);
-
-      if(result == -1)
-      {
-        if((errno == EAGAIN)||(errno == EWOULDBLOCK))
-          continue;
-        return -1;
-      }
-
-      outCursor+=result;
-
-    } while(outCursor != buff.size());
-    return outCursor;
+      const size_t pos=frame.offset-frame.head_size;
+      return write(frame.buffer->data()+pos,frame.buffer->size()-pos,noTLS);
+    }
+    
+    iovec parts[2]={
+      {const_cast<uint8_t*>(frame.head+frame.offset),frame.head_size-frame.offset},
+      {frame.buffer->data(),frame.buffer->size()}
+    };
+    msghdr msg{};
+    msg.msg_iov=parts;
+    msg.msg_iovlen=2;
+    const ssize_t result=::sendmsg(fd,&msg,MSG_NOSIGNAL|MSG_DONTWAIT);
+    if(result == -1)
+    {
+      if((errno == EAGAIN)||(errno == EWOULDBLOCK))
+        return 0;
+      return -1;
+    }
+    return static_cast<int>(result);
+  }
+  
+  /**
+   * @brief with TLS the header and the payload are written one after
+   * another, every part is retried as is on WANT_WRITE.
+   **/
+  const int writeFrame(const OutFrame& frame, const itc::utils::Bool2Type<true> withTLS)
+  {
+    if(frame.fragment != 0)
+    {
+      const size_t len=stageFragments(frame);
+      return write(tlsStage().data(),len,withTLS);
+    }
+    
+    if(frame.offset < frame.head_size)
+      return write(frame.head+frame.offset,frame.head_size-frame.offset,withTLS);
+    const size_t pos=frame.offset-frame.head_size;
+    return write(frame.buffer->data()+pos,frame.buffer->size()-pos,withTLS);
+  }
+  
+  /**
+   * @brief writes the rest of the fragments, up to FRAGMENTS_PER_WRITE
+   * fragments per sendmsg().
+   **/
+  const int writeFragments(const OutFrame& frame)
+  {
+    static constexpr size_t FRAGMENTS_PER_WRITE=256;
+    
+    WebSocketProtocol::FragmentedMessage::HeaderType heads[FRAGMENTS_PER_WRITE];
+    iovec parts[2*FRAGMENTS_PER_WRITE];
+    
+    msghdr msg{};
+    msg.msg_iov=parts;
+    msg.msg_iovlen=WebSocketProtocol::FragmentedMessage::gather(
+      frame.buffer->data(),frame.buffer->size(),frame.fragment,frame.opcode,
+      frame.offset,parts,heads,FRAGMENTS_PER_WRITE
+    );
+    const ssize_t result=::sendmsg(fd,&msg,MSG_NOSIGNAL|MSG_DONTWAIT);
+    if(result == -1)
+    {
+      if((errno == EAGAIN)||(errno == EWOULDBLOCK))
+        return 0;
+      return -1;
+    }
+    return static_cast<int>(result);
+  }
+  
+  /**
+   * @brief wolfSSL has no vectored write: the fragments from the frame
+   * offset are copied into the staging buffer, up to one TLS record. The
+   * same offset gives the same bytes, as required for a retry after
+   * WANT_WRITE.
+   * @return amount of bytes staged.
+   **/
+  const size_t stageFragments(const OutFrame& frame)
+  {
+    static constexpr size_t FRAGMENTS_PER_WRITE=16;
+    static constexpr size_t TLS_RECORD_SIZE=16384;
+    
+    WebSocketProtocol::FragmentedMessage::HeaderType heads[FRAGMENTS_PER_WRITE];
+    iovec parts[2*FRAGMENTS_PER_WRITE];
+    
+    const size_t count=WebSocketProtocol::FragmentedMessage::gather(
+      frame.buffer->data(),frame.buffer->size(),frame.fragment,frame.opcode,
+      frame.offset,parts,heads,FRAGMENTS_PER_WRITE
+    );
+    
+    auto& stage=tlsStage();
+    stage.clear();
+    for(size_t i=0;(i < count)&&(stage.size() < TLS_RECORD_SIZE);++i)
+    {
+      const uint8_t* part=static_cast<const uint8_t*>(parts[i].iov_base);
+      const size_t len=std::min(parts[i].iov_len,TLS_RECORD_SIZE-stage.size());
+      stage.insert(stage.end(),part,part+len);
+    }
+    return stage.size();
+  }
+  
+  static std::vector<uint8_t>& tlsStage()
+  {
+    static thread_local std::vector<uint8_t> stage;
+    return stage;
+  }
+  
+  /**
+   * @return amount of bytes written, 0 if the socket would block, -1 on error.
+   **/
+  const int write(const uint8_t* data, const size_t len, const itc::utils::Bool2Type<false> noTLS)
+  {
+    const int result=::send(fd,data,len,MSG_NOSIGNAL|MSG_DONTWAIT);
+    if(result == -1)
+    {
+      if((errno == EAGAIN)||(errno == EWOULDBLOCK))
+        return 0;
+      return -1;
+    }
+    return result;
   }
 
-  const int send(const std::vector<uint8_t>& buff,const itc::utils::Bool2Type<true> withTLS)
+  /**
+   * @return amount of bytes written, 0 if the socket would block, -1 on
+   * error. wolfSSL requires the same buffer to be retried after WANT_WRITE,
+   * which is the case since the frame offset only advances on success.
+   **/
+  const int write(const uint8_t* data, const size_t len, const itc::utils::Bool2Type<true> withTLS)
   {
     if(TLSSocket)
     {
-      size_t outCursor=0;
-      do
-      {
-        const int result=wolfSSL_write(TLSSocket,buff.data()+outCursor,buff.size()-outCursor);
+      const int result=wolfSSL_write(TLSSocket,data,len);
 
-        if(result == -1)
-        {
-          logWOLFSSLError(result,"WebSocket::send(withTLS) :");
-          return -1;
-        }
-        
-        outCursor+=result;
-      }while(outCursor!=buff.size());
-
-      return outCursor;
+      if(result <= 0)
+      {
+        const int error=wolfSSL_get_error(TLSSocket,result);
+        if((error == SSL_ERROR_WANT_WRITE)||(error == SSL_ERROR_WANT_READ))
+          return 0;
+        logWOLFSSLError(result,"WebSocket::write(withTLS) :");
+        return -1;
+      }
+      return result;
     }
     return -1;
   }  
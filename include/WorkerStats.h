@@ -51,10 +51,11 @@ namespace LAppS
     size_t mBytesIn;
     size_t mBytesOut;
     size_t mInQueueDepth;
+    size_t mPausedConnections;
     
     IOStats(): WorkerMinStats(), mInMessageCount{0},mOutMessageCount{0},
       mInMessageMaxSize{0},mOutMessageMaxSize{0},mBytesIn{0},mBytesOut{0},
-      mInQueueDepth{0}
+      mInQueueDepth{0},mPausedConnections{0}
     {
     }
       
@@ -67,6 +68,7 @@ namespace LAppS
       mInMessageMaxSize=value.mInMessageMaxSize;
       mOutMessageMaxSize=value.mOutMessageMaxSize;
       mInQueueDepth=value.mInQueueDepth;
+      mPausedConnections=value.mPausedConnections;
       return *this;
     }
   };
@@ -0,0 +1,104 @@
+/**
+ *  Copyright 2017-2018, Pavel Kraynyukhov <pavel.kraynyukhov@gmail.com>
+ *
+ *  This file is a part of LAppS (Lua Application Server).
+ *
+ *  LAppS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  LAppS is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with LAppS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  $Id: Awaitable.h October 26, 2026 10:15 AM $
+ *
+ **/
+
+
+#ifndef __AWAITABLE_H__
+#  define __AWAITABLE_H__
+
+#include <chrono>
+
+extern "C" {
+#include <lua.h>
+}
+
+namespace LAppS
+{
+  namespace abstract
+  {
+    /**
+     * @brief what a suspended coroutine of a service instance waits for,
+     * see CoScheduler. All the methods are called by the instance thread.
+     **/
+    class Awaitable
+    {
+     public:
+      typedef std::chrono::steady_clock Clock;
+
+     private:
+      Clock::time_point mDeadline;
+
+     public:
+      /**
+       * @param timeout_ms - negative to wait forever.
+       **/
+      explicit Awaitable(const long timeout_ms)
+      : mDeadline(
+          (timeout_ms < 0) ? Clock::time_point::max() : Clock::now()+std::chrono::milliseconds(timeout_ms)
+        )
+      {
+      }
+
+      Awaitable(const Awaitable&)=delete;
+      Awaitable(Awaitable&)=delete;
+
+      virtual ~Awaitable()=default;
+
+      /**
+       * @brief pushes the results onto the suspended thread if the wait is
+       * over. L is the main state of the instance, for calling Lua.
+       * @return amount of values pushed, -1 if not ready yet.
+       **/
+      virtual const int poll(lua_State* L, lua_State* thread)=0;
+
+      /**
+       * @brief pushes the results of the wait timed out, nil by default.
+       **/
+      virtual const int expire(lua_State* thread)
+      {
+        lua_pushnil(thread);
+        return 1;
+      }
+
+      /**
+       * @brief true if poll() has to be tried periodically. Otherwise the
+       * awaitable waits for the deadline only, or wakes the instance up
+       * itself and reports it with ready().
+       **/
+      virtual const bool polling() const
+      {
+        return true;
+      }
+
+      virtual const bool ready() const
+      {
+        return false;
+      }
+
+      const Clock::time_point& deadline() const
+      {
+        return mDeadline;
+      }
+    };
+  }
+}
+
+#endif /* __AWAITABLE_H__ */
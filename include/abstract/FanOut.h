@@ -0,0 +1,81 @@
+/**
+ *  Copyright 2017-2018, Pavel Kraynyukhov <pavel.kraynyukhov@gmail.com>
+ * 
+ *  This file is a part of LAppS (Lua Application Server).
+ *  
+ *  LAppS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *  
+ *  LAppS is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *  
+ *  You should have received a copy of the GNU General Public License
+ *  along with LAppS.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  $Id: FanOut.h October 20, 2026 1:40 PM $
+ * 
+ **/
+
+
+#ifndef __FANOUT_H__
+#  define __FANOUT_H__
+
+#include <memory>
+#include <cstdint>
+#include <WSEvent.h>
+
+namespace abstract
+{
+  class WebSocket;
+  class FanOut;
+  
+  /**
+   * @brief a socket's side of a subscription: the channel partition and
+   * the subscriber's slot in it. Channels are not destroyed while they have
+   * members, hence the raw pointer.
+   **/
+  struct Membership
+  {
+    FanOut*   channel;
+    uint32_t  slot;
+  };
+  
+  /**
+   * @brief subscribers of a broadcast channel which are connected to one
+   * IOWorker. All the methods are called on that worker's thread only.
+   * 
+   * Subscriptions are indexed both ways: the channel keeps the subscriber
+   * and the index of its Membership record, the socket keeps the channel
+   * and the slot. Both sides are swap-removed, so subscribe, unsubscribe
+   * and cleanup on disconnect are O(1) in the channel size.
+   **/
+  class FanOut
+  {
+   public:
+    /**
+     * @brief key is the conflation key or 0.
+     **/
+    virtual void deliver(const MSGBufferTypeSPtr&, const uint64_t key)=0;
+    /**
+     * @brief ws is nullptr if the connection is gone before the
+     * subscription request reached the worker.
+     **/
+    virtual void subscribe(WebSocket* ws)=0;
+    virtual void unsubscribe(WebSocket*)=0;
+    /**
+     * @brief removes the subscriber at slot, both sides of the index.
+     **/
+    virtual void removeAt(const uint32_t slot)=0;
+    /**
+     * @brief the subscriber at slot has its Membership record moved.
+     **/
+    virtual void relink(const uint32_t slot, const uint32_t membership)=0;
+    virtual ~FanOut()=default;
+  };
+}
+
+#endif /* __FANOUT_H__ */
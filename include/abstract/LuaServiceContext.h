@@ -25,6 +25,8 @@
 #  define __LUASERVICECONTEXT_H__
 
 #include <string>
+#include <atomic>
+#include <chrono>
 #include <abstract/ServiceContext.h>
 
 extern "C" {
@@ -38,14 +40,22 @@ extern "C" {
 #include <modules/nljson.h>
 #include <modules/wsSend.h>
 #include <modules/bcast.h>
+#include <modules/topics.h>
 #include <modules/pam_auth.h>
 #include <modules/murmur.h>
 #include <modules/time_now.h>
 #include <modules/mqr.h>
 #include <modules/cws.h>
 #include <modules/nap.h>
+#include <modules/stats.h>
+#include <modules/cbor.h>
+#include <modules/rawffi.h>
+#include <modules/await.h>
+#include <modules/shdict.h>
 
 #include <Config.h>
+#include <LuaAllocator.h>
+#include <BytecodeCache.h>
 
 static void init_nljson_module(lua_State* L)
 {
@@ -84,6 +94,9 @@ static void init_murmur_module(lua_State* L)
 
 static void init_mqr_module(lua_State* L)
 {
+  luaopen_msgbuf(L);
+  lua_setfield(L,LUA_GLOBALSINDEX,"msgbuf");
+  lua_pop(L,lua_gettop(L));
   luaopen_mqr(L);
   lua_setfield(L,LUA_GLOBALSINDEX,"mqr");
   lua_pop(L,lua_gettop(L));
@@ -103,6 +116,13 @@ static void init_ws_module(lua_State* L)
   lua_pop(L,lua_gettop(L));
 }
 
+static void init_stats_module(lua_State* L)
+{
+  luaopen_stats(L);
+  lua_setfield(L,LUA_GLOBALSINDEX,"stats");
+  lua_pop(L,lua_gettop(L));
+}
+
 static void init_bcast_module(lua_State* L)
 {
   luaopen_bcast(L);
@@ -110,13 +130,63 @@ static void init_bcast_module(lua_State* L)
   lua_pop(L,lua_gettop(L));
 }
 
+static void init_topics_module(lua_State* L)
+{
+  luaopen_topics(L);
+  lua_setfield(L,LUA_GLOBALSINDEX,"topics");
+  lua_pop(L,lua_gettop(L));
+}
+
+static void init_cbor_module(lua_State* L)
+{
+  luaopen_cbor(L);
+  lua_setfield(L,LUA_GLOBALSINDEX,"cbor");
+  lua_pop(L,lua_gettop(L));
+}
+
+static void init_await_module(lua_State* L)
+{
+  luaopen_await(L);
+  lua_setfield(L,LUA_GLOBALSINDEX,"await");
+  lua_pop(L,lua_gettop(L));
+}
+
+static void init_shdict_module(lua_State* L)
+{
+  luaopen_shdict(L);
+  lua_setfield(L,LUA_GLOBALSINDEX,"shdict");
+  lua_pop(L,lua_gettop(L));
+}
+
+/**
+ * @brief requires LuaJIT FFI. Hooks ws:send() if the ws module is there
+ * already, may be called again after it is loaded.
+ **/
+static void init_rawffi_module(lua_State* L)
+{
+  lua_pushcfunction(L,luaopen_rawffi);
+  if(lua_pcall(L,0,1,0) != 0)
+  {
+    const std::string error(lua_tostring(L,-1));
+    lua_pop(L,lua_gettop(L));
+    throw std::system_error(ENOTSUP,std::system_category(),"Can't load rawffi module: "+error);
+  }
+  lua_setfield(L,LUA_GLOBALSINDEX,"rawffi");
+  lua_pop(L,lua_gettop(L));
+}
+
 static thread_local const std::map<std::string,void(*)(lua_State*)> modules_map={
   {"nap",init_nap_module},
   {"time",init_time_module},
   {"pam_auth",init_pam_auth_module},
   {"murmur",init_murmur_module},
   {"mqr",init_mqr_module},
-  {"cws",init_cws_module}
+  {"cws",init_cws_module},
+  {"stats",init_stats_module},
+  {"cbor",init_cbor_module},
+  {"rawffi",init_rawffi_module},
+  {"await",init_await_module},
+  {"shdict",init_shdict_module}
 };
 
 namespace LAppS
@@ -125,7 +195,105 @@ namespace LAppS
   {
     class LuaServiceContext : public ServiceContext
     {
+     private:
+      /**
+       * @brief "memory_limit" : bytes - hard cap of the Lua state of each
+       * instance of the service, 0 or absent for none. Requires LuaJIT
+       * built with GC64, otherwise the service is not started.
+       **/
+      static const size_t memoryLimit(const std::string& name)
+      {
+        const json& service=LAppSConfig::getInstance()->getServiceConfig(name);
+        auto limit=service.find("memory_limit");
+        if((limit == service.end())||(!limit.value().is_number_unsigned()))
+          return 0;
+        return limit.value();
+      }
+      
+      /**
+       * @brief "gc" : { "pause" : 200, "stepmul" : 200, "idle_step_kb" : 64,
+       * "idle_budget_us" : 500 } - the collector parameters of the Lua
+       * state (Lua defaults if absent) and the incremental GC work done
+       * while the instance is idle: steps of idle_step_kb for up to
+       * idle_budget_us per idle round, 0 disables it.
+       **/
+      struct GCConfig
+      {
+        int   pause;
+        int   stepmul;
+        int   idle_step_kb;
+        long  idle_budget_us;
+      };
+      
+      static const GCConfig getGCConfig(const std::string& name)
+      {
+        GCConfig config{0,0,64,500};
+        const json& service=LAppSConfig::getInstance()->getServiceConfig(name);
+        auto gc=service.find("gc");
+        if((gc == service.end())||(!gc.value().is_object())) return config;
+        
+        auto value=[&gc](const char* key, auto& field)
+        {
+          auto it=gc.value().find(key);
+          if((it != gc.value().end())&&it.value().is_number_unsigned())
+            field=it.value();
+        };
+        value("pause",config.pause);
+        value("stepmul",config.stepmul);
+        value("idle_step_kb",config.idle_step_kb);
+        value("idle_budget_us",config.idle_budget_us);
+        if(config.idle_step_kb == 0)
+          config.idle_budget_us=0;
+        return config;
+      }
+      
+      // instance thread writes, stats readers
+      struct GCStats
+      {
+        std::atomic<uint64_t> idle_steps{0};
+        std::atomic<uint64_t> idle_cycles{0};
+        std::atomic<uint64_t> idle_ns{0};
+        std::atomic<uint64_t> full_collections{0};
+        std::atomic<uint64_t> full_ns{0};
+      };
+      
+      GCConfig  mGCConfig;
+      GCStats   mGCStats;
+      int       mGCIdleFrom;
+      
+      static const uint64_t elapsedNS(const std::chrono::steady_clock::time_point& started)
+      {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-started).count();
+      }
+      
+      static int panic(lua_State* L)
+      {
+        ITC_ERROR(__FILE__,__LINE__,"PANIC: unprotected error in call to Lua API ({})",lua_tostring(L,-1));
+        return 0;
+      }
+      
+      lua_State* newState()
+      {
+        lua_State* L=lua_newstate(::LAppS::LuaAllocator::alloc,&mAllocator);
+        if(L)
+        {
+          lua_atpanic(L,panic);
+          return L;
+        }
+        // LuaJIT without GC64 accepts its own allocator only
+        if(mAllocator.limit() != 0)
+        {
+          throw std::system_error(
+            ENOTSUP,std::system_category(),
+            "memory_limit of service "+this->getName()+" requires LuaJIT 2.1 built with GC64"
+          );
+        }
+        ITC_ERROR(__FILE__,__LINE__,"Service {}: lua_newstate() has failed, the memory of the Lua state is not accounted",this->getName().c_str());
+        return luaL_newstate();
+      }
+      
      protected:
+      ::LAppS::LuaAllocator mAllocator;
       lua_State*  mLState;
       
       void cleanLuaStack()
@@ -152,11 +320,62 @@ namespace LAppS
         return true;
       }
 
+      /**
+       * @brief lua_pcall() of a service callback. The allocator can not
+       * collect garbage itself, so a call failed by the memory cap is made
+       * once more after a full GC, with copies of the function and its
+       * arguments kept below the call. The state is checked for memory
+       * pressure after every call.
+       **/
+      const int pcall(const int nargs, const int nresults)
+      {
+        const int func=lua_gettop(mLState)-nargs;
+        const bool keep=(mAllocator.limit() != 0)&&lua_checkstack(mLState,nargs+1);
+
+        if(keep)
+        {
+          for(int i=func;i<=func+nargs;++i)
+            lua_pushvalue(mLState,i);
+        }
+
+        int ret=lua_pcall(mLState,nargs,nresults,0);
+
+        if(keep)
+        {
+          if((ret == LUA_ERRMEM)&&mAllocator.exhausted())
+          {
+            lua_pop(mLState,1);
+            fullGC();
+            ret=lua_pcall(mLState,nargs,nresults,0);
+          }
+          else
+          {
+            for(int i=func;i<=func+nargs;++i)
+              lua_remove(mLState,func);
+          }
+        }
+        relieveMemoryPressure();
+        return ret;
+      }
+
+      /**
+       * @brief a call failed by the memory cap does not take the instance
+       * down: the garbage is collected and the error is replaced by true.
+       **/
       void checkForLuaErrorsOnPcall(const int ret, const char* method)
       {
+        if((ret == LUA_ERRMEM)&&mAllocator.exhausted())
+        {
+          ITC_ERROR(__FILE__,__LINE__,"Service [{}]: {}() has hit the memory limit of {} bytes, the call is dropped",this->getName().c_str(),method,mAllocator.limit());
+          lua_pop(mLState,1);
+          fullGC();
+          lua_pushboolean(mLState,true);
+          return;
+        }
         checkForLuaErrorsOn(ret,"calling method",method);
       }
 
+
       void checkForLuaErrorsOnRequire(const int ret, const char* module)
       {
         checkForLuaErrorsOn(ret,"loading module",module);
@@ -184,14 +403,26 @@ namespace LAppS
 
      public:
       explicit LuaServiceContext(const std::string& name)
-      : ServiceContext(name), mLState{luaL_newstate()}
+      : ServiceContext(name), mGCConfig(getGCConfig(name)), mGCStats(), mGCIdleFrom{0},
+        mAllocator(memoryLimit(name)), mLState{newState()}
       {
+        if(mGCConfig.pause > 0)
+          lua_gc(mLState,LUA_GCSETPAUSE,mGCConfig.pause);
+        if(mGCConfig.stepmul > 0)
+          lua_gc(mLState,LUA_GCSETSTEPMUL,mGCConfig.stepmul);
+
         luaL_openlibs(mLState);
+        install_bytecode_searcher(mLState);
         init_nljson_module(mLState);
         
         try{
-          json& modules=LAppSConfig::getInstance()->getLAppSConfig()["services"][this->getName()]["preload"];
+          // instances are constructed in parallel, the config is not modified here
+          const json& service=LAppSConfig::getInstance()->getServiceConfig(this->getName());
+          auto preload=service.find("preload");
+          if(preload == service.end())
+            return;
           
+          const json& modules=preload.value();
           for(auto it=modules.begin();it!=modules.end();++it)
           {
             auto it1=modules_map.find(*it);
@@ -217,6 +448,80 @@ namespace LAppS
       
       virtual const bool isServiceModuleValid()  = 0;
       
+      const json getMemoryStats() const
+      {
+        return mAllocator.getStats();
+      }
+      
+      /**
+       * @brief full GC if the state is close to its memory limit, called
+       * by the instance thread between the calls into Lua.
+       **/
+      void relieveMemoryPressure()
+      {
+        if(mAllocator.pressure())
+          fullGC();
+      }
+      
+      void fullGC()
+      {
+        const auto started=std::chrono::steady_clock::now();
+        lua_gc(mLState,LUA_GCCOLLECT,0);
+        mAllocator.collected();
+        mGCStats.full_collections.fetch_add(1,std::memory_order_relaxed);
+        mGCStats.full_ns.fetch_add(elapsedNS(started),std::memory_order_relaxed);
+      }
+      
+      /**
+       * @brief incremental GC work for an idle instance, bounded by
+       * idle_budget_us, so the collector is less likely to run inside the
+       * next burst of calls. After a finished cycle the steps resume half
+       * way to the threshold the pause sets for the next one.
+       * @return true if any work was done.
+       **/
+      const bool idleCollect()
+      {
+        if(mGCConfig.idle_budget_us == 0)
+          return false;
+        
+        const int pause=(mGCConfig.pause > 0) ? mGCConfig.pause : 200;
+        const int growth=(pause > 100) ? static_cast<int>(int64_t(mGCIdleFrom)*(pause-100)/200) : 0;
+        const int kb=lua_gc(mLState,LUA_GCCOUNT,0);
+        if(kb < mGCIdleFrom+std::max(mGCConfig.idle_step_kb,growth))
+          return false;
+        
+        const auto started=std::chrono::steady_clock::now();
+        const auto deadline=started+std::chrono::microseconds(mGCConfig.idle_budget_us);
+        uint64_t steps=0;
+        do
+        {
+          ++steps;
+          if(lua_gc(mLState,LUA_GCSTEP,mGCConfig.idle_step_kb))
+          {
+            mGCIdleFrom=lua_gc(mLState,LUA_GCCOUNT,0);
+            mGCStats.idle_cycles.fetch_add(1,std::memory_order_relaxed);
+            break;
+          }
+        }while(std::chrono::steady_clock::now() < deadline);
+        
+        mGCStats.idle_steps.fetch_add(steps,std::memory_order_relaxed);
+        mGCStats.idle_ns.fetch_add(elapsedNS(started),std::memory_order_relaxed);
+        return true;
+      }
+      
+      const json getGCStats() const
+      {
+        return json{
+          { "pause", mGCConfig.pause },
+          { "stepmul", mGCConfig.stepmul },
+          { "idle_steps", mGCStats.idle_steps.load(std::memory_order_relaxed) },
+          { "idle_cycles", mGCStats.idle_cycles.load(std::memory_order_relaxed) },
+          { "idle_ns", mGCStats.idle_ns.load(std::memory_order_relaxed) },
+          { "full_collections", mGCStats.full_collections.load(std::memory_order_relaxed) },
+          { "full_ns", mGCStats.full_ns.load(std::memory_order_relaxed) }
+        };
+      }
+      
       virtual ~LuaServiceContext()
       {
         if(mLState)
@@ -27,6 +27,8 @@
 #include <string>
 #include <chrono>
 #include <memory>
+#include <atomic>
+#include <cstdint>
 #include <Nonce.h>
 #include <abstract/Runnable.h>
 #include <ContextTypes.h>
@@ -34,14 +36,31 @@
 #include <sys/CancelableThread.h>
 #include <AppInEvent.h>
 
+#include <ext/json.hpp>
+
+using json=nlohmann::json;
+
 namespace LAppS
 {
   namespace abstract
   {
     class Service : public ::itc::abstract::IRunnable
     {
+     public:
+      /**
+       * @brief cumulative counters, the load is measured by the difference
+       * of two samples.
+       **/
+      struct LoadSample
+      {
+        size_t    depth;      // events queued right now
+        size_t    processed;  // events processed so far
+        uint64_t  busy_ns;    // time spent processing them
+      };
+      
      private:
       size_t              mInstanceId;
+      std::atomic<size_t> mConnections;
       
      public:
       explicit Service()
@@ -49,7 +68,8 @@ namespace LAppS
           std::hash<std::string>{}(std::to_string(std::chrono::duration_cast<std::chrono::nanoseconds>(
             std::chrono::time_point_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now()).time_since_epoch()
           ).count())+std::to_string(std::hash<size_t>{}(InstanceIdNonce::getInstance()->getNext())))
-      }{
+      }, mConnections{0}
+      {
       }
       
       Service(const Service&) = delete;
@@ -72,9 +92,62 @@ namespace LAppS
       virtual const bool filterIP(const uint32_t address) const = 0;
       virtual void shutdown() = 0;
       virtual const size_t getMaxMSGSize() const=0;
-      virtual void enqueue(const AppInEvent&&)=0;
+      virtual void enqueue(AppInEvent&&)=0;
       virtual std::atomic<bool>* get_stop_flag_address() = 0;
       
+      /**
+       * @brief read backpressure: true while the instance is over its
+       * queue depth high watermark.
+       **/
+      virtual const bool throttled()
+      {
+        return false;
+      }
+      
+      /**
+       * @brief runtime metrics of the instance, exported by
+       * ServiceRegistry::list().
+       **/
+      virtual const json getStats() const
+      {
+        return json::object();
+      }
+      
+      /**
+       * @brief payload bytes per fragment on the auto-fragmenting sockets,
+       * 0 for the default (WebSocketProtocol::FragmentedMessage).
+       **/
+      virtual const size_t getFragmentSize() const
+      {
+        return 0;
+      }
+      
+      /**
+       * @brief load of the instance for ServiceAutoscaler.
+       **/
+      virtual const LoadSample getLoad() const
+      {
+        return LoadSample{0,0,0};
+      }
+      
+      /**
+       * @brief connections bound to the instance (WebSocket::setApplication()).
+       **/
+      void bind()
+      {
+        mConnections.fetch_add(1,std::memory_order_relaxed);
+      }
+      
+      void unbind()
+      {
+        mConnections.fetch_sub(1,std::memory_order_relaxed);
+      }
+      
+      const size_t connections() const
+      {
+        return mConnections.load(std::memory_order_relaxed);
+      }
+      
       virtual ~Service() noexcept = default;
     };
   }
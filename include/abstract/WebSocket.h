@@ -22,24 +22,101 @@
 #define WEBSOCKET_H
 #include <vector>
 #include <queue>
+#include <atomic>
 #include <WSEvent.h>
+#include <OutFrame.h>
+#include <abstract/FanOut.h>
 namespace abstract
 {
+  class Worker;
+  
   class WebSocket : public std::enable_shared_from_this<abstract::WebSocket>
   {
   public:
     enum State { ACCEPT=-1, HANDSHAKE=0, MESSAGING=1, CLOSED=2 };
     
-    WebSocket()=default;
+    WebSocket() : mInFlight{0}, mHandle{0}, mMemberships()
+    {
+    }
+    
+    /**
+     * @brief the handle given to Lua instead of the socket address, see
+     * LAppS::wsHandles(). Set by the owning worker before the socket
+     * produces any event, 0 if the socket has none.
+     **/
+    const uint64_t handle() const
+    {
+      return mHandle;
+    }
+    void setHandle(const uint64_t handle)
+    {
+      mHandle=handle;
+    }
+    
+    /**
+     * @brief in-flight events accounting. Services reference the socket by
+     * a raw pointer, the owning worker must not release the socket while
+     * it is pinned.
+     **/
+    void pin()
+    {
+      mInFlight.fetch_add(1,std::memory_order_relaxed);
+    }
+    void unpin()
+    {
+      mInFlight.fetch_sub(1,std::memory_order_release);
+    }
+    const bool isPinned() const
+    {
+      return mInFlight.load(std::memory_order_acquire) > 0;
+    }
     
     virtual const int send(const std::vector<uint8_t>&)=0;
+    virtual const int send(const MSGBufferTypeSPtr&)=0;
+    virtual const int forward(const WebSocketProtocol::OpCode, const MSGBufferTypeSPtr&)=0;
     virtual const State getState() const=0;
     virtual const bool mustAutoFragment() const=0;
-    virtual std::shared_ptr<abstract::WebSocket> get_shared()=0;
     virtual void returnBuffer(std::remove_reference<const std::shared_ptr<MSGBufferType>&>::type)=0;
     virtual void close()=0;
+    virtual const int getfd() const=0;
+    virtual Worker* getOwner() const=0;
+    
+    // owning worker only
+    virtual void queueOut(OutFrame&&)=0;
+    virtual const size_t pendingBytes() const=0;
+    virtual const size_t dropShared(const size_t)=0;
+    virtual const bool replaceShared(const uint64_t, const MSGBufferTypeSPtr&)=0;
+    virtual void closeNow()=0;
+    
+    /**
+     * @brief owning worker only: broadcast channels this socket is
+     * subscribed to, see FanOut.
+     **/
+    std::vector<Membership>& memberships()
+    {
+      return mMemberships;
+    }
+    
+    /**
+     * @brief owning worker only: unsubscribes from all the channels.
+     **/
+    void leaveAll()
+    {
+      while(!mMemberships.empty())
+      {
+        const Membership& last=mMemberships.back();
+        last.channel->removeAt(last.slot);
+      }
+    }
   protected:
-    virtual ~WebSocket()=default;
+    virtual ~WebSocket()
+    {
+      leaveAll();
+    }
+  private:
+    std::atomic<uint32_t> mInFlight;
+    uint64_t              mHandle;
+    std::vector<Membership> mMemberships;
   };
 }
 
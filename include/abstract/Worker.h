@@ -30,6 +30,7 @@
 #include <TCPListener.h>
 #include <WorkerStats.h>
 #include <WSEvent.h>
+#include <OutFrame.h>
 #include <ext/json.hpp>
 
 using json=nlohmann::json;
@@ -81,7 +82,18 @@ namespace abstract
     {
       return ID;
     }
+    
+    /**
+     * @brief the worker running on the current thread or nullptr.
+     **/
+    static Worker*& current()
+    {
+      static thread_local Worker* worker=nullptr;
+      return worker;
+    }
+    
     virtual void enqueue(const ::itc::TCPListener::value_type&)=0;
+    virtual void post(OutFrame&&)=0;
     virtual void deleteConnection(const int32_t)=0;
     virtual void disconnect(const int32_t)=0;
     virtual const bool  isTLSEnabled() const = 0;
@@ -70,6 +70,18 @@ public:
       throw std::system_error(errno,std::system_category(),"Exception in epoll_ctl() in ePoll::add_in(): ");
   }
   
+  /**
+   * \@brief adds fd with the level-triggered EPOLLIN (e.g. an eventfd).
+   **/
+  void add_level_in(const int fd)
+  {
+    epoll_event ev;
+    ev.events=EPOLLIN;
+    ev.data.fd=fd;
+    if(epoll_ctl(mPollFD,EPOLL_CTL_ADD,fd,&ev)==-1)
+      throw std::system_error(errno,std::system_category(),"Exception in epoll_ctl() in ePoll::add_level_in(): ");
+  }
+  
   void add_out(const int fd)
   {
     epoll_event ev;
@@ -0,0 +1,472 @@
+/**
+ *  Copyright 2017-2018, Pavel Kraynyukhov <pavel.kraynyukhov@gmail.com>
+ *
+ *  This file is a part of LAppS (Lua Application Server).
+ *
+ *  LAppS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  LAppS is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with LAppS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  $Id: await.h October 26, 2026 11:30 AM $
+ *
+ **/
+
+
+#ifndef __AWAIT_H__
+#  define __AWAIT_H__
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <CoScheduler.h>
+#include <MQueue.h>
+#include <modules/mqr.h>
+#include <modules/pam_auth.h>
+
+extern "C" {
+#include <lua.h>
+#include <lualib.h>
+#include <lauxlib.h>
+}
+
+/**
+ * Lua interface:
+ *   await.sleep(ms)                     -> true
+ *   await.recv(mqr_obj[, timeout])      -> nljson|msgbuf|nil
+ *   await.poll(fn[, timeout])           -> results of fn()|nil
+ *   await.login(service, user, password)-> boolean (PAM)
+ *   await.yield()
+ *   await.running()                     -> boolean
+ *
+ * Inside of onMessage() of a service with "coroutines" : true these
+ * suspend the request and let the instance process other messages until
+ * the wait is over. Anywhere else they block the instance, as nap, mqr
+ * and pam_auth do. Timeouts are in milliseconds, forever if absent.
+ *
+ * await.poll() calls fn until it returns a non-nil value, e.g. a reply
+ * stored by a cws onmessage callback:
+ *   local reply=await.poll(function() cws:eventloop() return replies[id] end, 5000)
+ *
+ * In a coroutine await.login() runs PAM on one of a few shared threads,
+ * it returns false and an error when too many logins are queued already.
+ **/
+
+namespace LAppS
+{
+  namespace await
+  {
+    class Sleep : public abstract::Awaitable
+    {
+     public:
+      explicit Sleep(const long ms) : abstract::Awaitable(ms)
+      {
+      }
+      const int poll(lua_State* L, lua_State* thread)
+      {
+        return -1;
+      }
+      const int expire(lua_State* thread)
+      {
+        lua_pushboolean(thread,true);
+        return 1;
+      }
+      const bool polling() const
+      {
+        return false;
+      }
+    };
+
+    class Recv : public abstract::Awaitable
+    {
+     private:
+      MQ::QueueHolderType mQueue;
+
+     public:
+      Recv(const MQ::QueueHolderType& queue, const long timeout_ms)
+      : abstract::Awaitable(timeout_ms), mQueue(queue)
+      {
+      }
+      const int poll(lua_State* L, lua_State* thread)
+      {
+        MQ::MessageType message;
+        if(!mQueue->try_recv(message))
+          return -1;
+        push_mqr_message(thread,std::move(message));
+        return 1;
+      }
+    };
+
+    /**
+     * @brief calls the function in the main state of the instance until
+     * it returns something but nil. An error is returned as nil, message.
+     **/
+    class Poll : public abstract::Awaitable
+    {
+     private:
+      lua_State*  mLState;
+      int         mFunction;
+
+     public:
+      Poll(lua_State* L, const int function, const long timeout_ms)
+      : abstract::Awaitable(timeout_ms), mLState(L), mFunction(function)
+      {
+      }
+      ~Poll()
+      {
+        luaL_unref(mLState,LUA_REGISTRYINDEX,mFunction);
+      }
+      const int poll(lua_State* L, lua_State* thread)
+      {
+        const int top=lua_gettop(L);
+        lua_rawgeti(L,LUA_REGISTRYINDEX,mFunction);
+        if(lua_pcall(L,0,LUA_MULTRET,0) != 0)
+        {
+          lua_pushnil(thread);
+          lua_xmove(L,thread,1);
+          lua_settop(L,top);
+          return 2;
+        }
+        const int nresults=lua_gettop(L)-top;
+        if((nresults == 0)||lua_isnil(L,top+1))
+        {
+          lua_settop(L,top);
+          return -1;
+        }
+        lua_xmove(L,thread,nresults);
+        return nresults;
+      }
+    };
+
+    /**
+     * @brief the threads making the blocking calls of the coroutines. The
+     * threads are started on first use, a call which finds the queue full
+     * is refused.
+     **/
+    class BlockingCalls
+    {
+     private:
+      static constexpr size_t THREADS=4;
+      static constexpr size_t QUEUE_SIZE=1024;
+
+      ::LAppS::MQ::Queue<std::function<void()>> mQueue;
+      std::vector<std::thread>                  mThreads;
+
+      BlockingCalls() : mQueue(QUEUE_SIZE), mThreads()
+      {
+        for(size_t i=0;i<THREADS;++i)
+        {
+          mThreads.emplace_back(
+            [this]()
+            {
+              std::function<void()> call;
+              // an empty call stops the thread
+              while(mQueue.recv(call)&&call)
+              {
+                call();
+                call=nullptr;
+              }
+            }
+          );
+        }
+      }
+
+     public:
+      BlockingCalls(const BlockingCalls&)=delete;
+      BlockingCalls(BlockingCalls&)=delete;
+
+      ~BlockingCalls()
+      {
+        for(size_t i=0;i<mThreads.size();)
+        {
+          if(mQueue.try_send(std::function<void()>()))
+            ++i;
+          else
+            std::this_thread::yield();
+        }
+        for(auto& thread : mThreads)
+          thread.join();
+      }
+
+      static BlockingCalls& getInstance()
+      {
+        static BlockingCalls instance;
+        return instance;
+      }
+
+      /**
+       * @return false if the queue is full.
+       **/
+      const bool submit(std::function<void()>&& call)
+      {
+        return mQueue.try_send(std::move(call));
+      }
+    };
+
+    /**
+     * @brief result of a blocking call made by BlockingCalls.
+     **/
+    struct JobState
+    {
+      std::atomic<bool> done{false};
+      bool              result=false;
+    };
+
+    class Job : public abstract::Awaitable
+    {
+     private:
+      std::shared_ptr<JobState> mState;
+
+     public:
+      explicit Job(const std::shared_ptr<JobState>& state)
+      : abstract::Awaitable(-1), mState(state)
+      {
+      }
+      const int poll(lua_State* L, lua_State* thread)
+      {
+        if(!mState->done.load(std::memory_order_acquire))
+          return -1;
+        lua_pushboolean(thread,mState->result);
+        return 1;
+      }
+      const bool polling() const
+      {
+        return false;
+      }
+      const bool ready() const
+      {
+        return mState->done.load(std::memory_order_acquire);
+      }
+    };
+  }
+}
+
+/**
+ * @brief optional timeout in milliseconds at idx, -1 (forever) if absent.
+ **/
+static const bool await_timeout(lua_State* L, const int idx, long& timeout_ms)
+{
+  if((lua_gettop(L) < idx)||lua_isnil(L,idx))
+  {
+    timeout_ms=-1;
+    return true;
+  }
+  if(!lua_isnumber(L,idx)) return false;
+  timeout_ms=static_cast<long>(lua_tointeger(L,idx));
+  return true;
+}
+
+/**
+ * @brief the scheduler if L is a coroutine it runs, nullptr otherwise.
+ **/
+static LAppS::CoScheduler* await_scheduler(lua_State* L)
+{
+  auto scheduler=LAppS::CoScheduler::get(L);
+  if(scheduler&&scheduler->running(L))
+    return scheduler;
+  return nullptr;
+}
+
+extern "C"
+{
+  LUA_API int await_sleep(lua_State* L)
+  {
+    if((lua_gettop(L) != 1)||(!lua_isnumber(L,1))||(lua_tointeger(L,1) < 0))
+    {
+      lua_pushboolean(L,false);
+      lua_pushstring(L,"Usage: await.sleep(ms), where ms is a non-negative integer");
+      return 2;
+    }
+
+    const long ms=static_cast<long>(lua_tointeger(L,1));
+    if(auto scheduler=await_scheduler(L))
+      return scheduler->await(L,std::make_unique<LAppS::await::Sleep>(ms));
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+    lua_pushboolean(L,true);
+    return 1;
+  }
+
+  LUA_API int await_recv(lua_State* L)
+  {
+    static const char* usage="Usage: nljson|msgbuf|nil [,string] await.recv(mqr_obj[,timeout]), returns nil if the timeout expires.";
+
+    long timeout_ms;
+    if((lua_gettop(L) < 1)||(lua_gettop(L) > 2)||(!await_timeout(L,2,timeout_ms)))
+    {
+      lua_pushnil(L);
+      lua_pushstring(L,usage);
+      return 2;
+    }
+
+    try{
+      const auto& queue=assert_type_mqr(L,1);
+
+      LAppS::MQ::MessageType message;
+      if(queue->try_recv(message))
+      {
+        push_mqr_message(L,std::move(message));
+        return 1;
+      }
+
+      if(auto scheduler=await_scheduler(L))
+      {
+        if(timeout_ms == 0)
+        {
+          lua_pushnil(L);
+          return 1;
+        }
+        return scheduler->await(L,std::make_unique<LAppS::await::Recv>(queue,timeout_ms));
+      }
+
+      if(queue->recv(message,timeout_ms))
+        push_mqr_message(L,std::move(message));
+      else
+        lua_pushnil(L);
+      return 1;
+    }catch(const std::exception& e)
+    {
+      lua_pushnil(L);
+      lua_pushstring(L,e.what());
+      return 2;
+    }
+  }
+
+  LUA_API int await_poll(lua_State* L)
+  {
+    static const char* usage="Usage: ...|nil [,string] await.poll(fn[,timeout]), calls fn until it returns a non-nil value and returns the results of fn, nil if the timeout expires.";
+
+    long timeout_ms;
+    if((lua_gettop(L) < 1)||(lua_gettop(L) > 2)||(!lua_isfunction(L,1))||(!await_timeout(L,2,timeout_ms)))
+    {
+      lua_pushnil(L);
+      lua_pushstring(L,usage);
+      return 2;
+    }
+    lua_settop(L,1);
+
+    const auto deadline=std::chrono::steady_clock::now()+std::chrono::milliseconds(timeout_ms);
+    auto scheduler=await_scheduler(L);
+
+    while(true)
+    {
+      lua_pushvalue(L,1);
+      if(lua_pcall(L,0,LUA_MULTRET,0) != 0)
+      {
+        lua_pushnil(L);
+        lua_insert(L,-2);
+        return 2;
+      }
+      const int nresults=lua_gettop(L)-1;
+      if((nresults > 0)&&(!lua_isnil(L,2)))
+        return nresults;
+      lua_settop(L,1);
+
+      if((timeout_ms == 0)||((timeout_ms > 0)&&(std::chrono::steady_clock::now() >= deadline)))
+      {
+        lua_pushnil(L);
+        return 1;
+      }
+
+      if(scheduler)
+      {
+        lua_pushvalue(L,1);
+        const int function=luaL_ref(L,LUA_REGISTRYINDEX);
+        long left=-1;
+        if(timeout_ms > 0)
+          left=std::chrono::duration_cast<std::chrono::milliseconds>(deadline-std::chrono::steady_clock::now()).count();
+        return scheduler->await(L,std::make_unique<LAppS::await::Poll>(L,function,left));
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(LAppS::CoScheduler::POLL_MS));
+    }
+  }
+
+  LUA_API int await_login(lua_State* L)
+  {
+    static const char* usage="Usage: boolean[,string] await.login(string service,string username,string password) returns true on successful authentication, otherwise false.";
+
+    if((lua_gettop(L) != 3)||(lua_type(L,1) != LUA_TSTRING)||(lua_type(L,2) != LUA_TSTRING)||(lua_type(L,3) != LUA_TSTRING)||
+       (lua_strlen(L,1) == 0)||(lua_strlen(L,2) == 0)||(lua_strlen(L,3) == 0))
+    {
+      lua_pushboolean(L,false);
+      lua_pushstring(L,usage);
+      return 2;
+    }
+
+    auto scheduler=await_scheduler(L);
+    if(!scheduler)
+    {
+      lua_pushboolean(L,pam_login(lua_tostring(L,1),lua_tostring(L,2),lua_tostring(L,3)));
+      return 1;
+    }
+
+    try{
+      auto state=std::make_shared<LAppS::await::JobState>();
+      const bool queued=LAppS::await::BlockingCalls::getInstance().submit(
+        [state,parker=scheduler->parker(),service=std::string(lua_tostring(L,1)),
+         username=std::string(lua_tostring(L,2)),password=std::string(lua_tostring(L,3))]()
+        {
+          state->result=pam_login(service.c_str(),username.c_str(),password.c_str());
+          state->done.store(true,std::memory_order_release);
+          if(parker) parker->unpark();
+        }
+      );
+      if(!queued)
+      {
+        lua_pushboolean(L,false);
+        lua_pushstring(L,"too many logins are in progress");
+        return 2;
+      }
+      return scheduler->await(L,std::make_unique<LAppS::await::Job>(state));
+    }catch(const std::exception& e)
+    {
+      lua_pushboolean(L,false);
+      lua_pushstring(L,e.what());
+      return 2;
+    }
+  }
+
+  LUA_API int await_yield(lua_State* L)
+  {
+    if(auto scheduler=await_scheduler(L))
+      return scheduler->await(L,nullptr);
+    return 0;
+  }
+
+  LUA_API int await_running(lua_State* L)
+  {
+    lua_pushboolean(L,await_scheduler(L) != nullptr);
+    return 1;
+  }
+
+  LUA_API int luaopen_await(lua_State *L)
+  {
+    static const struct luaL_reg functions[] = {
+      {"sleep", await_sleep},
+      {"recv", await_recv},
+      {"poll", await_poll},
+      {"login", await_login},
+      {"yield", await_yield},
+      {"running", await_running},
+      {nullptr,nullptr}
+    };
+    lua_newtable(L);
+    luaL_openlib(L, NULL, functions,0);
+    return 1;
+  }
+}
+
+#endif /* __AWAIT_H__ */
@@ -24,10 +24,15 @@
 #ifndef __BCAST_H__
 #  define __BCAST_H__
 
+#include <cmath>
+#include <cstdint>
 #include <memory>
+#include <string_view>
+#include <functional>
 
 #include <Broadcasts.h>
 #include <WSServerMessage.h>
+#include <HandleTable.h>
 
 #include <ext/json.hpp>
 #include <modules/UserDataAdapter.h>
@@ -43,29 +48,33 @@ extern "C" {
 #include <ext/tsl/robin_map.h>
 }
 
+#include <modules/cbor.h>
+
 static thread_local tsl::robin_map<size_t,std::shared_ptr<LAppS::BCastType::BCastValueType>> broadcasts;
 
 
-const bool isLAppSBcastMessageValid(const json& msg)
+/**
+ * @brief serialises the nljson message into a new WebSocket frame, the
+ * envelope is checked while the message is encoded.
+ * @return the frame or nullptr if the message is not a valid LAppS
+ * broadcast message.
+ **/
+MSGBufferTypeSPtr makeLAppSBcastFrame(const json& msg)
 {
-  
-  auto cid=msg.find("cid");
-  
-  if(cid == msg.end()) return false;
-  
-  if(cid.value().is_null()) return false;
-  
-  if(cid.value().is_number())
-  {
-    auto message=msg.find("message");
-    if(message!=msg.end())
+  bool has_cid=false;
+  bool has_message=false;
+  WebSocketProtocol::InPlaceServerMessage frame;
+  const bool encoded=cbor_encode_json_object(
+    msg,frame.payload(),
+    [&has_cid,&has_message](const std::string& key, const json& value)
     {
-      bool valid=message.value().is_array();
-      return valid;
+      if(key == "cid") has_cid=value.is_number();
+      else if(key == "message") has_message=value.is_array();
     }
-    return false;
-  }
-  return false;
+  );
+  if(encoded&&has_cid&&has_message)
+    return frame.finish(WebSocketProtocol::BINARY);
+  return nullptr;
 }
 
 auto find_bcast(const size_t bcastid)
@@ -82,49 +91,219 @@ auto find_bcast(const size_t bcastid)
   return bcast_addr;
 }
 
-extern "C"
+/**
+ * @brief reads the channel options from the Lua table at idx.
+ * @return false if the table is malformed.
+ **/
+const bool bcast_options(lua_State *L, const int idx, LAppS::BroadcastOptions& options)
 {
-  LUA_API int bcast_send(lua_State *L)
+  lua_getfield(L,idx,"policy");
+  if(lua_isstring(L,-1))
   {
-    static const char* usage="Usage: boolean[,string] bcast:send(id,message), where `id' is a unique identifier of the broadcast channel. The `id' must be an unsigned integer. message - is a userdata of nljson type. Returns: true on success, false on error. Optionally an error message is returned.";
-    
-    auto argc=lua_gettop(L);
-    
-    if(argc!=3)
+    const std::string policy(lua_tostring(L,-1));
+    if(policy == "skip") options.policy=LAppS::SlowSubscriberPolicy::SKIP;
+    else if(policy == "drop") options.policy=LAppS::SlowSubscriberPolicy::DROP;
+    else if(policy == "disconnect") options.policy=LAppS::SlowSubscriberPolicy::DISCONNECT;
+    else
+    {
+      lua_pop(L,1);
+      return false;
+    }
+  }
+  else if(!lua_isnil(L,-1))
+  {
+    lua_pop(L,1);
+    return false;
+  }
+  lua_pop(L,1);
+  
+  lua_getfield(L,idx,"conflate");
+  if(lua_isboolean(L,-1))
+  {
+    options.conflate=lua_toboolean(L,-1);
+  }
+  else if(!lua_isnil(L,-1))
+  {
+    lua_pop(L,1);
+    return false;
+  }
+  lua_pop(L,1);
+  
+  lua_getfield(L,idx,"max_pending");
+  if(lua_isnumber(L,-1))
+  {
+    const lua_Integer max_pending=lua_tointeger(L,-1);
+    if(max_pending <= 0)
+    {
+      lua_pop(L,1);
+      return false;
+    }
+    options.max_pending=static_cast<size_t>(max_pending);
+  }
+  else if(!lua_isnil(L,-1))
+  {
+    lua_pop(L,1);
+    return false;
+  }
+  lua_pop(L,1);
+  
+  lua_getfield(L,idx,"retain");
+  if(lua_isnumber(L,-1))
+  {
+    const lua_Integer retain=lua_tointeger(L,-1);
+    if(retain < 0)
+    {
+      lua_pop(L,1);
+      return false;
+    }
+    options.retain=static_cast<size_t>(retain);
+  }
+  else if(!lua_isnil(L,-1))
+  {
+    lua_pop(L,1);
+    return false;
+  }
+  lua_pop(L,1);
+  
+  lua_getfield(L,idx,"retain_keys");
+  if(lua_isboolean(L,-1))
+  {
+    options.retain_keys=lua_toboolean(L,-1);
+  }
+  else if(!lua_isnil(L,-1))
+  {
+    lua_pop(L,1);
+    return false;
+  }
+  lua_pop(L,1);
+  return true;
+}
+
+/**
+ * @brief conflation key of an integer or a string at idx, never 0.
+ * Fractional, infinite and NaN numbers are refused, truncating them would
+ * make distinct keys collide.
+ **/
+const bool bcast_key(lua_State *L, const int idx, uint64_t& key)
+{
+  switch(lua_type(L,idx))
+  {
+    case LUA_TNUMBER:
+    {
+      const lua_Number value=lua_tonumber(L,idx);
+      if((value != std::floor(value))||!(std::fabs(value) < 9223372036854775808.0))
+        return false;
+      key=static_cast<uint64_t>(static_cast<int64_t>(value))+0x9E3779B97F4A7C15ULL;
+      break;
+    }
+    case LUA_TSTRING:
+    {
+      size_t len;
+      const char* str=lua_tolstring(L,idx,&len);
+      key=std::hash<std::string_view>{}(std::string_view(str,len));
+      break;
+    }
+    default:
+      return false;
+  }
+  if(key == 0) key=1;
+  return true;
+}
+
+/**
+ * @brief common part of bcast:send(), bcast:snapshot() and bcast:delta().
+ **/
+int bcast_deliver(lua_State *L, const LAppS::BroadcastDelivery how, const char* usage)
+{
+  auto argc=lua_gettop(L);
+  
+  if((argc!=3)&&(argc!=4))
+  {
+    lua_pushboolean(L,false);
+    lua_pushstring(L,usage);
+    return 2;
+  }
+  
+  uint64_t key=0;
+  if(argc == 4)
+  {
+    if(!bcast_key(L,4,key))
     {
       lua_pushboolean(L,false);
       lua_pushstring(L,usage);
       return 2;
     }
-    
-    if(lua_isnumber(L,argc-1))
-    {
-      try {
-        const json& message=get_userdata_value(L,argc);
-        
-        if(isLAppSBcastMessageValid(message))
-        {
-          size_t bcastid=static_cast<size_t>(lua_tointeger(L,argc-1));
-          auto bcast_addr=find_bcast(bcastid);
-          auto msg=std::make_shared<MSGBufferType>();
-          WebSocketProtocol::ServerMessage(msg,WebSocketProtocol::BINARY,json::to_cbor(message));
-          bcast_addr->bcast(msg);
-          lua_pushboolean(L,true);
-          return 1;
-        }else{
-          lua_pushboolean(L,false);
-          return 1;
-        }
-      }catch(const std::exception& e)
+  }
+  
+  if(lua_isnumber(L,2))
+  {
+    try {
+      const json& message=get_userdata_value(L,3);
+      
+      auto msg=makeLAppSBcastFrame(message);
+      if(msg)
       {
+        size_t bcastid=static_cast<size_t>(lua_tointeger(L,2));
+        auto bcast_addr=find_bcast(bcastid);
+        bcast_addr->bcast(msg,key,how);
+        lua_pushboolean(L,true);
+        return 1;
+      }else{
         lua_pushboolean(L,false);
-        lua_pushstring(L,e.what());
-        return 2;
+        return 1;
       }
+    }catch(const std::exception& e)
+    {
+      lua_pushboolean(L,false);
+      lua_pushstring(L,e.what());
+      return 2;
+    }
+  }
+  lua_pushboolean(L,false);
+  lua_pushstring(L,usage);
+  return 2;
+}
+
+extern "C"
+{
+  LUA_API int bcast_send(lua_State *L)
+  {
+    static const char* usage="Usage: boolean[,string] bcast:send(id,message[,key]), where `id' is a unique identifier of the broadcast channel. The `id' must be an unsigned integer. message - is a userdata of nljson type. key - optional conflation key (integer or string), on conflating channels the message replaces the not yet sent message with the same key for slow subscribers. On retaining channels the message is also kept for the late subscribers. Returns: true on success, false on error. Optionally an error message is returned.";
+    return bcast_deliver(L,LAppS::BroadcastDelivery::SEND,usage);
+  }
+  
+  LUA_API int bcast_snapshot(lua_State *L)
+  {
+    static const char* usage="Usage: boolean[,string] bcast:snapshot(id,message[,key]), where `id' is a unique identifier of the broadcast channel. The `id' must be an unsigned integer. message - is a userdata of nljson type. The message is only kept for the late subscribers of a retaining channel (with `retain_keys' the latest message per key replaces the previous one), the current subscribers do not receive it. Returns: true on success, false on error. Optionally an error message is returned.";
+    return bcast_deliver(L,LAppS::BroadcastDelivery::SNAPSHOT,usage);
+  }
+  
+  LUA_API int bcast_delta(lua_State *L)
+  {
+    static const char* usage="Usage: boolean[,string] bcast:delta(id,message[,key]), where `id' is a unique identifier of the broadcast channel. The `id' must be an unsigned integer. message - is a userdata of nljson type. The message is delivered to the current subscribers only and is never retained. Returns: true on success, false on error. Optionally an error message is returned.";
+    return bcast_deliver(L,LAppS::BroadcastDelivery::DELTA,usage);
+  }
+  
+  LUA_API int bcast_forget(lua_State *L)
+  {
+    static const char* usage="Usage: boolean[,string] bcast:forget(id), where `id' is a unique identifier of the broadcast channel. Drops all the messages retained for the late subscribers. Returns: true on success, false on error. Optionally an error message is returned.";
+    
+    if((lua_gettop(L) != 2)||(!lua_isnumber(L,2)))
+    {
+      lua_pushboolean(L,false);
+      lua_pushstring(L,usage);
+      return 2;
+    }
+    try{
+      auto bcast_addr=find_bcast(static_cast<size_t>(lua_tointeger(L,2)));
+      bcast_addr->forget();
+      lua_pushboolean(L,true);
+      return 1;
+    }catch(const std::exception& e){
+      lua_pushboolean(L,false);
+      lua_pushstring(L,e.what());
+      return 2;
     }
-    lua_pushboolean(L,false);
-    lua_pushstring(L,usage);
-    return 2;
   }
   
   LUA_API int bcast_subscribe(lua_State *L)
@@ -140,11 +319,17 @@ extern "C"
     }
     if(lua_isnumber(L,argc)&&lua_isnumber(L,argc-1))
     {
-      auto handler=(abstract::WebSocket*)(lua_tointeger(L,argc));
+      LAppS::WSHandleTable::Guard handler(LAppS::wsHandles(),lua_tointeger(L,argc));
       size_t bcastid=static_cast<size_t>(lua_tointeger(L,argc-1));
+      if(!handler)
+      {
+        lua_pushboolean(L,false);
+        lua_pushstring(L,"bcast:subscribe(): the connection is closed");
+        return 2;
+      }
       try{
         auto bcast_addr=find_bcast(bcastid);
-        bcast_addr->subscribe(handler);
+        bcast_addr->subscribe(handler.get());
         lua_pushboolean(L,true);
         return 1;
         
@@ -172,11 +357,13 @@ extern "C"
     }
     if(lua_isnumber(L,argc)&&lua_isnumber(L,argc-1))
     {
-      auto handler=(abstract::WebSocket*)(lua_tointeger(L,argc));
+      LAppS::WSHandleTable::Guard handler(LAppS::wsHandles(),lua_tointeger(L,argc));
       size_t bcastid=static_cast<size_t>(lua_tointeger(L,argc-1));
       try{
         auto bcast_addr=find_bcast(bcastid);
-        bcast_addr->unsubscribe(handler);
+        // a closed connection has left all the channels already
+        if(handler)
+          bcast_addr->unsubscribe(handler.get());
         lua_pushboolean(L,true);
         return 1;
         
@@ -192,19 +379,36 @@ extern "C"
   }
   LUA_API int bcast_create(lua_State *L)
   {
-    static const char* usage="Usage: bcast:create(id), where `id' is a unique identifier of the broadcast channel. The `id' must be an unsigned integer.";
+    static const char* usage="Usage: bcast:create(id[,options]), where `id' is a unique identifier of the broadcast channel. The `id' must be an unsigned integer. Optional `options' table: { policy = \"skip\"|\"drop\"|\"disconnect\", max_pending = bytes, conflate = boolean, retain = count, retain_keys = boolean }. policy defines what happens to the subscribers which have more than max_pending bytes queued, conflate enables the latest-value-per-key delivery for bcast:send() with a key. retain keeps the last `count' messages and retain_keys keeps the latest message per key, both are replayed to each new subscriber before the live messages.";
     auto argc=lua_gettop(L);
-    if(argc!=2)
+    if((argc!=2)&&(argc!=3))
     {
       lua_pushboolean(L,false);
       lua_pushstring(L,usage);
       return 2;
     }
     
-    if(lua_isnumber(L,argc))
+    LAppS::BroadcastOptions options;
+    if(argc == 3)
+    {
+      if(!lua_istable(L,3))
+      {
+        lua_pushboolean(L,false);
+        lua_pushstring(L,usage);
+        return 2;
+      }
+      if(!bcast_options(L,3,options))
+      {
+        lua_pushboolean(L,false);
+        lua_pushstring(L,usage);
+        return 2;
+      }
+    }
+    
+    if(lua_isnumber(L,2))
     {
-      size_t bcastid=lua_tointeger(L,argc);
-      LAppS::BroadcastRegistry::getInstance()->create(bcastid);
+      size_t bcastid=lua_tointeger(L,2);
+      LAppS::BroadcastRegistry::getInstance()->create(bcastid,options);
       
       auto bcast_addr=find_bcast(bcastid);
       if(!bcast_addr)
@@ -228,6 +432,9 @@ extern "C"
         {"subscribe", bcast_subscribe},
         {"unsubscribe", bcast_unsubscribe},
         {"send", bcast_send},
+        {"snapshot", bcast_snapshot},
+        {"delta", bcast_delta},
+        {"forget", bcast_forget},
         {nullptr,nullptr}
       };
       luaL_newmetatable(L,"bcast");
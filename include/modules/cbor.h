@@ -0,0 +1,1065 @@
+/**
+ *  Copyright 2017-2018, Pavel Kraynyukhov <pavel.kraynyukhov@gmail.com>
+ * 
+ *  This file is a part of LAppS (Lua Application Server).
+ *  
+ *  LAppS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *  
+ *  LAppS is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *  
+ *  You should have received a copy of the GNU General Public License
+ *  along with LAppS.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  $Id: cbor.h October 23, 2026 10:00 AM $
+ * 
+ **/
+
+
+#ifndef __CBOR_H__
+#  define __CBOR_H__
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+extern "C" {
+#include <lua.h>
+#include <lualib.h>
+#include <lauxlib.h>
+}
+
+#include <ext/json.hpp>
+#include <modules/UserDataAdapter.h>
+#include <modules/msgbuf.h>
+
+/**
+ * Native CBOR (RFC 7049) codec for Lua values, without an intermediate
+ * JSON DOM.
+ *
+ * Decoding: maps become tables, arrays become sequences, byte and text
+ * strings become Lua strings, null and undefined become cbor.null (a NULL
+ * light userdata), tags are skipped.
+ *
+ * Encoding: a table is an array if its keys are exactly 1..#t (an empty
+ * table is an empty array), otherwise it is a map with string or number
+ * keys. Integral numbers are encoded as integers, the rest as doubles.
+ * nil and cbor.null are encoded as null, nljson userdata and cbor views
+ * are embedded as is, msgbuf userdata become byte strings.
+ **/
+
+static const int CBOR_MAX_DEPTH=256;
+
+struct CBORReader
+{
+  const uint8_t* pos;
+  const uint8_t* end;
+  
+  void need(const size_t n) const
+  {
+    if(static_cast<size_t>(end-pos) < n)
+      throw std::system_error(EINVAL,std::system_category(),"CBOR: unexpected end of data");
+  }
+  
+  /**
+   * @brief count items of at least width bytes each, checked without
+   * computing count*width: the count of a head may be up to 2^64-1.
+   **/
+  void need(const uint64_t count, const uint64_t width) const
+  {
+    if(count > static_cast<uint64_t>(end-pos)/width)
+      throw std::system_error(EINVAL,std::system_category(),"CBOR: unexpected end of data");
+  }
+};
+
+static const uint64_t cbor_read_argument(CBORReader& r, const uint8_t info)
+{
+  if(info < 24) return info;
+  
+  size_t n;
+  switch(info)
+  {
+    case 24: n=1; break;
+    case 25: n=2; break;
+    case 26: n=4; break;
+    case 27: n=8; break;
+    default:
+      throw std::system_error(EINVAL,std::system_category(),"CBOR: malformed item head");
+  }
+  r.need(n);
+  uint64_t value=0;
+  for(size_t i=0;i<n;++i)
+    value=(value<<8)|r.pos[i];
+  r.pos+=n;
+  return value;
+}
+
+static const double cbor_half_to_double(const uint16_t half)
+{
+  const int exp=(half>>10)&0x1f;
+  const int mant=half&0x3ff;
+  double value;
+  if(exp == 0) value=std::ldexp(mant,-24);
+  else if(exp != 31) value=std::ldexp(mant+1024,exp-25);
+  else value=(mant == 0) ? std::numeric_limits<double>::infinity() : std::numeric_limits<double>::quiet_NaN();
+  return (half & 0x8000) ? -value : value;
+}
+
+static void cbor_decode_item(lua_State* L, CBORReader& r, const int depth);
+
+static void cbor_decode_string(lua_State* L, CBORReader& r, const uint8_t major, const uint8_t info)
+{
+  if(info != 31)
+  {
+    const uint64_t len=cbor_read_argument(r,info);
+    r.need(len);
+    lua_pushlstring(L,reinterpret_cast<const char*>(r.pos),len);
+    r.pos+=len;
+    return;
+  }
+  // indefinite length, chunks of definite length strings of the same type
+  std::string buffer;
+  while(true)
+  {
+    r.need(1);
+    const uint8_t ib=*r.pos++;
+    if(ib == 0xff) break;
+    if(((ib>>5) != major)||((ib&0x1f) == 31))
+      throw std::system_error(EINVAL,std::system_category(),"CBOR: malformed indefinite length string");
+    const uint64_t len=cbor_read_argument(r,ib&0x1f);
+    r.need(len);
+    buffer.append(reinterpret_cast<const char*>(r.pos),len);
+    r.pos+=len;
+  }
+  lua_pushlstring(L,buffer.data(),buffer.size());
+}
+
+static const bool cbor_at_break(CBORReader& r)
+{
+  r.need(1);
+  if(*r.pos == 0xff)
+  {
+    ++r.pos;
+    return true;
+  }
+  return false;
+}
+
+static void cbor_decode_item(lua_State* L, CBORReader& r, const int depth)
+{
+  if(depth > CBOR_MAX_DEPTH)
+    throw std::system_error(EINVAL,std::system_category(),"CBOR: nesting is too deep");
+  if(!lua_checkstack(L,4))
+    throw std::system_error(ENOMEM,std::system_category(),"CBOR: Lua stack overflow");
+  
+  r.need(1);
+  const uint8_t ib=*r.pos++;
+  const uint8_t major=ib>>5;
+  const uint8_t info=ib&0x1f;
+  
+  switch(major)
+  {
+    case 0:
+      lua_pushnumber(L,static_cast<lua_Number>(cbor_read_argument(r,info)));
+      return;
+    case 1:
+      lua_pushnumber(L,-1.0-static_cast<lua_Number>(cbor_read_argument(r,info)));
+      return;
+    case 2:
+    case 3:
+      cbor_decode_string(L,r,major,info);
+      return;
+    case 4:
+    {
+      if(info == 31)
+      {
+        lua_newtable(L);
+        for(int i=1;!cbor_at_break(r);++i)
+        {
+          cbor_decode_item(L,r,depth+1);
+          lua_rawseti(L,-2,i);
+        }
+        return;
+      }
+      const uint64_t count=cbor_read_argument(r,info);
+      // every element takes at least one byte
+      r.need(count);
+      lua_createtable(L,static_cast<int>(count),0);
+      for(uint64_t i=1;i<=count;++i)
+      {
+        cbor_decode_item(L,r,depth+1);
+        lua_rawseti(L,-2,static_cast<int>(i));
+      }
+      return;
+    }
+    case 5:
+    {
+      const bool indefinite=(info == 31);
+      const uint64_t count=indefinite ? 0 : cbor_read_argument(r,info);
+      if(!indefinite) r.need(count,2);
+      lua_createtable(L,0,static_cast<int>(count));
+      for(uint64_t i=0;indefinite ? !cbor_at_break(r) : (i < count);++i)
+      {
+        cbor_decode_item(L,r,depth+1);
+        if(lua_isnil(L,-1)||(lua_type(L,-1) == LUA_TLIGHTUSERDATA)||((lua_type(L,-1) == LUA_TNUMBER)&&std::isnan(lua_tonumber(L,-1))))
+          throw std::system_error(EINVAL,std::system_category(),"CBOR: map key can not be represented in Lua");
+        cbor_decode_item(L,r,depth+1);
+        lua_rawset(L,-3);
+      }
+      return;
+    }
+    case 6:
+      cbor_read_argument(r,info);
+      cbor_decode_item(L,r,depth+1);
+      return;
+    default: // 7
+      switch(info)
+      {
+        case 20:
+          lua_pushboolean(L,false);
+          return;
+        case 21:
+          lua_pushboolean(L,true);
+          return;
+        case 22:
+        case 23:
+          lua_pushlightuserdata(L,nullptr);
+          return;
+        case 25:
+          lua_pushnumber(L,cbor_half_to_double(static_cast<uint16_t>(cbor_read_argument(r,info))));
+          return;
+        case 26:
+        {
+          const uint32_t bits=static_cast<uint32_t>(cbor_read_argument(r,info));
+          float value;
+          memcpy(&value,&bits,sizeof(value));
+          lua_pushnumber(L,value);
+          return;
+        }
+        case 27:
+        {
+          const uint64_t bits=cbor_read_argument(r,info);
+          double value;
+          memcpy(&value,&bits,sizeof(value));
+          lua_pushnumber(L,value);
+          return;
+        }
+        default:
+          if(info < 24)
+          {
+            // unassigned simple values
+            lua_pushlightuserdata(L,nullptr);
+            return;
+          }
+          if(info == 24)
+          {
+            cbor_read_argument(r,info);
+            lua_pushlightuserdata(L,nullptr);
+            return;
+          }
+          throw std::system_error(EINVAL,std::system_category(),"CBOR: unexpected break or reserved simple value");
+      }
+  }
+}
+
+/**
+ * @brief pushes the decoded CBOR item on the Lua stack. Throws on
+ * malformed or trailing data, the stack is restored then.
+ **/
+static void cbor_decode(lua_State* L, const uint8_t* data, const size_t len)
+{
+  const int top=lua_gettop(L);
+  CBORReader r{data,data+len};
+  try{
+    cbor_decode_item(L,r,0);
+    if(r.pos != r.end)
+      throw std::system_error(EINVAL,std::system_category(),"CBOR: trailing data after the item");
+  }catch(...)
+  {
+    lua_settop(L,top);
+    throw;
+  }
+}
+
+/**
+ * @brief skips one item without decoding it. The item is validated the
+ * same way as by cbor_decode_item(), nothing is allocated.
+ **/
+static void cbor_skip_item(CBORReader& r, const int depth)
+{
+  if(depth > CBOR_MAX_DEPTH)
+    throw std::system_error(EINVAL,std::system_category(),"CBOR: nesting is too deep");
+  
+  r.need(1);
+  const uint8_t ib=*r.pos++;
+  const uint8_t major=ib>>5;
+  const uint8_t info=ib&0x1f;
+  
+  switch(major)
+  {
+    case 0:
+    case 1:
+      cbor_read_argument(r,info);
+      return;
+    case 2:
+    case 3:
+    {
+      if(info != 31)
+      {
+        const uint64_t len=cbor_read_argument(r,info);
+        r.need(len);
+        r.pos+=len;
+        return;
+      }
+      while(!cbor_at_break(r))
+      {
+        const uint8_t cb=*r.pos++;
+        if(((cb>>5) != major)||((cb&0x1f) == 31))
+          throw std::system_error(EINVAL,std::system_category(),"CBOR: malformed indefinite length string");
+        const uint64_t len=cbor_read_argument(r,cb&0x1f);
+        r.need(len);
+        r.pos+=len;
+      }
+      return;
+    }
+    case 4:
+    case 5:
+    {
+      const uint64_t items=(major == 4) ? 1 : 2;
+      if(info == 31)
+      {
+        while(!cbor_at_break(r))
+          for(uint64_t j=0;j<items;++j)
+            cbor_skip_item(r,depth+1);
+        return;
+      }
+      const uint64_t count=cbor_read_argument(r,info);
+      r.need(count,items);
+      for(uint64_t i=0;i<count;++i)
+        for(uint64_t j=0;j<items;++j)
+          cbor_skip_item(r,depth+1);
+      return;
+    }
+    case 6:
+      cbor_read_argument(r,info);
+      cbor_skip_item(r,depth+1);
+      return;
+    default: // 7
+      if(info < 24) return;
+      if(info < 28)
+      {
+        cbor_read_argument(r,info);
+        return;
+      }
+      throw std::system_error(EINVAL,std::system_category(),"CBOR: unexpected break or reserved simple value");
+  }
+}
+
+/**
+ * @brief reads the head of an array or a map, skipping the tags.
+ * @return major type of the item (4 or 5), or 0 if it is not a container.
+ * The reader is not moved then.
+ **/
+static const uint8_t cbor_open_container(CBORReader& r, uint64_t& count, bool& indefinite)
+{
+  CBORReader probe=r;
+  while(true)
+  {
+    probe.need(1);
+    const uint8_t ib=*probe.pos++;
+    const uint8_t major=ib>>5;
+    const uint8_t info=ib&0x1f;
+    if(major == 6)
+    {
+      cbor_read_argument(probe,info);
+      continue;
+    }
+    if((major != 4)&&(major != 5))
+      return 0;
+    indefinite=(info == 31);
+    count=indefinite ? 0 : cbor_read_argument(probe,info);
+    r=probe;
+    return major;
+  }
+}
+
+/**
+ * @brief true if there is one more element in the container opened with
+ * cbor_open_container(), i is the amount of the elements consumed so far.
+ **/
+static const bool cbor_container_next(CBORReader& r, const uint64_t i, const uint64_t count, const bool indefinite)
+{
+  return indefinite ? !cbor_at_break(r) : (i < count);
+}
+
+/**
+ * @brief consumes a definite length text string.
+ * @return false if the item is something else, the reader is not moved then.
+ **/
+static const bool cbor_read_text(CBORReader& r, const char*& str, size_t& len)
+{
+  r.need(1);
+  if(((*r.pos>>5) != 3)||((*r.pos&0x1f) == 31))
+    return false;
+  CBORReader probe=r;
+  const uint8_t info=*probe.pos++&0x1f;
+  len=cbor_read_argument(probe,info);
+  probe.need(len);
+  str=reinterpret_cast<const char*>(probe.pos);
+  probe.pos+=len;
+  r=probe;
+  return true;
+}
+
+/**
+ * @brief reads an integer or a floating point number.
+ * @return false if the item is not a number, the reader is not moved then.
+ **/
+static const bool cbor_read_number(CBORReader& r, double& value)
+{
+  r.need(1);
+  const uint8_t major=*r.pos>>5;
+  const uint8_t info=*r.pos&0x1f;
+  if((major > 1)&&((major != 7)||(info < 25)||(info > 27)))
+    return false;
+  CBORReader probe=r;
+  ++probe.pos;
+  const uint64_t arg=cbor_read_argument(probe,info);
+  switch(major)
+  {
+    case 0: value=static_cast<double>(arg); break;
+    case 1: value=-1.0-static_cast<double>(arg); break;
+    default:
+      if(info == 25)
+      {
+        value=cbor_half_to_double(static_cast<uint16_t>(arg));
+      }
+      else if(info == 26)
+      {
+        const uint32_t bits=static_cast<uint32_t>(arg);
+        float fvalue;
+        memcpy(&fvalue,&bits,sizeof(fvalue));
+        value=fvalue;
+      }
+      else
+      {
+        memcpy(&value,&arg,sizeof(value));
+      }
+  }
+  r=probe;
+  return true;
+}
+
+/**
+ * Lazy read-only views over CBOR encoded data (userdata "cborview").
+ *
+ * A view references an array or a map inside of a shared buffer and
+ * decodes only what is indexed: scalars and strings are returned as Lua
+ * values, nested arrays and maps as views of the same buffer. The buffer
+ * is owned by CBORViewSource. Once the source is detached (e.a. when the
+ * message buffer goes back to the WebSocket's pool after onMessage()),
+ * all views of it raise an error on access.
+ **/
+struct CBORViewSource
+{
+  MSGBufferTypeSPtr buffer;
+};
+
+typedef std::shared_ptr<CBORViewSource> CBORViewSourceSPtr;
+
+struct CBORView
+{
+  CBORViewSourceSPtr  source;
+  size_t              offset;
+  size_t              length;
+};
+
+static CBORView* testtype_cborview(lua_State* L, const int idx)
+{
+  void* udptr=lua_touserdata(L,idx);
+  if((udptr == nullptr)||(!lua_getmetatable(L,idx)))
+    return nullptr;
+  luaL_getmetatable(L,"cborview");
+  const bool is_view=lua_rawequal(L,-1,-2);
+  lua_pop(L,2);
+  return is_view ? static_cast<CBORView*>(udptr) : nullptr;
+}
+
+static void push_cborview(lua_State* L, const CBORViewSourceSPtr& source, const size_t offset, const size_t length)
+{
+  auto udptr=static_cast<CBORView*>(lua_newuserdata(L,sizeof(CBORView)));
+  new(udptr) CBORView{source,offset,length};
+  luaL_getmetatable(L,"cborview");
+  lua_setmetatable(L,-2);
+}
+
+/**
+ * @return reader over the viewed item, throws if the source is detached.
+ **/
+static CBORReader cbor_view_reader(const CBORView& view)
+{
+  if(!view.source->buffer)
+    throw std::system_error(EINVAL,std::system_category(),"CBOR: the view is used after its message was released, use cbor.decode() to keep the data");
+  const uint8_t* begin=view.source->buffer->data()+view.offset;
+  return CBORReader{begin,begin+view.length};
+}
+
+/**
+ * @brief pushes the item at r either as a view (arrays and maps) or as
+ * a decoded value, and moves the reader past it.
+ **/
+static void cbor_view_push_item(lua_State* L, const CBORView& parent, CBORReader& r)
+{
+  CBORReader probe=r;
+  uint64_t count;
+  bool indefinite;
+  if(cbor_open_container(probe,count,indefinite) == 0)
+  {
+    cbor_decode_item(L,r,0);
+    return;
+  }
+  const uint8_t* start=r.pos;
+  cbor_skip_item(r,0);
+  const uint8_t* base=parent.source->buffer->data();
+  push_cborview(L,parent.source,start-base,r.pos-start);
+}
+
+/**
+ * @brief consumes a map key.
+ * @return true if it equals the Lua string or number at idx.
+ **/
+static const bool cbor_view_key_equals(lua_State* L, const int idx, CBORReader& r)
+{
+  if(lua_type(L,idx) == LUA_TSTRING)
+  {
+    const char* str;
+    size_t len;
+    if(cbor_read_text(r,str,len))
+    {
+      size_t klen;
+      const char* key=lua_tolstring(L,idx,&klen);
+      return (klen == len)&&(memcmp(key,str,len) == 0);
+    }
+  }
+  else if(lua_type(L,idx) == LUA_TNUMBER)
+  {
+    double value;
+    if(cbor_read_number(r,value))
+      return value == lua_tonumber(L,idx);
+  }
+  cbor_skip_item(r,1);
+  return false;
+}
+
+/**
+ * @brief pushes view[key] where key is at idx: the 1-based element of an
+ * array or the value of a map key, nil if there is none.
+ **/
+static void cbor_view_index(lua_State* L, const CBORView& view, const int idx)
+{
+  CBORReader r=cbor_view_reader(view);
+  uint64_t count;
+  bool indefinite;
+  const uint8_t major=cbor_open_container(r,count,indefinite);
+  
+  if(major == 4)
+  {
+    const lua_Number key=(lua_type(L,idx) == LUA_TNUMBER) ? lua_tonumber(L,idx) : 0;
+    if((key >= 1)&&(std::floor(key) == key))
+    {
+      const uint64_t pos=static_cast<uint64_t>(key)-1;
+      for(uint64_t i=0;cbor_container_next(r,i,count,indefinite);++i)
+      {
+        if(i == pos)
+        {
+          cbor_view_push_item(L,view,r);
+          return;
+        }
+        cbor_skip_item(r,1);
+      }
+    }
+  }
+  else if(major == 5)
+  {
+    for(uint64_t i=0;cbor_container_next(r,i,count,indefinite);++i)
+    {
+      if(cbor_view_key_equals(L,idx,r))
+      {
+        cbor_view_push_item(L,view,r);
+        return;
+      }
+      cbor_skip_item(r,1);
+    }
+  }
+  lua_pushnil(L);
+}
+
+/**
+ * @return amount of elements of the array or of pairs of the map.
+ **/
+static const uint64_t cbor_view_size(const CBORView& view)
+{
+  CBORReader r=cbor_view_reader(view);
+  uint64_t count;
+  bool indefinite;
+  const uint8_t major=cbor_open_container(r,count,indefinite);
+  if(!indefinite) return count;
+  uint64_t i=0;
+  for(;cbor_container_next(r,i,count,indefinite);++i)
+  {
+    cbor_skip_item(r,1);
+    if(major == 5) cbor_skip_item(r,1);
+  }
+  return i;
+}
+
+static void cbor_write_head(std::vector<uint8_t>& out, const uint8_t major, const uint64_t value)
+{
+  const uint8_t mt=static_cast<uint8_t>(major<<5);
+  if(value < 24)
+  {
+    out.push_back(mt|static_cast<uint8_t>(value));
+  }
+  else if(value <= 0xff)
+  {
+    out.push_back(mt|24);
+    out.push_back(static_cast<uint8_t>(value));
+  }
+  else if(value <= 0xffff)
+  {
+    out.push_back(mt|25);
+    out.push_back(static_cast<uint8_t>(value>>8));
+    out.push_back(static_cast<uint8_t>(value));
+  }
+  else if(value <= 0xffffffffULL)
+  {
+    out.push_back(mt|26);
+    for(int shift=24;shift>=0;shift-=8)
+      out.push_back(static_cast<uint8_t>(value>>shift));
+  }
+  else
+  {
+    out.push_back(mt|27);
+    for(int shift=56;shift>=0;shift-=8)
+      out.push_back(static_cast<uint8_t>(value>>shift));
+  }
+}
+
+static void cbor_write_text(std::vector<uint8_t>& out, const char* str, const size_t len)
+{
+  cbor_write_head(out,3,len);
+  out.insert(out.end(),str,str+len);
+}
+
+/**
+ * @return amount of elements if the table at idx is a sequence 1..n (an
+ * empty table counts), or -1 if it has to be encoded as a map.
+ **/
+static const int cbor_sequence_size(lua_State* L, const int idx)
+{
+  const size_t len=lua_objlen(L,idx);
+  size_t count=0;
+  lua_pushnil(L);
+  while(lua_next(L,idx) != 0)
+  {
+    lua_pop(L,1);
+    if(lua_type(L,-1) != LUA_TNUMBER)
+    {
+      lua_pop(L,1);
+      return -1;
+    }
+    const lua_Number key=lua_tonumber(L,-1);
+    if((key < 1)||(key > len)||(std::floor(key) != key))
+    {
+      lua_pop(L,1);
+      return -1;
+    }
+    ++count;
+  }
+  return (count == len) ? static_cast<int>(len) : -1;
+}
+
+static void cbor_encode_number(const lua_Number value, std::vector<uint8_t>& out)
+{
+  if((std::floor(value) == value)&&(std::fabs(value) < 9223372036854775808.0))
+  {
+    const int64_t integer=static_cast<int64_t>(value);
+    if(integer >= 0)
+      cbor_write_head(out,0,static_cast<uint64_t>(integer));
+    else
+      cbor_write_head(out,1,static_cast<uint64_t>(-1-integer));
+    return;
+  }
+  uint64_t bits;
+  const double dvalue=value;
+  memcpy(&bits,&dvalue,sizeof(bits));
+  out.push_back(0xfb);
+  for(int shift=56;shift>=0;shift-=8)
+    out.push_back(static_cast<uint8_t>(bits>>shift));
+}
+
+static void cbor_encode_item(lua_State* L, const int idx, std::vector<uint8_t>& out, const int depth)
+{
+  if(depth > CBOR_MAX_DEPTH)
+    throw std::system_error(EINVAL,std::system_category(),"CBOR: nesting is too deep or the table is recursive");
+  if(!lua_checkstack(L,4))
+    throw std::system_error(ENOMEM,std::system_category(),"CBOR: Lua stack overflow");
+  
+  switch(lua_type(L,idx))
+  {
+    case LUA_TNIL:
+      out.push_back(0xf6);
+      return;
+    case LUA_TBOOLEAN:
+      out.push_back(lua_toboolean(L,idx) ? 0xf5 : 0xf4);
+      return;
+    case LUA_TNUMBER:
+      cbor_encode_number(lua_tonumber(L,idx),out);
+      return;
+    case LUA_TSTRING:
+    {
+      size_t len;
+      const char* str=lua_tolstring(L,idx,&len);
+      cbor_write_text(out,str,len);
+      return;
+    }
+    case LUA_TLIGHTUSERDATA:
+      if(lua_touserdata(L,idx) == nullptr)
+      {
+        out.push_back(0xf6);
+        return;
+      }
+      break;
+    case LUA_TUSERDATA:
+    {
+      if(auto view=testtype_cborview(L,idx))
+      {
+        // already encoded
+        const CBORReader r=cbor_view_reader(*view);
+        out.insert(out.end(),r.pos,r.end);
+        return;
+      }
+      if(auto buffer=testtype_msgbuf(L,idx))
+      {
+        cbor_write_head(out,2,(*buffer)->size());
+        out.insert(out.end(),(*buffer)->begin(),(*buffer)->end());
+        return;
+      }
+      const std::vector<uint8_t> cbor=json::to_cbor(get_userdata_value(L,idx));
+      out.insert(out.end(),cbor.begin(),cbor.end());
+      return;
+    }
+    case LUA_TTABLE:
+    {
+      const int size=cbor_sequence_size(L,idx);
+      if(size >= 0)
+      {
+        cbor_write_head(out,4,static_cast<uint64_t>(size));
+        for(int i=1;i<=size;++i)
+        {
+          lua_rawgeti(L,idx,i);
+          cbor_encode_item(L,lua_gettop(L),out,depth+1);
+          lua_pop(L,1);
+        }
+        return;
+      }
+      
+      size_t count=0;
+      lua_pushnil(L);
+      while(lua_next(L,idx) != 0)
+      {
+        lua_pop(L,1);
+        ++count;
+      }
+      cbor_write_head(out,5,count);
+      lua_pushnil(L);
+      while(lua_next(L,idx) != 0)
+      {
+        const int key=lua_gettop(L)-1;
+        if(lua_type(L,key) == LUA_TSTRING)
+        {
+          // lua_tolstring() must not convert the key in place during lua_next()
+          size_t len;
+          const char* str=lua_tolstring(L,key,&len);
+          cbor_write_text(out,str,len);
+        }
+        else if(lua_type(L,key) == LUA_TNUMBER)
+        {
+          cbor_encode_number(lua_tonumber(L,key),out);
+        }
+        else
+        {
+          throw std::system_error(EINVAL,std::system_category(),std::string("CBOR: can not encode a map key of type ")+lua_typename(L,lua_type(L,key)));
+        }
+        cbor_encode_item(L,key+1,out,depth+1);
+        lua_pop(L,1);
+      }
+      return;
+    }
+    default:
+      break;
+  }
+  throw std::system_error(EINVAL,std::system_category(),std::string("CBOR: can not encode a value of type ")+lua_typename(L,lua_type(L,idx)));
+}
+
+/**
+ * @brief encodes the JSON object member by member. Every member is passed
+ * to inspect(key,value) before it is encoded, so that the caller can check
+ * the envelope in the same pass. The output is the same as of
+ * json::to_cbor().
+ * @return false if msg is not an object.
+ **/
+template <typename Inspect> static const bool cbor_encode_json_object(const json& msg, std::vector<uint8_t>& out, Inspect inspect)
+{
+  if(!msg.is_object()) return false;
+  cbor_write_head(out,5,msg.size());
+  for(auto it=msg.begin();it!=msg.end();++it)
+  {
+    const std::string& key=it.key();
+    inspect(key,it.value());
+    cbor_write_text(out,key.data(),key.size());
+    json::to_cbor(it.value(),out);
+  }
+  return true;
+}
+
+/**
+ * @brief same as above for the Lua table at idx, inspect(key,value_idx)
+ * gets the string keys only.
+ * @return false if the value at idx is not a table.
+ **/
+template <typename Inspect> static const bool cbor_encode_table(lua_State* L, const int idx, std::vector<uint8_t>& out, Inspect inspect)
+{
+  if(!lua_istable(L,idx)) return false;
+  const int top=lua_gettop(L);
+  try{
+    size_t count=0;
+    lua_pushnil(L);
+    while(lua_next(L,idx) != 0)
+    {
+      lua_pop(L,1);
+      ++count;
+    }
+    cbor_write_head(out,5,count);
+    lua_pushnil(L);
+    while(lua_next(L,idx) != 0)
+    {
+      const int key=lua_gettop(L)-1;
+      if(lua_type(L,key) == LUA_TSTRING)
+      {
+        size_t len;
+        const char* str=lua_tolstring(L,key,&len);
+        inspect(std::string_view(str,len),key+1);
+        cbor_write_text(out,str,len);
+      }
+      else if(lua_type(L,key) == LUA_TNUMBER)
+      {
+        cbor_encode_number(lua_tonumber(L,key),out);
+      }
+      else
+      {
+        throw std::system_error(EINVAL,std::system_category(),std::string("CBOR: can not encode a map key of type ")+lua_typename(L,lua_type(L,key)));
+      }
+      cbor_encode_item(L,key+1,out,1);
+      lua_pop(L,1);
+    }
+  }catch(...)
+  {
+    lua_settop(L,top);
+    throw;
+  }
+  return true;
+}
+
+/**
+ * @brief appends the CBOR encoding of the Lua value at idx to out. Throws
+ * if the value can not be encoded, the stack is restored then.
+ **/
+static void cbor_encode(lua_State* L, const int idx, std::vector<uint8_t>& out)
+{
+  const int top=lua_gettop(L);
+  const int absidx=(idx > 0) ? idx : top+idx+1;
+  try{
+    cbor_encode_item(L,absidx,out,0);
+  }catch(...)
+  {
+    lua_settop(L,top);
+    throw;
+  }
+}
+
+extern "C" {
+  LUA_API int cbor_lua_encode(lua_State *L)
+  {
+    if(lua_gettop(L) != 1)
+    {
+      lua_pushnil(L);
+      lua_pushstring(L,"Usage: string cbor.encode(value), returns the CBOR encoding of value");
+      return 2;
+    }
+    try{
+      static thread_local std::vector<uint8_t> out;
+      out.clear();
+      cbor_encode(L,1,out);
+      lua_pushlstring(L,reinterpret_cast<const char*>(out.data()),out.size());
+      return 1;
+    }catch(const std::exception& e)
+    {
+      lua_pushnil(L);
+      lua_pushstring(L,e.what());
+      return 2;
+    }
+  }
+  
+  LUA_API int cbor_lua_decode(lua_State *L)
+  {
+    const uint8_t* data=nullptr;
+    size_t len=0;
+    
+    if(lua_gettop(L) == 1)
+    {
+      if(lua_type(L,1) == LUA_TSTRING)
+      {
+        data=reinterpret_cast<const uint8_t*>(lua_tolstring(L,1,&len));
+      }
+      else if(auto buffer=testtype_msgbuf(L,1))
+      {
+        data=(*buffer)->data();
+        len=(*buffer)->size();
+      }
+    }
+    const CBORView* view=(lua_gettop(L) == 1) ? testtype_cborview(L,1) : nullptr;
+    if((data == nullptr)&&(view == nullptr))
+    {
+      lua_pushnil(L);
+      lua_pushstring(L,"Usage: value cbor.decode(string|msgbuf|cborview), returns the decoded Lua value");
+      return 2;
+    }
+    try{
+      if(view)
+      {
+        const CBORReader r=cbor_view_reader(*view);
+        data=r.pos;
+        len=r.end-r.pos;
+      }
+      cbor_decode(L,data,len);
+      return 1;
+    }catch(const std::exception& e)
+    {
+      lua_pushnil(L);
+      lua_pushstring(L,e.what());
+      return 2;
+    }
+  }
+  
+  LUA_API int cbor_lua_view(lua_State *L)
+  {
+    auto buffer=(lua_gettop(L) == 1) ? testtype_msgbuf(L,1) : nullptr;
+    if((buffer == nullptr)||(!(*buffer)))
+    {
+      lua_pushnil(L);
+      lua_pushstring(L,"Usage: cborview cbor.view(msgbuf), returns a lazy view of the CBOR array or map in msgbuf");
+      return 2;
+    }
+    try{
+      CBORReader r{(*buffer)->data(),(*buffer)->data()+(*buffer)->size()};
+      CBORReader probe=r;
+      uint64_t count;
+      bool indefinite;
+      if(cbor_open_container(probe,count,indefinite) == 0)
+        throw std::system_error(EINVAL,std::system_category(),"CBOR: only arrays and maps can be viewed");
+      cbor_skip_item(r,0);
+      if(r.pos != r.end)
+        throw std::system_error(EINVAL,std::system_category(),"CBOR: trailing data after the item");
+      // the view shares the msgbuf, which is never detached
+      push_cborview(L,std::make_shared<CBORViewSource>(CBORViewSource{*buffer}),0,(*buffer)->size());
+      return 1;
+    }catch(const std::exception& e)
+    {
+      lua_pushnil(L);
+      lua_pushstring(L,e.what());
+      return 2;
+    }
+  }
+  
+  LUA_API int cborview_index(lua_State *L)
+  {
+    try{
+      const CBORView* view=testtype_cborview(L,1);
+      if(view == nullptr)
+        throw std::system_error(EINVAL,std::system_category(),"not a cborview object");
+      cbor_view_index(L,*view,2);
+      return 1;
+    }catch(const std::exception& e)
+    {
+      lua_pushstring(L,e.what());
+    }
+    // raised outside of the catch block, the message is on the stack already
+    return lua_error(L);
+  }
+  
+  LUA_API int cborview_len(lua_State *L)
+  {
+    try{
+      const CBORView* view=testtype_cborview(L,1);
+      if(view == nullptr)
+        throw std::system_error(EINVAL,std::system_category(),"not a cborview object");
+      lua_pushnumber(L,static_cast<lua_Number>(cbor_view_size(*view)));
+      return 1;
+    }catch(const std::exception& e)
+    {
+      lua_pushstring(L,e.what());
+    }
+    return lua_error(L);
+  }
+  
+  LUA_API int cborview_gc(lua_State *L)
+  {
+    auto view=testtype_cborview(L,1);
+    if(view)
+    {
+      std::destroy_at(view);
+    }
+    return 0;
+  }
+  
+  LUA_API int luaopen_cbor(lua_State *L)
+  {
+    static const struct luaL_reg functions[]= {
+      {"encode",cbor_lua_encode},
+      {"decode",cbor_lua_decode},
+      {"view",cbor_lua_view},
+      {nullptr,nullptr}
+    };
+    
+    static const struct luaL_reg view_members[] = {
+      {"__index", cborview_index},
+      {"__len", cborview_len},
+      {"__gc", cborview_gc},
+      {nullptr,nullptr}
+    };
+    
+    luaL_newmetatable(L,"cborview");
+    luaL_openlib(L, NULL, view_members,0);
+    lua_pop(L,1);
+    
+    luaL_openlib(L, "cbor", functions,0);
+    lua_pushlightuserdata(L,nullptr);
+    lua_setfield(L,-2,"null");
+    
+    return 1;
+  }
+}
+
+#endif /* __CBOR_H__ */
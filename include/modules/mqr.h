@@ -32,6 +32,7 @@
 #include <MQRegistry.h>
 
 #include <modules/UserDataAdapter.h>
+#include <modules/msgbuf.h>
 #include <ext/json.hpp>
 
 extern "C" {
@@ -40,14 +41,18 @@ extern "C" {
 #include <lauxlib.h>
 #include <stdio.h>
 
-  static auto assert_type_mqr(lua_State* L,const int& lvl)
+  /**
+   * the mqr userdata holds the queue itself, resolved once by mqr.create(),
+   * so that the queue operations never touch the registry.
+   **/
+  static const LAppS::MQ::QueueHolderType& assert_type_mqr(lua_State* L,const int& lvl)
   {
-    size_t* ptr=(size_t*)luaL_checkudata(L, lvl, "mqr");
-    if(!ptr)
+    auto ptr=static_cast<LAppS::MQ::QueueHolderType*>(luaL_checkudata(L, lvl, "mqr"));
+    if((!ptr)||(!(*ptr)))
     {
       throw std::system_error(EINVAL,std::system_category(),"not an MQR object");
     }
-    return ptr;
+    return *ptr;
   }
   
   LUA_API int destroy_nljson_object(lua_State *L)
@@ -73,13 +78,14 @@ extern "C" {
   {
      unsigned int argc = lua_gettop(L);
      
-     if((argc == 1)&&(lua_isstring(L,argc)))
+     if(((argc == 1)||((argc == 2)&&lua_isnumber(L,2)&&(lua_tointeger(L,2) >= 2)))&&(lua_isstring(L,1)))
      {
-       std::string qname(lua_tostring(L,argc));
+       std::string qname(lua_tostring(L,1));
+       const size_t capacity=(argc == 2) ? static_cast<size_t>(lua_tointeger(L,2)) : LAppS::MQ::DEFAULT_CAPACITY;
        
-       auto udptr=static_cast<size_t*>(lua_newuserdata(L,sizeof(size_t*)));
+       auto udptr=static_cast<LAppS::MQ::QueueHolderType*>(lua_newuserdata(L,sizeof(LAppS::MQ::QueueHolderType)));
        
-       (*udptr)=LAppS::MQ::QueueRegistry::getInstance()->create(qname);
+       new(udptr) LAppS::MQ::QueueHolderType(LAppS::MQ::QueueRegistry::getInstance()->create(qname,capacity));
        
        luaL_getmetatable(L, "mqr");
        lua_setmetatable(L, -2);
@@ -87,7 +93,7 @@ extern "C" {
        return 1;
      }else{ // usage
        lua_pushnil(L);
-       lua_pushstring(L,"mqr mqr.create(name) - where name is a string, returns userdata of mqr type");
+       lua_pushstring(L,"mqr mqr.create(name[,capacity]) - where name is a string and capacity is the maximum amount of queued messages (at least 2, rounded up to the power of two, 16384 by default), returns userdata of mqr type");
        return 2;
      }
   }
@@ -99,21 +105,36 @@ extern "C" {
     if(argc==2)
     {
       try{
-        size_t* ptr=assert_type_mqr(L,1);
+        const auto& queue=assert_type_mqr(L,1);
         try{
-          auto queue=LAppS::MQ::QueueRegistry::getInstance()->find(*ptr);
-          
           try{
-            auto udptr=luaL_checkudata(L, 2, "nljson");
-            if(udptr)
+            LAppS::MQ::MessageType message;
+            if(lua_type(L,2) == LUA_TSTRING)
+            {
+              size_t len;
+              const uint8_t* str=reinterpret_cast<const uint8_t*>(lua_tolstring(L,2,&len));
+              message.bytes=std::make_shared<MSGBufferType>(str,str+len);
+            }
+            else if(auto buffer=testtype_msgbuf(L,2))
+            {
+              message.bytes=*buffer;
+            }
+            else
+            {
+              auto udptr=luaL_checkudata(L, 2, "nljson");
+              if(!udptr)
+                throw std::system_error(EINVAL, std::system_category(), "not an object of the nljson or msgbuf userdata-type, nor a string");
+              message.object=udptr2jsptr(udptr);
+            }
+            
+            if(queue->try_send(std::move(message)))
             {
-              
-              queue->send(std::move(udptr2jsptr(udptr)));
               lua_pushboolean(L,true);
               return 1;
-            }else{
-              throw std::system_error(EINVAL, std::system_category(), "not an object of the nljson userdata-type");
             }
+            lua_pushboolean(L,false);
+            lua_pushstring(L,"the queue is full");
+            return 2;
           }
           catch(const std::exception& e)
           {
@@ -135,109 +156,183 @@ extern "C" {
       }
     }else{
       lua_pushboolean(L,false);
-      lua_pushstring(L,"Usage: boolean [,string] mqr_obj:post(nljson_obj)");
+      lua_pushstring(L,"Usage: boolean [,string] mqr_obj:post(message), where message is an nljson object, a msgbuf or a string. Strings and msgbufs are received as msgbuf, without decoding.");
       return 2;
     }
   }
   
-  LUA_API int try_recv(lua_State *L)
+  static void push_mqr_message(lua_State* L, LAppS::MQ::MessageType&& message)
   {
-    unsigned int argc=lua_gettop(L);
+    if(message.bytes)
+    {
+      push_msgbuf(L,std::move(message.bytes));
+      return;
+    }
     
-    if(argc==1)
+    auto udjsptr=static_cast<UDJSPTR**>(lua_newuserdata(L,sizeof(UDJSPTR*)));
+    (*udjsptr)=new UDJSPTR(SHARED_PTR,new JSPTR(std::move(message.object)));
+    
+    luaL_getmetatable(L, "nljson");
+    lua_pushcfunction(L, destroy_nljson_object);
+    lua_setfield(L, -2, "__gc");
+    lua_setmetatable(L, -2);
+  }
+  
+  /**
+   * @brief optional timeout in milliseconds at idx, -1 (forever) if absent.
+   **/
+  static const bool mqr_timeout(lua_State* L, const int idx, long& timeout_ms)
+  {
+    if(lua_gettop(L) < idx)
     {
-      try{
-        auto ptr=assert_type_mqr(L,1);
-        try{
-          auto queue=LAppS::MQ::QueueRegistry::getInstance()->find(*ptr);
-          
-          try{
-            auto udjsptr=static_cast<UDJSPTR**>(lua_newuserdata(L,sizeof(UDJSPTR*)));
-            (*udjsptr)=new UDJSPTR(SHARED_PTR,new JSPTR());
-            
-            if(queue->try_recv(*((*udjsptr)->ptr)))
-            {
-              luaL_getmetatable(L, "nljson");
-              lua_pushcfunction(L, destroy_nljson_object);
-              lua_setfield(L, -2, "__gc");
-              lua_setmetatable(L, -2);
-              return 1;
-            }else{
-              lua_pop(L,1);
-              lua_pushnil(L);
-              return 1;
-            }
-          }
-          catch(const std::exception& e)
-          {
-            lua_pushboolean(L,false);
-            lua_pushstring(L,e.what());
-            return 2;
-          }
-        }catch(const std::exception& e)
-        {
-          lua_pushboolean(L,false);
-          lua_pushstring(L,e.what());
-          return 2;
-        }
-      }catch(const std::exception& e)
+      timeout_ms=-1;
+      return true;
+    }
+    if(!lua_isnumber(L,idx)) return false;
+    timeout_ms=static_cast<long>(lua_tointeger(L,idx));
+    return true;
+  }
+  
+  LUA_API int try_recv(lua_State *L)
+  {
+    if(lua_gettop(L) != 1)
+    {
+      lua_pushboolean(L,false);
+      lua_pushstring(L,"Usage: nljson|msgbuf|nil [,string] mqr_obj:try_recv()");
+      return 2;
+    }
+    
+    try{
+      const auto& queue=assert_type_mqr(L,1);
+      
+      LAppS::MQ::MessageType message;
+      if(queue->try_recv(message))
       {
-        lua_pushboolean(L,false);
-        lua_pushstring(L,e.what());
-        return 2;
+        push_mqr_message(L,std::move(message));
       }
-    }else{
+      else
+      {
+        lua_pushnil(L);
+      }
+      return 1;
+    }catch(const std::exception& e)
+    {
       lua_pushboolean(L,false);
-      lua_pushstring(L,"Usage: boolean [,string] mqr_obj:post(nljson_obj)");
+      lua_pushstring(L,e.what());
       return 2;
-    } 
+    }
   }
   
   LUA_API int receive(lua_State *L)
   {
-    unsigned int argc=lua_gettop(L);
+    static const char* usage="Usage: nljson|msgbuf|nil [,string] mqr_obj:recv([timeout]), where timeout is in milliseconds. Waits forever without the timeout, returns nil if the timeout expires.";
     
-    if(argc==1)
+    long timeout_ms;
+    if((lua_gettop(L) > 2)||(!mqr_timeout(L,2,timeout_ms)))
     {
-      try{
-        auto ptr=assert_type_mqr(L,1);
-        try{
-          auto queue=LAppS::MQ::QueueRegistry::getInstance()->find(*ptr);
-          
-          try{
-            auto udjsptr=static_cast<UDJSPTR**>(lua_newuserdata(L,sizeof(UDJSPTR*)));
-            (*udjsptr)=new UDJSPTR(SHARED_PTR,new JSPTR());
-            (*((*udjsptr)->ptr))=queue->recv();
-            
-              luaL_getmetatable(L, "nljson");
-              lua_pushcfunction(L, destroy_nljson_object);
-              lua_setfield(L, -2, "__gc");
-              lua_setmetatable(L, -2);
-              return 1;
-          }
-          catch(const std::exception& e)
-          {
-            lua_pushboolean(L,false);
-            lua_pushstring(L,e.what());
-            return 2;
-          }
-        }catch(const std::exception& e)
-        {
-          lua_pushboolean(L,false);
-          lua_pushstring(L,e.what());
-          return 2;
-        }
-      }catch(const std::exception& e)
+      lua_pushboolean(L,false);
+      lua_pushstring(L,usage);
+      return 2;
+    }
+    
+    try{
+      const auto& queue=assert_type_mqr(L,1);
+      
+      LAppS::MQ::MessageType message;
+      if(queue->recv(message,timeout_ms))
       {
-        lua_pushboolean(L,false);
-        lua_pushstring(L,e.what());
-        return 2;
+        push_mqr_message(L,std::move(message));
       }
-    }else{
+      else
+      {
+        lua_pushnil(L);
+      }
+      return 1;
+    }catch(const std::exception& e)
+    {
+      lua_pushboolean(L,false);
+      lua_pushstring(L,e.what());
+      return 2;
+    }
+  }
+  
+  LUA_API int recv_many(lua_State *L)
+  {
+    static const char* usage="Usage: table|nil [,string] mqr_obj:recv_many(n[,timeout]), waits up to timeout milliseconds (forever without the timeout) for the first message and returns an array of up to n messages, or nil if the timeout expires.";
+    
+    long timeout_ms;
+    const int argc=lua_gettop(L);
+    if((argc < 2)||(argc > 3)||(!lua_isnumber(L,2))||(lua_tointeger(L,2) <= 0)||(!mqr_timeout(L,3,timeout_ms)))
+    {
+      lua_pushboolean(L,false);
+      lua_pushstring(L,usage);
+      return 2;
+    }
+    
+    try{
+      const auto& queue=assert_type_mqr(L,1);
+      const size_t max=static_cast<size_t>(lua_tointeger(L,2));
+      
+      static thread_local std::vector<LAppS::MQ::MessageType> batch;
+      batch.clear();
+      
+      const size_t count=queue->recv_many(batch,max,timeout_ms);
+      if(count == 0)
+      {
+        lua_pushnil(L);
+        return 1;
+      }
+      
+      lua_createtable(L,static_cast<int>(count),0);
+      for(size_t i=0;i<count;++i)
+      {
+        push_mqr_message(L,std::move(batch[i]));
+        lua_rawseti(L,-2,static_cast<int>(i+1));
+      }
+      batch.clear();
+      return 1;
+    }catch(const std::exception& e)
+    {
       lua_pushboolean(L,false);
-      lua_pushstring(L,"Usage: nljson, [boolean, string] mqr_obj:recv()");
+      lua_pushstring(L,e.what());
       return 2;
-    } 
+    }
+  }
+  
+  LUA_API int mqr_empty(lua_State *L)
+  {
+    try{
+      lua_pushboolean(L,assert_type_mqr(L,1)->empty());
+      return 1;
+    }catch(const std::exception& e)
+    {
+      lua_pushboolean(L,false);
+      lua_pushstring(L,e.what());
+      return 2;
+    }
+  }
+  
+  LUA_API int mqr_size(lua_State *L)
+  {
+    try{
+      lua_pushinteger(L,static_cast<lua_Integer>(assert_type_mqr(L,1)->size()));
+      return 1;
+    }catch(const std::exception& e)
+    {
+      lua_pushboolean(L,false);
+      lua_pushstring(L,e.what());
+      return 2;
+    }
+  }
+  
+  LUA_API int mqr_gc(lua_State *L)
+  {
+    auto ptr=static_cast<LAppS::MQ::QueueHolderType*>(luaL_checkudata(L, 1, "mqr"));
+    if(ptr)
+    {
+      std::destroy_at(ptr);
+    }
+    return 0;
   }
   
   LUA_API int mqr_methods(lua_State *L)
@@ -259,7 +354,11 @@ extern "C" {
       {"post", post},
       {"try_recv", try_recv},
       {"recv", receive},
+      {"recv_many", recv_many},
+      {"empty", mqr_empty},
+      {"size", mqr_size},
       {"__index", mqr_methods},
+      {"__gc", mqr_gc},
       {nullptr,nullptr}
     };
 
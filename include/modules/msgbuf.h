@@ -0,0 +1,161 @@
+/**
+ *  Copyright 2017-2018, Pavel Kraynyukhov <pavel.kraynyukhov@gmail.com>
+ * 
+ *  This file is a part of LAppS (Lua Application Server).
+ *  
+ *  LAppS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *  
+ *  LAppS is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *  
+ *  You should have received a copy of the GNU General Public License
+ *  along with LAppS.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  $Id: msgbuf.h October 22, 2026 2:10 PM $
+ * 
+ **/
+
+
+#ifndef __MSGBUF_H__
+#  define __MSGBUF_H__
+
+#include <memory>
+#include <string>
+#include <system_error>
+
+#include <WSEvent.h>
+
+extern "C" {
+#include <lua.h>
+#include <lualib.h>
+#include <lauxlib.h>
+}
+
+/**
+ * msgbuf is a refcounted byte buffer (MSGBufferTypeSPtr) visible to Lua.
+ * It passes through MQR without being decoded and is shared, not copied,
+ * between the producer and the consumers.
+ **/
+
+/**
+ * @return the buffer of the msgbuf userdata at idx or nullptr if the value
+ * is not a msgbuf.
+ **/
+static MSGBufferTypeSPtr* testtype_msgbuf(lua_State* L, const int idx)
+{
+  void* udptr=lua_touserdata(L,idx);
+  if((udptr == nullptr)||(!lua_getmetatable(L,idx)))
+    return nullptr;
+  luaL_getmetatable(L,"msgbuf");
+  const bool is_msgbuf=lua_rawequal(L,-1,-2);
+  lua_pop(L,2);
+  return is_msgbuf ? static_cast<MSGBufferTypeSPtr*>(udptr) : nullptr;
+}
+
+static const MSGBufferTypeSPtr& checktype_msgbuf(lua_State* L, const int idx)
+{
+  auto ptr=testtype_msgbuf(L,idx);
+  if((ptr == nullptr)||(!(*ptr)))
+    throw std::system_error(EINVAL,std::system_category(),"not a msgbuf object");
+  return *ptr;
+}
+
+static void push_msgbuf(lua_State* L, MSGBufferTypeSPtr&& buffer)
+{
+  auto udptr=static_cast<MSGBufferTypeSPtr*>(lua_newuserdata(L,sizeof(MSGBufferTypeSPtr)));
+  new(udptr) MSGBufferTypeSPtr(std::move(buffer));
+  luaL_getmetatable(L,"msgbuf");
+  lua_setmetatable(L,-2);
+}
+
+extern "C" {
+  LUA_API int msgbuf_new(lua_State *L)
+  {
+    if((lua_gettop(L) != 1)||(lua_type(L,1) != LUA_TSTRING))
+    {
+      lua_pushnil(L);
+      lua_pushstring(L,"Usage: msgbuf msgbuf.new(string), copies the string into a new buffer");
+      return 2;
+    }
+    size_t len;
+    const uint8_t* str=reinterpret_cast<const uint8_t*>(lua_tolstring(L,1,&len));
+    push_msgbuf(L,std::make_shared<MSGBufferType>(str,str+len));
+    return 1;
+  }
+  
+  LUA_API int msgbuf_tostring(lua_State *L)
+  {
+    try{
+      const auto& buffer=checktype_msgbuf(L,1);
+      lua_pushlstring(L,reinterpret_cast<const char*>(buffer->data()),buffer->size());
+      return 1;
+    }catch(const std::exception& e)
+    {
+      lua_pushnil(L);
+      lua_pushstring(L,e.what());
+      return 2;
+    }
+  }
+  
+  LUA_API int msgbuf_size(lua_State *L)
+  {
+    try{
+      lua_pushinteger(L,static_cast<lua_Integer>(checktype_msgbuf(L,1)->size()));
+      return 1;
+    }catch(const std::exception& e)
+    {
+      lua_pushnil(L);
+      lua_pushstring(L,e.what());
+      return 2;
+    }
+  }
+  
+  LUA_API int msgbuf_gc(lua_State *L)
+  {
+    auto ptr=testtype_msgbuf(L,1);
+    if(ptr)
+    {
+      std::destroy_at(ptr);
+    }
+    return 0;
+  }
+  
+  LUA_API int msgbuf_methods(lua_State *L)
+  {
+    luaL_getmetatable(L, "msgbuf");
+    lua_getfield(L,-1,lua_tostring(L,2));
+    
+    return 1;
+  }
+  
+  LUA_API int luaopen_msgbuf(lua_State *L)
+  {
+    static const struct luaL_reg functions[]= {
+      {"new",msgbuf_new},
+      {nullptr,nullptr}
+    };
+    
+    static const struct luaL_reg members[] = {
+      {"size", msgbuf_size},
+      {"tostring", msgbuf_tostring},
+      {"__len", msgbuf_size},
+      {"__tostring", msgbuf_tostring},
+      {"__index", msgbuf_methods},
+      {"__gc", msgbuf_gc},
+      {nullptr,nullptr}
+    };
+
+    luaL_newmetatable(L,"msgbuf");
+    luaL_openlib(L, NULL, members,0);
+    luaL_openlib(L, "msgbuf", functions,0);
+
+    return 1;
+  }
+}
+
+#endif /* __MSGBUF_H__ */
@@ -44,6 +44,42 @@ int lapps_pam_conversation(int n, const struct pam_message **msg, struct pam_res
   return PAM_SUCCESS;
 }
 
+/**
+ * @brief checks the password and the account of the user with PAM,
+ * blocks until the PAM modules respond.
+ **/
+static const bool pam_login(const char* service, const char* username, const char* password)
+{
+  pam_handle_t *pamh=NULL;
+  
+  struct pam_conv conv = {
+    lapps_pam_conversation,
+    const_cast<char*>(password)
+  };
+  
+  int ret = pam_start(service, username, &conv, &pamh);
+  
+  if(ret == PAM_SUCCESS)
+  {
+    ret=pam_authenticate(pamh, 0);
+    if(ret == PAM_SUCCESS)
+    {
+      ret=pam_acct_mgmt(pamh, 0);
+    }
+    
+    if(ret == PAM_SUCCESS)
+    {
+      if (pam_end(pamh,ret) == PAM_SUCCESS)
+      {
+        pamh=NULL;
+        __resp[0].resp=NULL;
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
 extern "C" 
 {
   #include <lua.h>
@@ -63,9 +99,6 @@ extern "C"
   {
     static const char* usage="Usage: boolean[,string] pam_auth:login(string service,string username,string password) returns true on successful authentication, otherwise false. In case of inappropriate usage returns this error message as well.";
     
-    pam_handle_t *pamh=NULL;
-    int ret;
-    
     auto argc=lua_gettop(L);
     if(argc!=4)
     {
@@ -85,39 +118,7 @@ extern "C"
       return 2;
     }
     
-    const char *service=lua_tostring(L,argc-2);
-    const char *username=lua_tostring(L,argc-1);
-    
-    
-    struct pam_conv conv = {
-      lapps_pam_conversation,
-      (char*)(lua_tostring(L,argc))
-    };
-
-    
-    ret = pam_start(service, username, &conv, &pamh);
-    
-    if(ret == PAM_SUCCESS)
-    {
-      ret=pam_authenticate(pamh, 0);
-      if(ret == PAM_SUCCESS)
-      {
-        ret=pam_acct_mgmt(pamh, 0);
-      }
-      
-      if(ret == PAM_SUCCESS)
-      {
-        if (pam_end(pamh,ret) == PAM_SUCCESS)
-        {
-          pamh=NULL;
-          __resp[0].resp=NULL;
-          lua_pushboolean(L,true);
-          return 1;
-        }
-      }
-    }
-    
-    lua_pushboolean(L,false);
+    lua_pushboolean(L,pam_login(lua_tostring(L,argc-2),lua_tostring(L,argc-1),lua_tostring(L,argc)));
     return 1;
   }
   
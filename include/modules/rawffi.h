@@ -0,0 +1,250 @@
+/**
+ *  Copyright 2017-2018, Pavel Kraynyukhov <pavel.kraynyukhov@gmail.com>
+ * 
+ *  This file is a part of LAppS (Lua Application Server).
+ *  
+ *  LAppS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *  
+ *  LAppS is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *  
+ *  You should have received a copy of the GNU General Public License
+ *  along with LAppS.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  $Id: rawffi.h October 24, 2026 11:20 AM $
+ * 
+ **/
+
+
+#ifndef __RAWFFI_H__
+#  define __RAWFFI_H__
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <system_error>
+
+extern "C" {
+#include <lua.h>
+#include <lualib.h>
+#include <lauxlib.h>
+}
+
+#include <WSServerMessage.h>
+#include <abstract/WebSocket.h>
+#include <HandleTable.h>
+#include <modules/cbor.h>
+#include <modules/bcast.h>
+
+/**
+ * LuaJIT FFI interface to the outbound paths.
+ *
+ * The lapps_* functions below are plain C entry points, so that the calls
+ * from Lua are compiled by the tracer. The executable is linked with
+ * -rdynamic to make them visible to ffi.C.
+ *
+ * RAW services with "raw_ffi" : true get the inbound message as a
+ * `const lapps_message_t*` cdata instead of a Lua string. The message
+ * references the inbound buffer and is valid until onMessage() returns
+ * (data is NULL afterwards, the same cdata is reused for the next
+ * message). ws:send(handler, opcode, message) and rawffi.send() forward
+ * it as is, with only a new frame header.
+ **/
+
+typedef struct lapps_message
+{
+  const uint8_t*            data;
+  size_t                    size;
+  const MSGBufferTypeSPtr*  buffer;
+} lapps_message_t;
+
+static const char* rawffi_chunk=R"(
+local loaded=package.loaded.rawffi
+if loaded then
+  loaded.hook(ws)
+  return loaded
+end
+
+local ffi=require("ffi")
+ffi.cdef[[
+  typedef struct lapps_message { const uint8_t* data; size_t size; const void* buffer; } lapps_message_t;
+  int lapps_ws_send(uint64_t handler, int opcode, const void* data, size_t size);
+  int lapps_ws_forward(uint64_t handler, int opcode, const lapps_message_t* message);
+  int lapps_bcast_send(uint64_t id, const void* data, size_t size, uint64_t key);
+]]
+
+local C=ffi.C
+local cast=ffi.cast
+local istype=ffi.istype
+local message_ptr=ffi.typeof("const lapps_message_t*")
+
+local rawffi={ message=message_ptr }
+
+-- message: lapps_message_t cdata, string or pointer with size
+function rawffi.send(handler, opcode, message, size)
+  if type(message) == "cdata" and istype(message_ptr,message) then
+    return C.lapps_ws_forward(handler,opcode,message) == 0
+  end
+  return C.lapps_ws_send(handler,opcode,message,size or #message) == 0
+end
+
+-- message: CBOR of a LAppS out of order notification
+function rawffi.bcast(id, message, size, key)
+  return C.lapps_bcast_send(id,message,size or #message,key or 0) == 0
+end
+
+-- the cdata of the lapps_message_t at the address of the light userdata
+function rawffi.wrap(pointer)
+  return cast(message_ptr,pointer)
+end
+
+function rawffi.hook(ws)
+  if (ws == nil) or (ws.rawffi_send ~= nil) then return end
+  local send=ws.send
+  ws.rawffi_send=send
+  ws.send=function(self, handler, opcode, message, ...)
+    if type(message) == "cdata" then
+      if istype(message_ptr,message) and (C.lapps_ws_forward(handler,opcode,message) == 0) then
+        return true
+      end
+      return false, "ws:send(): the message is released, is not a lapps_message_t or the connection is closed"
+    end
+    return send(self,handler,opcode,message,...)
+  end
+end
+
+rawffi.hook(ws)
+package.loaded.rawffi=rawffi
+return rawffi
+)";
+
+/**
+ * @brief sends len bytes as a single frame, or as fragments if the socket
+ * requires so. The data is copied into the frame.
+ **/
+static void rawffi_send_copy(abstract::WebSocket* handler, const WebSocketProtocol::OpCode opcode, const uint8_t* data, const size_t len)
+{
+  if(handler->mustAutoFragment())
+  {
+    handler->forward(opcode,std::make_shared<MSGBufferType>(data,data+len));
+    return;
+  }
+  WebSocketProtocol::InPlaceServerMessage frame;
+  frame.payload().insert(frame.payload().end(),data,data+len);
+  handler->send(frame.finish(opcode));
+}
+
+extern "C" {
+  /**
+   * @return 0 on success, -1 on error.
+   **/
+  __attribute__((visibility("default"),used))
+  int lapps_ws_send(uint64_t handler, int opcode, const void* data, size_t size)
+  {
+    if(((opcode != WebSocketProtocol::TEXT)&&(opcode != WebSocketProtocol::BINARY))||((data == nullptr)&&(size > 0)))
+      return -1;
+    LAppS::WSHandleTable::Guard ws(LAppS::wsHandles(),handler);
+    if(!ws)
+      return -1;
+    try{
+      rawffi_send_copy(
+        ws.get(),static_cast<WebSocketProtocol::OpCode>(opcode),
+        static_cast<const uint8_t*>(data),size
+      );
+      return 0;
+    }catch(...)
+    {
+      return -1;
+    }
+  }
+  
+  /**
+   * @brief sends the inbound message buffer with a new header, without
+   * copying the payload.
+   * @return 0 on success, -1 on error or if the message is released.
+   **/
+  __attribute__((visibility("default"),used))
+  int lapps_ws_forward(uint64_t handler, int opcode, const lapps_message_t* message)
+  {
+    if((opcode != WebSocketProtocol::TEXT)&&(opcode != WebSocketProtocol::BINARY))
+      return -1;
+    if((message == nullptr)||(message->data == nullptr)||(message->buffer == nullptr))
+      return -1;
+    LAppS::WSHandleTable::Guard ws(LAppS::wsHandles(),handler);
+    if(!ws)
+      return -1;
+    try{
+      // auto-fragmenting sockets fragment the forwarded buffer as well
+      if(ws->forward(static_cast<WebSocketProtocol::OpCode>(opcode),*(message->buffer)) == -1)
+        return -1;
+      return 0;
+    }catch(...)
+    {
+      return -1;
+    }
+  }
+  
+  /**
+   * @brief broadcasts the CBOR encoded LAppS message (cid and message
+   * members are checked) on the channel id, see bcast:send().
+   * @return 0 on success, -1 on error.
+   **/
+  __attribute__((visibility("default"),used))
+  int lapps_bcast_send(uint64_t id, const void* data, size_t size, uint64_t key)
+  {
+    if(data == nullptr) return -1;
+    try{
+      const uint8_t* begin=static_cast<const uint8_t*>(data);
+      CBORReader r{begin,begin+size};
+      uint64_t count;
+      bool indefinite;
+      if(cbor_open_container(r,count,indefinite) != 5)
+        return -1;
+      bool has_cid=false;
+      bool has_message=false;
+      for(uint64_t i=0;cbor_container_next(r,i,count,indefinite);++i)
+      {
+        const char* name;
+        size_t len;
+        if(cbor_read_text(r,name,len))
+        {
+          CBORReader value=r;
+          double number;
+          uint64_t elements;
+          bool unbounded;
+          if((len == 3)&&(memcmp(name,"cid",3) == 0))
+            has_cid=cbor_read_number(value,number);
+          else if((len == 7)&&(memcmp(name,"message",7) == 0))
+            has_message=(cbor_open_container(value,elements,unbounded) == 4);
+        }
+        else cbor_skip_item(r,1);
+        cbor_skip_item(r,1);
+      }
+      if((r.pos != r.end)||(!has_cid)||(!has_message))
+        return -1;
+      
+      WebSocketProtocol::InPlaceServerMessage frame;
+      frame.payload().insert(frame.payload().end(),begin,begin+size);
+      find_bcast(static_cast<size_t>(id))->bcast(frame.finish(WebSocketProtocol::BINARY),key,LAppS::BroadcastDelivery::SEND);
+      return 0;
+    }catch(...)
+    {
+      return -1;
+    }
+  }
+  
+  LUA_API int luaopen_rawffi(lua_State *L)
+  {
+    if(luaL_loadbuffer(L,rawffi_chunk,strlen(rawffi_chunk),"=rawffi") != 0)
+      return lua_error(L);
+    lua_call(L,0,1);
+    return 1;
+  }
+}
+
+#endif /* __RAWFFI_H__ */
@@ -0,0 +1,383 @@
+/**
+ *  Copyright 2017-2018, Pavel Kraynyukhov <pavel.kraynyukhov@gmail.com>
+ *
+ *  This file is a part of LAppS (Lua Application Server).
+ *
+ *  LAppS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  LAppS is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with LAppS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  $Id: shdict.h October 28, 2026 3:40 PM $
+ *
+ **/
+
+
+#ifndef __SHDICT_H__
+#  define __SHDICT_H__
+
+#include <errno.h>
+#include <string>
+#include <system_error>
+
+#include <SharedDict.h>
+
+extern "C" {
+#include <lua.h>
+#include <lualib.h>
+#include <lauxlib.h>
+}
+
+static const char* shdict_status(const LAppS::SharedDict::Status status)
+{
+  switch(status)
+  {
+    case LAppS::SharedDict::Status::OK: return "ok";
+    case LAppS::SharedDict::Status::NOT_FOUND: return "not found";
+    case LAppS::SharedDict::Status::EXISTS: return "exists";
+    case LAppS::SharedDict::Status::NOT_A_NUMBER: return "not a number";
+    case LAppS::SharedDict::Status::NO_MEMORY: return "no memory";
+    case LAppS::SharedDict::Status::TOO_LARGE: return "too large";
+  }
+  return "unknown error";
+}
+
+/**
+ * @brief the item from the Lua value at idx.
+ **/
+static const bool shdict_item(lua_State* L, const int idx, LAppS::SharedDict::Item& item)
+{
+  switch(lua_type(L,idx))
+  {
+    case LUA_TBOOLEAN:
+      item=LAppS::SharedDict::Item{LAppS::SharedDict::Type::BOOLEAN,lua_toboolean(L,idx) != 0,0,std::string_view()};
+      return true;
+    case LUA_TNUMBER:
+      item=LAppS::SharedDict::Item{LAppS::SharedDict::Type::NUMBER,false,lua_tonumber(L,idx),std::string_view()};
+      return true;
+    case LUA_TSTRING:
+    {
+      size_t len;
+      const char* str=lua_tolstring(L,idx,&len);
+      item=LAppS::SharedDict::Item{LAppS::SharedDict::Type::STRING,false,0,std::string_view(str,len)};
+      return true;
+    }
+    default:
+      return false;
+  }
+}
+
+/**
+ * @brief optional ttl in milliseconds at idx, 0 (never expires) if absent.
+ **/
+static const bool shdict_ttl(lua_State* L, const int idx, long& ttl_ms)
+{
+  if(lua_isnoneornil(L,idx))
+  {
+    ttl_ms=0;
+    return true;
+  }
+  if(!lua_isnumber(L,idx)) return false;
+  ttl_ms=static_cast<long>(lua_tointeger(L,idx));
+  return ttl_ms >= 0;
+}
+
+static const std::string_view shdict_key(lua_State* L, const int idx)
+{
+  if(lua_type(L,idx) != LUA_TSTRING)
+    throw std::system_error(EINVAL,std::system_category(),"the key must be a string");
+  size_t len;
+  const char* str=lua_tolstring(L,idx,&len);
+  return std::string_view(str,len);
+}
+
+extern "C" {
+  /**
+   * the shdict userdata holds a pointer to the dictionary, which lives as
+   * long as the process.
+   **/
+  static LAppS::SharedDict* assert_type_shdict(lua_State* L,const int& lvl)
+  {
+    auto ptr=static_cast<LAppS::SharedDict**>(luaL_checkudata(L, lvl, "shdict"));
+    if((!ptr)||(!(*ptr)))
+    {
+      throw std::system_error(EINVAL,std::system_category(),"not a shdict object");
+    }
+    return *ptr;
+  }
+
+  LUA_API int shdict_get_dict(lua_State *L)
+  {
+    if((lua_gettop(L) != 1)||(lua_type(L,1) != LUA_TSTRING))
+    {
+      lua_pushnil(L);
+      lua_pushstring(L,"shdict shdict.get(name) - where name is a dictionary from the shared_dicts section of lapps.json, returns userdata of shdict type");
+      return 2;
+    }
+
+    auto dict=LAppS::SSharedDicts::getInstance()->find(lua_tostring(L,1));
+    if(!dict)
+    {
+      lua_pushnil(L);
+      lua_pushfstring(L,"no shared dictionary %s is configured",lua_tostring(L,1));
+      return 2;
+    }
+
+    auto udptr=static_cast<LAppS::SharedDict**>(lua_newuserdata(L,sizeof(LAppS::SharedDict*)));
+    (*udptr)=dict;
+    luaL_getmetatable(L, "shdict");
+    lua_setmetatable(L, -2);
+    return 1;
+  }
+
+  LUA_API int shdict_get(lua_State *L)
+  {
+    if(lua_gettop(L) != 2)
+    {
+      lua_pushnil(L);
+      lua_pushstring(L,"Usage: value|nil [,string] shdict_obj:get(key), returns nil if the key is absent or expired");
+      return 2;
+    }
+
+    try{
+      // reused, so that the strings are not reallocated on each call
+      static thread_local LAppS::SharedDict::Value value;
+      if(!assert_type_shdict(L,1)->get(shdict_key(L,2),value))
+      {
+        lua_pushnil(L);
+        return 1;
+      }
+      switch(value.type)
+      {
+        case LAppS::SharedDict::Type::BOOLEAN:
+          lua_pushboolean(L,value.boolean);
+          break;
+        case LAppS::SharedDict::Type::NUMBER:
+          lua_pushnumber(L,value.number);
+          break;
+        case LAppS::SharedDict::Type::STRING:
+          lua_pushlstring(L,value.string.data(),value.string.size());
+          break;
+      }
+      return 1;
+    }catch(const std::exception& e)
+    {
+      lua_pushnil(L);
+      lua_pushstring(L,e.what());
+      return 2;
+    }
+  }
+
+  static int shdict_store(lua_State *L, const bool only_new, const char* usage)
+  {
+    LAppS::SharedDict::Item item;
+    long ttl_ms;
+    const int argc=lua_gettop(L);
+    if((argc < 3)||(argc > 4)||(!shdict_item(L,3,item))||(!shdict_ttl(L,4,ttl_ms)))
+    {
+      lua_pushboolean(L,false);
+      lua_pushstring(L,usage);
+      return 2;
+    }
+
+    try{
+      auto dict=assert_type_shdict(L,1);
+      const auto key=shdict_key(L,2);
+      const auto status=only_new ? dict->add(key,item,ttl_ms) : dict->set(key,item,ttl_ms);
+      if(status == LAppS::SharedDict::Status::OK)
+      {
+        lua_pushboolean(L,true);
+        return 1;
+      }
+      lua_pushboolean(L,false);
+      lua_pushstring(L,shdict_status(status));
+      return 2;
+    }catch(const std::exception& e)
+    {
+      lua_pushboolean(L,false);
+      lua_pushstring(L,e.what());
+      return 2;
+    }
+  }
+
+  LUA_API int shdict_set(lua_State *L)
+  {
+    return shdict_store(L,false,"Usage: boolean [,string] shdict_obj:set(key,value[,ttl]), where value is a string, a number or a boolean and ttl is in milliseconds (never expires without the ttl)");
+  }
+
+  LUA_API int shdict_add(lua_State *L)
+  {
+    return shdict_store(L,true,"Usage: boolean [,string] shdict_obj:add(key,value[,ttl]), like set() but fails with \"exists\" if the key is there");
+  }
+
+  LUA_API int shdict_incr(lua_State *L)
+  {
+    static const char* usage="Usage: number|nil [,string] shdict_obj:incr(key,delta[,init[,ttl]]), atomically adds delta to the number. An absent key is created with init+delta and the ttl (milliseconds) if init is given.";
+
+    long ttl_ms;
+    const int argc=lua_gettop(L);
+    if((argc < 3)||(argc > 5)||(!lua_isnumber(L,3))||((argc >= 4)&&(!lua_isnoneornil(L,4))&&(!lua_isnumber(L,4)))||(!shdict_ttl(L,5,ttl_ms)))
+    {
+      lua_pushnil(L);
+      lua_pushstring(L,usage);
+      return 2;
+    }
+
+    try{
+      auto dict=assert_type_shdict(L,1);
+      const double init=lua_isnumber(L,4) ? lua_tonumber(L,4) : 0;
+      double result;
+      const auto status=dict->incr(shdict_key(L,2),lua_tonumber(L,3),result,lua_isnumber(L,4) ? &init : nullptr,ttl_ms);
+      if(status == LAppS::SharedDict::Status::OK)
+      {
+        lua_pushnumber(L,result);
+        return 1;
+      }
+      lua_pushnil(L);
+      lua_pushstring(L,shdict_status(status));
+      return 2;
+    }catch(const std::exception& e)
+    {
+      lua_pushnil(L);
+      lua_pushstring(L,e.what());
+      return 2;
+    }
+  }
+
+  LUA_API int shdict_delete(lua_State *L)
+  {
+    if(lua_gettop(L) != 2)
+    {
+      lua_pushboolean(L,false);
+      lua_pushstring(L,"Usage: boolean [,string] shdict_obj:delete(key), returns false if the key is absent");
+      return 2;
+    }
+
+    try{
+      lua_pushboolean(L,assert_type_shdict(L,1)->remove(shdict_key(L,2)));
+      return 1;
+    }catch(const std::exception& e)
+    {
+      lua_pushboolean(L,false);
+      lua_pushstring(L,e.what());
+      return 2;
+    }
+  }
+
+  LUA_API int shdict_expire(lua_State *L)
+  {
+    long ttl_ms;
+    if((lua_gettop(L) != 3)||(!shdict_ttl(L,3,ttl_ms)))
+    {
+      lua_pushboolean(L,false);
+      lua_pushstring(L,"Usage: boolean [,string] shdict_obj:expire(key,ttl), sets the ttl in milliseconds of the key, 0 - never expires");
+      return 2;
+    }
+
+    try{
+      lua_pushboolean(L,assert_type_shdict(L,1)->expire(shdict_key(L,2),ttl_ms));
+      return 1;
+    }catch(const std::exception& e)
+    {
+      lua_pushboolean(L,false);
+      lua_pushstring(L,e.what());
+      return 2;
+    }
+  }
+
+  LUA_API int shdict_ttl_left(lua_State *L)
+  {
+    if(lua_gettop(L) != 2)
+    {
+      lua_pushnil(L);
+      lua_pushstring(L,"Usage: number|nil [,string] shdict_obj:ttl(key), returns milliseconds left, -1 if the key never expires, nil if it is absent");
+      return 2;
+    }
+
+    try{
+      long ttl_ms;
+      if(assert_type_shdict(L,1)->ttl(shdict_key(L,2),ttl_ms))
+        lua_pushinteger(L,static_cast<lua_Integer>(ttl_ms));
+      else
+        lua_pushnil(L);
+      return 1;
+    }catch(const std::exception& e)
+    {
+      lua_pushnil(L);
+      lua_pushstring(L,e.what());
+      return 2;
+    }
+  }
+
+  LUA_API int shdict_flush_expired(lua_State *L)
+  {
+    try{
+      lua_pushinteger(L,static_cast<lua_Integer>(assert_type_shdict(L,1)->flushExpired()));
+      return 1;
+    }catch(const std::exception& e)
+    {
+      lua_pushnil(L);
+      lua_pushstring(L,e.what());
+      return 2;
+    }
+  }
+
+  LUA_API int shdict_count(lua_State *L)
+  {
+    try{
+      lua_pushinteger(L,static_cast<lua_Integer>(assert_type_shdict(L,1)->count()));
+      return 1;
+    }catch(const std::exception& e)
+    {
+      lua_pushnil(L);
+      lua_pushstring(L,e.what());
+      return 2;
+    }
+  }
+
+  LUA_API int shdict_methods(lua_State *L)
+  {
+    luaL_getmetatable(L, "shdict");
+    lua_getfield(L,-1,lua_tostring(L,2));
+
+    return 1;
+  }
+
+  LUA_API int luaopen_shdict(lua_State *L)
+  {
+    static const struct luaL_reg functions[]= {
+      {"get",shdict_get_dict},
+      {nullptr,nullptr}
+    };
+
+    static const struct luaL_reg members[] = {
+      {"get", shdict_get},
+      {"set", shdict_set},
+      {"add", shdict_add},
+      {"incr", shdict_incr},
+      {"delete", shdict_delete},
+      {"expire", shdict_expire},
+      {"ttl", shdict_ttl_left},
+      {"flush_expired", shdict_flush_expired},
+      {"count", shdict_count},
+      {"__index", shdict_methods},
+      {nullptr,nullptr}
+    };
+
+    luaL_newmetatable(L,"shdict");
+    luaL_openlib(L, NULL, members,0);
+    luaL_openlib(L, "shdict", functions,0);
+
+    return 1;
+  }
+}
+
+#endif /* __SHDICT_H__ */
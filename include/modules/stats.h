@@ -0,0 +1,70 @@
+/**
+ *  Copyright 2017-2018, Pavel Kraynyukhov <pavel.kraynyukhov@gmail.com>
+ * 
+ *  This file is a part of LAppS (Lua Application Server).
+ *  
+ *  LAppS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *  
+ *  LAppS is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *  
+ *  You should have received a copy of the GNU General Public License
+ *  along with LAppS.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  $Id: stats.h October 19, 2026 5:05 PM $
+ * 
+ **/
+
+
+#ifndef __STATS_H__
+#  define __STATS_H__
+
+#include <ServiceRegistry.h>
+
+#include <modules/nljson.h>
+#include <modules/UserDataAdapter.h>
+
+extern "C" {
+  #include <lua.h>
+  #include <lualib.h>
+  #include <lauxlib.h>
+
+  /**
+   * @brief stats.services() - returns an nljson array with all service
+   * instances and their runtime metrics (queue depth, watermarks, etc.).
+   **/
+  LUA_API int stats_services(lua_State *L)
+  {
+    try{
+      auto udjsptr=static_cast<UDJSPTR**>(lua_newuserdata(L,sizeof(UDJSPTR*)));
+      (*udjsptr)=new UDJSPTR(SHARED_PTR,new JSPTR());
+      *((*udjsptr)->ptr)=LAppS::SServiceRegistry::getInstance()->list();
+      luaL_getmetatable(L, "nljson");
+      lua_setmetatable(L, -2);
+      return 1;
+    }catch(const std::exception& e)
+    {
+      lua_pushboolean(L,false);
+      lua_pushstring(L,e.what());
+      return 2;
+    }
+  }
+
+  LUA_API int luaopen_stats(lua_State *L)
+  {
+    luaL_Reg functions[]= {
+      {"services", stats_services },
+      {nullptr,nullptr}
+    };
+    luaL_register(L,"stats",functions);
+    return 1;
+  }
+}
+
+
+#endif /* __STATS_H__ */
@@ -0,0 +1,179 @@
+/**
+ *  Copyright 2017-2018, Pavel Kraynyukhov <pavel.kraynyukhov@gmail.com>
+ * 
+ *  This file is a part of LAppS (Lua Application Server).
+ *  
+ *  LAppS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *  
+ *  LAppS is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *  
+ *  You should have received a copy of the GNU General Public License
+ *  along with LAppS.  If not, see <http://www.gnu.org/licenses/>.
+ * 
+ *  $Id: topics.h October 21, 2026 11:30 AM $
+ * 
+ **/
+
+
+
+#ifndef __TOPICS_H__
+#  define __TOPICS_H__
+
+#include <memory>
+#include <string_view>
+
+#include <Broadcasts.h>
+#include <WSServerMessage.h>
+#include <HandleTable.h>
+
+#include <ext/json.hpp>
+#include <modules/UserDataAdapter.h>
+#include <modules/bcast.h>
+
+using json = nlohmann::json;
+
+
+extern "C" {
+#include <lua.h>
+#include <lualib.h>
+#include <lauxlib.h>
+}
+
+/**
+ * Lua interface:
+ *   topics:subscribe(filter, handler)
+ *   topics:unsubscribe(filter, handler)
+ *   topics:publish(topic, message)
+ * 
+ * Levels are separated by '/' or '.', in filters '*' matches one level
+ * and the trailing '#' matches the rest of the topic. message is an nljson
+ * userdata with a LAppS out of order notification, as for bcast:send().
+ **/
+
+int topics_subscription(lua_State *L, const bool subscribe)
+{
+  static const char* usage="Usage: boolean[,string] topics:subscribe(filter,handler) or topics:unsubscribe(filter,handler), where `filter' is a topic filter string with optional `*' and `#' wildcards and `handler' is an IO handler provided for onMessage() method of your application. Returns: true on success, false on error. Optionally an error message is returned.";
+  
+  if((lua_gettop(L) != 3)||(lua_type(L,2) != LUA_TSTRING)||(!lua_isnumber(L,3)))
+  {
+    lua_pushboolean(L,false);
+    lua_pushstring(L,usage);
+    return 2;
+  }
+  
+  size_t len;
+  const char* str=lua_tolstring(L,2,&len);
+  const std::string_view filter(str,len);
+  LAppS::WSHandleTable::Guard handler(LAppS::wsHandles(),lua_tointeger(L,3));
+  
+  if(!LAppS::TopicRegistry::getInstance()->isValidFilter(filter))
+  {
+    lua_pushboolean(L,false);
+    lua_pushstring(L,"Malformed topic filter: wildcards must occupy a whole level, `#' is allowed as the last level only");
+    return 2;
+  }
+  
+  // a closed connection has left all the channels already
+  if(!handler)
+  {
+    lua_pushboolean(L,!subscribe);
+    if(subscribe)
+    {
+      lua_pushstring(L,"topics:subscribe(): the connection is closed");
+      return 2;
+    }
+    return 1;
+  }
+  
+  try{
+    if(subscribe)
+      LAppS::TopicRegistry::getInstance()->subscribe(filter,handler.get());
+    else
+      LAppS::TopicRegistry::getInstance()->unsubscribe(filter,handler.get());
+    lua_pushboolean(L,true);
+    return 1;
+  }catch(const std::exception& e)
+  {
+    lua_pushboolean(L,false);
+    lua_pushstring(L,e.what());
+    return 2;
+  }
+}
+
+extern "C"
+{
+  LUA_API int topics_subscribe(lua_State *L)
+  {
+    return topics_subscription(L,true);
+  }
+  
+  LUA_API int topics_unsubscribe(lua_State *L)
+  {
+    return topics_subscription(L,false);
+  }
+  
+  LUA_API int topics_publish(lua_State *L)
+  {
+    static const char* usage="Usage: boolean,number|string topics:publish(topic,message), where `topic' is a topic string without wildcards, message - is a userdata of nljson type. Returns: true and the number of matching filters on success, false and an error message on error.";
+    
+    if((lua_gettop(L) != 3)||(lua_type(L,2) != LUA_TSTRING))
+    {
+      lua_pushboolean(L,false);
+      lua_pushstring(L,usage);
+      return 2;
+    }
+    
+    size_t len;
+    const char* str=lua_tolstring(L,2,&len);
+    const std::string_view topic(str,len);
+    
+    if(!LAppS::TopicRegistry::getInstance()->isValidTopic(topic))
+    {
+      lua_pushboolean(L,false);
+      lua_pushstring(L,"Malformed topic: wildcards are not allowed in published topics");
+      return 2;
+    }
+    
+    try {
+      auto msg=makeLAppSBcastFrame(get_userdata_value(L,3));
+      if(!msg)
+      {
+        lua_pushboolean(L,false);
+        lua_pushstring(L,"An attempt to publish an invalid LAppS-protocol message");
+        return 2;
+      }
+      
+      const size_t matched=LAppS::TopicRegistry::getInstance()->publish(topic,msg);
+      lua_pushboolean(L,true);
+      lua_pushinteger(L,matched);
+      return 2;
+    }catch(const std::exception& e)
+    {
+      lua_pushboolean(L,false);
+      lua_pushstring(L,e.what());
+      return 2;
+    }
+  }
+  
+  LUA_API int luaopen_topics(lua_State *L)
+  {
+    static const struct luaL_reg members[] = {
+      {"subscribe", topics_subscribe},
+      {"unsubscribe", topics_unsubscribe},
+      {"publish", topics_publish},
+      {nullptr,nullptr}
+    };
+    luaL_newmetatable(L,"topics");
+    luaL_openlib(L, NULL, members,0);
+    
+    return 1;
+  }
+}
+
+#endif /* __TOPICS_H__ */
@@ -28,9 +28,11 @@
 #include <errno.h>
 #include <memory>
 #include <vector>
+#include <string_view>
 
 #include <abstract/WebSocket.h>
 #include <abstract/Worker.h>
+#include <HandleTable.h>
 #include <modules/UserDataAdapter.h>
 #include <WSServerMessage.h>
 
@@ -44,72 +46,150 @@ extern "C" {
 
 }
 
+#include <modules/cbor.h>
+
 using json = nlohmann::json;
 
-const bool isLAppSOutMessageValid(const json& msg)
+/**
+ * @brief members of an outbound LAppS message which are checked for the
+ * message to be valid. It is filled by the encoders while the message is
+ * serialised, so the message is traversed once.
+ **/
+struct LAppSOutEnvelope
 {
+  bool    has_cid=false;
+  double  cid=0;
+  bool    has_status=false;
+  double  status=-1;
+  bool    error_valid=false;
+  bool    result_valid=false;
+  bool    message_valid=false;
   
-  auto cid=msg.find("cid");
-  
-  if(cid == msg.end()) return false;
-  
-  if(cid.value().is_null()) return false;
-  
-  if(cid.value().is_number())
+  const bool valid() const
   {
-  
-    auto status=msg.find("status");
-    if(status!=msg.end())
+    if((!has_cid)||(!has_status)) return false;
+    
+    if(status == 0) // error, no checks for additional members
+      return (cid == 0)&&error_valid;
+    
+    if(status == 1) // response object (cid == 0) or OON object
+      return (cid == 0) ? result_valid : message_valid;
+    
+    return false;
+  }
+};
+
+/**
+ * @brief appends CBOR of the nljson message to out.
+ * @return false if the message is not a valid LAppS message.
+ **/
+const bool encodeLAppSOutMessage(const json& msg, std::vector<uint8_t>& out)
+{
+  LAppSOutEnvelope envelope;
+  const bool encoded=cbor_encode_json_object(
+    msg,out,
+    [&envelope](const std::string& key, const json& value)
     {
-      bool valid=status.value().is_number();
-      if(valid && ((status.value() == 1) || (status.value() == 0)))
+      if(key == "cid")
+      {
+        envelope.has_cid=value.is_number();
+        if(envelope.has_cid) envelope.cid=value.get<double>();
+      }
+      else if(key == "status")
+      {
+        envelope.has_status=value.is_number();
+        if(envelope.has_status) envelope.status=value.get<double>();
+      }
+      else if(key == "error")
       {
-        if(status.value() == 0)
+        if(value.is_object())
         {
-          if(cid.value() != 0) return false;
-          
-          auto error=msg.find("error");
-          if(error!=msg.end())
-          {
-            auto error_code=error.value().find("code");
-            auto error_message=error.value().find("message");
-            valid =  (error_code != error.value().end())&&(!error_code.value().is_null()&&(error_code.value().is_number()));
-            valid = valid && (error_message != error.value().end()) && (!error_message.value().is_null()) && error_message.value().is_string();
-            return valid; // No checks for additional members. No idea if I need to invalidate messages with additional members
-          }
-          else return false;
+          auto code=value.find("code");
+          auto message=value.find("message");
+          envelope.error_valid=(code != value.end())&&code.value().is_number()&&(message != value.end())&&message.value().is_string();
         }
-        else // not an error message
+      }
+      else if(key == "result") envelope.result_valid=value.is_array();
+      else if(key == "message") envelope.message_valid=value.is_array();
+    }
+  );
+  return encoded&&envelope.valid();
+}
+
+/**
+ * @brief true if the value at idx is a sequence or a view of a CBOR array.
+ **/
+const bool isLAppSOutArray(lua_State* L, const int idx)
+{
+  if(lua_istable(L,idx))
+    return cbor_sequence_size(L,idx) >= 0;
+  
+  const CBORView* view=testtype_cborview(L,idx);
+  if((view == nullptr)||(!view->source->buffer))
+    return false;
+  CBORReader r=cbor_view_reader(*view);
+  uint64_t count;
+  bool indefinite;
+  return cbor_open_container(r,count,indefinite) == 4;
+}
+
+/**
+ * @brief same as above for the message in the Lua table at idx.
+ **/
+const bool encodeLAppSOutMessage(lua_State* L, const int idx, std::vector<uint8_t>& out)
+{
+  LAppSOutEnvelope envelope;
+  const bool encoded=cbor_encode_table(
+    L,idx,out,
+    [L,&envelope](const std::string_view& key, const int value)
+    {
+      if(key == "cid")
+      {
+        envelope.has_cid=(lua_type(L,value) == LUA_TNUMBER);
+        envelope.cid=lua_tonumber(L,value);
+      }
+      else if(key == "status")
+      {
+        envelope.has_status=(lua_type(L,value) == LUA_TNUMBER);
+        envelope.status=lua_tonumber(L,value);
+      }
+      else if(key == "error")
+      {
+        if(lua_istable(L,value))
         {
-          if(cid.value() == 0) // response object
-          {
-            auto result=msg.find("result");
-            if(result != msg.end())
-            {
-              if(result.value().is_null()) return false;
-              if(result.value().is_array()) return true;
-              return false;
-            }
-            else
-            {
-              return false;
-            }
-          }
-          else // OON object
-          {
-            auto message=msg.find("message");
-            if(message!=msg.end())
-            {
-              if(message.value().is_null()) return false;
-              if(message.value().is_array()) return true;
-              return false;
-            }
-            return false;
-          }
+          lua_getfield(L,value,"code");
+          lua_getfield(L,value,"message");
+          envelope.error_valid=(lua_type(L,-2) == LUA_TNUMBER)&&(lua_type(L,-1) == LUA_TSTRING);
+          lua_pop(L,2);
         }
-      } else return false;
-    } else return false;
-  } else return false;
+      }
+      else if(key == "result") envelope.result_valid=isLAppSOutArray(L,value);
+      else if(key == "message") envelope.message_valid=isLAppSOutArray(L,value);
+    }
+  );
+  return encoded&&envelope.valid();
+}
+
+/**
+ * @brief serialises the message with encode(out) straight into the frame
+ * buffer and sends it. Auto-fragmenting sockets get the encoded payload,
+ * which they send as fragments of the same buffer.
+ * @return false if encode() has rejected the message, nothing is sent then.
+ **/
+template <typename Encoder> const bool wssend_encoded(abstract::WebSocket* handler, Encoder encode)
+{
+  if(handler->mustAutoFragment())
+  {
+    auto payload=std::make_shared<MSGBufferType>();
+    if(!encode(*payload)) return false;
+    handler->forward(WebSocketProtocol::BINARY,payload);
+    return true;
+  }
+  
+  WebSocketProtocol::InPlaceServerMessage frame;
+  if(!encode(frame.payload())) return false;
+  handler->send(frame.finish(WebSocketProtocol::BINARY));
+  return true;
 }
 
 int wssend_raw(lua_State* L, abstract::WebSocket* handler)
@@ -144,20 +224,14 @@ int wssend_raw(lua_State* L, abstract::WebSocket* handler)
     
     if(handler->mustAutoFragment())
     {
-      WebSocketProtocol::FragmentedServerMessage::msgQType msgqueue;
-
-      WebSocketProtocol::FragmentedServerMessage(msgqueue,opcode,msg,len);
-      while(!msgqueue.empty())
-      {
-        handler->send(std::move(*msgqueue.front()));
-        msgqueue.pop();
-      }
+      auto payload=std::make_shared<MSGBufferType>(msg,msg+len);
+      handler->forward(opcode,payload);
     }
     else
     {
-      MSGBufferType message;
-      WebSocketProtocol::ServerMessage(message,opcode,msg,len);
-      handler->send(std::move(message));
+      auto message=std::make_shared<MSGBufferType>();
+      WebSocketProtocol::ServerMessage(*message,opcode,msg,len);
+      handler->send(message);
     }
 
     lua_pushboolean(L,true);
@@ -172,33 +246,28 @@ int wssend_raw(lua_State* L, abstract::WebSocket* handler)
 int wssend_lapps(lua_State* L, abstract::WebSocket* handler)
 {
   const int udidx=3;
-  if(lua_isuserdata(L,udidx)) // protocol::LAPPS
+  if(lua_istable(L,udidx)||lua_isuserdata(L,udidx)) // protocol::LAPPS
   {
     try {
-      auto opcode=WebSocketProtocol::BINARY;
-      
-      
-      const json& msg=get_userdata_value(L,udidx);
-      if(isLAppSOutMessageValid(msg))
+      bool sent;
+      if(lua_istable(L,udidx))
+      {
+        // LAppS message in a Lua table, encoded to CBOR without the JSON DOM
+        sent=wssend_encoded(
+          handler,
+          [L,udidx](std::vector<uint8_t>& out){ return encodeLAppSOutMessage(L,udidx,out); }
+        );
+      }
+      else
+      {
+        const json& msg=get_userdata_value(L,udidx);
+        sent=wssend_encoded(
+          handler,
+          [&msg](std::vector<uint8_t>& out){ return encodeLAppSOutMessage(msg,out); }
+        );
+      }
+      if(sent)
       {
-        if(handler->mustAutoFragment())
-        {
-          WebSocketProtocol::FragmentedServerMessage::msgQType msgqueue;
-
-          WebSocketProtocol::FragmentedServerMessage(msgqueue,opcode,json::to_cbor(msg));
-          
-          while(!msgqueue.empty())
-          {
-            handler->send(std::move(*msgqueue.front()));
-            msgqueue.pop();
-          }
-        }
-        else
-        {
-          MSGBufferType message;
-          WebSocketProtocol::ServerMessage(message,opcode,json::to_cbor(msg));
-          handler->send(std::move(message));
-        }
         lua_pushboolean(L,true);
         return 1;
       }else{
@@ -215,7 +284,7 @@ int wssend_lapps(lua_State* L, abstract::WebSocket* handler)
   }else
   {
     lua_pushboolean(L,false);
-    lua_pushstring(L,"Usage: ws::send(handler, nljson), - userdata object of nljson type is not provided");
+    lua_pushstring(L,"Usage: ws::send(handler, nljson|table), - neither userdata object of nljson type nor a table is provided");
     return 2;
   }
 }
@@ -229,20 +298,20 @@ int wsclose(lua_State*L,abstract::WebSocket* handler, const size_t argc)
     uint16_t close_code=lua_tointeger(L,udidx);
     
     try {
-      MSGBufferType message;
+      auto message=std::make_shared<MSGBufferType>();
       
       if((close_code>999)&&((close_code < 1012)||((close_code>2999)&&(close_code<5000))))
       {
         if(argc == 3)
         {
-          WebSocketProtocol::ServerCloseMessage(message,close_code);
+          WebSocketProtocol::ServerCloseMessage(*message,close_code);
         }else if(argc == 4)
         {
           if(lua_isstring(L,4))
           {
             size_t len;
             const char *errmsg=lua_tolstring(L,argc,&len);
-            WebSocketProtocol::ServerCloseMessage(message,close_code,errmsg,len);
+            WebSocketProtocol::ServerCloseMessage(*message,close_code,errmsg,len);
           }
           else
           {
@@ -256,7 +325,7 @@ int wsclose(lua_State*L,abstract::WebSocket* handler, const size_t argc)
           lua_pushstring(L,"Usage: ws:close(handler, error_code [, error_string]) - wrong number of arguments is provided");
           return 2;
         }
-        handler->send(std::move(message));
+        handler->send(message);
         lua_pushboolean(L,true);
         return 1;
       }
@@ -293,8 +362,14 @@ extern "C" {
           int hdidx=2;
           if(lua_isnumber(L, hdidx))
           {
-            auto handler=(abstract::WebSocket*)(lua_tointeger(L,hdidx));
-            return wsclose(L,handler,argc);
+            LAppS::WSHandleTable::Guard handler(LAppS::wsHandles(),lua_tointeger(L,hdidx));
+            if(!handler)
+            {
+              lua_pushboolean(L,false);
+              lua_pushstring(L,"ws::close(): the connection is closed already");
+              return 2;
+            }
+            return wsclose(L,handler.get(),argc);
           }
           else{
             lua_pushboolean(L,false);
@@ -321,8 +396,14 @@ extern "C" {
           int hdidx=2;
           if(lua_isnumber(L, hdidx))
           {
-            auto handler=(abstract::WebSocket*)(lua_tointeger(L,hdidx));
-            return wssend_lapps(L,handler);
+            LAppS::WSHandleTable::Guard handler(LAppS::wsHandles(),lua_tointeger(L,hdidx));
+            if(!handler)
+            {
+              lua_pushboolean(L,false);
+              lua_pushstring(L,"ws::send(): the connection is closed");
+              return 2;
+            }
+            return wssend_lapps(L,handler.get());
           }
           else{
             lua_pushboolean(L,false);
@@ -336,8 +417,14 @@ extern "C" {
           int hdidx=2;
           if(lua_isnumber(L, hdidx))
           {
-            auto handler=(abstract::WebSocket*)(lua_tointeger(L,hdidx));
-            return wssend_raw(L,handler);
+            LAppS::WSHandleTable::Guard handler(LAppS::wsHandles(),lua_tointeger(L,hdidx));
+            if(!handler)
+            {
+              lua_pushboolean(L,false);
+              lua_pushstring(L,"ws::send(): the connection is closed");
+              return 2;
+            }
+            return wssend_raw(L,handler.get());
           }
           else{
             lua_pushboolean(L,false);
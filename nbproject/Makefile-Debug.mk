@@ -76,12 +76,12 @@ ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}/lapps: ../utils/dist/Debug/GNU-Linux/
 
 ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}/lapps: ${OBJECTFILES}
 	${MKDIR} -p ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}
-	g++ -o ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}/lapps ${OBJECTFILES} ${LDLIBSOPTIONS} -std=c++17 -pthread -flto -lwolfssl -lpam -lmimalloc -lluajit-5.1 -lstdc++fs -lbz2 -lfmt
+	g++ -o ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}/lapps ${OBJECTFILES} ${LDLIBSOPTIONS} -std=c++17 -pthread -flto -rdynamic -lwolfssl -lpam -lmimalloc -lluajit-5.1 -lstdc++fs -lbz2 -lfmt
 
 ${OBJECTDIR}/src/main.o: src/main.cpp nbproject/Makefile-${CND_CONF}.mk
 	${MKDIR} -p ${OBJECTDIR}/src
 	${RM} "$@.d"
-	$(COMPILE.cc) -Wall -DAPP_NAME=\"LAppS\" -DDTFM_TIMING_RESISTANT -DECC_TIMING_RESISTANT -DLAPPS_TLS_ENABLE -DLOG_FILE=\"lapps.log\" -DLOG_TRACE -DMAX_BUFF_SIZE=512 -DMIMALLOC -DSTATS_ENABLE -DWC_RSA_BLINDING -DWOLFSSL_TLS13 -I../ITCLib/include -I../utils/include -Iinclude -I/usr/include/luajit-2.0 -Iinclude/modules -I/usr/local/include -I/usr/local/include/luajit-2.0 -I/usr/local/lib/mimalloc-1.6/include -I../lar -Illhttp/include -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/src/main.o src/main.cpp
+	$(COMPILE.cc) -Wall -DAPP_NAME=\"LAppS\" -DDTFM_TIMING_RESISTANT -DECC_TIMING_RESISTANT -DLAPPS_TLS_ENABLE -DLOG_FILE=\"lapps.log\" -DLOG_TRACE -DMAX_BUFF_SIZE=512 -DMIMALLOC -DSTATS_ENABLE -DWC_RSA_BLINDING -DWOLFSSL_TLS13 -I../ITCLib/include -I../utils/include -Iinclude -I/usr/include/luajit-2.1 -Iinclude/modules -I/usr/local/include -I/usr/local/include/luajit-2.1 -I/usr/local/lib/mimalloc-1.6/include -I../lar -Illhttp/include -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/src/main.o src/main.cpp
 
 # Subprojects
 .build-subprojects:
@@ -103,7 +103,7 @@ ${TESTDIR}/TestFiles: ${TESTDIR}/tests/uriview.o ${OBJECTFILES:%.o=%_nomain.o}
 ${TESTDIR}/tests/uriview.o: tests/uriview.cpp 
 	${MKDIR} -p ${TESTDIR}/tests
 	${RM} "$@.d"
-	$(COMPILE.cc) -Wall -DAPP_NAME=\"LAppS\" -DDTFM_TIMING_RESISTANT -DECC_TIMING_RESISTANT -DLAPPS_TLS_ENABLE -DLOG_FILE=\"lapps.log\" -DLOG_TRACE -DMAX_BUFF_SIZE=512 -DMIMALLOC -DSTATS_ENABLE -DWC_RSA_BLINDING -DWOLFSSL_TLS13 -I../ITCLib/include -I../utils/include -Iinclude -I/usr/include/luajit-2.0 -Iinclude/modules -I/usr/local/include -I/usr/local/include/luajit-2.0 -I/usr/local/lib/mimalloc-1.6/include -I../lar -Illhttp/include -I. -Iinclude -pipe -std=c++17 -pthread -O2 -march=nocona -mtune=generic -mfpmath=sse -msse2 -fstack-protector-strong -ftree-vectorize -funroll-loops -Wall -lfmt -MMD -MP -MF "$@.d" -o ${TESTDIR}/tests/uriview.o tests/uriview.cpp
+	$(COMPILE.cc) -Wall -DAPP_NAME=\"LAppS\" -DDTFM_TIMING_RESISTANT -DECC_TIMING_RESISTANT -DLAPPS_TLS_ENABLE -DLOG_FILE=\"lapps.log\" -DLOG_TRACE -DMAX_BUFF_SIZE=512 -DMIMALLOC -DSTATS_ENABLE -DWC_RSA_BLINDING -DWOLFSSL_TLS13 -I../ITCLib/include -I../utils/include -Iinclude -I/usr/include/luajit-2.1 -Iinclude/modules -I/usr/local/include -I/usr/local/include/luajit-2.1 -I/usr/local/lib/mimalloc-1.6/include -I../lar -Illhttp/include -I. -Iinclude -pipe -std=c++17 -pthread -O2 -march=nocona -mtune=generic -mfpmath=sse -msse2 -fstack-protector-strong -ftree-vectorize -funroll-loops -Wall -lfmt -MMD -MP -MF "$@.d" -o ${TESTDIR}/tests/uriview.o tests/uriview.cpp
 
 
 ${OBJECTDIR}/src/main_nomain.o: ${OBJECTDIR}/src/main.o src/main.cpp 
@@ -114,7 +114,7 @@ ${OBJECTDIR}/src/main_nomain.o: ${OBJECTDIR}/src/main.o src/main.cpp
 	   (echo "$$NMOUTPUT" | ${GREP} 'T _main$$'); \
 	then  \
 	    ${RM} "$@.d";\
-	    $(COMPILE.cc) -Wall -DAPP_NAME=\"LAppS\" -DDTFM_TIMING_RESISTANT -DECC_TIMING_RESISTANT -DLAPPS_TLS_ENABLE -DLOG_FILE=\"lapps.log\" -DLOG_TRACE -DMAX_BUFF_SIZE=512 -DMIMALLOC -DSTATS_ENABLE -DWC_RSA_BLINDING -DWOLFSSL_TLS13 -I../ITCLib/include -I../utils/include -Iinclude -I/usr/include/luajit-2.0 -Iinclude/modules -I/usr/local/include -I/usr/local/include/luajit-2.0 -I/usr/local/lib/mimalloc-1.6/include -I../lar -Illhttp/include -Dmain=__nomain -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/src/main_nomain.o src/main.cpp;\
+	    $(COMPILE.cc) -Wall -DAPP_NAME=\"LAppS\" -DDTFM_TIMING_RESISTANT -DECC_TIMING_RESISTANT -DLAPPS_TLS_ENABLE -DLOG_FILE=\"lapps.log\" -DLOG_TRACE -DMAX_BUFF_SIZE=512 -DMIMALLOC -DSTATS_ENABLE -DWC_RSA_BLINDING -DWOLFSSL_TLS13 -I../ITCLib/include -I../utils/include -Iinclude -I/usr/include/luajit-2.1 -Iinclude/modules -I/usr/local/include -I/usr/local/include/luajit-2.1 -I/usr/local/lib/mimalloc-1.6/include -I../lar -Illhttp/include -Dmain=__nomain -MMD -MP -MF "$@.d" -o ${OBJECTDIR}/src/main_nomain.o src/main.cpp;\
 	else  \
 	    ${CP} ${OBJECTDIR}/src/main.o ${OBJECTDIR}/src/main_nomain.o;\
 	fi
@@ -0,0 +1,132 @@
+/**
+ *  Copyright 2017-2018, Pavel Kraynyukhov <pavel.kraynyukhov@gmail.com>
+ *
+ *  This file is a part of LAppS (Lua Application Server).
+ *
+ *  LAppS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  LAppS is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with LAppS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  $Id: cbor.cpp October 29, 2026 4:50 PM $
+ *
+ **/
+
+
+/**
+ * cbor module: encoding, decoding and skipping of items, including the
+ * malformed input a client may send.
+ **/
+
+#include <modules/cbor.h>
+
+#include <iostream>
+#include <string>
+
+static size_t failures=0;
+
+static void check(const bool passed, const std::string& what)
+{
+  std::cout << (passed ? "PASSED. " : "FAILED. ") << what << std::endl;
+  if(!passed) ++failures;
+}
+
+/**
+ * @brief runs the chunk, which returns a boolean.
+ **/
+static void run(lua_State* L, const std::string& chunk, const std::string& what)
+{
+  bool passed=(luaL_dostring(L,chunk.c_str()) == 0)&&lua_toboolean(L,-1);
+  if((!passed)&&(lua_type(L,-1) == LUA_TSTRING))
+    std::cout << lua_tostring(L,-1) << std::endl;
+  lua_settop(L,0);
+  check(passed,what);
+}
+
+/**
+ * @brief true if cbor_skip_item() consumes exactly the data.
+ **/
+static const bool skips(const std::string& data)
+{
+  CBORReader r{reinterpret_cast<const uint8_t*>(data.data()),reinterpret_cast<const uint8_t*>(data.data())+data.size()};
+  try{
+    cbor_skip_item(r,0);
+    return r.pos == r.end;
+  }catch(const std::system_error&)
+  {
+    return false;
+  }
+}
+
+int main()
+{
+  lua_State* L=luaL_newstate();
+  luaL_openlibs(L);
+  luaopen_cbor(L);
+  lua_settop(L,0);
+
+  run(L,"return cbor.encode(1) == '\\1' and cbor.encode(-1) == '\\32' and cbor.encode('a') == '\\97a'","small integers and strings are encoded by the RFC");
+  run(L,"return cbor.encode(cbor.null) == '\\246' and cbor.encode(true) == '\\245'","null and booleans are encoded by the RFC");
+  run(L,"return cbor.encode({1,2,3}) == '\\131\\1\\2\\3'","a sequence becomes an array");
+  run(L,"return cbor.decode('\\246') == cbor.null","null decodes to cbor.null");
+
+  run(L,R"(
+    local t=cbor.decode(cbor.encode({1,'two',{a=true,b=1.5,c={-7}},[4]=2^40}))
+    return t[1] == 1 and t[2] == 'two' and t[3].a == true and t[3].b == 1.5 and t[3].c[1] == -7 and t[4] == 2^40
+  )","nested values survive the round trip");
+  run(L,R"(
+    local s=string.rep('x',70000)
+    return cbor.decode(cbor.encode(s)) == s
+  )","long strings survive the round trip");
+
+  run(L,R"(
+    local t={} t.self=t
+    local v,err=cbor.encode(t)
+    return v == nil and type(err) == 'string'
+  )","a recursive table is refused");
+  run(L,R"(
+    local v,err=cbor.decode('\130\1')
+    return v == nil and type(err) == 'string'
+  )","truncated data is refused");
+  run(L,R"(
+    local v,err=cbor.decode('\1\1')
+    return v == nil and type(err) == 'string'
+  )","trailing data is refused");
+  run(L,R"(
+    local v,err=cbor.decode(string.rep('\129',300)..'\1')
+    return v == nil and type(err) == 'string'
+  )","nesting beyond the limit is refused");
+  run(L,R"(
+    local v,err=cbor.decode('\187\128\0\0\0\0\0\0\0')
+    return v == nil and type(err) == 'string'
+  )","a map count beyond the data is refused without overflow");
+  run(L,R"(
+    local v,err=cbor.decode('\155\255\255\255\255\255\255\255\255')
+    return v == nil and type(err) == 'string'
+  )","an array count beyond the data is refused");
+  run(L,R"(
+    local v,err=cbor.decode('\161\249\126\0\1')
+    return v == nil and type(err) == 'string'
+  )","a NaN map key is refused");
+  run(L,R"(
+    local t=cbor.decode('\161\99nan\1')
+    return t ~= nil and t.nan == 1
+  )","a string key 'nan' is accepted");
+
+  check(skips(std::string("\x83\x01\xa1\x61\x61\xf5\x9f\x02\xff",9)),"skip consumes a nested item");
+  check(!skips(std::string("\x82\x01",2)),"skip refuses truncated data");
+  check(!skips(std::string("\xbb\x80\x00\x00\x00\x00\x00\x00\x00",9)),"skip refuses a map count beyond the data without overflow");
+  check(!skips(std::string("\xbb\x40\x00\x00\x00\x00\x00\x00\x00",9)),"skip refuses a map count which overflows when doubled");
+  check(!skips(std::string(300,'\x81')+"\x01"),"skip refuses nesting beyond the limit");
+
+  lua_close(L);
+  return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,108 @@
+/**
+ *  Copyright 2017-2018, Pavel Kraynyukhov <pavel.kraynyukhov@gmail.com>
+ *
+ *  This file is a part of LAppS (Lua Application Server).
+ *
+ *  LAppS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  LAppS is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with LAppS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  $Id: handletable.cpp October 29, 2026 3:40 PM $
+ *
+ **/
+
+
+/**
+ * HandleTable: handle layout, the generation check of released handles,
+ * slot reuse and guards.
+ **/
+
+#include <HandleTable.h>
+
+#include <iostream>
+#include <string>
+#include <system_error>
+
+static size_t failures=0;
+
+static void check(const bool passed, const std::string& what)
+{
+  std::cout << (passed ? "PASSED. " : "FAILED. ") << what << std::endl;
+  if(!passed) ++failures;
+}
+
+typedef LAppS::HandleTable<int> Table;
+
+int main()
+{
+  Table table;
+  int a=1, b=2;
+
+  const uint64_t ha=table.create(0,&a);
+  const uint64_t hb=table.create(Table::SHARDS-1,&b);
+
+  check((ha != Table::INVALID)&&(hb != Table::INVALID),"handles are never 0");
+  check((ha < (uint64_t(1)<<53))&&(hb < (uint64_t(1)<<53)),"handles are exact as Lua numbers");
+  check(ha != hb,"handles of different shards differ");
+
+  {
+    Table::Guard guard(table,ha);
+    check(guard&&(guard.get() == &a),"a live handle resolves to its object");
+    check(table.guarded(ha),"a guarded handle is reported");
+  }
+  check(!table.guarded(ha),"the guard is dropped with its scope");
+
+  {
+    Table::Guard guard(table,Table::INVALID);
+    check(!guard,"the invalid handle does not resolve");
+  }
+  {
+    Table::Guard guard(table,ha|(uint64_t(1)<<60));
+    check(!guard,"a handle out of range does not resolve");
+  }
+  {
+    Table::Guard guard(table,ha+1);
+    check(!guard,"a handle of an unused slot does not resolve");
+  }
+
+  table.release(ha);
+  {
+    Table::Guard guard(table,ha);
+    check(!guard,"a released handle does not resolve");
+  }
+
+  const uint64_t hc=table.create(0,&b);
+  check(hc != ha,"the reused slot gets a new generation");
+  check(((hc^ha)&((uint64_t(1)<<32)-1)) == 0,"the released slot is reused");
+  {
+    Table::Guard stale(table,ha);
+    Table::Guard fresh(table,hc);
+    check(!stale&&fresh&&(fresh.get() == &b),"the stale handle stays invalid after the reuse");
+  }
+
+  table.release(ha);
+  {
+    Table::Guard guard(table,hc);
+    check(static_cast<bool>(guard),"releasing a stale handle does not affect the new one");
+  }
+
+  bool thrown=false;
+  try{
+    table.create(Table::SHARDS,&a);
+  }catch(const std::system_error&)
+  {
+    thrown=true;
+  }
+  check(thrown,"a shard id out of range is rejected");
+
+  return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,187 @@
+/**
+ *  Copyright 2017-2018, Pavel Kraynyukhov <pavel.kraynyukhov@gmail.com>
+ *
+ *  This file is a part of LAppS (Lua Application Server).
+ *
+ *  LAppS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  LAppS is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with LAppS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  $Id: rings.cpp October 29, 2026 3:05 PM $
+ *
+ **/
+
+
+/**
+ * SPSCRing, MPMCRing and MQ::Queue: the full and empty paths, wrap-around
+ * of the sequence numbers and a few producers and consumers at once.
+ **/
+
+#include <SPSCRing.h>
+#include <MPMCRing.h>
+#include <MQueue.h>
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+static size_t failures=0;
+
+static void check(const bool passed, const std::string& what)
+{
+  std::cout << (passed ? "PASSED. " : "FAILED. ") << what << std::endl;
+  if(!passed) ++failures;
+}
+
+static void spsc()
+{
+  bool thrown=false;
+  try{
+    LAppS::SPSCRing<int> ring(1);
+  }catch(const std::system_error&)
+  {
+    thrown=true;
+  }
+  check(thrown,"SPSCRing rejects a capacity below 2");
+
+  LAppS::SPSCRing<int> ring(3);
+  check(ring.capacity() == 4,"SPSCRing capacity is rounded up to a power of two");
+  check(ring.empty()&&(ring.front() == nullptr),"SPSCRing starts empty");
+
+  int value=0;
+  check(!ring.try_pop(value),"SPSCRing try_pop fails when empty");
+
+  bool order=true;
+  for(int round=0;round<10;++round)
+  {
+    for(int i=0;i<4;++i)
+      ring.try_push(round*4+i);
+    if(round == 0)
+    {
+      check(ring.full()&&(ring.size() == 4),"SPSCRing is full at capacity");
+      check(!ring.try_push(-1),"SPSCRing try_push fails when full");
+    }
+    for(int i=0;i<4;++i)
+      order=order&&ring.try_pop(value)&&(value == round*4+i);
+  }
+  check(order,"SPSCRing keeps the order across wrap-arounds");
+  check(ring.empty()&&(ring.tail() == 40),"SPSCRing is empty after draining");
+
+  LAppS::SPSCRing<size_t> pipe(64);
+  const size_t total=1000000;
+  std::thread producer([&pipe,total](){
+    for(size_t i=0;i<total;)
+      if(pipe.try_push(i)) ++i;
+      else std::this_thread::yield();
+  });
+  size_t expected=0;
+  bool sequential=true;
+  while(expected < total)
+  {
+    size_t* ptr=pipe.front();
+    if(ptr == nullptr)
+    {
+      std::this_thread::yield();
+      continue;
+    }
+    sequential=sequential&&(*ptr == expected);
+    pipe.pop();
+    ++expected;
+  }
+  producer.join();
+  check(sequential,"SPSCRing passes a million values between two threads in order");
+}
+
+static void mpmc()
+{
+  LAppS::MPMCRing<int> ring(4);
+  int value=0;
+  check(ring.empty()&&!ring.try_pop(value),"MPMCRing try_pop fails when empty");
+
+  bool order=true;
+  for(int round=0;round<10;++round)
+  {
+    for(int i=0;i<4;++i)
+      ring.try_push(round*4+i);
+    if(round == 0)
+      check(!ring.try_push(-1)&&(ring.size() == 4),"MPMCRing try_push fails when full");
+    for(int i=0;i<4;++i)
+      order=order&&ring.try_pop(value)&&(value == round*4+i);
+  }
+  check(order&&ring.empty(),"MPMCRing keeps the order across wrap-arounds");
+
+  const size_t producers=4, consumers=4, each=100000;
+  LAppS::MPMCRing<size_t> shared(128);
+  std::vector<size_t> sums(consumers,0);
+  std::vector<std::thread> threads;
+  std::atomic<size_t> received{0};
+
+  for(size_t p=0;p<producers;++p)
+    threads.emplace_back([&shared,each](){
+      for(size_t i=1;i<=each;)
+        if(shared.try_push(i)) ++i;
+        else std::this_thread::yield();
+    });
+  for(size_t c=0;c<consumers;++c)
+    threads.emplace_back([&shared,&sums,&received,c,producers,each](){
+      size_t v=0;
+      while(received.load() < producers*each)
+        if(shared.try_pop(v))
+        {
+          sums[c]+=v;
+          received.fetch_add(1);
+        }
+        else std::this_thread::yield();
+    });
+  for(auto& thread : threads)
+    thread.join();
+
+  size_t sum=0;
+  for(auto s : sums) sum+=s;
+  check(sum == producers*each*(each+1)/2,"MPMCRing delivers every value exactly once");
+}
+
+static void mqueue()
+{
+  LAppS::MQ::Queue<int> queue(2);
+  int value=0;
+
+  const auto start=std::chrono::steady_clock::now();
+  check(!queue.recv(value,50),"Queue recv times out when empty");
+  check(std::chrono::steady_clock::now()-start >= std::chrono::milliseconds(50),"Queue recv waits for the timeout");
+  check(!queue.recv(value,0),"Queue recv with zero timeout does not wait");
+
+  check(queue.try_send(1)&&queue.try_send(2),"Queue accepts up to its capacity");
+  check(!queue.try_send(3),"Queue try_send fails when full");
+
+  std::vector<int> batch;
+  check((queue.recv_many(batch,10,0) == 2)&&(batch[0] == 1)&&(batch[1] == 2),"Queue recv_many takes what is available");
+  check(queue.empty(),"Queue is empty after recv_many");
+
+  std::thread sender([&queue](){
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    queue.try_send(42);
+  });
+  check(queue.recv(value)&&(value == 42),"Queue recv wakes up on send");
+  sender.join();
+}
+
+int main()
+{
+  spsc();
+  mpmc();
+  mqueue();
+  return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,115 @@
+/**
+ *  Copyright 2017-2018, Pavel Kraynyukhov <pavel.kraynyukhov@gmail.com>
+ *
+ *  This file is a part of LAppS (Lua Application Server).
+ *
+ *  LAppS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  LAppS is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with LAppS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  $Id: shareddict.cpp October 29, 2026 4:15 PM $
+ *
+ **/
+
+
+/**
+ * SharedDict: set, add, get, incr, ttl, removal and the arena limits.
+ **/
+
+#include <SharedDict.h>
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+
+static size_t failures=0;
+
+static void check(const bool passed, const std::string& what)
+{
+  std::cout << (passed ? "PASSED. " : "FAILED. ") << what << std::endl;
+  if(!passed) ++failures;
+}
+
+typedef LAppS::SharedDict Dict;
+
+static Dict::Item text(const std::string_view& value)
+{
+  return Dict::Item{Dict::Type::STRING,false,0,value};
+}
+
+static Dict::Item number(const double value)
+{
+  return Dict::Item{Dict::Type::NUMBER,false,value,std::string_view()};
+}
+
+int main()
+{
+  Dict dict(Dict::SHARDS*Dict::MIN_SHARD_SIZE);
+  Dict::Value value;
+
+  check(!dict.get("key",value),"an absent key is not found");
+  check(dict.set("key",text("value")) == Dict::Status::OK,"set stores a string");
+  check(dict.get("key",value)&&(value.type == Dict::Type::STRING)&&(value.string == "value"),"get returns the string");
+  check(dict.set("key",number(1.5)) == Dict::Status::OK,"set replaces the value");
+  check(dict.get("key",value)&&(value.type == Dict::Type::NUMBER)&&(value.number == 1.5),"get returns the replaced value");
+
+  check(dict.add("key",number(2)) == Dict::Status::EXISTS,"add refuses a live key");
+  check(dict.add("other",text("x")) == Dict::Status::OK,"add stores an absent key");
+
+  double result=0;
+  check(dict.incr("key",2,result) == Dict::Status::OK&&(result == 3.5),"incr adds to the number");
+  check(dict.incr("other",1,result) == Dict::Status::NOT_A_NUMBER,"incr refuses a string");
+  check(dict.incr("counter",1,result) == Dict::Status::NOT_FOUND,"incr without init refuses an absent key");
+  const double init=10;
+  check(dict.incr("counter",1,result,&init) == Dict::Status::OK&&(result == 11),"incr with init creates the key");
+
+  long ttl=0;
+  check(dict.ttl("counter",ttl)&&(ttl == -1),"an entry without ttl never expires");
+  check(dict.set("short",text("lived"),20) == Dict::Status::OK,"set stores an entry with ttl");
+  check(dict.ttl("short",ttl)&&(ttl >= 0)&&(ttl <= 20),"ttl reports the time left");
+  check(dict.add("short",text("again")) == Dict::Status::EXISTS,"add refuses a key before it expires");
+  std::this_thread::sleep_for(std::chrono::milliseconds(40));
+  check(!dict.get("short",value),"an expired entry is not found");
+  check(dict.add("short",text("again")) == Dict::Status::OK,"add replaces an expired entry");
+
+  check(dict.expire("short",10),"expire sets a ttl of a live entry");
+  check(dict.set("unread",text("x"),10) == Dict::Status::OK,"set stores another entry with ttl");
+  std::this_thread::sleep_for(std::chrono::milliseconds(30));
+  check(!dict.expire("short",10),"expire skips an expired entry");
+  check(dict.flushExpired() == 1,"flushExpired removes the expired entries left");
+
+  check(dict.remove("other")&&!dict.get("other",value),"remove deletes the key");
+  check(!dict.remove("other"),"remove of an absent key fails");
+
+  const std::string huge(Dict::MAX_ITEM_SIZE+1,'x');
+  check(dict.set("huge",text(huge)) == Dict::Status::TOO_LARGE,"a value above the item limit is refused");
+  check(dict.set(huge,number(1)) == Dict::Status::TOO_LARGE,"a key above the item limit is refused");
+
+  const std::string big(Dict::MAX_ITEM_SIZE,'x');
+  Dict::Status status=Dict::Status::OK;
+  size_t stored=0;
+  for(size_t i=0;(i<1000)&&(status == Dict::Status::OK);++i)
+  {
+    status=dict.set("big"+std::to_string(i),text(big));
+    if(status == Dict::Status::OK) ++stored;
+  }
+  check(status == Dict::Status::NO_MEMORY,"a full arena refuses new entries");
+  check(dict.count() == stored+2,"the refused entry is not kept");
+  check(dict.get("key",value)&&(value.number == 3.5),"the stored entries survive a refusal");
+
+  for(size_t i=0;i<stored;++i)
+    dict.remove("big"+std::to_string(i));
+  check(dict.set("big",text(big)) == Dict::Status::OK,"removed entries free their memory");
+
+  return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,174 @@
+/**
+ *  Copyright 2017-2018, Pavel Kraynyukhov <pavel.kraynyukhov@gmail.com>
+ *
+ *  This file is a part of LAppS (Lua Application Server).
+ *
+ *  LAppS is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  LAppS is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with LAppS.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  $Id: topictree.cpp October 29, 2026 2:10 PM $
+ *
+ **/
+
+/**
+ * TopicTree: filter validation, wildcard matching and pruning, with a
+ * channel which records its members and messages.
+ **/
+
+#include <TopicTree.h>
+
+#include <iostream>
+#include <set>
+#include <string>
+#include <vector>
+
+static size_t failures=0;
+
+static void check(const bool passed, const std::string& what)
+{
+  std::cout << (passed ? "PASSED. " : "FAILED. ") << what << std::endl;
+  if(!passed) ++failures;
+}
+
+struct Channel
+{
+  // every channel ever created, so that a disconnect can be simulated
+  static std::vector<Channel*>& all()
+  {
+    static std::vector<Channel*> channels;
+    return channels;
+  }
+
+  std::set<const int*> members;
+  size_t               messages;
+
+  explicit Channel(const size_t id) : members(), messages{0}
+  {
+    all().push_back(this);
+  }
+
+  ~Channel()
+  {
+    for(auto& channel : all())
+      if(channel == this) channel=nullptr;
+  }
+
+  void subscribe(const int* handler)
+  {
+    members.insert(handler);
+  }
+
+  void unsubscribe(const int* handler)
+  {
+    members.erase(handler);
+  }
+
+  void bcast(const MSGBufferTypeSPtr& msg)
+  {
+    ++messages;
+  }
+
+  const bool idle() const
+  {
+    return members.empty();
+  }
+};
+
+typedef LAppS::TopicTree<Channel> Tree;
+
+static void validation()
+{
+  check(Tree::isValidFilter("a/b/c"),"plain filter is valid");
+  check(Tree::isValidFilter("a/*/c"),"single level wildcard is valid");
+  check(Tree::isValidFilter("a.#"),"trailing multi level wildcard is valid");
+  check(!Tree::isValidFilter("a/#/c"),"multi level wildcard in the middle is invalid");
+  check(!Tree::isValidFilter("a/b*"),"wildcard inside of a level is invalid");
+  check(!Tree::isValidFilter(""),"empty filter is invalid");
+  check(Tree::isValidTopic("a/b"),"plain topic is valid");
+  check(!Tree::isValidTopic("a/*"),"topic with a wildcard is invalid");
+}
+
+static void matching()
+{
+  Tree tree;
+  const int h1=1, h2=2;
+  auto msg=std::make_shared<MSGBufferType>(1,'x');
+
+  tree.subscribe("a/b",&h1);
+  tree.subscribe("a/*",&h1);
+  tree.subscribe("a/#",&h2);
+  tree.subscribe("#",&h2);
+  tree.subscribe("*/c",&h2);
+
+  check(tree.size() == 5,"one channel per filter");
+  check(tree.publish("a/b",msg) == 4,"a/b matches a/b, a/*, a/# and #");
+  check(tree.publish("a.c",msg) == 4,"a.c matches a/*, a/#, # and */c");
+  check(tree.publish("a",msg) == 2,"a matches a/# and #");
+  check(tree.publish("b/c/d",msg) == 1,"b/c/d matches # only");
+  check(tree.publish("$SYS/a",msg) == 0,"wildcards skip the $ topics");
+
+  tree.subscribe("$SYS/#",&h1);
+  check(tree.publish("$SYS/a",msg) == 1,"explicit $ filter matches");
+}
+
+static void pruning()
+{
+  Tree tree;
+  const int h1=1, h2=2;
+  auto msg=std::make_shared<MSGBufferType>(1,'x');
+
+  tree.subscribe("x/y/z",&h1);
+  tree.subscribe("x/y/w",&h1);
+  tree.subscribe("x/y/z",&h2);
+
+  tree.unsubscribe("x/y/z",&h1);
+  check(tree.size() == 2,"a channel with subscribers is kept");
+
+  tree.unsubscribe("x/y/z",&h2);
+  check(tree.size() == 1,"the unsubscribed branch is pruned at once");
+  check(tree.publish("x/y/w",msg) == 1,"the sibling branch is intact");
+  check(tree.publish("x/y/z",msg) == 0,"the pruned filter does not match");
+
+  tree.unsubscribe("x/y/w",&h1);
+  check(tree.size() == 0,"the last channel is pruned");
+
+  tree.unsubscribe("no/such/filter",&h1);
+  check(tree.size() == 0,"unsubscribing from an unknown filter is harmless");
+
+  tree.subscribe("x/y/z",&h1);
+  check(tree.publish("x/y/z",msg) == 1,"the pruned filter can be subscribed again");
+  tree.unsubscribe("x/y/z",&h1);
+
+  // the subscribers of these go away without unsubscribing
+  for(int i=0;i<100;++i)
+    tree.subscribe("gone/"+std::to_string(i)+"/#",&h1);
+  tree.subscribe("kept",&h2);
+  for(auto channel : Channel::all())
+    if(channel&&(channel->members.count(&h1) > 0)) channel->members.clear();
+
+  for(int i=0;i<100;++i)
+  {
+    tree.subscribe("churn",&h1);
+    tree.unsubscribe("churn",&h1);
+  }
+  check(tree.size() == 1,"the channels left idle by disconnects are pruned");
+  check(tree.publish("kept",msg) == 1,"the live channel is kept");
+}
+
+int main()
+{
+  validation();
+  matching();
+  pruning();
+  return (failures == 0) ? 0 : 1;
+}